@@ -0,0 +1,278 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Throughput of the software conversions droidvdec uses when the codec
+ * can't output graphic buffers. Every run is first checked byte for byte
+ * against a plain C reference, so a faster kernel can't get away with a
+ * wrong answer. Bytes are counted once for the visible I420 output.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <string.h>
+#include "gst/droid/gstdroidconvert.h"
+
+#define ALIGN_SIZE(size, to) (((size) + to  - 1) & ~(to - 1))
+
+/* each case runs for at least this long */
+#define MIN_TIME (200 * GST_MSECOND)
+
+typedef struct
+{
+  const gchar *name;
+  GstDroidFormatConverter converter;
+} Kernel;
+
+static const Kernel kernels[] = {
+  {"planar", GST_DROID_FORMAT_CONVERTER_YUV420_PLANAR},
+  {"semi-planar", GST_DROID_FORMAT_CONVERTER_YUV420_SEMI_PLANAR},
+  {"packed-32m", GST_DROID_FORMAT_CONVERTER_YUV420_PACKED_SEMI_PLANAR},
+};
+
+/* Codec frame size and the visible area inside it */
+typedef struct
+{
+  gint width;
+  gint height;
+  DroidMediaRect crop;
+} Frame;
+
+static const Frame frames[] = {
+  {320, 240, {0, 0, 320, 240}},
+  {640, 480, {0, 0, 640, 480}},
+  {1280, 720, {0, 0, 1280, 720}},
+  {1920, 1088, {0, 0, 1920, 1080}},
+  {3840, 2160, {0, 0, 3840, 2160}},
+  /* odd crops */
+  {1920, 1088, {2, 2, 1919, 1081}},
+  {640, 480, {1, 3, 638, 478}},
+  {176, 144, {3, 1, 176, 144}},
+};
+
+/* Row alignment masks of the output, 0 is tightly packed */
+static const guint stride_aligns[] = { 0, 15, 63 };
+
+/*
+ * Where the planes of a codec frame are. Chroma sample x of row y is at
+ * u + y * chroma_stride + x * step.
+ */
+typedef struct
+{
+  const guint8 *y;
+  const guint8 *u;
+  const guint8 *v;
+  gsize stride;
+  gsize chroma_stride;
+  gsize step;
+  gsize size;
+} Layout;
+
+static void
+get_layout (GstDroidFormatConverter converter, const guint8 * in,
+    gsize width, gsize height, Layout * l)
+{
+  gsize slice_height;
+
+  switch (converter) {
+    case GST_DROID_FORMAT_CONVERTER_YUV420_PLANAR:
+      l->stride = width;
+      l->chroma_stride = width / 2;
+      l->step = 1;
+      l->y = in;
+      l->u = in + width * height;
+      l->v = l->u + l->chroma_stride * (height / 2);
+      l->size = width * height + 2 * l->chroma_stride * (height / 2);
+      return;
+    case GST_DROID_FORMAT_CONVERTER_YUV420_SEMI_PLANAR:
+      l->stride = width;
+      slice_height = ALIGN_SIZE (height, 16);
+      break;
+    default:
+      l->stride = ALIGN_SIZE (width, 128);
+      slice_height = ALIGN_SIZE (height, 32);
+      break;
+  }
+
+  l->chroma_stride = l->stride;
+  l->step = 2;
+  l->y = in;
+  l->u = in + l->stride * slice_height;
+  l->v = l->u + 1;
+  l->size = l->stride * slice_height * 3 / 2;
+}
+
+static void
+reference_to_i420 (guint8 * out, const GstVideoInfo * info, const Layout * l,
+    const DroidMediaRect * crop)
+{
+  gint x, y, c;
+
+  for (y = 0; y < GST_VIDEO_INFO_HEIGHT (info); y++) {
+    for (x = 0; x < GST_VIDEO_INFO_WIDTH (info); x++) {
+      out[info->offset[0] + y * info->stride[0] + x] =
+          l->y[(crop->top + y) * l->stride + crop->left + x];
+    }
+  }
+
+  for (c = 1; c < 3; c++) {
+    const guint8 *plane = c == 1 ? l->u : l->v;
+
+    for (y = 0; y < GST_VIDEO_INFO_COMP_HEIGHT (info, c); y++) {
+      for (x = 0; x < GST_VIDEO_INFO_COMP_WIDTH (info, c); x++) {
+        out[info->offset[c] + y * info->stride[c] + x] =
+            plane[(crop->top / 2 + y) * l->chroma_stride +
+            (crop->left / 2 + x) * l->step];
+      }
+    }
+  }
+}
+
+/* Only the visible bytes count, padding is left alone by design */
+static gboolean
+compare (const guint8 * a, const guint8 * b, const GstVideoInfo * info)
+{
+  gint c, y;
+
+  for (c = 0; c < 3; c++) {
+    for (y = 0; y < GST_VIDEO_INFO_COMP_HEIGHT (info, c); y++) {
+      gsize offset = info->offset[c] + y * info->stride[c];
+
+      if (memcmp (a + offset, b + offset,
+              GST_VIDEO_INFO_COMP_WIDTH (info, c))) {
+        g_printerr ("plane %d row %d differs\n", c, y);
+        return FALSE;
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+static gsize
+visible_bytes (const GstVideoInfo * info)
+{
+  gsize bytes = 0;
+  gint c;
+
+  for (c = 0; c < 3; c++) {
+    bytes += (gsize) GST_VIDEO_INFO_COMP_WIDTH (info, c) *
+        GST_VIDEO_INFO_COMP_HEIGHT (info, c);
+  }
+
+  return bytes;
+}
+
+static gboolean
+run (const Kernel * kernel, const Frame * frame, guint stride_align)
+{
+  GstDroidConvertToI420Func func =
+      gst_droid_convert_get_to_i420_func (kernel->converter);
+  GstVideoAlignment align;
+  GstVideoInfo info;
+  Layout layout;
+  guint8 *in, *out, *expected;
+  GRand *rand;
+  GstClockTime start, elapsed;
+  guint64 iterations = 0;
+  gsize i, size;
+  gchar *name;
+  gboolean ok;
+
+  /* big enough for any layout, get_layout tells the real size */
+  size = ALIGN_SIZE (frame->width, 128) * ALIGN_SIZE (frame->height, 32) * 2;
+  in = g_malloc (size);
+  get_layout (kernel->converter, in, frame->width, frame->height, &layout);
+
+  rand = g_rand_new_with_seed (frame->width * frame->height + stride_align);
+  for (i = 0; i < layout.size; i++) {
+    in[i] = g_rand_int (rand);
+  }
+  g_rand_free (rand);
+
+  gst_video_info_set_format (&info, GST_VIDEO_FORMAT_I420,
+      frame->crop.right - frame->crop.left,
+      frame->crop.bottom - frame->crop.top);
+  gst_video_alignment_reset (&align);
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++) {
+    align.stride_align[i] = stride_align;
+  }
+  gst_video_info_align (&info, &align);
+
+  out = g_malloc0 (info.size);
+  expected = g_malloc0 (info.size);
+
+  reference_to_i420 (expected, &info, &layout, &frame->crop);
+  func (out, &info, in, frame->width, frame->height, &frame->crop);
+  ok = compare (out, expected, &info);
+
+  name = g_strdup_printf ("%dx%d+%d+%d", GST_VIDEO_INFO_WIDTH (&info),
+      GST_VIDEO_INFO_HEIGHT (&info), frame->crop.left, frame->crop.top);
+
+  if (ok) {
+    start = gst_util_get_timestamp ();
+    do {
+      func (out, &info, in, frame->width, frame->height, &frame->crop);
+      iterations++;
+      elapsed = gst_util_get_timestamp () - start;
+    } while (elapsed < MIN_TIME);
+
+    g_print ("%-12s %-18s %6u %12" G_GUINT64_FORMAT " %8.2f\n",
+        kernel->name, name, stride_align + 1, elapsed / iterations,
+        (gdouble) visible_bytes (&info) * iterations / elapsed);
+  } else {
+    g_printerr ("%s %s stride align %u: output differs from the reference\n",
+        kernel->name, name, stride_align + 1);
+  }
+
+  g_free (name);
+  g_free (expected);
+  g_free (out);
+  g_free (in);
+
+  return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gboolean ok = TRUE;
+  guint k, f, a;
+
+  gst_init (&argc, &argv);
+
+  /* bytes per ns is GB/s */
+  g_print ("%-12s %-18s %6s %12s %8s\n", "kernel", "crop", "align",
+      "ns/frame", "GB/s");
+
+  for (k = 0; k < G_N_ELEMENTS (kernels); k++) {
+    for (f = 0; f < G_N_ELEMENTS (frames); f++) {
+      for (a = 0; a < G_N_ELEMENTS (stride_aligns); a++) {
+        ok &= run (&kernels[k], &frames[f], stride_aligns[a]);
+      }
+    }
+  }
+
+  return ok ? 0 : 1;
+}
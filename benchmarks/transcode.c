@@ -0,0 +1,172 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Transcode throughput of droidvdec ! droidvenc on top of the fake
+ * droidmedia. The fake codecs don't touch the pixels so this measures what
+ * gst-droid itself costs per frame: buffer pools, queue buffer binding and
+ * either the zero-copy meta data path or the staging copy the encoder falls
+ * back to.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+#define FRAMES 300
+
+typedef struct
+{
+  gint width;
+  gint height;
+} Resolution;
+
+static const Resolution resolutions[] = {
+  {640, 360},
+  {1280, 720},
+  {1920, 1080},
+  {1918, 1078},
+};
+
+static void
+handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad, guint * frames)
+{
+  (*frames)++;
+}
+
+/* Returns the wall time of the whole run or GST_CLOCK_TIME_NONE on error */
+static GstClockTime
+run (const Resolution * res, gboolean staging, guint * frames)
+{
+  GstElement *pipeline, *src, *sink;
+  GstBus *bus;
+  GstMessage *msg;
+  GstCaps *caps;
+  GstClockTime start, elapsed = GST_CLOCK_TIME_NONE;
+  GError *error = NULL;
+  guint i;
+
+  g_setenv ("FAKE_DROIDMEDIA_CODEC_NO_META_DATA", staging ? "1" : "0", TRUE);
+
+  pipeline = gst_parse_launch ("appsrc name=src format=time ! droidvdec ! "
+      "droidvenc ! video/mpeg,mpegversion=4 ! "
+      "fakesink name=sink sync=false signal-handoffs=true", &error);
+  if (!pipeline) {
+    g_printerr ("failed to create the pipeline: %s\n", error->message);
+    g_clear_error (&error);
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+  caps = gst_caps_new_simple ("video/x-vp8",
+      "width", G_TYPE_INT, res->width, "height", G_TYPE_INT, res->height,
+      "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  gst_app_src_set_caps (GST_APP_SRC (src), caps);
+  gst_caps_unref (caps);
+
+  /* The fake decoder ignores its input, every frame is a key frame */
+  for (i = 0; i < FRAMES; i++) {
+    GstBuffer *buffer = gst_buffer_new_allocate (NULL, 64, NULL);
+
+    gst_buffer_memset (buffer, 0, 0, 64);
+    GST_BUFFER_PTS (buffer) = gst_util_uint64_scale (i, GST_SECOND, 30);
+    GST_BUFFER_DURATION (buffer) = GST_SECOND / 30;
+    gst_app_src_push_buffer (GST_APP_SRC (src), buffer);
+  }
+  gst_app_src_end_of_stream (GST_APP_SRC (src));
+
+  *frames = 0;
+  g_signal_connect (sink, "handoff", G_CALLBACK (handoff), frames);
+
+  bus = gst_element_get_bus (pipeline);
+
+  start = gst_util_get_timestamp ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  msg = gst_bus_timed_pop_filtered (bus, 60 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  if (msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS) {
+    elapsed = gst_util_get_timestamp () - start;
+  } else if (msg) {
+    gst_message_parse_error (msg, &error, NULL);
+    g_printerr ("%dx%d: %s\n", res->width, res->height, error->message);
+    g_clear_error (&error);
+  } else {
+    g_printerr ("%dx%d: timed out\n", res->width, res->height);
+  }
+
+  if (msg) {
+    gst_message_unref (msg);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (sink);
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+
+  return elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gboolean failed = FALSE;
+  guint i, staging;
+
+  gst_init (&argc, &argv);
+
+  g_print ("%-10s %-10s %8s %10s %12s %10s\n", "size", "path", "frames",
+      "fps", "ns/frame", "MB/s");
+
+  for (i = 0; i < G_N_ELEMENTS (resolutions); i++) {
+    for (staging = 0; staging < 2; staging++) {
+      const Resolution *res = &resolutions[i];
+      GstClockTime elapsed;
+      guint frames;
+      gchar *size;
+      /* the raw YV12 frames moving from the decoder to the encoder */
+      gdouble bytes = (gdouble) res->width * res->height * 3 / 2;
+
+      elapsed = run (res, staging, &frames);
+      if (!GST_CLOCK_TIME_IS_VALID (elapsed) || frames != FRAMES) {
+        g_printerr ("%dx%d %s: got %u of %u frames\n", res->width,
+            res->height, staging ? "staging" : "zero-copy", frames, FRAMES);
+        failed = TRUE;
+        continue;
+      }
+
+      size = g_strdup_printf ("%dx%d", res->width, res->height);
+      g_print ("%-10s %-10s %8u %10.1f %12" G_GUINT64_FORMAT " %10.1f\n",
+          size, staging ? "staging" : "zero-copy", frames,
+          frames * (gdouble) GST_SECOND / elapsed, elapsed / frames,
+          bytes * frames * GST_SECOND / elapsed / (1024 * 1024));
+      g_free (size);
+    }
+  }
+
+  return failed ? 1 : 0;
+}
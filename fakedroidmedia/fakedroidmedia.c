@@ -0,0 +1,180 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fakedroidmedia.h"
+#include <string.h>
+
+guint
+fake_droid_media_get_env_uint (const gchar * name, guint def)
+{
+  const gchar *value = g_getenv (name);
+  gchar *end = NULL;
+  guint64 ret;
+
+  if (!value || !*value) {
+    return def;
+  }
+
+  ret = g_ascii_strtoull (value, &end, 10);
+  if (end == value || *end != '\0' || ret > G_MAXUINT) {
+    g_warning ("fakedroidmedia: ignoring invalid %s=%s", name, value);
+    return def;
+  }
+
+  return (guint) ret;
+}
+
+bool
+droid_media_init ()
+{
+  return true;
+}
+
+void
+droid_media_deinit ()
+{
+}
+
+void
+droid_media_pixel_format_constants_init (DroidMediaPixelFormatConstants * c)
+{
+  memset (c, 0x0, sizeof (*c));
+
+  c->HAL_PIXEL_FORMAT_RGBA_8888 = FAKE_HAL_PIXEL_FORMAT_RGBA_8888;
+  c->HAL_PIXEL_FORMAT_RGBX_8888 = FAKE_HAL_PIXEL_FORMAT_RGBX_8888;
+  c->HAL_PIXEL_FORMAT_RGB_888 = FAKE_HAL_PIXEL_FORMAT_RGB_888;
+  c->HAL_PIXEL_FORMAT_RGB_565 = FAKE_HAL_PIXEL_FORMAT_RGB_565;
+  c->HAL_PIXEL_FORMAT_BGRA_8888 = FAKE_HAL_PIXEL_FORMAT_BGRA_8888;
+  c->HAL_PIXEL_FORMAT_YV12 = FAKE_HAL_PIXEL_FORMAT_YV12;
+  c->HAL_PIXEL_FORMAT_YCbCr_422_SP = FAKE_HAL_PIXEL_FORMAT_YCbCr_422_SP;
+  c->HAL_PIXEL_FORMAT_YCrCb_420_SP = FAKE_HAL_PIXEL_FORMAT_YCrCb_420_SP;
+  c->HAL_PIXEL_FORMAT_YCbCr_422_I = FAKE_HAL_PIXEL_FORMAT_YCbCr_422_I;
+  c->QOMX_COLOR_FormatYUV420PackedSemiPlanar32m =
+      FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar32m;
+  c->QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka =
+      FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka;
+}
+
+void
+droid_media_colour_format_constants_init (DroidMediaColourFormatConstants * c)
+{
+  memset (c, 0x0, sizeof (*c));
+
+  c->QOMX_COLOR_FormatYUV420PackedSemiPlanar32m =
+      FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar32m;
+  c->QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka =
+      FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka;
+  c->OMX_COLOR_FormatYUV420Planar = FAKE_OMX_COLOR_FormatYUV420Planar;
+  c->OMX_COLOR_FormatYUV420PackedPlanar =
+      FAKE_OMX_COLOR_FormatYUV420PackedPlanar;
+  c->OMX_COLOR_FormatYUV420SemiPlanar = FAKE_OMX_COLOR_FormatYUV420SemiPlanar;
+  c->OMX_COLOR_FormatL8 = FAKE_OMX_COLOR_FormatL8;
+  c->OMX_COLOR_FormatYUV422SemiPlanar = FAKE_OMX_COLOR_FormatYUV422SemiPlanar;
+  c->OMX_COLOR_FormatYCbYCr = FAKE_OMX_COLOR_FormatYCbYCr;
+  c->OMX_COLOR_FormatYCrYCb = FAKE_OMX_COLOR_FormatYCrYCb;
+  c->OMX_COLOR_FormatCbYCrY = FAKE_OMX_COLOR_FormatCbYCrY;
+  c->OMX_COLOR_Format32bitARGB8888 = FAKE_OMX_COLOR_Format32bitARGB8888;
+  c->OMX_COLOR_Format32bitBGRA8888 = FAKE_OMX_COLOR_Format32bitBGRA8888;
+  c->OMX_COLOR_Format16bitRGB565 = FAKE_OMX_COLOR_Format16bitRGB565;
+  c->OMX_COLOR_Format16bitBGR565 = FAKE_OMX_COLOR_Format16bitBGR565;
+}
+
+void
+droid_media_camera_constants_init (DroidMediaCameraConstants * c)
+{
+  memset (c, 0x0, sizeof (*c));
+
+  /* Values from Android system/core/include/system/camera.h */
+  c->CAMERA_MSG_SHUTTER = 0x0002;
+  c->CAMERA_MSG_POSTVIEW_FRAME = 0x0040;
+  c->CAMERA_MSG_RAW_IMAGE = 0x0080;
+  c->CAMERA_MSG_COMPRESSED_IMAGE = 0x0100;
+  c->CAMERA_FRAME_CALLBACK_FLAG_NOOP = 0x00;
+  c->CAMERA_FRAME_CALLBACK_FLAG_CAMERA = 0x05;
+  c->CAMERA_CMD_ENABLE_SHUTTER_SOUND = 4;
+}
+
+/* Frame layout for the formats the fake hands out. Stride is in pixels */
+gsize
+fake_droid_media_frame_size (uint32_t format, uint32_t width, uint32_t height,
+    uint32_t * stride)
+{
+  gsize aligned = (width + 31) & ~31;
+
+  switch (format) {
+    case FAKE_HAL_PIXEL_FORMAT_YV12:
+    case FAKE_HAL_PIXEL_FORMAT_YCrCb_420_SP:
+      *stride = aligned;
+      return aligned * height + 2 * (aligned / 2) * ((height + 1) / 2);
+    case FAKE_OMX_COLOR_FormatYUV420Planar:
+    case FAKE_OMX_COLOR_FormatYUV420SemiPlanar:
+      *stride = width;
+      return width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    case FAKE_HAL_PIXEL_FORMAT_YCbCr_422_SP:
+    case FAKE_HAL_PIXEL_FORMAT_YCbCr_422_I:
+    case FAKE_HAL_PIXEL_FORMAT_RGB_565:
+      *stride = aligned;
+      return aligned * height * 2;
+    case FAKE_HAL_PIXEL_FORMAT_RGB_888:
+      *stride = aligned;
+      return aligned * height * 3;
+    default:
+      *stride = aligned;
+      return aligned * height * 4;
+  }
+}
+
+/*
+ * A luma ramp with a bar moving one step per frame, grey chroma. Good
+ * enough to tell frames apart and cheap enough to not skew timings.
+ */
+void
+fake_droid_media_frame_fill (guint8 * data, uint32_t format, uint32_t width,
+    uint32_t height, uint32_t stride, guint frame)
+{
+  uint32_t y;
+  uint32_t bar = (frame * 8) % MAX (width, 1);
+  gsize luma = (gsize) stride * height;
+  uint32_t ignored;
+  gsize size;
+
+  switch (format) {
+    case FAKE_HAL_PIXEL_FORMAT_YV12:
+    case FAKE_HAL_PIXEL_FORMAT_YCrCb_420_SP:
+    case FAKE_OMX_COLOR_FormatYUV420Planar:
+    case FAKE_OMX_COLOR_FormatYUV420SemiPlanar:
+      for (y = 0; y < height; y++) {
+        guint8 *row = data + (gsize) y * stride;
+        memset (row, 16 + (y * 219) / MAX (height, 1), width);
+        memset (row + bar, 235, MIN (16, width - bar));
+      }
+      size = fake_droid_media_frame_size (format, width, height, &ignored);
+      memset (data + luma, 128, size - luma);
+      break;
+    default:
+      size = fake_droid_media_frame_size (format, width, height, &ignored);
+      memset (data, frame & 0xff, size);
+      break;
+  }
+}
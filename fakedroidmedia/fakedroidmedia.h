@@ -0,0 +1,129 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __FAKE_DROID_MEDIA_H__
+#define __FAKE_DROID_MEDIA_H__
+
+#include <glib.h>
+#include "droidmedia.h"
+#include "droidmediacamera.h"
+#include "droidmediacodec.h"
+#include "droidmediaconvert.h"
+#include "droidmediarecorder.h"
+#include "droidmediaconstants.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Software stand-in for droidmedia. The Android values are used for the
+ * pixel and colour formats so the format tables in gst-droid work as is.
+ */
+#define FAKE_HAL_PIXEL_FORMAT_RGBA_8888          1
+#define FAKE_HAL_PIXEL_FORMAT_RGBX_8888          2
+#define FAKE_HAL_PIXEL_FORMAT_RGB_888            3
+#define FAKE_HAL_PIXEL_FORMAT_RGB_565            4
+#define FAKE_HAL_PIXEL_FORMAT_BGRA_8888          5
+#define FAKE_HAL_PIXEL_FORMAT_YCbCr_422_SP       0x10
+#define FAKE_HAL_PIXEL_FORMAT_YCrCb_420_SP       0x11
+#define FAKE_HAL_PIXEL_FORMAT_YCbCr_422_I        0x14
+#define FAKE_HAL_PIXEL_FORMAT_YV12               0x32315659
+
+#define FAKE_OMX_COLOR_Format16bitRGB565         6
+#define FAKE_OMX_COLOR_Format16bitBGR565         7
+#define FAKE_OMX_COLOR_Format32bitBGRA8888       15
+#define FAKE_OMX_COLOR_Format32bitARGB8888       16
+#define FAKE_OMX_COLOR_FormatYUV420Planar        19
+#define FAKE_OMX_COLOR_FormatYUV420PackedPlanar  20
+#define FAKE_OMX_COLOR_FormatYUV420SemiPlanar    21
+#define FAKE_OMX_COLOR_FormatYUV422SemiPlanar    24
+#define FAKE_OMX_COLOR_FormatYCbYCr              25
+#define FAKE_OMX_COLOR_FormatYCrYCb              26
+#define FAKE_OMX_COLOR_FormatCbYCrY              27
+#define FAKE_OMX_COLOR_FormatL8                  35
+#define FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka 0x7FA30C03
+#define FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar32m            0x7FA30C04
+
+/* Tunables, all read from the environment */
+#define FAKE_DROID_MEDIA_ENV_CAMERAS        "FAKE_DROIDMEDIA_CAMERAS"
+#define FAKE_DROID_MEDIA_ENV_CAMERA_FPS     "FAKE_DROIDMEDIA_CAMERA_FPS"
+#define FAKE_DROID_MEDIA_ENV_QUEUE_LENGTH   "FAKE_DROIDMEDIA_QUEUE_LENGTH"
+#define FAKE_DROID_MEDIA_ENV_CODEC_LATENCY  "FAKE_DROIDMEDIA_CODEC_LATENCY"
+#define FAKE_DROID_MEDIA_ENV_CODEC_REORDER  "FAKE_DROIDMEDIA_CODEC_REORDER"
+#define FAKE_DROID_MEDIA_ENV_NO_META_DATA   "FAKE_DROIDMEDIA_CODEC_NO_META_DATA"
+
+guint fake_droid_media_get_env_uint (const gchar * name, guint def);
+
+/* buffers */
+struct _DroidMediaBuffer
+{
+  int fd;
+  gsize size;
+  guint8 *data;
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t format;
+
+  int64_t timestamp;
+  int64_t frame_number;
+  DroidMediaRect crop_rect;
+
+  void *user_data;
+
+  /* NULL for buffers created with droid_media_buffer_create () */
+  DroidMediaBufferQueue *queue;
+  gboolean queued;
+  gboolean orphaned;
+};
+
+DroidMediaBuffer *fake_droid_media_buffer_new (uint32_t width,
+    uint32_t height, uint32_t format);
+void fake_droid_media_buffer_free (DroidMediaBuffer * buffer);
+
+DroidMediaBufferQueue *fake_droid_media_buffer_queue_new (void);
+void fake_droid_media_buffer_queue_free (DroidMediaBufferQueue * queue);
+DroidMediaBuffer *fake_droid_media_buffer_queue_dequeue (DroidMediaBufferQueue *
+    queue, uint32_t width, uint32_t height, uint32_t format);
+void fake_droid_media_buffer_queue_post (DroidMediaBufferQueue * queue,
+    DroidMediaBuffer * buffer);
+void fake_droid_media_buffer_queue_flush (DroidMediaBufferQueue * queue);
+
+/* raw frames */
+gsize fake_droid_media_frame_size (uint32_t format, uint32_t width,
+    uint32_t height, uint32_t * stride);
+void fake_droid_media_frame_fill (guint8 * data, uint32_t format,
+    uint32_t width, uint32_t height, uint32_t stride, guint frame);
+
+/* codecs. The recorder drives an encoder from the camera thread */
+DroidMediaCodec *fake_droid_media_codec_new_encoder (DroidMediaCodecEncoderMetaData
+    * meta);
+void fake_droid_media_codec_queue_copy (DroidMediaCodec * codec,
+    const guint8 * data, gsize size, int64_t ts);
+void fake_droid_media_codec_drain_sync (DroidMediaCodec * codec);
+
+void fake_droid_media_camera_set_recorder (DroidMediaCamera * camera,
+    DroidMediaRecorder * recorder);
+void fake_droid_media_recorder_push (DroidMediaRecorder * recorder,
+    const guint8 * data, gsize size, int64_t ts);
+
+G_END_DECLS
+
+#endif /* __FAKE_DROID_MEDIA_H__ */
@@ -0,0 +1,377 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             /* memfd_create () */
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fakedroidmedia.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#define FAKE_DROID_MEDIA_QUEUE_LENGTH_DEFAULT 6
+#define FAKE_DROID_MEDIA_DEQUEUE_TIMEOUT (G_USEC_PER_SEC / 2)
+
+/*
+ * One lock for all queues. Buffers can outlive their queue when the consumer
+ * still holds them so the queue pointer of a buffer is protected by it too.
+ */
+G_LOCK_DEFINE_STATIC (queue_lock);
+
+struct _DroidMediaBufferQueue
+{
+  GCond cond;
+
+  DroidMediaBufferQueueCallbacks cb;
+  void *data;
+
+  /* all buffers of the queue, handed out or back in it */
+  GPtrArray *buffers;
+  GQueue free;
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  int64_t frame_number;
+};
+
+/* memfd backed so the buffers can be exported and mmapped like gralloc ones */
+DroidMediaBuffer *
+fake_droid_media_buffer_new (uint32_t width, uint32_t height, uint32_t format)
+{
+  DroidMediaBuffer *buffer;
+  uint32_t stride;
+  gsize size = fake_droid_media_frame_size (format, width, height, &stride);
+  int fd;
+  void *data;
+
+  fd = memfd_create ("fakedroidmedia-buffer", MFD_CLOEXEC);
+  if (fd < 0) {
+    g_warning ("fakedroidmedia: memfd_create failed: %s", g_strerror (errno));
+    return NULL;
+  }
+
+  if (ftruncate (fd, size) < 0) {
+    g_warning ("fakedroidmedia: ftruncate failed: %s", g_strerror (errno));
+    close (fd);
+    return NULL;
+  }
+
+  data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    g_warning ("fakedroidmedia: mmap failed: %s", g_strerror (errno));
+    close (fd);
+    return NULL;
+  }
+
+  buffer = g_slice_new0 (DroidMediaBuffer);
+  buffer->fd = fd;
+  buffer->size = size;
+  buffer->data = data;
+  buffer->width = width;
+  buffer->height = height;
+  buffer->stride = stride;
+  buffer->format = format;
+  buffer->crop_rect.right = width;
+  buffer->crop_rect.bottom = height;
+
+  return buffer;
+}
+
+void
+fake_droid_media_buffer_free (DroidMediaBuffer * buffer)
+{
+  munmap (buffer->data, buffer->size);
+  close (buffer->fd);
+  g_slice_free (DroidMediaBuffer, buffer);
+}
+
+DroidMediaBuffer *
+droid_media_buffer_create (uint32_t w, uint32_t h, uint32_t format)
+{
+  return fake_droid_media_buffer_new (w, h, format);
+}
+
+void
+droid_media_buffer_destroy (DroidMediaBuffer * buffer)
+{
+  /* The allocator destroys every buffer it wraps. Queue buffers belong to
+   * their queue which frees them, like droidmedia drops its reference. */
+  if (buffer->queue) {
+    return;
+  }
+
+  fake_droid_media_buffer_free (buffer);
+}
+
+void *
+droid_media_buffer_lock (DroidMediaBuffer * buffer, uint32_t flags)
+{
+  return buffer->data;
+}
+
+void
+droid_media_buffer_unlock (DroidMediaBuffer * buffer)
+{
+}
+
+void
+droid_media_buffer_get_info (DroidMediaBuffer * buffer,
+    DroidMediaBufferInfo * info)
+{
+  memset (info, 0x0, sizeof (*info));
+
+  info->width = buffer->width;
+  info->height = buffer->height;
+  info->stride = buffer->stride;
+  info->format = buffer->format;
+  info->timestamp = buffer->timestamp;
+  info->frame_number = buffer->frame_number;
+  info->crop_rect = buffer->crop_rect;
+}
+
+DroidMediaRect
+droid_media_buffer_get_crop_rect (DroidMediaBuffer * buffer)
+{
+  return buffer->crop_rect;
+}
+
+void
+droid_media_buffer_set_user_data (DroidMediaBuffer * buffer, void *data)
+{
+  buffer->user_data = data;
+}
+
+void *
+droid_media_buffer_get_user_data (DroidMediaBuffer * buffer)
+{
+  return buffer->user_data;
+}
+
+#ifdef HAVE_DROID_MEDIA_BUFFER_GET_FD
+int
+droid_media_buffer_get_fd (DroidMediaBuffer * buffer)
+{
+  return buffer->fd;
+}
+#endif
+
+/*
+ * There are no fences, the buffer simply goes back to its queue. Buffers
+ * dropped by their queue while the consumer held them are freed here.
+ */
+void
+droid_media_buffer_release (DroidMediaBuffer * buffer,
+    EGLDisplay display, EGLSyncKHR fence)
+{
+  DroidMediaBufferQueue *queue;
+
+  G_LOCK (queue_lock);
+
+  queue = buffer->queue;
+
+  if (!queue) {
+    G_UNLOCK (queue_lock);
+    if (buffer->orphaned) {
+      fake_droid_media_buffer_free (buffer);
+    }
+    return;
+  }
+
+  if (!buffer->queued) {
+    buffer->queued = TRUE;
+    g_queue_push_tail (&queue->free, buffer);
+    g_cond_signal (&queue->cond);
+  }
+
+  G_UNLOCK (queue_lock);
+}
+
+int
+droid_media_buffer_queue_length ()
+{
+  return fake_droid_media_get_env_uint (FAKE_DROID_MEDIA_ENV_QUEUE_LENGTH,
+      FAKE_DROID_MEDIA_QUEUE_LENGTH_DEFAULT);
+}
+
+void
+droid_media_buffer_queue_set_callbacks (DroidMediaBufferQueue * queue,
+    DroidMediaBufferQueueCallbacks * cb, void *data)
+{
+  G_LOCK (queue_lock);
+  if (cb) {
+    queue->cb = *cb;
+  } else {
+    memset (&queue->cb, 0x0, sizeof (queue->cb));
+  }
+  queue->data = data;
+  G_UNLOCK (queue_lock);
+}
+
+DroidMediaBufferQueue *
+fake_droid_media_buffer_queue_new (void)
+{
+  DroidMediaBufferQueue *queue = g_slice_new0 (DroidMediaBufferQueue);
+
+  g_cond_init (&queue->cond);
+  queue->buffers = g_ptr_array_new ();
+  g_queue_init (&queue->free);
+
+  return queue;
+}
+
+void
+fake_droid_media_buffer_queue_free (DroidMediaBufferQueue * queue)
+{
+  fake_droid_media_buffer_queue_flush (queue);
+
+  g_ptr_array_free (queue->buffers, TRUE);
+  g_cond_clear (&queue->cond);
+  g_slice_free (DroidMediaBufferQueue, queue);
+}
+
+/*
+ * Drops all buffers. Like the real queue we tell the consumer first so it
+ * stops using them.
+ */
+void
+fake_droid_media_buffer_queue_flush (DroidMediaBufferQueue * queue)
+{
+  DroidMediaBufferQueueCallbacks cb;
+  void *data;
+  guint i;
+
+  G_LOCK (queue_lock);
+  cb = queue->cb;
+  data = queue->data;
+  G_UNLOCK (queue_lock);
+
+  if (cb.buffers_released) {
+    cb.buffers_released (data);
+  }
+
+  G_LOCK (queue_lock);
+  for (i = 0; i < queue->buffers->len; i++) {
+    DroidMediaBuffer *buffer = g_ptr_array_index (queue->buffers, i);
+
+    buffer->queue = NULL;
+
+    if (buffer->queued) {
+      fake_droid_media_buffer_free (buffer);
+    } else {
+      buffer->orphaned = TRUE;
+    }
+  }
+  g_ptr_array_set_size (queue->buffers, 0);
+  g_queue_clear (&queue->free);
+  queue->width = queue->height = queue->format = 0;
+  G_UNLOCK (queue_lock);
+}
+
+/*
+ * Returns a free buffer of the given layout. New buffers are created until
+ * the queue is full, after that we wait for the consumer to release one. NULL
+ * means the consumer held on to all of them for too long.
+ */
+DroidMediaBuffer *
+fake_droid_media_buffer_queue_dequeue (DroidMediaBufferQueue * queue,
+    uint32_t width, uint32_t height, uint32_t format)
+{
+  DroidMediaBuffer *buffer = NULL;
+  DroidMediaBufferQueueCallbacks cb;
+  void *data;
+  gint64 deadline;
+  gboolean created = FALSE;
+  gboolean changed;
+
+  G_LOCK (queue_lock);
+  changed = queue->buffers->len > 0 && (queue->width != width
+      || queue->height != height || queue->format != format);
+  G_UNLOCK (queue_lock);
+
+  if (changed) {
+    fake_droid_media_buffer_queue_flush (queue);
+  }
+
+  G_LOCK (queue_lock);
+
+  queue->width = width;
+  queue->height = height;
+  queue->format = format;
+
+  deadline = g_get_monotonic_time () + FAKE_DROID_MEDIA_DEQUEUE_TIMEOUT;
+
+  while (!(buffer = g_queue_pop_head (&queue->free))) {
+    if (queue->buffers->len < (guint) droid_media_buffer_queue_length ()) {
+      buffer = fake_droid_media_buffer_new (width, height, format);
+      if (buffer) {
+        buffer->queue = queue;
+        g_ptr_array_add (queue->buffers, buffer);
+        created = TRUE;
+      }
+      break;
+    }
+
+    if (!g_cond_wait_until (&queue->cond, &G_LOCK_NAME (queue_lock),
+            deadline)) {
+      break;
+    }
+  }
+
+  if (buffer) {
+    buffer->queued = FALSE;
+    buffer->frame_number = queue->frame_number++;
+  }
+
+  cb = queue->cb;
+  data = queue->data;
+
+  G_UNLOCK (queue_lock);
+
+  if (created && cb.buffer_created) {
+    cb.buffer_created (data, buffer);
+  }
+
+  return buffer;
+}
+
+/* Hands a filled buffer to the consumer. Rejected buffers go straight back */
+void
+fake_droid_media_buffer_queue_post (DroidMediaBufferQueue * queue,
+    DroidMediaBuffer * buffer)
+{
+  DroidMediaBufferQueueCallbacks cb;
+  void *data;
+
+  G_LOCK (queue_lock);
+  cb = queue->cb;
+  data = queue->data;
+  G_UNLOCK (queue_lock);
+
+  if (!cb.frame_available || !cb.frame_available (data, buffer)) {
+    droid_media_buffer_release (buffer, NULL, NULL);
+  }
+}
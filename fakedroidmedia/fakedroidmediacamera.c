@@ -0,0 +1,580 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fakedroidmedia.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAKE_DROID_MEDIA_CAMERAS_DEFAULT 2
+#define FAKE_DROID_MEDIA_CAMERA_FPS_DEFAULT 30
+#define FAKE_DROID_MEDIA_FOCUS_FRAMES 3
+
+/* What a typical HAL3 backed camera reports, trimmed to what gst-droid reads */
+static const gchar *default_params =
+    "preview-size=1280x720;"
+    "preview-size-values=1920x1080,1280x720,640x480;"
+    "preview-format=yuv420sp;"
+    "preview-format-values=yuv420sp,yuv420p;"
+    "preview-frame-rate=30;"
+    "preview-frame-rate-values=15,30;"
+    "preview-fps-range=15000,30000;"
+    "preview-fps-range-values=(15000,30000),(30000,30000);"
+    "picture-size=1920x1080;"
+    "picture-size-values=1920x1080,1280x720,640x480;"
+    "picture-format=jpeg;"
+    "picture-format-values=jpeg;"
+    "jpeg-quality=95;"
+    "jpeg-thumbnail-size-values=320x240,0x0;"
+    "video-size=1280x720;"
+    "video-size-values=1920x1080,1280x720,640x480;"
+    "preferred-preview-size-for-video=1280x720;"
+    "video-frame-format=yuv420sp;"
+    "focus-mode=auto;"
+    "focus-mode-values=auto,infinity,continuous-video,continuous-picture;"
+    "flash-mode=off;"
+    "flash-mode-values=off,on,auto,torch;"
+    "whitebalance=auto;"
+    "whitebalance-values=auto,daylight,cloudy-daylight,incandescent,fluorescent;"
+    "scene-mode=auto;"
+    "scene-mode-values=auto,night,sports,portrait,landscape;"
+    "effect=none;"
+    "effect-values=none,mono,negative,sepia;"
+    "antibanding=auto;"
+    "antibanding-values=off,50hz,60hz,auto;"
+    "exposure-compensation=0;"
+    "max-exposure-compensation=4;"
+    "min-exposure-compensation=-4;"
+    "exposure-compensation-step=0.5;"
+    "zoom=0;"
+    "max-zoom=4;"
+    "zoom-ratios=100,150,200,300,400;"
+    "zoom-supported=true;"
+    "max-num-detected-faces-hw=0;"
+    "max-num-focus-areas=1;"
+    "max-num-metering-areas=1;"
+    "focal-length=4.0;"
+    "horizontal-view-angle=62.0;"
+    "vertical-view-angle=48.0";
+
+struct _DroidMediaCameraRecordingData
+{
+  guint8 *data;
+  gsize size;
+};
+
+struct _DroidMediaCamera
+{
+  int num;
+
+  DroidMediaBufferQueue *queue;
+
+  /* protects everything below */
+  GMutex lock;
+  GCond cond;
+
+  DroidMediaCameraCallbacks cb;
+  void *data;
+
+  GHashTable *params;
+  uint32_t width;
+  uint32_t height;
+  guint fps;
+
+  gboolean locked;
+  gboolean recording;
+  int preview_flags;
+  gint focus_frames;
+  gint capture_msg;
+
+  DroidMediaRecorder *recorder;
+
+  GThread *thread;
+  gboolean running;
+  gboolean delivering;
+  guint frame;
+};
+
+static void
+fake_droid_media_camera_parse_params (GHashTable * params, const char *str)
+{
+  gchar **pairs = g_strsplit (str, ";", -1);
+  gchar **pair;
+
+  for (pair = pairs; *pair; pair++) {
+    gchar *eq = strchr (*pair, '=');
+
+    if (!eq || eq == *pair) {
+      continue;
+    }
+
+    g_hash_table_insert (params, g_strndup (*pair, eq - *pair),
+        g_strdup (eq + 1));
+  }
+
+  g_strfreev (pairs);
+}
+
+/* Called with the lock held */
+static void
+fake_droid_media_camera_update_format (DroidMediaCamera * camera)
+{
+  const gchar *size = g_hash_table_lookup (camera->params, "preview-size");
+  const gchar *range = g_hash_table_lookup (camera->params,
+      "preview-fps-range");
+  const gchar *rate = g_hash_table_lookup (camera->params,
+      "preview-frame-rate");
+  guint width = 0, height = 0, min = 0, max = 0;
+
+  if (size && sscanf (size, "%ux%u", &width, &height) == 2 && width > 0
+      && height > 0) {
+    camera->width = width;
+    camera->height = height;
+  }
+
+  camera->fps = FAKE_DROID_MEDIA_CAMERA_FPS_DEFAULT;
+  if (range && sscanf (range, "%u,%u", &min, &max) == 2 && max >= 1000) {
+    camera->fps = max / 1000;
+  } else if (rate && atoi (rate) > 0) {
+    camera->fps = atoi (rate);
+  }
+
+  camera->fps = fake_droid_media_get_env_uint
+      (FAKE_DROID_MEDIA_ENV_CAMERA_FPS, camera->fps);
+  if (camera->fps == 0) {
+    camera->fps = FAKE_DROID_MEDIA_CAMERA_FPS_DEFAULT;
+  }
+}
+
+/*
+ * No real JPEG encoder here. The placeholder is a marker framed blob which
+ * is enough for the capture path and exif handling but won't decode.
+ */
+static void
+fake_droid_media_camera_capture (DroidMediaCamera * camera, int msg,
+    DroidMediaCameraCallbacks * cb, void *data, guint8 * frame, gsize size)
+{
+  DroidMediaCameraConstants c;
+  DroidMediaData mem;
+
+  droid_media_camera_constants_init (&c);
+
+  if ((msg & c.CAMERA_MSG_SHUTTER) && cb->shutter_cb) {
+    cb->shutter_cb (data);
+  }
+
+  mem.data = frame;
+  mem.size = size;
+
+  if ((msg & c.CAMERA_MSG_RAW_IMAGE) && cb->raw_image_cb) {
+    cb->raw_image_cb (data, &mem);
+  }
+
+  if ((msg & c.CAMERA_MSG_POSTVIEW_FRAME) && cb->postview_frame_cb) {
+    cb->postview_frame_cb (data, &mem);
+  }
+
+  if ((msg & c.CAMERA_MSG_COMPRESSED_IMAGE) && cb->compressed_image_cb) {
+    static const guint8 jpeg[] = {
+      0xff, 0xd8, 0xff, 0xfe, 0x00, 0x10,
+      'f', 'a', 'k', 'e', 'd', 'r', 'o', 'i', 'd', 'm', 'e', 'd', 'i', 'a',
+      0xff, 0xd9
+    };
+
+    mem.data = (void *) jpeg;
+    mem.size = sizeof (jpeg);
+    cb->compressed_image_cb (data, &mem);
+  }
+}
+
+static gpointer
+fake_droid_media_camera_thread (gpointer user_data)
+{
+  DroidMediaCamera *camera = (DroidMediaCamera *) user_data;
+  gint64 next = g_get_monotonic_time ();
+
+  g_mutex_lock (&camera->lock);
+
+  while (camera->running) {
+    DroidMediaCameraCallbacks cb = camera->cb;
+    void *data = camera->data;
+    DroidMediaRecorder *recorder = camera->recorder;
+    gboolean recording = camera->recording;
+    gboolean preview_cb = (camera->preview_flags & 0x01) != 0;
+    gboolean focused = FALSE;
+    gint capture = camera->capture_msg;
+    uint32_t width = camera->width;
+    uint32_t height = camera->height;
+    guint frame = camera->frame++;
+    DroidMediaBuffer *buffer;
+    int64_t ts;
+
+    if (camera->focus_frames > 0 && --camera->focus_frames == 0) {
+      focused = TRUE;
+    }
+    camera->capture_msg = 0;
+    camera->delivering = TRUE;
+
+    g_mutex_unlock (&camera->lock);
+
+    buffer = fake_droid_media_buffer_queue_dequeue (camera->queue, width,
+        height, FAKE_HAL_PIXEL_FORMAT_YCrCb_420_SP);
+
+    if (buffer) {
+      ts = g_get_monotonic_time () * 1000;
+
+      fake_droid_media_frame_fill (buffer->data, buffer->format, width, height,
+          buffer->stride, frame);
+      buffer->timestamp = ts;
+
+      if (preview_cb && cb.preview_frame_cb) {
+        DroidMediaData mem;
+        mem.data = buffer->data;
+        mem.size = buffer->size;
+        cb.preview_frame_cb (data, &mem);
+      }
+
+      if (recorder) {
+        fake_droid_media_recorder_push (recorder, buffer->data, buffer->size,
+            ts / 1000);
+      } else if (recording && cb.video_frame_cb) {
+        DroidMediaCameraRecordingData *video =
+            g_slice_new (DroidMediaCameraRecordingData);
+
+        video->data = g_malloc (buffer->size);
+        memcpy (video->data, buffer->data, buffer->size);
+        video->size = buffer->size;
+        cb.video_frame_cb (data, video);
+      }
+
+      if (capture) {
+        fake_droid_media_camera_capture (camera, capture, &cb, data,
+            buffer->data, buffer->size);
+      }
+
+      fake_droid_media_buffer_queue_post (camera->queue, buffer);
+    }
+
+    if (focused && cb.focus_cb) {
+      cb.focus_cb (data, 1);
+    }
+
+    g_mutex_lock (&camera->lock);
+
+    camera->delivering = FALSE;
+    g_cond_broadcast (&camera->cond);
+
+    next += G_USEC_PER_SEC / camera->fps;
+    if (next < g_get_monotonic_time ()) {
+      /* we fell behind, don't try to catch up with a burst */
+      next = g_get_monotonic_time ();
+    }
+
+    while (camera->running
+        && g_cond_wait_until (&camera->cond, &camera->lock, next));
+  }
+
+  g_mutex_unlock (&camera->lock);
+
+  return NULL;
+}
+
+int
+droid_media_camera_get_number_of_cameras ()
+{
+  return fake_droid_media_get_env_uint (FAKE_DROID_MEDIA_ENV_CAMERAS,
+      FAKE_DROID_MEDIA_CAMERAS_DEFAULT);
+}
+
+/* Camera 0 looks back, all others to the front */
+bool
+droid_media_camera_get_info (DroidMediaCameraInfo * info, int camera_number)
+{
+  if (camera_number < 0
+      || camera_number >= droid_media_camera_get_number_of_cameras ()) {
+    return false;
+  }
+
+  info->facing = camera_number == 0 ? DROID_MEDIA_CAMERA_FACING_BACK :
+      DROID_MEDIA_CAMERA_FACING_FRONT;
+  info->orientation = camera_number == 0 ? 90 : 270;
+
+  return true;
+}
+
+DroidMediaCamera *
+droid_media_camera_connect (int camera_number)
+{
+  DroidMediaCamera *camera;
+
+  if (camera_number < 0
+      || camera_number >= droid_media_camera_get_number_of_cameras ()) {
+    return NULL;
+  }
+
+  camera = g_slice_new0 (DroidMediaCamera);
+  camera->num = camera_number;
+  camera->queue = fake_droid_media_buffer_queue_new ();
+  g_mutex_init (&camera->lock);
+  g_cond_init (&camera->cond);
+  camera->params = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  fake_droid_media_camera_parse_params (camera->params, default_params);
+  fake_droid_media_camera_update_format (camera);
+
+  return camera;
+}
+
+void
+droid_media_camera_disconnect (DroidMediaCamera * camera)
+{
+  droid_media_camera_stop_preview (camera);
+
+  fake_droid_media_buffer_queue_free (camera->queue);
+  g_hash_table_unref (camera->params);
+  g_cond_clear (&camera->cond);
+  g_mutex_clear (&camera->lock);
+  g_slice_free (DroidMediaCamera, camera);
+}
+
+bool
+droid_media_camera_lock (DroidMediaCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+  camera->locked = TRUE;
+  g_mutex_unlock (&camera->lock);
+
+  return true;
+}
+
+DroidMediaBufferQueue *
+droid_media_camera_get_buffer_queue (DroidMediaCamera * camera)
+{
+  return camera->queue;
+}
+
+void
+droid_media_camera_set_callbacks (DroidMediaCamera * camera,
+    DroidMediaCameraCallbacks * cb, void *data)
+{
+  g_mutex_lock (&camera->lock);
+  camera->cb = *cb;
+  camera->data = data;
+  g_mutex_unlock (&camera->lock);
+}
+
+int32_t
+droid_media_camera_get_video_color_format (DroidMediaCamera * camera)
+{
+  return FAKE_OMX_COLOR_FormatYUV420SemiPlanar;
+}
+
+bool
+droid_media_camera_start_preview (DroidMediaCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+
+  if (!camera->running) {
+    camera->running = TRUE;
+    camera->thread = g_thread_new ("fakecamera",
+        fake_droid_media_camera_thread, camera);
+  }
+
+  g_mutex_unlock (&camera->lock);
+
+  return true;
+}
+
+void
+droid_media_camera_stop_preview (DroidMediaCamera * camera)
+{
+  GThread *thread;
+
+  g_mutex_lock (&camera->lock);
+  camera->running = FALSE;
+  thread = camera->thread;
+  camera->thread = NULL;
+  g_cond_broadcast (&camera->cond);
+  g_mutex_unlock (&camera->lock);
+
+  if (thread) {
+    g_thread_join (thread);
+  }
+}
+
+bool
+droid_media_camera_set_parameters (DroidMediaCamera * camera,
+    const char *params)
+{
+  g_mutex_lock (&camera->lock);
+  fake_droid_media_camera_parse_params (camera->params, params);
+  fake_droid_media_camera_update_format (camera);
+  g_mutex_unlock (&camera->lock);
+
+  return true;
+}
+
+/* The caller frees the string with free () */
+char *
+droid_media_camera_get_parameters (DroidMediaCamera * camera)
+{
+  GString *str = g_string_new (NULL);
+  GHashTableIter iter;
+  gpointer key, value;
+  char *ret;
+
+  g_mutex_lock (&camera->lock);
+  g_hash_table_iter_init (&iter, camera->params);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    g_string_append_printf (str, "%s%s=%s", str->len ? ";" : "",
+        (const gchar *) key, (const gchar *) value);
+  }
+  g_mutex_unlock (&camera->lock);
+
+  ret = strdup (str->str);
+  g_string_free (str, TRUE);
+
+  return ret;
+}
+
+/* Delivered from the camera thread along with the next frame */
+bool
+droid_media_camera_take_picture (DroidMediaCamera * camera, int msgType)
+{
+  gboolean ret;
+
+  g_mutex_lock (&camera->lock);
+  ret = camera->running;
+  if (ret) {
+    camera->capture_msg = msgType;
+  }
+  g_mutex_unlock (&camera->lock);
+
+  return ret;
+}
+
+bool
+droid_media_camera_start_auto_focus (DroidMediaCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+  camera->focus_frames = FAKE_DROID_MEDIA_FOCUS_FRAMES;
+  g_mutex_unlock (&camera->lock);
+
+  return true;
+}
+
+bool
+droid_media_camera_cancel_auto_focus (DroidMediaCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+  camera->focus_frames = 0;
+  g_mutex_unlock (&camera->lock);
+
+  return true;
+}
+
+bool
+droid_media_camera_enable_face_detection (DroidMediaCamera * camera,
+    DroidMediaCameraFaceDetectionType type, bool enable)
+{
+  return true;
+}
+
+bool
+droid_media_camera_send_command (DroidMediaCamera * camera, int32_t cmd,
+    int32_t arg1, int32_t arg2)
+{
+  return true;
+}
+
+void
+droid_media_camera_set_preview_callback_flags (DroidMediaCamera * camera,
+    int preview_callback_flag)
+{
+  g_mutex_lock (&camera->lock);
+  camera->preview_flags = preview_callback_flag;
+  g_mutex_unlock (&camera->lock);
+}
+
+/* Recording frames are plain copies of the preview frames */
+bool
+droid_media_camera_store_meta_data_in_buffers (DroidMediaCamera * camera,
+    bool enabled)
+{
+  return true;
+}
+
+bool
+droid_media_camera_start_recording (DroidMediaCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+  camera->recording = TRUE;
+  g_mutex_unlock (&camera->lock);
+
+  return true;
+}
+
+void
+droid_media_camera_stop_recording (DroidMediaCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+  camera->recording = FALSE;
+  g_mutex_unlock (&camera->lock);
+}
+
+void
+droid_media_camera_release_recording_frame (DroidMediaCamera * camera,
+    DroidMediaCameraRecordingData * data)
+{
+  g_free (data->data);
+  g_slice_free (DroidMediaCameraRecordingData, data);
+}
+
+void *
+droid_media_camera_recording_frame_get_data (DroidMediaCameraRecordingData *
+    data)
+{
+  return data->data;
+}
+
+size_t
+droid_media_camera_recording_frame_get_size (DroidMediaCameraRecordingData *
+    data)
+{
+  return data->size;
+}
+
+void
+fake_droid_media_camera_set_recorder (DroidMediaCamera * camera,
+    DroidMediaRecorder * recorder)
+{
+  g_mutex_lock (&camera->lock);
+  camera->recorder = recorder;
+
+  /* the camera thread may still be feeding the previous one */
+  while (camera->delivering) {
+    g_cond_wait (&camera->cond, &camera->lock);
+  }
+  g_mutex_unlock (&camera->lock);
+}
@@ -0,0 +1,639 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fakedroidmedia.h"
+#include <string.h>
+
+/*
+ * The fake codecs don't look at the data. Encoders pass their input through
+ * as the encoded payload, decoders output a test pattern of the configured
+ * size. Output can be delayed and reordered to mimic real hardware:
+ *
+ *   FAKE_DROIDMEDIA_CODEC_LATENCY  minimum time in ms between queue and output
+ *   FAKE_DROIDMEDIA_CODEC_REORDER  depth of the reorder window in frames
+ *   FAKE_DROIDMEDIA_CODEC_NO_META_DATA  non zero refuses encoders in meta
+ *                                       data mode like some vendor codecs
+ */
+
+#define FAKE_DROID_MEDIA_CODEC_LOOP_TIMEOUT (G_USEC_PER_SEC / 10)
+#define FAKE_DROID_MEDIA_AUDIO_SAMPLES 1024
+
+/* Layout of VideoNativeMetadata as sent by droidvenc */
+typedef struct
+{
+  uint32_t type;
+  void *buffer;
+  int fence_fd;
+} FakeNativeMetaData;
+
+typedef struct
+{
+  guint8 *data;
+  gsize size;
+  int64_t ts;
+  int64_t dts;
+  gboolean sync;
+  gint64 due;
+} FakeCodecFrame;
+
+struct _DroidMediaCodec
+{
+  gboolean encoder;
+  gboolean audio;
+  gboolean meta_data;
+  gboolean external_loop;
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  int32_t sample_rate;
+
+  /* NULL unless a video decoder outputs graphic buffers */
+  DroidMediaBufferQueue *queue;
+
+  guint latency;
+  guint reorder;
+
+  /* protects everything below */
+  GMutex lock;
+  GCond cond;
+
+  DroidMediaCodecCallbacks cb;
+  void *cb_data;
+  DroidMediaCodecDataCallbacks data_cb;
+  void *data_cb_data;
+
+  GQueue pending;
+  GQueue held;
+  gboolean started;
+  gboolean draining;
+  gboolean eos;
+  gboolean sync_requested;
+  guint frames;
+
+  /* only touched by the output thread */
+  guint output_frames;
+
+  GThread *thread;
+};
+
+static void
+fake_codec_frame_free (FakeCodecFrame * frame)
+{
+  g_free (frame->data);
+  g_slice_free (FakeCodecFrame, frame);
+}
+
+static gint
+fake_codec_frame_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  int64_t ts_a = ((const FakeCodecFrame *) a)->ts;
+  int64_t ts_b = ((const FakeCodecFrame *) b)->ts;
+
+  return ts_a < ts_b ? -1 : ts_a > ts_b;
+}
+
+/* Called with the lock held */
+static void
+fake_codec_clear (DroidMediaCodec * codec)
+{
+  g_queue_foreach (&codec->pending, (GFunc) fake_codec_frame_free, NULL);
+  g_queue_clear (&codec->pending);
+  g_queue_foreach (&codec->held, (GFunc) fake_codec_frame_free, NULL);
+  g_queue_clear (&codec->held);
+}
+
+/*
+ * Moves frames out of the reorder window. Decoders return presentation order
+ * like real ones. Encoders emit the last frame of each group first like a
+ * B-frame GOP would, decoding timestamps stay monotonic. Called with the lock
+ * held.
+ */
+static GList *
+fake_codec_reorder (DroidMediaCodec * codec, gboolean flush)
+{
+  GList *ready = NULL, *l;
+  GQueue sorted = G_QUEUE_INIT;
+  FakeCodecFrame *frame;
+
+  if (!codec->encoder) {
+    while (codec->held.length > (flush ? 0 : codec->reorder)) {
+      frame = g_queue_pop_head (&codec->held);
+      frame->dts = frame->ts;
+      ready = g_list_append (ready, frame);
+    }
+
+    return ready;
+  }
+
+  if (!flush && codec->held.length <= codec->reorder) {
+    return NULL;
+  }
+
+  while ((frame = g_queue_pop_head (&codec->held))) {
+    g_queue_insert_sorted (&sorted, frame, fake_codec_frame_compare, NULL);
+    ready = g_list_append (ready, frame);
+  }
+
+  if (ready && ready->next) {
+    GList *last = g_list_last (ready);
+
+    ready = g_list_remove_link (ready, last);
+    ready = g_list_concat (last, ready);
+  }
+
+  for (l = ready; l; l = l->next) {
+    frame = g_queue_pop_head (&sorted);
+    ((FakeCodecFrame *) l->data)->dts = frame->ts;
+  }
+
+  return ready;
+}
+
+static void
+fake_codec_emit (DroidMediaCodec * codec, FakeCodecFrame * frame)
+{
+  DroidMediaCodecDataCallbacks data_cb;
+  void *data;
+  DroidMediaCodecData out;
+
+  g_mutex_lock (&codec->lock);
+  data_cb = codec->data_cb;
+  data = codec->data_cb_data;
+  g_mutex_unlock (&codec->lock);
+
+  memset (&out, 0x0, sizeof (out));
+  out.ts = frame->ts * 1000;
+  out.decoding_ts = frame->dts * 1000;
+  out.sync = frame->sync;
+
+  if (codec->encoder) {
+    out.data.data = frame->data;
+    out.data.size = frame->size;
+  } else if (codec->audio) {
+    out.data.size = FAKE_DROID_MEDIA_AUDIO_SAMPLES * codec->channels * 2;
+    out.data.data = g_malloc0 (out.data.size);
+  } else if (codec->queue) {
+    DroidMediaBuffer *buffer =
+        fake_droid_media_buffer_queue_dequeue (codec->queue, codec->width,
+        codec->height, FAKE_HAL_PIXEL_FORMAT_YV12);
+
+    if (buffer) {
+      fake_droid_media_frame_fill (buffer->data, buffer->format,
+          buffer->width, buffer->height, buffer->stride,
+          codec->output_frames++);
+      buffer->timestamp = out.ts;
+      fake_droid_media_buffer_queue_post (codec->queue, buffer);
+    }
+
+    return;
+  } else {
+    uint32_t stride;
+
+    out.data.size = fake_droid_media_frame_size
+        (FAKE_OMX_COLOR_FormatYUV420Planar, codec->width, codec->height,
+        &stride);
+    out.data.data = g_malloc (out.data.size);
+    fake_droid_media_frame_fill (out.data.data,
+        FAKE_OMX_COLOR_FormatYUV420Planar, codec->width, codec->height, stride,
+        codec->output_frames++);
+  }
+
+  if (data_cb.data_available) {
+    data_cb.data_available (data, &out);
+  }
+
+  if (!codec->encoder) {
+    g_free (out.data.data);
+  }
+}
+
+/*
+ * Waits until the deadline for the next frame to become due and delivers
+ * whatever leaves the reorder window. Only an external loop is told about
+ * EOS, our own thread just idles until the codec is stopped or flushed.
+ */
+static DroidMediaCodecLoopReturn
+fake_codec_process (DroidMediaCodec * codec, gint64 deadline)
+{
+  FakeCodecFrame *frame;
+  GList *ready, *l;
+  gboolean eos = FALSE;
+  DroidMediaCodecCallbacks cb;
+  void *data;
+
+  g_mutex_lock (&codec->lock);
+
+  for (;;) {
+    gint64 now = g_get_monotonic_time ();
+    gint64 wake = deadline;
+
+    if (!codec->started) {
+      g_mutex_unlock (&codec->lock);
+      return DROID_MEDIA_CODEC_LOOP_ERROR;
+    }
+
+    if (codec->eos && codec->external_loop) {
+      g_mutex_unlock (&codec->lock);
+      return DROID_MEDIA_CODEC_LOOP_EOS;
+    }
+
+    frame = g_queue_peek_head (&codec->pending);
+    if (!codec->eos && ((frame && frame->due <= now) || (!frame
+                && codec->draining))) {
+      break;
+    }
+
+    if (frame && frame->due < wake) {
+      wake = frame->due;
+    }
+
+    if (!g_cond_wait_until (&codec->cond, &codec->lock, wake)
+        && wake == deadline) {
+      g_mutex_unlock (&codec->lock);
+      return DROID_MEDIA_CODEC_LOOP_OK;
+    }
+  }
+
+  if (frame) {
+    g_queue_pop_head (&codec->pending);
+    if (codec->encoder) {
+      g_queue_push_tail (&codec->held, frame);
+    } else {
+      g_queue_insert_sorted (&codec->held, frame, fake_codec_frame_compare,
+          NULL);
+    }
+    ready = fake_codec_reorder (codec, FALSE);
+  } else {
+    ready = fake_codec_reorder (codec, TRUE);
+    codec->draining = FALSE;
+    codec->eos = eos = TRUE;
+  }
+
+  /* room for more input */
+  g_cond_broadcast (&codec->cond);
+
+  cb = codec->cb;
+  data = codec->cb_data;
+
+  g_mutex_unlock (&codec->lock);
+
+  for (l = ready; l; l = l->next) {
+    fake_codec_emit (codec, l->data);
+  }
+  g_list_free_full (ready, (GDestroyNotify) fake_codec_frame_free);
+
+  if (eos) {
+    if (cb.signal_eos) {
+      cb.signal_eos (data);
+    }
+
+    g_mutex_lock (&codec->lock);
+    g_cond_broadcast (&codec->cond);
+    g_mutex_unlock (&codec->lock);
+  }
+
+  return DROID_MEDIA_CODEC_LOOP_OK;
+}
+
+static gpointer
+fake_codec_thread (gpointer user_data)
+{
+  DroidMediaCodec *codec = (DroidMediaCodec *) user_data;
+
+  while (fake_codec_process (codec, g_get_monotonic_time () +
+          FAKE_DROID_MEDIA_CODEC_LOOP_TIMEOUT) !=
+      DROID_MEDIA_CODEC_LOOP_ERROR);
+
+  return NULL;
+}
+
+static DroidMediaCodec *
+fake_codec_new (DroidMediaCodecMetaData * meta, gboolean encoder)
+{
+  DroidMediaCodec *codec = g_slice_new0 (DroidMediaCodec);
+
+  codec->encoder = encoder;
+  codec->audio = meta->type && g_str_has_prefix (meta->type, "audio/");
+  codec->external_loop = (meta->flags & DROID_MEDIA_CODEC_USE_EXTERNAL_LOOP)
+      != 0;
+  codec->width = meta->width;
+  codec->height = meta->height;
+  codec->channels = meta->channels > 0 ? meta->channels : 2;
+  codec->sample_rate = meta->sample_rate > 0 ? meta->sample_rate : 44100;
+
+  if (!encoder && !codec->audio
+      && !(meta->flags & DROID_MEDIA_CODEC_NO_MEDIA_BUFFER)) {
+    codec->queue = fake_droid_media_buffer_queue_new ();
+  }
+
+  codec->latency =
+      fake_droid_media_get_env_uint (FAKE_DROID_MEDIA_ENV_CODEC_LATENCY, 0);
+  codec->reorder =
+      fake_droid_media_get_env_uint (FAKE_DROID_MEDIA_ENV_CODEC_REORDER, 0);
+
+  g_mutex_init (&codec->lock);
+  g_cond_init (&codec->cond);
+  g_queue_init (&codec->pending);
+  g_queue_init (&codec->held);
+
+  return codec;
+}
+
+bool
+droid_media_codec_is_supported (DroidMediaCodecMetaData * meta, bool encoder)
+{
+  return meta->type && (g_str_has_prefix (meta->type, "video/")
+      || g_str_has_prefix (meta->type, "audio/"));
+}
+
+DroidMediaCodec *
+droid_media_codec_create_decoder (DroidMediaCodecDecoderMetaData * meta)
+{
+  return fake_codec_new (&meta->parent, FALSE);
+}
+
+DroidMediaCodec *
+droid_media_codec_create_encoder (DroidMediaCodecEncoderMetaData * meta)
+{
+  DroidMediaCodec *codec;
+
+  if (meta->meta_data
+      && fake_droid_media_get_env_uint (FAKE_DROID_MEDIA_ENV_NO_META_DATA, 0)) {
+    return NULL;
+  }
+
+  codec = fake_codec_new (&meta->parent, TRUE);
+
+  codec->meta_data = meta->meta_data;
+
+  return codec;
+}
+
+DroidMediaCodec *
+fake_droid_media_codec_new_encoder (DroidMediaCodecEncoderMetaData * meta)
+{
+  DroidMediaCodec *codec = fake_codec_new (&meta->parent, TRUE);
+
+  /* the recorder feeds plain frames */
+  codec->meta_data = FALSE;
+
+  return codec;
+}
+
+bool
+droid_media_codec_start (DroidMediaCodec * codec)
+{
+  g_mutex_lock (&codec->lock);
+
+  codec->started = TRUE;
+  codec->eos = FALSE;
+  codec->draining = FALSE;
+
+  if (!codec->external_loop && !codec->thread) {
+    codec->thread = g_thread_new ("fakecodec", fake_codec_thread, codec);
+  }
+
+  g_mutex_unlock (&codec->lock);
+
+  return true;
+}
+
+void
+droid_media_codec_stop (DroidMediaCodec * codec)
+{
+  GThread *thread;
+
+  g_mutex_lock (&codec->lock);
+  codec->started = FALSE;
+  thread = codec->thread;
+  codec->thread = NULL;
+  fake_codec_clear (codec);
+  g_cond_broadcast (&codec->cond);
+  g_mutex_unlock (&codec->lock);
+
+  if (thread) {
+    g_thread_join (thread);
+  }
+}
+
+void
+droid_media_codec_destroy (DroidMediaCodec * codec)
+{
+  droid_media_codec_stop (codec);
+
+  if (codec->queue) {
+    fake_droid_media_buffer_queue_free (codec->queue);
+  }
+
+  g_cond_clear (&codec->cond);
+  g_mutex_clear (&codec->lock);
+  g_slice_free (DroidMediaCodec, codec);
+}
+
+/*
+ * Takes ownership of data. Blocks like a full input port would while the
+ * pending and reorder queues hold a queue length worth of frames.
+ */
+static void
+fake_codec_queue (DroidMediaCodec * codec, guint8 * data, gsize size,
+    int64_t ts, gboolean sync)
+{
+  FakeCodecFrame *frame = g_slice_new0 (FakeCodecFrame);
+  guint max = droid_media_buffer_queue_length () + codec->reorder;
+
+  frame->data = data;
+  frame->size = size;
+  frame->ts = ts;
+  frame->due = g_get_monotonic_time () + codec->latency * 1000;
+
+  g_mutex_lock (&codec->lock);
+
+  while (codec->started && !codec->draining
+      && codec->pending.length + codec->held.length >= max) {
+    g_cond_wait (&codec->cond, &codec->lock);
+  }
+
+  if (!codec->started) {
+    g_mutex_unlock (&codec->lock);
+    fake_codec_frame_free (frame);
+    return;
+  }
+
+  frame->sync = sync || codec->sync_requested || codec->frames == 0;
+  codec->sync_requested = FALSE;
+  codec->frames++;
+
+  g_queue_push_tail (&codec->pending, frame);
+  g_cond_broadcast (&codec->cond);
+
+  g_mutex_unlock (&codec->lock);
+}
+
+void
+droid_media_codec_queue (DroidMediaCodec * codec, DroidMediaCodecData * data,
+    DroidMediaBufferCallbacks * cb)
+{
+  guint8 *payload = NULL;
+  gsize size = 0;
+
+  if (codec->encoder) {
+    const guint8 *src = data->data.data;
+
+    size = data->data.size;
+
+    if (codec->meta_data && size >= sizeof (FakeNativeMetaData)) {
+      DroidMediaBuffer *buffer =
+          ((const FakeNativeMetaData *) data->data.data)->buffer;
+
+      src = buffer->data;
+      size = buffer->size;
+    }
+
+    payload = g_malloc (size);
+    memcpy (payload, src, size);
+  }
+
+  /* the input is consumed right away */
+  if (cb && cb->unref) {
+    cb->unref (cb->data);
+  }
+
+  fake_codec_queue (codec, payload, size, data->ts, data->sync);
+}
+
+void
+fake_droid_media_codec_queue_copy (DroidMediaCodec * codec,
+    const guint8 * data, gsize size, int64_t ts)
+{
+  guint8 *payload = g_malloc (size);
+
+  memcpy (payload, data, size);
+  fake_codec_queue (codec, payload, size, ts, FALSE);
+}
+
+DroidMediaBufferQueue *
+droid_media_codec_get_buffer_queue (DroidMediaCodec * codec)
+{
+  return codec->queue;
+}
+
+void
+droid_media_codec_set_callbacks (DroidMediaCodec * codec,
+    DroidMediaCodecCallbacks * cb, void *data)
+{
+  g_mutex_lock (&codec->lock);
+  codec->cb = *cb;
+  codec->cb_data = data;
+  g_mutex_unlock (&codec->lock);
+}
+
+void
+droid_media_codec_set_data_callbacks (DroidMediaCodec * codec,
+    DroidMediaCodecDataCallbacks * cb, void *data)
+{
+  g_mutex_lock (&codec->lock);
+  codec->data_cb = *cb;
+  codec->data_cb_data = data;
+  g_mutex_unlock (&codec->lock);
+}
+
+DroidMediaCodecLoopReturn
+droid_media_codec_loop (DroidMediaCodec * codec)
+{
+  return fake_codec_process (codec, g_get_monotonic_time () +
+      FAKE_DROID_MEDIA_CODEC_LOOP_TIMEOUT);
+}
+
+void
+droid_media_codec_drain (DroidMediaCodec * codec)
+{
+  g_mutex_lock (&codec->lock);
+  if (codec->started && !codec->eos) {
+    codec->draining = TRUE;
+    g_cond_broadcast (&codec->cond);
+  }
+  g_mutex_unlock (&codec->lock);
+}
+
+/* Waits for a drain to finish. Used by the recorder */
+void
+fake_droid_media_codec_drain_sync (DroidMediaCodec * codec)
+{
+  droid_media_codec_drain (codec);
+
+  g_mutex_lock (&codec->lock);
+  while (codec->started && (codec->draining || codec->pending.length > 0)) {
+    g_cond_wait (&codec->cond, &codec->lock);
+  }
+  g_mutex_unlock (&codec->lock);
+}
+
+#ifdef HAVE_DROID_MEDIA_CODEC_FLUSH
+void
+droid_media_codec_flush (DroidMediaCodec * codec)
+{
+  g_mutex_lock (&codec->lock);
+  fake_codec_clear (codec);
+  codec->eos = FALSE;
+  codec->draining = FALSE;
+  g_cond_broadcast (&codec->cond);
+  g_mutex_unlock (&codec->lock);
+}
+#endif
+
+void
+droid_media_codec_get_output_info (DroidMediaCodec * codec,
+    DroidMediaCodecMetaData * info, DroidMediaRect * crop)
+{
+  info->width = codec->width;
+  info->height = codec->height;
+  info->channels = codec->channels;
+  info->sample_rate = codec->sample_rate;
+  info->hal_format = codec->queue ? FAKE_HAL_PIXEL_FORMAT_YV12 :
+      FAKE_OMX_COLOR_FormatYUV420Planar;
+
+  crop->left = 0;
+  crop->top = 0;
+  crop->right = codec->width;
+  crop->bottom = codec->height;
+}
+
+#ifdef HAVE_DROID_MEDIA_CODEC_SET_VIDEO_ENCODER_BITRATE
+void
+droid_media_codec_set_video_encoder_bitrate (DroidMediaCodec * codec,
+    int32_t bitrate)
+{
+  /* pass through, there is no rate to control */
+}
+#endif
+
+#ifdef HAVE_DROID_MEDIA_CODEC_REQUEST_SYNC_FRAME
+void
+droid_media_codec_request_sync_frame (DroidMediaCodec * codec)
+{
+  g_mutex_lock (&codec->lock);
+  codec->sync_requested = TRUE;
+  g_mutex_unlock (&codec->lock);
+}
+#endif
@@ -0,0 +1,108 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fakedroidmedia.h"
+#include <string.h>
+
+/*
+ * The fake decoders output tightly packed I420 so all there is to do is
+ * cropping.
+ */
+struct _DroidMediaConvert
+{
+  DroidMediaRect rect;
+  int32_t width;
+  int32_t height;
+};
+
+DroidMediaConvert *
+droid_media_convert_create ()
+{
+  return g_slice_new0 (DroidMediaConvert);
+}
+
+void
+droid_media_convert_destroy (DroidMediaConvert * convert)
+{
+  g_slice_free (DroidMediaConvert, convert);
+}
+
+void
+droid_media_convert_set_crop_rect (DroidMediaConvert * convert,
+    DroidMediaRect rect, int32_t width, int32_t height)
+{
+  convert->rect = rect;
+  convert->width = width;
+  convert->height = height;
+}
+
+static void
+fake_droid_media_convert_copy_plane (guint8 * dst, const guint8 * src,
+    gsize src_stride, gsize x, gsize y, gsize width, gsize height)
+{
+  gsize row;
+
+  for (row = 0; row < height; row++) {
+    memcpy (dst + row * width, src + (y + row) * src_stride + x, width);
+  }
+}
+
+bool
+droid_media_convert_to_i420 (DroidMediaConvert * convert, DroidMediaData * in,
+    void *out)
+{
+  gsize width = convert->width;
+  gsize height = convert->height;
+  gsize x = convert->rect.left;
+  gsize y = convert->rect.top;
+  gsize crop_width = convert->rect.right - convert->rect.left;
+  gsize crop_height = convert->rect.bottom - convert->rect.top;
+  gsize chroma_width = (width + 1) / 2;
+  gsize chroma_height = (height + 1) / 2;
+  gsize chroma_crop_width = (crop_width + 1) / 2;
+  gsize chroma_crop_height = (crop_height + 1) / 2;
+  const guint8 *src = in->data;
+  guint8 *dst = out;
+
+  if (crop_width == 0 || crop_height == 0 || x + crop_width > width
+      || y + crop_height > height
+      || (gsize) in->size < width * height + 2 * chroma_width * chroma_height) {
+    return false;
+  }
+
+  fake_droid_media_convert_copy_plane (dst, src, width, x, y, crop_width,
+      crop_height);
+  src += width * height;
+  dst += crop_width * crop_height;
+
+  fake_droid_media_convert_copy_plane (dst, src, chroma_width, x / 2, y / 2,
+      chroma_crop_width, chroma_crop_height);
+  src += chroma_width * chroma_height;
+  dst += chroma_crop_width * chroma_crop_height;
+
+  fake_droid_media_convert_copy_plane (dst, src, chroma_width, x / 2, y / 2,
+      chroma_crop_width, chroma_crop_height);
+
+  return true;
+}
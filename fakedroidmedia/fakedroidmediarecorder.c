@@ -0,0 +1,87 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fakedroidmedia.h"
+
+/* An encoder fed with the preview frames of the camera */
+struct _DroidMediaRecorder
+{
+  DroidMediaCamera *camera;
+  DroidMediaCodec *codec;
+};
+
+DroidMediaRecorder *
+droid_media_recorder_create (DroidMediaCamera * camera,
+    DroidMediaCodecEncoderMetaData * meta)
+{
+  DroidMediaRecorder *recorder = g_slice_new0 (DroidMediaRecorder);
+
+  recorder->camera = camera;
+  recorder->codec = fake_droid_media_codec_new_encoder (meta);
+
+  return recorder;
+}
+
+void
+droid_media_recorder_destroy (DroidMediaRecorder * recorder)
+{
+  droid_media_recorder_stop (recorder);
+  droid_media_codec_destroy (recorder->codec);
+  g_slice_free (DroidMediaRecorder, recorder);
+}
+
+bool
+droid_media_recorder_start (DroidMediaRecorder * recorder)
+{
+  if (!droid_media_codec_start (recorder->codec)) {
+    return false;
+  }
+
+  fake_droid_media_camera_set_recorder (recorder->camera, recorder);
+
+  return true;
+}
+
+/* Everything queued so far is delivered before we return */
+void
+droid_media_recorder_stop (DroidMediaRecorder * recorder)
+{
+  fake_droid_media_camera_set_recorder (recorder->camera, NULL);
+  fake_droid_media_codec_drain_sync (recorder->codec);
+  droid_media_codec_stop (recorder->codec);
+}
+
+void
+droid_media_recorder_set_data_callbacks (DroidMediaRecorder * recorder,
+    DroidMediaCodecDataCallbacks * cb, void *data)
+{
+  droid_media_codec_set_data_callbacks (recorder->codec, cb, data);
+}
+
+void
+fake_droid_media_recorder_push (DroidMediaRecorder * recorder,
+    const guint8 * data, gsize size, int64_t ts)
+{
+  fake_droid_media_codec_queue_copy (recorder->codec, data, size, ts);
+}
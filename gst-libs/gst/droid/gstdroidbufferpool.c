@@ -22,6 +22,7 @@
 #include <gst/gst.h>
 #include "gstdroidbufferpool.h"
 #include "gstdroidmediabuffer.h"
+#include "gstdroidhaltrace.h"
 
 /* Element signals and args */
 enum
@@ -34,13 +35,82 @@ G_DEFINE_TYPE (GstDroidBufferPool, gst_droid_buffer_pool, GST_TYPE_BUFFER_POOL);
 
 static guint gst_droid_buffer_pool_signals[LAST_SIGNAL] = { 0 };
 
+#define GST_DROID_BUFFER_POOL_SLOT_UNBOUND G_MAXUINT
+
+/*
+ * Binding state of a queue buffer. It lives as qdata on the GstBuffer and
+ * knows its own index in the pool slots array so binding, acquiring and
+ * releasing never have to search.
+ */
+typedef struct
+{
+  GstBuffer *buffer;
+  GstDroidBufferPool *pool;
+  guint index;
+  gboolean acquired;
+} GstDroidBufferPoolSlot;
+
+static GQuark gst_droid_buffer_pool_slot_quark;
+
+static void
+gst_droid_buffer_pool_slot_free (gpointer data)
+{
+  g_slice_free (GstDroidBufferPoolSlot, data);
+}
+
+/*
+ * Limits max buffers to what the graphics memory budget still allows.
+ * Graphic buffers on our free list are already paid for. Sets adjusted
+ * when max had to be lowered.
+ */
+static gboolean
+gst_droid_buffer_pool_fit_budget (GstDroidBufferPool * pool,
+    GstStructure * config, GstCaps * caps, guint size, gboolean * adjusted)
+{
+  guint min, max, fit;
+  gsize available;
+
+  available = gst_droid_media_buffer_get_budget_available ();
+  if (available == G_MAXSIZE || size == 0) {
+    return TRUE;
+  }
+
+  if (!gst_buffer_pool_config_get_params (config, NULL, NULL, &min, &max)) {
+    return FALSE;
+  }
+
+  GST_OBJECT_LOCK (pool);
+  fit = MIN (available / size, G_MAXUINT) +
+      g_queue_get_length (&pool->free_memories);
+  GST_OBJECT_UNLOCK (pool);
+
+  if (fit < min) {
+    GST_ERROR_OBJECT (pool, "graphics memory budget exceeded: %u buffers of %u"
+        " bytes needed but only %u fit", min, size, fit);
+    return FALSE;
+  }
+
+  if (max == 0 || max > fit) {
+    GST_WARNING_OBJECT (pool, "graphics memory budget limits the pool to %u"
+        " buffers", fit);
+    gst_buffer_pool_config_set_params (config, caps, size, min, fit);
+    *adjusted = TRUE;
+  }
+
+  return TRUE;
+}
+
 static gboolean
 gst_droid_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
 {
   GstCaps *caps;
   guint size;
-  GstAllocationParams params = { GST_MEMORY_FLAG_NO_SHARE, 0, 0, 0 };
+  GstAllocationParams params = { 0, 0, 0, 0 };
   GstDroidBufferPool *pool = GST_DROID_BUFFER_POOL (bpool);
+  GstVideoInfo previous_info;
+  gboolean previous_use_queue_buffers;
+  GQueue stale_memories = G_QUEUE_INIT;
+  gboolean adjusted = FALSE;
 
   if (!gst_buffer_pool_config_get_params (config, &caps, &size, NULL, NULL)) {
     GST_WARNING_OBJECT (pool, "Invalid pool configuration");
@@ -52,7 +122,11 @@ gst_droid_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
 
     GST_OBJECT_LOCK (pool);
 
+    previous_info = pool->video_info;
+    previous_use_queue_buffers = pool->use_queue_buffers;
+
     if (!gst_video_info_from_caps (&pool->video_info, caps)) {
+      pool->video_info = previous_info;
       GST_OBJECT_UNLOCK (pool);
       GST_WARNING_OBJECT (pool, "Invalid video caps %" GST_PTR_FORMAT, caps);
       return FALSE;
@@ -62,22 +136,55 @@ gst_droid_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
     pool->use_queue_buffers = gst_caps_features_contains
         (features, GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER);
 
+    /* Graphic buffers kept from a previous configuration are only reusable
+     * if they still have the right size and format */
+    if (pool->use_queue_buffers || previous_use_queue_buffers
+        || GST_VIDEO_INFO_FORMAT (&previous_info) !=
+        GST_VIDEO_INFO_FORMAT (&pool->video_info)
+        || GST_VIDEO_INFO_WIDTH (&previous_info) !=
+        GST_VIDEO_INFO_WIDTH (&pool->video_info)
+        || GST_VIDEO_INFO_HEIGHT (&previous_info) !=
+        GST_VIDEO_INFO_HEIGHT (&pool->video_info)
+        || previous_info.size != pool->video_info.size) {
+      stale_memories = pool->free_memories;
+      g_queue_init (&pool->free_memories);
+    }
+
     GST_DEBUG_OBJECT (pool, "Configured pool. caps: %" GST_PTR_FORMAT, caps);
-    pool->allocator = gst_droid_media_buffer_allocator_new ();
-    gst_object_ref (pool->allocator);
+    pool->lazy_unlock = gst_buffer_pool_config_has_option (config,
+        GST_BUFFER_POOL_OPTION_DROID_MEDIA_BUFFER_LAZY_UNLOCK);
+
+    gst_droid_media_buffer_allocator_set_lazy_unlock (pool->allocator,
+        pool->lazy_unlock);
     gst_buffer_pool_config_set_allocator (config,
         (GstAllocator *) pool->allocator, &params);
     GST_OBJECT_UNLOCK (pool);
+
+    if (!g_queue_is_empty (&stale_memories)) {
+      GST_DEBUG_OBJECT (pool, "dropping %u graphic buffers of the old config",
+          g_queue_get_length (&stale_memories));
+    }
+    g_queue_clear_full (&stale_memories, (GDestroyNotify) gst_memory_unref);
+
+    if (!pool->use_queue_buffers
+        && !gst_droid_buffer_pool_fit_budget (pool, config, caps, size,
+            &adjusted)) {
+      return FALSE;
+    }
   }
 
+  /* A config cut down to the budget is applied but reported as FALSE so the
+   * caller can read it back and decide whether it can live with it */
   return GST_BUFFER_POOL_CLASS (gst_droid_buffer_pool_parent_class)
-      ->set_config (bpool, config);
+      ->set_config (bpool, config) && !adjusted;
 }
 
 static const gchar **
 gst_droid_buffer_pool_get_options (GstBufferPool * bpool)
 {
-  static const gchar *options[] = { GST_BUFFER_POOL_OPTION_VIDEO_META, NULL };
+  static const gchar *options[] = { GST_BUFFER_POOL_OPTION_VIDEO_META,
+    GST_BUFFER_POOL_OPTION_DROID_MEDIA_BUFFER_LAZY_UNLOCK, NULL
+  };
 
   return options;
 }
@@ -100,9 +207,17 @@ gst_droid_buffer_pool_alloc (GstBufferPool * pool, GstBuffer ** buf,
 
   if (!dpool->use_queue_buffers) {
     GstVideoInfo *video_info;
-    GstMemory *memory =
-        gst_droid_media_buffer_allocator_alloc_new (dpool->allocator,
-        &dpool->video_info);
+    GstMemory *memory;
+
+    GST_OBJECT_LOCK (dpool);
+    memory = g_queue_pop_head (&dpool->free_memories);
+    GST_OBJECT_UNLOCK (dpool);
+
+    if (!memory) {
+      memory = gst_droid_media_buffer_allocator_alloc_new (dpool->allocator,
+          &dpool->video_info);
+    }
+
     if (!memory) {
       gst_buffer_unref (buffer);
       return GST_FLOW_ERROR;
@@ -123,26 +238,78 @@ gst_droid_buffer_pool_alloc (GstBufferPool * pool, GstBuffer ** buf,
   return GST_FLOW_OK;
 }
 
+/* Must be called with the binding lock held */
+static void
+gst_droid_buffer_pool_unbind_slot (GstDroidBufferPool * dpool,
+    GstDroidBufferPoolSlot * slot)
+{
+  GstDroidBufferPoolSlot *last;
+
+  last = g_ptr_array_index (dpool->slots, dpool->slots->len - 1);
+  last->index = slot->index;
+  g_ptr_array_remove_index_fast (dpool->slots, slot->index);
+
+  slot->index = GST_DROID_BUFFER_POOL_SLOT_UNBOUND;
+  slot->acquired = FALSE;
+}
+
+/*
+ * Buffers freed by the pool, on deactivation or when the pool shrinks, hand
+ * their graphic buffer to the free list so the next allocation with the
+ * same configuration does not have to go to gralloc.
+ */
+static void
+gst_droid_buffer_pool_free_buffer (GstBufferPool * pool, GstBuffer * buffer)
+{
+  GstDroidBufferPool *dpool = GST_DROID_BUFFER_POOL (pool);
+
+  if (!dpool->use_queue_buffers && gst_buffer_n_memory (buffer) == 1) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, 0);
+
+    if (gst_is_droid_media_buffer_memory (mem)
+        && mem->allocator == dpool->allocator && !mem->parent) {
+      gst_droid_media_buffer_memory_release_lock (mem);
+
+      GST_OBJECT_LOCK (dpool);
+      g_queue_push_tail (&dpool->free_memories, gst_memory_ref (mem));
+      GST_OBJECT_UNLOCK (dpool);
+    }
+  }
+
+  GST_BUFFER_POOL_CLASS (parent_class)->free_buffer (pool, buffer);
+}
+
 static void
 gst_droid_buffer_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
 {
   GstDroidBufferPool *dpool = GST_DROID_BUFFER_POOL (pool);
   DroidMediaBuffer *droid_buffer = NULL;
 
+  if (dpool->lazy_unlock) {
+    guint i;
+
+    for (i = 0; i < gst_buffer_n_memory (buffer); ++i) {
+      gst_droid_media_buffer_memory_release_lock (gst_buffer_peek_memory
+          (buffer, i));
+    }
+  }
+
   if (dpool->use_queue_buffers) {
-    guint index;
+    GstDroidBufferPoolSlot *slot = gst_mini_object_get_qdata
+        (GST_MINI_OBJECT_CAST (buffer), gst_droid_buffer_pool_slot_quark);
 
     g_mutex_lock (&dpool->binding_lock);
 
-    if (g_ptr_array_find (dpool->acquired_buffers, buffer, &index)) {
-      g_ptr_array_remove_index_fast (dpool->acquired_buffers, index);
-
+    if (slot && slot->index != GST_DROID_BUFFER_POOL_SLOT_UNBOUND) {
       droid_buffer =
           gst_droid_media_buffer_memory_get_buffer_from_gst_buffer (buffer);
 
-      if (droid_media_buffer_get_user_data (droid_buffer) == buffer) {
-        g_ptr_array_add (dpool->bound_buffers, buffer);
+      if (slot->acquired && droid_buffer
+          && droid_media_buffer_get_user_data (droid_buffer) == buffer) {
+        slot->acquired = FALSE;
       } else {
+        /* The binding is gone. The buffer goes back to the free list */
+        gst_droid_buffer_pool_unbind_slot (dpool, slot);
         droid_buffer = NULL;
       }
     }
@@ -153,7 +320,8 @@ gst_droid_buffer_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
   if (droid_buffer) {
     buffer->pool = gst_object_ref (pool);
 
-    droid_media_buffer_release (droid_buffer, dpool->display, NULL);
+    GST_DROID_HAL_TRACE (pool, "droid_media_buffer_release",
+        droid_media_buffer_release (droid_buffer, dpool->display, NULL));
   } else {
     if (dpool->use_queue_buffers) {
       gst_buffer_remove_all_memory (buffer);
@@ -181,6 +349,7 @@ gst_droid_buffer_pool_bind_media_buffer (GstBufferPool * pool,
   GstDroidBufferPool *dpool;
   GstBuffer *gst_buffer;
   GstMemory *mem;
+  GstDroidBufferPoolSlot *slot;
 
   if (!GST_IS_DROID_BUFFER_POOL (pool)) {
     return FALSE;
@@ -204,39 +373,36 @@ gst_droid_buffer_pool_bind_media_buffer (GstBufferPool * pool,
 
   gst_buffer_insert_memory (gst_buffer, 0, mem);
 
+  slot = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (gst_buffer),
+      gst_droid_buffer_pool_slot_quark);
+  if (!slot) {
+    slot = g_slice_new0 (GstDroidBufferPoolSlot);
+    slot->buffer = gst_buffer;
+    gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (gst_buffer),
+        gst_droid_buffer_pool_slot_quark, slot,
+        gst_droid_buffer_pool_slot_free);
+  }
+
   g_mutex_lock (&dpool->binding_lock);
 
   droid_media_buffer_set_user_data (buffer, gst_buffer);
 
-  g_ptr_array_add (dpool->bound_buffers, gst_buffer);
+  slot->pool = dpool;
+  slot->index = dpool->slots->len;
+  slot->acquired = FALSE;
+  g_ptr_array_add (dpool->slots, slot);
 
   g_mutex_unlock (&dpool->binding_lock);
 
   return TRUE;
 }
 
-static void
-gst_droid_buffer_pool_clear_buffers_user_data (GPtrArray * buffers)
-{
-  guint i;
-
-  for (i = 0; i < buffers->len; ++i) {
-    DroidMediaBuffer *buffer =
-        gst_droid_media_buffer_memory_get_buffer_from_gst_buffer ((GstBuffer *)
-        g_ptr_array_index (buffers, i));
-
-    if (buffer) {
-      droid_media_buffer_set_user_data (buffer, NULL);
-    }
-  }
-}
-
 GstBuffer *
 gst_droid_buffer_pool_acquire_media_buffer (GstBufferPool * pool,
     DroidMediaBuffer * buffer)
 {
-  guint index;
   GstBuffer *gst_buffer = NULL;
+  GstDroidBufferPoolSlot *slot = NULL;
   GstDroidBufferPool *dpool = GST_DROID_BUFFER_POOL (pool);
 
   if (!dpool) {
@@ -246,8 +412,12 @@ gst_droid_buffer_pool_acquire_media_buffer (GstBufferPool * pool,
   g_mutex_lock (&dpool->binding_lock);
 
   gst_buffer = (GstBuffer *) droid_media_buffer_get_user_data (buffer);
+  if (gst_buffer) {
+    slot = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (gst_buffer),
+        gst_droid_buffer_pool_slot_quark);
+  }
 
-  if (!gst_buffer || gst_buffer->pool != pool) {
+  if (!slot || slot->pool != dpool) {
     droid_media_buffer_set_user_data (buffer, NULL);
 
     g_mutex_unlock (&dpool->binding_lock);
@@ -263,12 +433,12 @@ gst_droid_buffer_pool_acquire_media_buffer (GstBufferPool * pool,
     g_mutex_lock (&dpool->binding_lock);
 
     gst_buffer = (GstBuffer *) droid_media_buffer_get_user_data (buffer);
+    slot = gst_buffer ? gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST
+        (gst_buffer), gst_droid_buffer_pool_slot_quark) : NULL;
   }
 
-  if (gst_buffer && g_ptr_array_find (dpool->bound_buffers, gst_buffer, &index)) {
-    g_ptr_array_remove_index_fast (dpool->bound_buffers, index);
-
-    g_ptr_array_add (dpool->acquired_buffers, gst_buffer);
+  if (slot && slot->index != GST_DROID_BUFFER_POOL_SLOT_UNBOUND) {
+    slot->acquired = TRUE;
   }
 
   g_mutex_unlock (&dpool->binding_lock);
@@ -279,7 +449,7 @@ gst_droid_buffer_pool_acquire_media_buffer (GstBufferPool * pool,
 void
 gst_droid_buffer_pool_media_buffers_invalidated (GstBufferPool * pool)
 {
-  GPtrArray *buffers_to_release = NULL;
+  GPtrArray *buffers_to_release;
   guint i;
   GstDroidBufferPool *dpool;
 
@@ -290,32 +460,131 @@ gst_droid_buffer_pool_media_buffers_invalidated (GstBufferPool * pool)
 
   dpool = GST_DROID_BUFFER_POOL (pool);
 
+  buffers_to_release = g_ptr_array_new ();
+
   g_mutex_lock (&dpool->binding_lock);
 
-  gst_droid_buffer_pool_clear_buffers_user_data (dpool->bound_buffers);
-  gst_droid_buffer_pool_clear_buffers_user_data (dpool->acquired_buffers);
+  for (i = 0; i < dpool->slots->len; ++i) {
+    GstDroidBufferPoolSlot *slot = g_ptr_array_index (dpool->slots, i);
+    DroidMediaBuffer *buffer =
+        gst_droid_media_buffer_memory_get_buffer_from_gst_buffer (slot->buffer);
 
-  if (dpool->bound_buffers->len != 0) {
-    buffers_to_release = dpool->bound_buffers;
+    if (buffer) {
+      droid_media_buffer_set_user_data (buffer, NULL);
+    }
 
-    dpool->bound_buffers = g_ptr_array_new ();
+    /* Acquired buffers are owned downstream and go back to the free list
+     * when they are released */
+    if (!slot->acquired) {
+      g_ptr_array_add (buffers_to_release, slot->buffer);
+    }
+
+    slot->index = GST_DROID_BUFFER_POOL_SLOT_UNBOUND;
+    slot->acquired = FALSE;
   }
 
-  g_ptr_array_set_size (dpool->acquired_buffers, 0);
+  g_ptr_array_set_size (dpool->slots, 0);
 
   g_mutex_unlock (&dpool->binding_lock);
 
-  if (buffers_to_release) {
-    for (i = 0; i < buffers_to_release->len; ++i) {
-      gst_buffer_unref ((GstBuffer *) g_ptr_array_index (buffers_to_release,
-              i));
-    }
-    g_ptr_array_free (buffers_to_release, TRUE);
+  for (i = 0; i < buffers_to_release->len; ++i) {
+    gst_buffer_unref ((GstBuffer *) g_ptr_array_index (buffers_to_release, i));
   }
+  g_ptr_array_free (buffers_to_release, TRUE);
 
   g_signal_emit (pool, gst_droid_buffer_pool_signals[BUFFERS_INVALIDATED], 0);
 }
 
+/* Graphics memory held by the pool's allocator */
+GstStructure *
+gst_droid_buffer_pool_get_stats (GstBufferPool * pool)
+{
+  GstDroidBufferPool *dpool;
+  GstStructure *stats = NULL;
+
+  g_return_val_if_fail (GST_IS_DROID_BUFFER_POOL (pool), NULL);
+
+  dpool = GST_DROID_BUFFER_POOL (pool);
+
+  GST_OBJECT_LOCK (dpool);
+  if (dpool->allocator) {
+    stats = gst_droid_media_buffer_allocator_get_stats (dpool->allocator);
+    gst_structure_set (stats, "free-buffers", G_TYPE_UINT,
+        g_queue_get_length (&dpool->free_memories), NULL);
+  }
+  GST_OBJECT_UNLOCK (dpool);
+
+  return stats;
+}
+
+/* The allocator graphic buffers of this pool come from */
+GstAllocator *
+gst_droid_buffer_pool_get_allocator (GstBufferPool * pool)
+{
+  g_return_val_if_fail (GST_IS_DROID_BUFFER_POOL (pool), NULL);
+
+  return gst_object_ref (GST_DROID_BUFFER_POOL (pool)->allocator);
+}
+
+/*
+ * Sets config on any pool. A pool may refuse the config but offer a
+ * modified one, e.g. with max buffers cut down to the graphics memory
+ * budget. That one is accepted as long as it still satisfies what we asked
+ * for. Takes ownership of config.
+ */
+gboolean
+gst_droid_buffer_pool_apply_config (GstBufferPool * pool,
+    GstStructure * config)
+{
+  GstCaps *caps = NULL;
+  guint size, min, max;
+
+  g_return_val_if_fail (GST_IS_BUFFER_POOL (pool), FALSE);
+
+  if (!gst_buffer_pool_config_get_params (config, &caps, &size, &min, &max)) {
+    gst_structure_free (config);
+    return FALSE;
+  }
+
+  if (caps) {
+    gst_caps_ref (caps);
+  }
+
+  if (gst_buffer_pool_set_config (pool, config)) {
+    goto done;
+  }
+
+  config = gst_buffer_pool_get_config (pool);
+  if (!gst_buffer_pool_config_validate_params (config, caps, size, min, max)) {
+    GST_WARNING_OBJECT (pool, "modified pool config is not usable");
+    gst_structure_free (config);
+    goto fail;
+  }
+
+  if (gst_buffer_pool_config_get_params (config, NULL, NULL, NULL, &max)) {
+    GST_INFO_OBJECT (pool, "accepting modified pool config, max buffers %u",
+        max);
+  }
+
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    goto fail;
+  }
+
+done:
+  if (caps) {
+    gst_caps_unref (caps);
+  }
+
+  return TRUE;
+
+fail:
+  if (caps) {
+    gst_caps_unref (caps);
+  }
+
+  return FALSE;
+}
+
 static void
 gst_droid_buffer_pool_finalize (GObject * object)
 {
@@ -325,8 +594,9 @@ gst_droid_buffer_pool_finalize (GObject * object)
     pool->allocator = 0;
   }
 
-  g_ptr_array_free (pool->bound_buffers, TRUE);
-  g_ptr_array_free (pool->acquired_buffers, TRUE);
+  g_ptr_array_free (pool->slots, TRUE);
+
+  g_queue_clear_full (&pool->free_memories, (GDestroyNotify) gst_memory_unref);
 
   g_mutex_clear (&pool->binding_lock);
 
@@ -342,9 +612,13 @@ gst_droid_buffer_pool_class_init (GstDroidBufferPoolClass * klass G_GNUC_UNUSED)
   gobject_class->finalize = gst_droid_buffer_pool_finalize;
   gstbufferpool_class->alloc_buffer = gst_droid_buffer_pool_alloc;
   gstbufferpool_class->release_buffer = gst_droid_buffer_release_buffer;
+  gstbufferpool_class->free_buffer = gst_droid_buffer_pool_free_buffer;
   gstbufferpool_class->get_options = gst_droid_buffer_pool_get_options;
   gstbufferpool_class->set_config = gst_droid_buffer_pool_set_config;
 
+  gst_droid_buffer_pool_slot_quark =
+      g_quark_from_static_string ("GstDroidBufferPoolSlot");
+
   gst_droid_buffer_pool_signals[BUFFERS_INVALIDATED] =
       g_signal_new ("buffers-invalidated",
       G_TYPE_FROM_CLASS (gstbufferpool_class), G_SIGNAL_RUN_LAST,
@@ -356,13 +630,18 @@ static void
 gst_droid_buffer_pool_init (GstDroidBufferPool * object)
 {
   GstDroidBufferPool *pool = GST_DROID_BUFFER_POOL (object);
-  pool->allocator = 0;
+
+  /* The allocator is kept across configurations. Free list memories use it */
+  pool->allocator =
+      gst_object_ref_sink (gst_droid_media_buffer_allocator_new ());
 
   g_mutex_init (&pool->binding_lock);
 
-  pool->bound_buffers = g_ptr_array_new ();
-  pool->acquired_buffers = g_ptr_array_new ();
+  pool->slots = g_ptr_array_new ();
+  g_queue_init (&pool->free_memories);
+  gst_video_info_init (&pool->video_info);
   pool->use_queue_buffers = FALSE;
+  pool->lazy_unlock = FALSE;
   pool->display = NULL;
 }
 
@@ -33,6 +33,10 @@ typedef struct _GstDroidBufferPoolClass GstDroidBufferPoolClass;
 
 typedef void *EGLDisplay;
 
+/* Keep graphic buffers locked between maps until they return to the pool */
+#define GST_BUFFER_POOL_OPTION_DROID_MEDIA_BUFFER_LAZY_UNLOCK \
+    "GstBufferPoolOptionDroidMediaBufferLazyUnlock"
+
 #define GST_TYPE_DROID_BUFFER_POOL      (gst_droid_buffer_pool_get_type())
 #define GST_IS_DROID_BUFFER_POOL(obj)   (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_DROID_BUFFER_POOL))
 #define GST_DROID_BUFFER_POOL(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_DROID_BUFFER_POOL, GstDroidBufferPool))
@@ -43,11 +47,13 @@ struct _GstDroidBufferPool
   GstBufferPool parent;
   GstAllocator *allocator;
   GstVideoInfo video_info;
-  GPtrArray *bound_buffers;
-  GPtrArray *acquired_buffers;
+  GPtrArray *slots;
+  /* graphic buffers of freed buffers. protected by the object lock */
+  GQueue free_memories;
   GMutex binding_lock;
   EGLDisplay display;
   gboolean use_queue_buffers;
+  gboolean lazy_unlock;
 };
 
 struct _GstDroidBufferPoolClass
@@ -66,6 +72,10 @@ gboolean   gst_droid_buffer_pool_bind_media_buffer (GstBufferPool *pool,
 void       gst_droid_buffer_pool_media_buffers_invalidated (GstBufferPool *pool);
 GstBuffer *gst_droid_buffer_pool_acquire_media_buffer (GstBufferPool *pool,
                                                        DroidMediaBuffer *buffer);
+GstStructure *gst_droid_buffer_pool_get_stats (GstBufferPool *pool);
+GstAllocator *gst_droid_buffer_pool_get_allocator (GstBufferPool *pool);
+gboolean   gst_droid_buffer_pool_apply_config (GstBufferPool *pool,
+                                               GstStructure *config);
 
 G_END_DECLS
 
@@ -24,8 +24,13 @@
 #endif
 
 #include "gstdroidcodec.h"
+#include "gstdroidhaltrace.h"
+#include "gstdroidmediabuffer.h"
+#include "droidmediaconstants.h"
 #include <glib.h>
+#include <string.h>             /* memset() */
 #include <gst/base/gstbytewriter.h>
+#include <gst/base/gstbitreader.h>
 #ifndef GST_USE_UNSTABLE_API
 #define GST_USE_UNSTABLE_API
 #endif /* GST_USE_UNSTABLE_API */
@@ -34,8 +39,10 @@
 GST_DEBUG_CATEGORY (gst_droid_codec_debug);
 #define GST_CAT_DEFAULT gst_droid_codec_debug
 
-static GstBuffer *create_mpeg4venc_codec_data (DroidMediaData * data);
-static GstBuffer *create_h264enc_codec_data (DroidMediaData * data);
+static GstBuffer *create_mpeg4venc_codec_data (GstDroidCodec * codec,
+    DroidMediaData * data);
+static GstBuffer *create_h264enc_codec_data (GstDroidCodec * codec,
+    DroidMediaData * data);
 static gboolean create_mpeg4vdec_codec_data_from_codec_data (GstDroidCodec *
     codec, GstBuffer * data, DroidMediaData * out);
 static gboolean
@@ -45,6 +52,10 @@ static gboolean create_h264dec_codec_data_from_codec_data (GstDroidCodec *
     codec, GstBuffer * data, DroidMediaData * out);
 static gboolean create_h265dec_codec_data_from_codec_data (GstDroidCodec *
     codec, GstBuffer * data, DroidMediaData * out);
+static gboolean create_av1dec_codec_data_from_codec_data (GstDroidCodec * codec,
+    GstBuffer * data, DroidMediaData * out);
+static gboolean create_av1dec_codec_data_from_frame_data (GstDroidCodec * codec,
+    GstBuffer * frame_data, DroidMediaData * out);
 static gboolean create_aacdec_codec_data_from_codec_data (GstDroidCodec * codec,
     GstBuffer * data, DroidMediaData * out);
 static gboolean create_aacdec_codec_data_from_frame_data (GstDroidCodec * codec,
@@ -55,14 +66,18 @@ static gboolean process_h26xdec_data (GstDroidCodec * codec, GstBuffer * buffer,
     DroidMediaData * out);
 static gboolean process_aacdec_data (GstDroidCodec * codec, GstBuffer * buffer,
     DroidMediaData * out);
+static gboolean process_av1dec_data (GstDroidCodec * codec, GstBuffer * buffer,
+    DroidMediaData * out);
 static gboolean is_mpeg4v (GstDroidCodec * codec, const GstStructure * s);
 static gboolean is_mpega (GstDroidCodec * codec, const GstStructure * s);
 static gboolean is_h264_dec (GstDroidCodec * codec, const GstStructure * s);
 static gboolean is_h264_enc (GstDroidCodec * codec, const GstStructure * s);
-static void h264enc_complement (GstCaps * caps);
-static gboolean process_h264enc_data (DroidMediaData * in,
-    DroidMediaData * out);
+static gboolean is_av1_dec (GstDroidCodec * codec, const GstStructure * s);
+static void h264enc_complement (GstDroidCodec * codec, GstCaps * caps);
+static gboolean process_h264enc_data (GstDroidCodec * codec,
+    DroidMediaCodecData * in, guint8 * out, gsize * out_size);
 static void gst_droid_codec_release_input_frame (void *data);
+static void gst_droid_codec_release_encoder_frame (void *data);
 static void gst_droid_codec_free (GstDroidCodec * codec);
 static void gst_droid_codec_type_fill_quirks (GstDroidCodec * codec);
 
@@ -73,10 +88,86 @@ typedef struct
   gpointer data;
 } GstDroidCodecFrameReleaseData;
 
+/* Layout of VideoNativeMetadata from Android media/hardware/HardwareAPI.h */
+typedef struct
+{
+  guint32 type;
+  gpointer buffer;
+  gint fence_fd;
+} GstDroidCodecNativeMetaData;
+
+/* From Android media/hardware/MetadataBufferType.h */
+#define kMetadataBufferTypeANWBuffer           2
+
+typedef struct
+{
+  GstMapInfo info;
+  gboolean mapped;
+  GstBuffer *buffer;
+  GstVideoCodecFrame *frame;
+  GstDroidCodecNativeMetaData meta_data;
+} GstDroidCodecEncoderReleaseData;
+
 struct _GstDroidCodecPrivate
 {
   guint h264_nal;
   gboolean aac_adts;
+  gint profile;
+  gint level;
+
+  /* H264 byte-stream output */
+  gboolean h264_byte_stream;
+  GstBuffer *headers;
+  gboolean headers_sent;
+  gboolean repeat_headers;
+
+  /* encoded data */
+  GstBufferPool *pool;
+  gsize pool_buffer_size;
+};
+
+/* Extra room we need when processing encoded data */
+#define GST_DROID_CODEC_ENCODED_DATA_PADDING   4
+
+/* Key frames can be several times bigger than the average frame */
+#define GST_DROID_CODEC_ENCODED_FRAME_FACTOR   4
+#define GST_DROID_CODEC_ENCODED_MIN_SIZE       (16 * 1024)
+#define GST_DROID_CODEC_ENCODED_NUM_BUFFERS    4
+
+typedef struct
+{
+  const gchar *name;
+  gint value;
+} GstDroidCodecNameMap;
+
+/* Android MediaCodecInfo.CodecProfileLevel values */
+static const GstDroidCodecNameMap h264_profiles[] = {
+  {"constrained-baseline", 0x10000},
+  {"baseline", 0x01},
+  {"main", 0x02},
+  {"extended", 0x04},
+  {"high", 0x08},
+  {"constrained-high", 0x80000},
+};
+
+static const GstDroidCodecNameMap h264_levels[] = {
+  {"1", 0x01},
+  {"1b", 0x02},
+  {"1.1", 0x04},
+  {"1.2", 0x08},
+  {"1.3", 0x10},
+  {"2", 0x20},
+  {"2.1", 0x40},
+  {"2.2", 0x80},
+  {"3", 0x100},
+  {"3.1", 0x200},
+  {"3.2", 0x400},
+  {"4", 0x800},
+  {"4.1", 0x1000},
+  {"4.2", 0x2000},
+  {"5", 0x4000},
+  {"5.1", 0x8000},
+  {"5.2", 0x10000},
 };
 
 struct _GstDroidCodecInfo
@@ -89,10 +180,13 @@ struct _GstDroidCodecInfo
 
     gboolean (*validate_structure) (GstDroidCodec * codec,
       const GstStructure * s);
-  void (*complement_caps) (GstCaps * caps);
-  GstBuffer *(*create_encoder_codec_data) (DroidMediaData * data);
-    gboolean (*process_encoder_data) (DroidMediaData * in,
-      DroidMediaData * out);
+  void (*complement_caps) (GstDroidCodec * codec, GstCaps * caps);
+  GstBuffer *(*create_encoder_codec_data) (GstDroidCodec * codec,
+      DroidMediaData * data);
+  /* out can hold the data, the in band headers and
+   * GST_DROID_CODEC_ENCODED_DATA_PADDING bytes */
+    gboolean (*process_encoder_data) (GstDroidCodec * codec,
+      DroidMediaCodecData * in, guint8 * out, gsize * out_size);
     gboolean (*create_decoder_codec_data_from_codec_data) (GstDroidCodec *
       codec, GstBuffer * codec_data, DroidMediaData * out);
     gboolean (*create_decoder_codec_data_from_frame_data) (GstDroidCodec *
@@ -142,8 +236,12 @@ static GstDroidCodecInfo codecs[] = {
   {GST_DROID_CODEC_DECODER_VIDEO, "video/x-vp9", "video/x-vnd.on2.vp9",
       "video/x-vp9", TRUE, NULL, NULL, NULL, NULL, NULL, NULL, NULL},
 
+  /* enabled by default, the hardware probe decides whether it is usable */
   {GST_DROID_CODEC_DECODER_VIDEO, "video/x-av1", "video/av01",
-      "video/x-av1", FALSE, NULL, NULL, NULL, NULL, NULL, NULL, NULL},
+        "video/x-av1, stream-format=obu-stream,alignment=tu", TRUE,
+        is_av1_dec, NULL, NULL, NULL,
+        create_av1dec_codec_data_from_codec_data,
+      create_av1dec_codec_data_from_frame_data, process_av1dec_data},
 
   {GST_DROID_CODEC_DECODER_VIDEO, "video/mpeg", "video/mpeg2",
         "video/mpeg, mpegversion=2", TRUE,
@@ -166,8 +264,8 @@ static GstDroidCodecInfo codecs[] = {
       is_mpeg4v, NULL, create_mpeg4venc_codec_data, NULL, NULL, NULL, NULL},
 
   {GST_DROID_CODEC_ENCODER_VIDEO, "video/x-h264", "video/avc",
-        "video/x-h264, stream-format=avc,alignment=au", TRUE,
-        is_h264_enc, h264enc_complement, create_h264enc_codec_data,
+        "video/x-h264, stream-format=(string){avc, byte-stream},alignment=au",
+        TRUE, is_h264_enc, h264enc_complement, create_h264enc_codec_data,
       process_h264enc_data, NULL, NULL, NULL},
 };
 
@@ -278,6 +376,13 @@ gst_droid_codec_get_droid_type (GstDroidCodec * codec)
 void
 gst_droid_codec_free (GstDroidCodec * codec)
 {
+  if (codec->data->pool) {
+    gst_buffer_pool_set_active (codec->data->pool, FALSE);
+    gst_object_unref (codec->data->pool);
+  }
+
+  gst_buffer_replace (&codec->data->headers, NULL);
+
   g_slice_free (GstDroidCodecPrivate, codec->data);
   g_slice_free (GstDroidCodec, codec);
 }
@@ -286,14 +391,26 @@ void
 gst_droid_codec_complement_caps (GstDroidCodec * codec, GstCaps * caps)
 {
   if (codec->info->complement_caps)
-    codec->info->complement_caps (caps);
+    codec->info->complement_caps (codec, caps);
 }
 
 GstBuffer *
 gst_droid_codec_create_encoder_codec_data (GstDroidCodec * codec,
     DroidMediaData * data)
 {
-  return codec->info->create_encoder_codec_data (data);
+  return codec->info->create_encoder_codec_data (codec, data);
+}
+
+gboolean
+gst_droid_codec_uses_in_band_headers (GstDroidCodec * codec)
+{
+  return codec->data->h264_byte_stream;
+}
+
+void
+gst_droid_codec_set_repeat_headers (GstDroidCodec * codec, gboolean repeat)
+{
+  codec->data->repeat_headers = repeat;
 }
 
 GstDroidCodecCodecDataResult
@@ -357,24 +474,380 @@ gst_droid_codec_prepare_decoder_frame (GstDroidCodec * codec,
   return TRUE;
 }
 
+/*
+ * Takes ownership of buffer and keeps it (and frame if given) alive until the
+ * encoder is done with it. With a media buffer the encoder reads the graphic
+ * buffer in meta data mode, otherwise it gets the mapped data of buffer.
+ */
+gboolean
+gst_droid_codec_prepare_encoder_frame (GstBuffer * buffer,
+    DroidMediaBuffer * media_buffer, GstVideoCodecFrame * frame,
+    DroidMediaCodecData * data, DroidMediaBufferCallbacks * cb)
+{
+  GstDroidCodecEncoderReleaseData *release_data;
+
+  release_data = g_slice_new0 (GstDroidCodecEncoderReleaseData);
+  release_data->buffer = buffer;
+
+  if (media_buffer) {
+    release_data->meta_data.type = kMetadataBufferTypeANWBuffer;
+    release_data->meta_data.buffer = media_buffer;
+    release_data->meta_data.fence_fd = -1;
+    data->data.size = sizeof (release_data->meta_data);
+    data->data.data = &release_data->meta_data;
+  } else {
+    if (!gst_buffer_map (buffer, &release_data->info, GST_MAP_READ)) {
+      GST_ERROR ("failed to map encoder input");
+      gst_buffer_unref (buffer);
+      g_slice_free (GstDroidCodecEncoderReleaseData, release_data);
+      return FALSE;
+    }
+
+    release_data->mapped = TRUE;
+    data->data.size = release_data->info.size;
+    data->data.data = release_data->info.data;
+  }
+
+  if (frame) {
+    release_data->frame = gst_video_codec_frame_ref (frame);
+  }
+
+  cb->unref = gst_droid_codec_release_encoder_frame;
+  cb->data = release_data;
+
+  return TRUE;
+}
+
+/* Applies a bitrate set on object while encoding. Takes the object lock */
+void
+gst_droid_codec_update_encoder_bitrate (GstObject * object,
+    DroidMediaCodec * codec, gint32 * bitrate, gboolean * changed)
+{
+  gint32 value;
+
+  GST_OBJECT_LOCK (object);
+  if (G_LIKELY (!*changed)) {
+    GST_OBJECT_UNLOCK (object);
+    return;
+  }
+
+  value = *bitrate;
+  *changed = FALSE;
+  GST_OBJECT_UNLOCK (object);
+
+  GST_INFO_OBJECT (object, "changing bitrate to %d", value);
+
+#ifdef HAVE_DROID_MEDIA_CODEC_SET_VIDEO_ENCODER_BITRATE
+  GST_DROID_HAL_TRACE (object, "droid_media_codec_set_video_encoder_bitrate",
+      droid_media_codec_set_video_encoder_bitrate (codec, value));
+#else
+  GST_WARNING_OBJECT (object,
+      "droidmedia cannot change bitrate while encoding. Bitrate will be applied on next start");
+#endif
+}
+
+void
+gst_droid_codec_request_sync_frame (GstObject * object,
+    DroidMediaCodec * codec)
+{
+  GST_DEBUG_OBJECT (object, "requesting sync frame");
+
+#ifdef HAVE_DROID_MEDIA_CODEC_REQUEST_SYNC_FRAME
+  GST_DROID_HAL_TRACE (object, "droid_media_codec_request_sync_frame",
+      droid_media_codec_request_sync_frame (codec));
+#else
+  GST_WARNING_OBJECT (object,
+      "droidmedia does not support requesting sync frames");
+#endif
+}
+
+/*
+ * Returns TRUE if the next input frame should be a sync frame, either
+ * because it is forced or because key_int_max frames went by without one
+ */
+gboolean
+gst_droid_codec_check_sync_frame (GstObject * object, gboolean force,
+    guint key_int_max, guint * frames_since_sync)
+{
+  if (force) {
+    GST_INFO_OBJECT (object, "key frame forced");
+  } else if (key_int_max > 0 && *frames_since_sync >= key_int_max) {
+    GST_DEBUG_OBJECT (object, "key-int-max reached");
+  } else {
+    (*frames_since_sync)++;
+    return FALSE;
+  }
+
+  *frames_since_sync = 1;
+
+  return TRUE;
+}
+
+void
+gst_droid_codec_staging_init (GstDroidCodecStaging * staging)
+{
+  gst_video_info_init (&staging->info);
+  staging->pool = NULL;
+  staging->converter = NULL;
+}
+
+/*
+ * Staged frames are tightly packed NV12 which every encoder we know of
+ * accepts. Odd sizes are rounded up so the last chroma column and row are kept.
+ */
+gboolean
+gst_droid_codec_staging_start (GstDroidCodecStaging * staging, gint width,
+    gint height, guint buffers)
+{
+  GstStructure *config;
+
+  gst_droid_codec_staging_stop (staging);
+
+  gst_video_info_set_format (&staging->info, GST_VIDEO_FORMAT_NV12, width,
+      height);
+
+  staging->pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (staging->pool);
+  gst_buffer_pool_config_set_params (config, NULL,
+      GST_VIDEO_INFO_SIZE (&staging->info), buffers, 0);
+
+  if (!gst_buffer_pool_set_config (staging->pool, config)
+      || !gst_buffer_pool_set_active (staging->pool, TRUE)) {
+    GST_ERROR ("failed to configure staging buffer pool");
+    gst_object_unref (staging->pool);
+    staging->pool = NULL;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void
+gst_droid_codec_staging_fill_settings (GstDroidCodecStaging * staging,
+    DroidMediaCodecEncoderMetaData * md)
+{
+  DroidMediaColourFormatConstants constants;
+
+  droid_media_colour_format_constants_init (&constants);
+
+  md->meta_data = false;
+  md->color_format = constants.OMX_COLOR_FormatYUV420SemiPlanar;
+  md->stride = GST_VIDEO_INFO_PLANE_STRIDE (&staging->info, 0);
+  md->slice_height = GST_VIDEO_INFO_PLANE_OFFSET (&staging->info, 1) /
+      md->stride;
+}
+
+/*
+ * Converts a frame into a staging buffer, scaling it if the sizes differ.
+ * The converter picks the orc kernels for the copies and the chroma
+ * (de)interleaving. It is kept until the input layout changes.
+ */
+GstBuffer *
+gst_droid_codec_staging_convert (GstDroidCodecStaging * staging,
+    GstVideoFrame * in)
+{
+  GstBuffer *buffer = NULL;
+  GstVideoFrame out;
+
+  if (staging->converter && !gst_video_info_is_equal (&in->info,
+          &staging->converter_info)) {
+    gst_video_converter_free (staging->converter);
+    staging->converter = NULL;
+  }
+
+  if (!staging->converter) {
+    staging->converter =
+        gst_video_converter_new (&in->info, &staging->info, NULL);
+    if (!staging->converter) {
+      GST_ERROR ("cannot stage frames in format %s",
+          gst_video_format_to_string (GST_VIDEO_FRAME_FORMAT (in)));
+      return NULL;
+    }
+
+    staging->converter_info = in->info;
+  }
+
+  if (gst_buffer_pool_acquire_buffer (staging->pool, &buffer,
+          NULL) != GST_FLOW_OK) {
+    GST_ERROR ("failed to acquire staging buffer");
+    return NULL;
+  }
+
+  if (!gst_video_frame_map (&out, &staging->info, buffer, GST_MAP_WRITE)) {
+    GST_ERROR ("failed to map staging buffer");
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+
+  gst_video_converter_frame (staging->converter, in, &out);
+
+  gst_video_frame_unmap (&out);
+
+  return buffer;
+}
+
+/*
+ * The graphic buffer layout comes from the media buffer. The size of the
+ * memory wrapping a queue buffer says nothing about it so the planes are
+ * located from the base address of the lock instead of mapping a frame.
+ */
+GstBuffer *
+gst_droid_codec_staging_convert_media_buffer (GstDroidCodecStaging * staging,
+    GstBuffer * input)
+{
+  GstVideoInfo *info =
+      gst_droid_media_buffer_get_video_info_from_gst_buffer (input);
+  GstMemory *mem = NULL;
+  GstVideoFrame vframe;
+  GstMapInfo map;
+  GstBuffer *buffer;
+  guint i;
+
+  for (i = 0; i < gst_buffer_n_memory (input); i++) {
+    if (gst_is_droid_media_buffer_memory (gst_buffer_peek_memory (input, i))) {
+      mem = gst_buffer_peek_memory (input, i);
+      break;
+    }
+  }
+
+  if (!mem || !info
+      || GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_ENCODED
+      || GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_UNKNOWN) {
+    GST_ERROR ("can't stage media buffer of unknown layout");
+    return NULL;
+  }
+
+  if (!gst_memory_map (mem, &map, GST_MAP_READ)) {
+    GST_ERROR ("failed to lock media buffer");
+    return NULL;
+  }
+
+  memset (&vframe, 0x0, sizeof (vframe));
+  vframe.info = *info;
+  vframe.buffer = input;
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++) {
+    vframe.data[i] = map.data + GST_VIDEO_INFO_PLANE_OFFSET (info, i);
+  }
+
+  buffer = gst_droid_codec_staging_convert (staging, &vframe);
+
+  gst_memory_unmap (mem, &map);
+
+  return buffer;
+}
+
+void
+gst_droid_codec_staging_stop (GstDroidCodecStaging * staging)
+{
+  if (staging->converter) {
+    gst_video_converter_free (staging->converter);
+    staging->converter = NULL;
+  }
+
+  if (staging->pool) {
+    gst_buffer_pool_set_active (staging->pool, FALSE);
+    gst_object_unref (staging->pool);
+    staging->pool = NULL;
+  }
+}
+
+void
+gst_droid_codec_configure_encoded_pool (GstDroidCodec * codec, gint bitrate,
+    gint frames_n, gint frames_d)
+{
+  GstStructure *config;
+  gsize size = GST_DROID_CODEC_ENCODED_MIN_SIZE;
+
+  if (frames_n > 0 && frames_d > 0 && bitrate > 0) {
+    size = MAX (size, gst_util_uint64_scale (bitrate / 8,
+            frames_d * GST_DROID_CODEC_ENCODED_FRAME_FACTOR, frames_n));
+  }
+
+  size += GST_DROID_CODEC_ENCODED_DATA_PADDING;
+
+  if (codec->data->pool && codec->data->pool_buffer_size == size) {
+    return;
+  }
+
+  if (codec->data->pool) {
+    gst_buffer_pool_set_active (codec->data->pool, FALSE);
+    gst_object_unref (codec->data->pool);
+  }
+
+  GST_INFO ("encoded buffer size %" G_GSIZE_FORMAT " for bitrate %d at %d/%d",
+      size, bitrate, frames_n, frames_d);
+
+  codec->data->pool = gst_buffer_pool_new ();
+  codec->data->pool_buffer_size = size;
+
+  /* No upper limit. We must never block the codec thread */
+  config = gst_buffer_pool_get_config (codec->data->pool);
+  gst_buffer_pool_config_set_params (config, NULL, size,
+      GST_DROID_CODEC_ENCODED_NUM_BUFFERS, 0);
+
+  if (!gst_buffer_pool_set_config (codec->data->pool, config)
+      || !gst_buffer_pool_set_active (codec->data->pool, TRUE)) {
+    GST_WARNING ("failed to configure encoded buffer pool");
+    gst_object_unref (codec->data->pool);
+    codec->data->pool = NULL;
+    codec->data->pool_buffer_size = 0;
+  }
+}
+
+static GstBuffer *
+gst_droid_codec_acquire_encoded_buffer (GstDroidCodec * codec, gsize size)
+{
+  GstBuffer *buffer = NULL;
+
+  if (codec->data->pool && size <= codec->data->pool_buffer_size) {
+    if (gst_buffer_pool_acquire_buffer (codec->data->pool, &buffer,
+            NULL) == GST_FLOW_OK) {
+      return buffer;
+    }
+
+    GST_WARNING ("failed to acquire encoded buffer from pool");
+  } else if (codec->data->pool) {
+    GST_DEBUG ("encoded data of size %" G_GSIZE_FORMAT " does not fit the pool",
+        size);
+  }
+
+  return gst_buffer_new_allocate (NULL, size, NULL);
+}
+
 GstBuffer *
 gst_droid_codec_prepare_encoded_data (GstDroidCodec * codec,
-    DroidMediaData * in)
+    DroidMediaCodecData * in)
 {
   GstBuffer *buffer;
+  GstMapInfo info;
+  gsize size = in->data.size + GST_DROID_CODEC_ENCODED_DATA_PADDING;
+
+  if (codec->data->headers) {
+    size += gst_buffer_get_size (codec->data->headers);
+  }
+
+  buffer = gst_droid_codec_acquire_encoded_buffer (codec, size);
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_WRITE)) {
+    GST_ERROR ("failed to map buffer");
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
 
   if (codec->info->process_encoder_data) {
-    DroidMediaData out;
-    if (!codec->info->process_encoder_data (in, &out)) {
-      buffer = NULL;
-    } else {
-      buffer = gst_buffer_new_wrapped (out.data, out.size);
+    if (!codec->info->process_encoder_data (codec, in, info.data, &size)) {
+      gst_buffer_unmap (buffer, &info);
+      gst_buffer_unref (buffer);
+      return NULL;
     }
   } else {
-    buffer = gst_buffer_new_allocate (NULL, in->size, NULL);
-    gst_buffer_fill (buffer, 0, in->data, in->size);
+    memcpy (info.data, in->data.data, in->data.size);
+    size = in->data.size;
   }
 
+  gst_buffer_unmap (buffer, &info);
+  gst_buffer_set_size (buffer, size);
+
   return buffer;
 }
 
@@ -401,6 +874,16 @@ gst_droid_codec_process_decoder_data (GstDroidCodec * codec, GstBuffer * buffer,
   return TRUE;
 }
 
+gboolean
+gst_droid_codec_get_profile_level (GstDroidCodec * codec, gint * profile,
+    gint * level)
+{
+  *profile = codec->data->profile;
+  *level = codec->data->level;
+
+  return *profile != 0 || *level != 0;
+}
+
 gint
 gst_droid_codec_get_samples_per_frane (GstCaps * caps)
 {
@@ -424,13 +907,17 @@ gst_droid_codec_get_samples_per_frane (GstCaps * caps)
     } else if (layer == 3 && mpegaudioversion != -1) {
       return (mpegaudioversion == 1 ? 1152 : 576);
     }
+  } else if (mpegversion == 2 || mpegversion == 4) {
+    /* AAC. The decoder scales this for HE-AAC once it knows the output rate */
+    return 1024;
   }
 
   return -1;
 }
 
 static GstBuffer *
-create_mpeg4venc_codec_data (DroidMediaData * data)
+create_mpeg4venc_codec_data (GstDroidCodec * codec G_GNUC_UNUSED,
+    DroidMediaData * data)
 {
   GstBuffer *codec_data = gst_buffer_new_allocate (NULL, data->size, NULL);
 
@@ -447,7 +934,7 @@ create_mpeg4venc_codec_data (DroidMediaData * data)
 }
 
 static GstBuffer *
-create_h264enc_codec_data (DroidMediaData * data)
+create_h264enc_avcc (DroidMediaData * data)
 {
   GstH264NalParser *parser = gst_h264_nal_parser_new ();
   gsize offset = 0;
@@ -583,6 +1070,24 @@ out:
   return codec_data;
 }
 
+static GstBuffer *
+create_h264enc_codec_data (GstDroidCodec * codec, DroidMediaData * data)
+{
+  if (codec->data->h264_byte_stream) {
+    /* SPS and PPS are sent in band. Keep them around for the key frames */
+    GST_MEMDUMP ("in band headers", data->data, data->size);
+
+    gst_buffer_replace (&codec->data->headers, NULL);
+    codec->data->headers = gst_buffer_new_allocate (NULL, data->size, NULL);
+    gst_buffer_fill (codec->data->headers, 0, data->data, data->size);
+    codec->data->headers_sent = FALSE;
+
+    return NULL;
+  }
+
+  return create_h264enc_avcc (data);
+}
+
 static gboolean
 is_mpeg4v (GstDroidCodec * codec G_GNUC_UNUSED, const GstStructure * s)
 {
@@ -633,28 +1138,74 @@ is_h264_dec (GstDroidCodec * codec G_GNUC_UNUSED, const GstStructure * s)
 }
 
 static gboolean
-is_h264_enc (GstDroidCodec * codec G_GNUC_UNUSED, const GstStructure * s)
+lookup_name (const GstDroidCodecNameMap * map, gsize len, const gchar * name,
+    gint * value)
+{
+  gsize x;
+
+  for (x = 0; x < len; x++) {
+    if (!g_strcmp0 (map[x].name, name)) {
+      *value = map[x].value;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean
+is_h264_enc (GstDroidCodec * codec, const GstStructure * s)
 {
   const char *alignment = gst_structure_get_string (s, "alignment");
   const char *format = gst_structure_get_string (s, "stream-format");
+  const char *profile = gst_structure_get_string (s, "profile");
+  const char *level = gst_structure_get_string (s, "level");
 
   /* We can accept caps without alignment or format and will add them later on */
   if (alignment && g_strcmp0 (alignment, "au")) {
     return FALSE;
   }
 
-  if (format && g_strcmp0 (format, "avc")) {
+  if (format && g_strcmp0 (format, "avc")
+      && g_strcmp0 (format, "byte-stream")) {
+    return FALSE;
+  }
+
+  codec->data->h264_byte_stream = !g_strcmp0 (format, "byte-stream");
+
+  /* profile and level are only honoured if downstream asks for a specific one */
+  if (profile && !lookup_name (h264_profiles, G_N_ELEMENTS (h264_profiles),
+          profile, &codec->data->profile)) {
+    GST_WARNING ("unsupported profile %s", profile);
+    return FALSE;
+  }
+
+  if (level && !lookup_name (h264_levels, G_N_ELEMENTS (h264_levels),
+          level, &codec->data->level)) {
+    GST_WARNING ("unsupported level %s", level);
     return FALSE;
   }
 
   return TRUE;
 }
 
+static gboolean
+is_av1_dec (GstDroidCodec * codec G_GNUC_UNUSED, const GstStructure * s)
+{
+  const char *alignment = gst_structure_get_string (s, "alignment");
+  const char *format = gst_structure_get_string (s, "stream-format");
+
+  /* We need whole temporal units with sized OBUs */
+  return alignment && format && !g_strcmp0 (alignment, "tu")
+      && !g_strcmp0 (format, "obu-stream");
+}
+
 static void
-h264enc_complement (GstCaps * caps)
+h264enc_complement (GstDroidCodec * codec, GstCaps * caps)
 {
   gst_caps_set_simple (caps, "alignment", G_TYPE_STRING, "au",
-      "stream-format", G_TYPE_STRING, "avc", NULL);
+      "stream-format", G_TYPE_STRING,
+      codec->data->h264_byte_stream ? "byte-stream" : "avc", NULL);
 }
 
 static gboolean
@@ -791,6 +1342,301 @@ out:
   return ret;
 }
 
+#define AV1_OBU_SEQUENCE_HEADER   1
+#define AV1_OBU_TEMPORAL_DELIMITER 2
+#define AV1_OBU_PADDING           15
+
+static gboolean
+av1_read_leb128 (GstByteReader * reader, guint * value)
+{
+  guint64 val = 0;
+  int x;
+
+  for (x = 0; x < 8; x++) {
+    guint8 byte;
+
+    if (!gst_byte_reader_get_uint8 (reader, &byte)) {
+      return FALSE;
+    }
+
+    val |= ((guint64) (byte & 0x7f)) << (x * 7);
+
+    if (!(byte & 0x80)) {
+      if (val > G_MAXUINT) {
+        return FALSE;
+      }
+
+      *value = val;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+ * Reads one OBU from reader. obu and obu_size cover the whole OBU including
+ * its header while payload points to the OBU payload.
+ * OBUs without obu_has_size_field extend to the end of the data.
+ */
+static gboolean
+av1_read_obu (GstByteReader * reader, guint8 * type, const guint8 ** obu,
+    guint * obu_size, const guint8 ** payload, guint * payload_size)
+{
+  guint start = gst_byte_reader_get_pos (reader);
+  guint8 header;
+  guint size;
+
+  if (!gst_byte_reader_get_uint8 (reader, &header)) {
+    return FALSE;
+  }
+
+  if (header & 0x80) {
+    GST_ERROR ("forbidden bit set in OBU header");
+    return FALSE;
+  }
+
+  *type = (header >> 3) & 0x0f;
+
+  /* extension header */
+  if ((header & 0x04) && !gst_byte_reader_skip (reader, 1)) {
+    return FALSE;
+  }
+
+  if (header & 0x02) {
+    if (!av1_read_leb128 (reader, &size)) {
+      GST_ERROR ("malformed OBU size");
+      return FALSE;
+    }
+  } else {
+    size = gst_byte_reader_get_remaining (reader);
+  }
+
+  if (!gst_byte_reader_get_data (reader, size, payload)) {
+    GST_ERROR ("truncated OBU");
+    return FALSE;
+  }
+
+  *payload_size = size;
+  *obu_size = gst_byte_reader_get_pos (reader) - start;
+  *obu = *payload - (*obu_size - size);
+
+  return TRUE;
+}
+
+static gboolean
+av1_find_sequence_header (const guint8 * data, gsize size, const guint8 ** obu,
+    guint * obu_size, const guint8 ** payload, guint * payload_size)
+{
+  GstByteReader reader;
+  guint8 type;
+
+  gst_byte_reader_init (&reader, data, size);
+
+  while (gst_byte_reader_get_remaining (&reader) > 0) {
+    if (!av1_read_obu (&reader, &type, obu, obu_size, payload, payload_size)) {
+      return FALSE;
+    }
+
+    if (type == AV1_OBU_SEQUENCE_HEADER) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static void
+av1_skip_uvlc (GstBitReader * reader)
+{
+  guint leading_zeros = 0;
+  guint8 bit = 0;
+
+  while (gst_bit_reader_get_bits_uint8 (reader, &bit, 1) && !bit) {
+    leading_zeros++;
+  }
+
+  if (leading_zeros < 32) {
+    gst_bit_reader_skip (reader, leading_zeros);
+  }
+}
+
+/*
+ * Builds the av1C header from the first operating point of a sequence header.
+ * Only profile, level and tier are filled, the rest of the color config is
+ * left at 8 bit 4:2:0. The decoder takes the real values from the sequence
+ * header OBU we append anyway.
+ */
+static gboolean
+av1_write_config_header (const guint8 * payload, guint payload_size,
+    guint8 * header)
+{
+  GstBitReader reader;
+  guint8 seq_profile = 0, reduced_still_picture_header = 0;
+  guint8 seq_level_idx = 0, seq_tier = 0;
+  guint8 flag = 0;
+
+  gst_bit_reader_init (&reader, payload, payload_size);
+
+  if (!gst_bit_reader_get_bits_uint8 (&reader, &seq_profile, 3)
+      || !gst_bit_reader_skip (&reader, 1)      /* still_picture */
+      || !gst_bit_reader_get_bits_uint8 (&reader,
+          &reduced_still_picture_header, 1)) {
+    return FALSE;
+  }
+
+  if (reduced_still_picture_header) {
+    if (!gst_bit_reader_get_bits_uint8 (&reader, &seq_level_idx, 5)) {
+      return FALSE;
+    }
+  } else {
+    guint8 decoder_model_info_present = 0;
+    guint8 initial_display_delay_present = 0;
+
+    /* timing_info_present_flag */
+    if (!gst_bit_reader_get_bits_uint8 (&reader, &flag, 1)) {
+      return FALSE;
+    }
+
+    if (flag) {
+      /* num_units_in_display_tick, time_scale */
+      if (!gst_bit_reader_skip (&reader, 64)
+          || !gst_bit_reader_get_bits_uint8 (&reader, &flag, 1)) {
+        return FALSE;
+      }
+
+      if (flag) {
+        /* num_ticks_per_picture_minus_1 */
+        av1_skip_uvlc (&reader);
+      }
+
+      if (!gst_bit_reader_get_bits_uint8 (&reader, &decoder_model_info_present,
+              1)) {
+        return FALSE;
+      }
+
+      if (decoder_model_info_present) {
+        /* buffer_delay_length_minus_1, num_units_in_decoding_tick,
+         * buffer_removal_time_length_minus_1, frame_presentation_time_length_minus_1 */
+        if (!gst_bit_reader_skip (&reader, 5 + 32 + 5 + 5)) {
+          return FALSE;
+        }
+      }
+    }
+
+    /* initial_display_delay_present_flag, operating_points_cnt_minus_1 and
+     * operating_point_idc[0] */
+    if (!gst_bit_reader_get_bits_uint8 (&reader,
+            &initial_display_delay_present, 1)
+        || !gst_bit_reader_skip (&reader, 5 + 12)
+        || !gst_bit_reader_get_bits_uint8 (&reader, &seq_level_idx, 5)) {
+      return FALSE;
+    }
+
+    if (seq_level_idx > 7
+        && !gst_bit_reader_get_bits_uint8 (&reader, &seq_tier, 1)) {
+      return FALSE;
+    }
+  }
+
+  header[0] = 0x81;             /* marker and version 1 */
+  header[1] = (seq_profile << 5) | seq_level_idx;
+  header[2] = (seq_tier << 7) | 0x0c;   /* chroma_subsampling_x and _y */
+  header[3] = 0;
+
+  return TRUE;
+}
+
+static gboolean
+create_av1dec_codec_data_from_codec_data (GstDroidCodec * codec G_GNUC_UNUSED,
+    GstBuffer * data, DroidMediaData * out)
+{
+  GstMapInfo info;
+  gboolean ret = FALSE;
+  const guint8 *obu = NULL, *payload = NULL;
+  guint obu_size = 0, payload_size = 0;
+
+  if (!gst_buffer_map (data, &info, GST_MAP_READ)) {
+    GST_ERROR ("failed to map buffer");
+    return FALSE;
+  }
+
+  if (info.size < 4 || info.data[0] != 0x81) {
+    GST_ERROR ("malformed av1C");
+    goto out;
+  }
+
+  /*
+   * av1C is a 4 bytes header followed by configOBUs which should carry
+   * the sequence header. We hand over the header and the sequence header OBU
+   * only and drop anything else (metadata OBUs) the muxer might have added.
+   */
+  if (!av1_find_sequence_header (info.data + 4, info.size - 4, &obu,
+          &obu_size, &payload, &payload_size)) {
+    GST_WARNING ("no sequence header in av1C, expecting it in the stream");
+    obu_size = 0;
+  }
+
+  out->size = 4 + obu_size;
+  out->data = g_malloc (out->size);
+  memcpy (out->data, info.data, 4);
+  if (obu_size > 0) {
+    memcpy ((guint8 *) out->data + 4, obu, obu_size);
+  }
+
+  GST_INFO ("av1C profile %d, level %d, sequence header size %u",
+      info.data[1] >> 5, info.data[1] & 0x1f, obu_size);
+
+  ret = TRUE;
+
+out:
+  gst_buffer_unmap (data, &info);
+
+  return ret;
+}
+
+static gboolean
+create_av1dec_codec_data_from_frame_data (GstDroidCodec * codec G_GNUC_UNUSED,
+    GstBuffer * frame_data, DroidMediaData * out)
+{
+  GstMapInfo info;
+  gboolean ret = FALSE;
+  const guint8 *obu = NULL, *payload = NULL;
+  guint obu_size = 0, payload_size = 0;
+  guint8 header[4];
+
+  /* No av1C so we construct one from the sequence header of the first temporal unit */
+  if (!gst_buffer_map (frame_data, &info, GST_MAP_READ)) {
+    GST_ERROR ("failed to map buffer");
+    return FALSE;
+  }
+
+  if (!av1_find_sequence_header (info.data, info.size, &obu, &obu_size,
+          &payload, &payload_size)) {
+    GST_ERROR ("no sequence header found in the first temporal unit");
+    goto out;
+  }
+
+  if (!av1_write_config_header (payload, payload_size, header)) {
+    GST_ERROR ("malformed sequence header");
+    goto out;
+  }
+
+  GST_INFO ("constructing av1C");
+
+  out->size = 4 + obu_size;
+  out->data = g_malloc (out->size);
+  memcpy (out->data, header, 4);
+  memcpy ((guint8 *) out->data + 4, obu, obu_size);
+
+  ret = TRUE;
+
+out:
+  gst_buffer_unmap (frame_data, &info);
+
+  return ret;
+}
+
 static int
 write_len (guint8 * buf, int val)
 {
@@ -1087,29 +1933,166 @@ process_aacdec_data (GstDroidCodec * codec, GstBuffer * buffer,
 }
 
 static gboolean
-process_h264enc_data (DroidMediaData * in, DroidMediaData * out)
+process_av1dec_data (GstDroidCodec * codec G_GNUC_UNUSED, GstBuffer * buffer,
+    DroidMediaData * out)
 {
-  guint32 size;
-  guint8 *data;
+  GstMapInfo info;
+  gboolean ret = FALSE;
+  GstByteReader reader;
+  GstByteWriter *writer = NULL;
 
-  if (in->size >= 4 && memcmp (in->data, "\x00\x00\x00\x01", 4) == 0) {
-    /* We will replace the first 4 bytes with the NAL size */
-    out->size = in->size;
-    data = in->data + 4;
-  } else {
-    /* We don't have the NAL prefix so we add 4 bytes for the NAL size */
-    out->size = in->size + 4;
-    data = in->data;
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    GST_ERROR ("failed to map buffer");
+    return FALSE;
   }
 
-  size = GUINT32_TO_BE (out->size - 4);
-  out->data = g_malloc (out->size);
-  if (!out->data) {
-    return FALSE;
+  /*
+   * A temporal unit is handed over as one access unit. Temporal delimiters
+   * and padding carry nothing for the decoder and are not present in
+   * MP4 samples which is what the droid decoders get fed on Android.
+   */
+  gst_byte_reader_init (&reader, info.data, info.size);
+  writer = gst_byte_writer_new_with_size (info.size, FALSE);
+
+  while (gst_byte_reader_get_remaining (&reader) > 0) {
+    const guint8 *obu = NULL, *payload = NULL;
+    guint obu_size = 0, payload_size = 0;
+    guint8 type;
+
+    if (!av1_read_obu (&reader, &type, &obu, &obu_size, &payload,
+            &payload_size)) {
+      GST_ERROR ("malformed temporal unit");
+      goto out;
+    }
+
+    if (type == AV1_OBU_TEMPORAL_DELIMITER || type == AV1_OBU_PADDING) {
+      GST_LOG ("dropping OBU of type %d", type);
+      continue;
+    }
+
+    if (!gst_byte_writer_put_data (writer, obu, obu_size)) {
+      GST_ERROR ("failed to write OBU");
+      goto out;
+    }
+  }
+
+  out->size = gst_byte_writer_get_size (writer);
+  out->data = gst_byte_writer_free_and_get_data (writer);
+  writer = NULL;
+  ret = TRUE;
+
+out:
+  if (writer) {
+    gst_byte_writer_free (writer);
+    writer = NULL;
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  return ret;
+}
+
+/* Size of the Annex B start code at data, 0 if there is none */
+static gsize
+h264_start_code_size (const guint8 * data, gsize size)
+{
+  if (size >= 4 && memcmp (data, "\x00\x00\x00\x01", 4) == 0) {
+    return 4;
+  } else if (size >= 3 && memcmp (data, "\x00\x00\x01", 3) == 0) {
+    return 3;
+  }
+
+  return 0;
+}
+
+/* Looks for an SPS among the NALs in front of the first slice */
+static gboolean
+h264_has_headers (const guint8 * data, gsize size)
+{
+  gsize offset = h264_start_code_size (data, size);
+  gboolean at_nal = TRUE;
+
+  while (offset < size) {
+    gsize prefix;
+
+    if (at_nal) {
+      guint8 type = data[offset] & 0x1f;
+
+      if (type == GST_H264_NAL_SPS) {
+        return TRUE;
+      } else if (type >= GST_H264_NAL_SLICE
+          && type <= GST_H264_NAL_SLICE_IDR) {
+        return FALSE;
+      }
+
+      at_nal = FALSE;
+    }
+
+    prefix = h264_start_code_size (data + offset, size - offset);
+    if (prefix > 0) {
+      offset += prefix;
+      at_nal = TRUE;
+    } else {
+      offset++;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean
+process_h264enc_byte_stream_data (GstDroidCodec * codec,
+    DroidMediaCodecData * in, guint8 * out, gsize * out_size)
+{
+  const guint8 *data = in->data.data;
+  gsize size = in->data.size;
+  gsize offset = 0;
+  gboolean has_prefix = h264_start_code_size (data, size) > 0;
+
+  /* The HAL output is byte-stream already. We only need to make sure
+   * a decoder can start at the key frame */
+  if (in->sync && codec->data->headers
+      && (codec->data->repeat_headers || !codec->data->headers_sent)
+      && !h264_has_headers (data, size)) {
+    offset = gst_buffer_extract (codec->data->headers, 0, out,
+        gst_buffer_get_size (codec->data->headers));
+    GST_LOG ("injected %" G_GSIZE_FORMAT " bytes of headers", offset);
+  }
+
+  if (in->sync) {
+    codec->data->headers_sent = TRUE;
+  }
+
+  if (!has_prefix) {
+    memcpy (out + offset, "\x00\x00\x00\x01", 4);
+    offset += 4;
+  }
+
+  memcpy (out + offset, data, size);
+  *out_size = offset + size;
+
+  return TRUE;
+}
+
+static gboolean
+process_h264enc_data (GstDroidCodec * codec, DroidMediaCodecData * in,
+    guint8 * out, gsize * out_size)
+{
+  guint32 size;
+  gsize prefix;
+
+  if (codec->data->h264_byte_stream) {
+    return process_h264enc_byte_stream_data (codec, in, out, out_size);
   }
 
-  memcpy (out->data, &size, sizeof (size));
-  memcpy (out->data + 4, data, out->size - 4);
+  /* We replace the start code, if any, with the 4 byte NAL size */
+  prefix = h264_start_code_size (in->data.data, in->data.size);
+  *out_size = in->data.size - prefix + 4;
+
+  size = GUINT32_TO_BE (*out_size - 4);
+
+  memcpy (out, &size, sizeof (size));
+  memcpy (out + 4, (guint8 *) in->data.data + prefix, *out_size - 4);
 
   return TRUE;
 }
@@ -1124,6 +2107,26 @@ gst_droid_codec_release_input_frame (void *data)
   g_slice_free (GstDroidCodecFrameReleaseData, info);
 }
 
+static void
+gst_droid_codec_release_encoder_frame (void *data)
+{
+  GstDroidCodecEncoderReleaseData *release_data =
+      (GstDroidCodecEncoderReleaseData *) data;
+
+  if (release_data->mapped) {
+    gst_buffer_unmap (release_data->buffer, &release_data->info);
+  }
+
+  /* For media buffers this hands the graphic buffer back to its producer */
+  gst_buffer_unref (release_data->buffer);
+
+  if (release_data->frame) {
+    gst_video_codec_frame_unref (release_data->frame);
+  }
+
+  g_slice_free (GstDroidCodecEncoderReleaseData, release_data);
+}
+
 static void
 gst_droid_codec_type_fill_quirks (GstDroidCodec * codec)
 {
@@ -38,7 +38,11 @@ G_BEGIN_DECLS
 #define DONT_USE_DROID_CONVERT_NAME    "dont-use-droid-convert"
 #define DONT_USE_DROID_CONVERT_VALUE   0x4
 
+/* From the OpenMAX IL headers. The encoder takes the real format from the buffer */
+#define GST_DROID_CODEC_COLOR_FORMAT_ANDROID_OPAQUE    0x7F000789
+
 typedef struct _GstDroidCodec GstDroidCodec;
+typedef struct _GstDroidCodecStaging GstDroidCodecStaging;
 typedef struct _GstDroidCodecInfo GstDroidCodecInfo;
 typedef struct _GstDroidCodecPrivate GstDroidCodecPrivate;
 typedef enum _GstDroidCodecType GstDroidCodecType;
@@ -69,6 +73,14 @@ struct _GstDroidCodec {
   gint quirks;
 };
 
+/* NV12 copies of encoder input for codecs which cannot take it as is */
+struct _GstDroidCodecStaging {
+  GstVideoInfo info;
+  GstBufferPool *pool;
+  GstVideoConverter *converter;
+  GstVideoInfo converter_info;
+};
+
 GType gst_droid_codec_get_type (void);
 
 static inline GstDroidCodec *gst_droid_codec_ref (GstDroidCodec * codec)
@@ -88,6 +100,8 @@ const gchar *gst_droid_codec_get_droid_type (GstDroidCodec * codec);
 
 void gst_droid_codec_complement_caps (GstDroidCodec *codec, GstCaps * caps);
 GstBuffer *gst_droid_codec_create_encoder_codec_data (GstDroidCodec *codec, DroidMediaData *data);
+gboolean gst_droid_codec_uses_in_band_headers (GstDroidCodec *codec);
+void gst_droid_codec_set_repeat_headers (GstDroidCodec *codec, gboolean repeat);
 
 GstDroidCodecCodecDataResult gst_droid_codec_create_decoder_codec_data (GstDroidCodec *codec,
 									GstBuffer *data,
@@ -98,11 +112,38 @@ gboolean gst_droid_codec_prepare_decoder_frame (GstDroidCodec * codec, GstVideoC
 						DroidMediaData * data,
 						DroidMediaBufferCallbacks *cb);
 
-GstBuffer *gst_droid_codec_prepare_encoded_data (GstDroidCodec * codec, DroidMediaData * in);
+void gst_droid_codec_configure_encoded_pool (GstDroidCodec * codec, gint bitrate,
+					     gint frames_n, gint frames_d);
+GstBuffer *gst_droid_codec_prepare_encoded_data (GstDroidCodec * codec,
+						 DroidMediaCodecData * in);
+
+gboolean gst_droid_codec_prepare_encoder_frame (GstBuffer * buffer,
+						DroidMediaBuffer * media_buffer,
+						GstVideoCodecFrame * frame,
+						DroidMediaCodecData * data,
+						DroidMediaBufferCallbacks * cb);
+void gst_droid_codec_update_encoder_bitrate (GstObject * object, DroidMediaCodec * codec,
+					     gint32 * bitrate, gboolean * changed);
+void gst_droid_codec_request_sync_frame (GstObject * object, DroidMediaCodec * codec);
+gboolean gst_droid_codec_check_sync_frame (GstObject * object, gboolean force,
+					   guint key_int_max, guint * frames_since_sync);
+
+void gst_droid_codec_staging_init (GstDroidCodecStaging * staging);
+gboolean gst_droid_codec_staging_start (GstDroidCodecStaging * staging, gint width,
+					gint height, guint buffers);
+void gst_droid_codec_staging_fill_settings (GstDroidCodecStaging * staging,
+					    DroidMediaCodecEncoderMetaData * md);
+GstBuffer *gst_droid_codec_staging_convert (GstDroidCodecStaging * staging,
+					    GstVideoFrame * in);
+GstBuffer *gst_droid_codec_staging_convert_media_buffer (GstDroidCodecStaging * staging,
+							 GstBuffer * input);
+void gst_droid_codec_staging_stop (GstDroidCodecStaging * staging);
 
 gboolean gst_droid_codec_process_decoder_data (GstDroidCodec * codec, GstBuffer * buffer,
 					       DroidMediaData * out);
 gint gst_droid_codec_get_samples_per_frane (GstCaps * caps);
+gboolean gst_droid_codec_get_profile_level (GstDroidCodec * codec, gint * profile,
+					    gint * level);
 
 G_END_DECLS
 
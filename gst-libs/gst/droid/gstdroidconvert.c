@@ -0,0 +1,162 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstdroidconvert.h"
+#include <string.h>
+#ifdef HAVE_ORC
+#include <orc/orc.h>
+#else
+#define orc_memcpy memcpy
+#endif
+
+#define ALIGN_SIZE(size, to) (((size) + to  - 1) & ~(to - 1))
+
+void
+gst_droid_convert_copy_plane (guint8 * out, gint stride_out,
+    const guint8 * in, gint stride_in, gint width, gint height)
+{
+  int i;
+  for (i = 0; i < height; i++) {
+    orc_memcpy (out, (void *) in, width);
+    out += stride_out;
+    in += stride_in;
+  }
+}
+
+void
+gst_droid_convert_copy_packed_planes (guint8 * out0, guint8 * out1,
+    gint stride_out, const guint8 * in, gint stride_in, gint width,
+    gint height)
+{
+  int x, y;
+  for (y = 0; y < height; y++) {
+    const guint8 *row = in;
+    for (x = 0; x < width; x++) {
+      out0[x] = row[0];
+      out1[x] = row[1];
+      row += 2;
+    }
+
+    out0 += stride_out;
+    out1 += stride_out;
+    in += stride_in;
+  }
+}
+
+/*
+ * The visible area starts at crop->left, crop->top and has the size of info.
+ * Chroma comes from the sample covering the top left luma sample and odd
+ * sizes round the chroma planes up like GstVideoInfo does.
+ */
+gboolean
+gst_droid_convert_yuv420_planar_to_i420 (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop)
+{
+  /* Buffer is already I420, so we can copy it straight over */
+  /* though we need to handle the cropping */
+  gsize chroma_stride = width / 2;
+  gint top = crop->top;
+  gint left = crop->left;
+
+  const guint8 *y = in + (top * width) + left;
+  const guint8 *u = in + (width * height) + (top / 2) * chroma_stride +
+      (left / 2);
+  const guint8 *v = in + (width * height) + chroma_stride * (height / 2) +
+      (top / 2) * chroma_stride + (left / 2);
+
+  gst_droid_convert_copy_plane (out + info->offset[0],
+      info->stride[0], y, width, GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info));
+  gst_droid_convert_copy_plane (out + info->offset[1],
+      info->stride[1], u, chroma_stride, GST_VIDEO_INFO_COMP_WIDTH (info, 1),
+      GST_VIDEO_INFO_COMP_HEIGHT (info, 1));
+  gst_droid_convert_copy_plane (out + info->offset[2],
+      info->stride[2], v, chroma_stride, GST_VIDEO_INFO_COMP_WIDTH (info, 2),
+      GST_VIDEO_INFO_COMP_HEIGHT (info, 2));
+
+  return TRUE;
+}
+
+static void
+gst_droid_convert_nv12_to_i420 (guint8 * out, const GstVideoInfo * info,
+    const guint8 * in, gsize stride, gsize slice_height,
+    const DroidMediaRect * crop)
+{
+  gint top = crop->top;
+  gint left = crop->left;
+
+  const guint8 *y = in + (top * stride) + left;
+  const guint8 *uv = in + (stride * slice_height) + (top / 2) * stride +
+      (left & ~1);
+
+  gst_droid_convert_copy_plane (out + info->offset[0],
+      info->stride[0], y, stride, GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info));
+  gst_droid_convert_copy_packed_planes (out + info->offset[1],
+      out + info->offset[2], info->stride[1], uv, stride,
+      GST_VIDEO_INFO_COMP_WIDTH (info, 1),
+      GST_VIDEO_INFO_COMP_HEIGHT (info, 1));
+}
+
+gboolean
+gst_droid_convert_yuv420_semi_planar_to_i420 (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop)
+{
+  /* OMX_COLOR_FormatYUV420SemiPlanar */
+  gst_droid_convert_nv12_to_i420 (out, info, in, width,
+      ALIGN_SIZE (height, 16), crop);
+
+  return TRUE;
+}
+
+gboolean
+gst_droid_convert_yuv420_packed_semi_planar_to_i420 (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop)
+{
+  /* NV12 format with 128 byte alignment */
+  gst_droid_convert_nv12_to_i420 (out, info, in, ALIGN_SIZE (width, 128),
+      ALIGN_SIZE (height, 32), crop);
+
+  return TRUE;
+}
+
+GstDroidConvertToI420Func
+gst_droid_convert_get_to_i420_func (GstDroidFormatConverter converter)
+{
+  switch (converter) {
+    case GST_DROID_FORMAT_CONVERTER_YUV420_PLANAR:
+      return gst_droid_convert_yuv420_planar_to_i420;
+    case GST_DROID_FORMAT_CONVERTER_YUV420_SEMI_PLANAR:
+      return gst_droid_convert_yuv420_semi_planar_to_i420;
+    case GST_DROID_FORMAT_CONVERTER_YUV420_PACKED_SEMI_PLANAR:
+      return gst_droid_convert_yuv420_packed_semi_planar_to_i420;
+    case GST_DROID_FORMAT_CONVERTER_NONE:
+      break;
+  }
+
+  return NULL;
+}
@@ -0,0 +1,61 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_DROID_CONVERT_H__
+#define __GST_DROID_CONVERT_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include "gstdroidformat.h"
+#include "droidmedia.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Software converters from codec output layouts to I420. in is a frame of
+ * width x height as reported by the codec, crop selects the visible area and
+ * out is laid out as described by info.
+ */
+typedef gboolean (*GstDroidConvertToI420Func) (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop);
+
+GstDroidConvertToI420Func gst_droid_convert_get_to_i420_func (GstDroidFormatConverter converter);
+
+gboolean gst_droid_convert_yuv420_planar_to_i420 (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop);
+gboolean gst_droid_convert_yuv420_semi_planar_to_i420 (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop);
+gboolean gst_droid_convert_yuv420_packed_semi_planar_to_i420 (guint8 * out,
+    const GstVideoInfo * info, const guint8 * in, gsize width, gsize height,
+    const DroidMediaRect * crop);
+
+/* row kernels */
+void gst_droid_convert_copy_plane (guint8 * out, gint stride_out,
+    const guint8 * in, gint stride_in, gint width, gint height);
+void gst_droid_convert_copy_packed_planes (guint8 * out0, guint8 * out1,
+    gint stride_out, const guint8 * in, gint stride_in, gint width,
+    gint height);
+
+G_END_DECLS
+
+#endif /* __GST_DROID_CONVERT_H__ */
@@ -0,0 +1,193 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstdroidformat.h"
+#include "droidmediaconstants.h"
+
+/*
+ * The HAL values are only known at runtime so the tables are filled in once
+ * on first use and never change after that.
+ */
+
+typedef struct
+{
+  int *hal_format;
+  GstVideoFormat gst_format;
+  gsize bytes_per_pixel;
+  gsize h_align;
+  gsize v_align;
+  GstDroidFormatConverter converter;
+} GstDroidFormatEntry;
+
+static DroidMediaPixelFormatConstants pixel_constants;
+static DroidMediaColourFormatConstants colour_constants;
+
+static const GstDroidFormatEntry pixel_entries[] = {
+  {&pixel_constants.HAL_PIXEL_FORMAT_RGBA_8888, GST_VIDEO_FORMAT_RGBA, 4, 4, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_RGBX_8888, GST_VIDEO_FORMAT_RGBx, 4, 4, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_RGB_888, GST_VIDEO_FORMAT_RGB, 3, 4, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_RGB_565, GST_VIDEO_FORMAT_RGB16, 2, 4, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_BGRA_8888, GST_VIDEO_FORMAT_BGRA, 4, 4, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_YV12, GST_VIDEO_FORMAT_YV12, 1, 16, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_YCbCr_422_SP, GST_VIDEO_FORMAT_NV16, 1, 1,
+      1, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_YCrCb_420_SP, GST_VIDEO_FORMAT_NV21, 1, 1,
+      1, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.HAL_PIXEL_FORMAT_YCbCr_422_I, GST_VIDEO_FORMAT_YUY2, 1, 1, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar32m,
+      GST_VIDEO_FORMAT_YV12, 1, 128, 32, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&pixel_constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka,
+      GST_VIDEO_FORMAT_NV12_64Z32, 0, 0, 0, GST_DROID_FORMAT_CONVERTER_NONE},
+};
+
+static const GstDroidFormatEntry colour_entries[] = {
+  {&colour_constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar32m,
+        GST_VIDEO_FORMAT_NV12, 1, 128, 32,
+      GST_DROID_FORMAT_CONVERTER_YUV420_PACKED_SEMI_PLANAR},
+  {&colour_constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka,
+      GST_VIDEO_FORMAT_NV12_64Z32, 0, 0, 0, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_FormatYUV420Planar, GST_VIDEO_FORMAT_I420, 1, 4,
+      1, GST_DROID_FORMAT_CONVERTER_YUV420_PLANAR},
+  {&colour_constants.OMX_COLOR_FormatYUV420PackedPlanar, GST_VIDEO_FORMAT_I420,
+      1, 1, 1, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_FormatYUV420SemiPlanar, GST_VIDEO_FORMAT_NV12, 1,
+      1, 1, GST_DROID_FORMAT_CONVERTER_YUV420_SEMI_PLANAR},
+  {&colour_constants.OMX_COLOR_FormatL8, GST_VIDEO_FORMAT_GRAY8, 1, 1, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_FormatYUV422SemiPlanar, GST_VIDEO_FORMAT_NV16, 1,
+      1, 1, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_FormatYCbYCr, GST_VIDEO_FORMAT_YUY2, 1, 1, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_FormatYCrYCb, GST_VIDEO_FORMAT_YVYU, 1, 1, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_FormatCbYCrY, GST_VIDEO_FORMAT_UYVY, 1, 1, 1,
+      GST_DROID_FORMAT_CONVERTER_NONE},
+  /* There is a mismatch in omxil specification 4.2.1 between
+   * OMX_COLOR_Format32bitARGB8888 and its description
+   * Follow the description */
+  {&colour_constants.OMX_COLOR_Format32bitARGB8888, GST_VIDEO_FORMAT_ABGR, 4, 4,
+      1, GST_DROID_FORMAT_CONVERTER_NONE},
+  /* Same issue as OMX_COLOR_Format32bitARGB8888 */
+  {&colour_constants.OMX_COLOR_Format32bitBGRA8888, GST_VIDEO_FORMAT_ARGB, 4, 4,
+      1, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_Format16bitRGB565, GST_VIDEO_FORMAT_RGB16, 2, 4,
+      1, GST_DROID_FORMAT_CONVERTER_NONE},
+  {&colour_constants.OMX_COLOR_Format16bitBGR565, GST_VIDEO_FORMAT_BGR16, 2, 4,
+      1, GST_DROID_FORMAT_CONVERTER_NONE},
+};
+
+#define N_PIXEL_FORMATS G_N_ELEMENTS (pixel_entries)
+#define N_COLOUR_FORMATS G_N_ELEMENTS (colour_entries)
+
+static GstDroidFormat pixel_formats[N_PIXEL_FORMATS];
+static GstDroidFormat colour_formats[N_COLOUR_FORMATS];
+
+static GHashTable *by_hal_format;
+static GHashTable *by_gst_format;
+static GHashTable *by_colour_format;
+
+/* The first entry wins when a value shows up more than once, like the tables used to */
+static void
+gst_droid_format_fill (const GstDroidFormatEntry * entries,
+    GstDroidFormat * formats, guint count, GHashTable * by_hal,
+    GHashTable * by_gst)
+{
+  guint i;
+
+  for (i = 0; i < count; ++i) {
+    GstDroidFormat *format = &formats[i];
+
+    format->hal_format = *entries[i].hal_format;
+    format->gst_format = entries[i].gst_format;
+    format->bytes_per_pixel = entries[i].bytes_per_pixel;
+    format->h_align = entries[i].h_align;
+    format->v_align = entries[i].v_align;
+    format->converter = entries[i].converter;
+
+    if (!g_hash_table_contains (by_hal, GINT_TO_POINTER (format->hal_format))) {
+      g_hash_table_insert (by_hal, GINT_TO_POINTER (format->hal_format),
+          format);
+    }
+
+    if (by_gst && !g_hash_table_contains (by_gst,
+            GINT_TO_POINTER (format->gst_format))) {
+      g_hash_table_insert (by_gst, GINT_TO_POINTER (format->gst_format),
+          format);
+    }
+  }
+}
+
+static void
+gst_droid_format_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    droid_media_pixel_format_constants_init (&pixel_constants);
+    droid_media_colour_format_constants_init (&colour_constants);
+
+    by_hal_format = g_hash_table_new (g_direct_hash, g_direct_equal);
+    by_gst_format = g_hash_table_new (g_direct_hash, g_direct_equal);
+    by_colour_format = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    gst_droid_format_fill (pixel_entries, pixel_formats, N_PIXEL_FORMATS,
+        by_hal_format, by_gst_format);
+    gst_droid_format_fill (colour_entries, colour_formats, N_COLOUR_FORMATS,
+        by_colour_format, NULL);
+
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+const GstDroidFormat *
+gst_droid_format_from_hal_format (int hal_format)
+{
+  gst_droid_format_init ();
+
+  return g_hash_table_lookup (by_hal_format, GINT_TO_POINTER (hal_format));
+}
+
+const GstDroidFormat *
+gst_droid_format_from_gst_format (GstVideoFormat format)
+{
+  gst_droid_format_init ();
+
+  return g_hash_table_lookup (by_gst_format, GINT_TO_POINTER (format));
+}
+
+const GstDroidFormat *
+gst_droid_format_from_colour_format (int colour_format)
+{
+  gst_droid_format_init ();
+
+  return g_hash_table_lookup (by_colour_format,
+      GINT_TO_POINTER (colour_format));
+}
@@ -0,0 +1,60 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_DROID_FORMAT_H__
+#define __GST_DROID_FORMAT_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstDroidFormat GstDroidFormat;
+typedef enum _GstDroidFormatConverter GstDroidFormatConverter;
+
+/* How a codec output format can be turned into I420 without droid convert */
+enum _GstDroidFormatConverter
+{
+  GST_DROID_FORMAT_CONVERTER_NONE,
+  GST_DROID_FORMAT_CONVERTER_YUV420_PLANAR,
+  GST_DROID_FORMAT_CONVERTER_YUV420_SEMI_PLANAR,
+  GST_DROID_FORMAT_CONVERTER_YUV420_PACKED_SEMI_PLANAR,
+};
+
+struct _GstDroidFormat
+{
+  int hal_format;
+  GstVideoFormat gst_format;
+  gsize bytes_per_pixel;
+  gsize h_align;
+  gsize v_align;
+  GstDroidFormatConverter converter;
+};
+
+/* graphic buffer pixel formats */
+const GstDroidFormat *gst_droid_format_from_hal_format (int hal_format);
+const GstDroidFormat *gst_droid_format_from_gst_format (GstVideoFormat format);
+
+/* colour formats reported by codecs */
+const GstDroidFormat *gst_droid_format_from_colour_format (int colour_format);
+
+G_END_DECLS
+
+#endif /* __GST_DROID_FORMAT_H__ */
@@ -0,0 +1,58 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstdroidhaltrace.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+
+gint _gst_droid_hal_trace_enabled = 0;
+
+G_LOCK_DEFINE_STATIC (trace_lock);
+static GstDroidHalTraceFunc trace_func = NULL;
+static gpointer trace_data = NULL;
+
+/* Only one tracer can be installed at a time. NULL removes it */
+void
+gst_droid_hal_trace_set_func (GstDroidHalTraceFunc func, gpointer user_data)
+{
+  G_LOCK (trace_lock);
+  trace_func = func;
+  trace_data = user_data;
+  g_atomic_int_set (&_gst_droid_hal_trace_enabled, func != NULL);
+  G_UNLOCK (trace_lock);
+}
+
+void
+gst_droid_hal_trace_record (GstObject * object, const gchar * call,
+    GstClockTime start)
+{
+  GstClockTime end = gst_util_get_timestamp ();
+  guint64 thread_id = (guint64) syscall (SYS_gettid);
+
+  G_LOCK (trace_lock);
+  if (trace_func) {
+    trace_func (object, call, thread_id, start, end, trace_data);
+  }
+  G_UNLOCK (trace_lock);
+}
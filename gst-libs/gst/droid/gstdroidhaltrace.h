@@ -0,0 +1,56 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_DROID_HAL_TRACE_H__
+#define __GST_DROID_HAL_TRACE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef void (*GstDroidHalTraceFunc) (GstObject * object, const gchar * call,
+    guint64 thread_id, GstClockTime start, GstClockTime end,
+    gpointer user_data);
+
+/* Non zero while a HAL tracer is installed. Read by GST_DROID_HAL_TRACE */
+extern gint _gst_droid_hal_trace_enabled;
+
+void gst_droid_hal_trace_set_func (GstDroidHalTraceFunc func,
+    gpointer user_data);
+void gst_droid_hal_trace_record (GstObject * object, const gchar * call,
+    GstClockTime start);
+
+/*
+ * Runs a droidmedia call and reports it to the tracer if there is one.
+ * Without a tracer this is a single predicted branch.
+ */
+#define GST_DROID_HAL_TRACE(object, call, statement) G_STMT_START {     \
+  GstClockTime __droid_hal_start = GST_CLOCK_TIME_NONE;                 \
+  if (G_UNLIKELY (_gst_droid_hal_trace_enabled))                        \
+    __droid_hal_start = gst_util_get_timestamp ();                      \
+  statement;                                                            \
+  if (G_UNLIKELY (__droid_hal_start != GST_CLOCK_TIME_NONE))            \
+    gst_droid_hal_trace_record ((GstObject *) (object), (call),         \
+        __droid_hal_start);                                             \
+} G_STMT_END
+
+G_END_DECLS
+
+#endif /* __GST_DROID_HAL_TRACE_H__ */
@@ -25,17 +25,43 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <gst/gst.h>
+#include <gst/allocators/allocators.h>
 #include <gst/interfaces/nemoeglimagememory.h>
+#include <errno.h>
+#include <string.h>             /* memcpy() */
+#include <unistd.h>             /* dup(), lseek() */
 #include "gstdroidmediabuffer.h"
-#include "droidmediaconstants.h"
+#include "gstdroidformat.h"
+#include "gstdroidhaltrace.h"
 
 GST_DEBUG_CATEGORY_STATIC (droid_memory_debug);
 #define GST_CAT_DEFAULT droid_memory_debug
 
+/* Graphics memory held by droid media buffer memories. Protected by accounting_lock */
+typedef struct
+{
+  gsize bytes;
+  guint buffers;
+  gsize peak_bytes;
+  guint peak_buffers;
+} GstDroidMediaBufferAccounting;
+
 typedef struct
 {
   NemoGstEglImageAllocator parent;
 
+  /* protected by accounting_lock */
+  GstDroidMediaBufferAccounting accounting;
+
+  /* keep buffers locked after the last unmap */
+  gboolean lazy_unlock;
+
+  /* stats. updated atomically */
+  gint locks;
+  gint unlocks;
+  gint upgrades;
+  gint cached_maps;
+
 } GstDroidMediaBufferAllocator;
 
 typedef struct
@@ -43,6 +69,7 @@ typedef struct
   NemoGstEglImageAllocatorClass parent_class;
 
   PFNEGLCREATEIMAGEKHRPROC egl_create_image_khr;
+  PFNEGLDESTROYIMAGEKHRPROC egl_destroy_image_khr;
 
 } GstDroidMediaBufferAllocatorClass;
 
@@ -52,21 +79,28 @@ typedef struct
 
   DroidMediaBuffer *buffer;
   GstVideoInfo video_info;
+  /* protected by map_lock. map_data stays set while a lazy lock is held */
+  GMutex map_lock;
   gpointer map_data;
   int map_count;
   GstMapFlags map_flags;
 
+  /* bytes charged to the accounting for this memory */
+  gsize accounted;
+
+  /* cached by gst_droid_media_buffer_memory_get_image. protected by image_lock */
+  EGLDisplay image_display;
+  EGLImageKHR image;
+
 } GstDroidMediaBufferMemory;
 
-typedef struct
-{
-  int hal_format;
-  GstVideoFormat gst_format;
-  int bytes_per_pixel;
-  int h_align;
-  int v_align;
+G_LOCK_DEFINE_STATIC (image_lock);
 
-} GstDroidMediaBufferFormatMap;
+G_LOCK_DEFINE_STATIC (accounting_lock);
+static GstDroidMediaBufferAccounting global_accounting;
+
+/* 0 means no budget. Set from GST_DROID_GRAPHICS_MEMORY_BUDGET */
+static gsize graphics_memory_budget;
 
 #define _do_init \
   GST_DEBUG_CATEGORY_INIT (droid_memory_debug, "droidmemory", 0, \
@@ -87,131 +121,130 @@ static gpointer gst_droid_media_buffer_memory_map (GstMemory * mem,
 static void gst_droid_media_buffer_memory_unmap (GstMemory * mem);
 static GstMemory *gst_droid_media_buffer_memory_copy (GstMemory * mem,
     gssize offset, gssize size);
+static GstMemory *gst_droid_media_buffer_memory_share (GstMemory * mem,
+    gssize offset, gssize size);
 
 static EGLImageKHR gst_droid_media_buffer_create_image (GstMemory * mem,
     EGLDisplay dpy, EGLContext ctx);
+static void gst_droid_media_buffer_memory_destroy_image
+    (GstDroidMediaBufferMemory * m);
 
-#define GST_DROID_MEDIA_BUFFER_FORMAT_COUNT 11
+/* Accepts a plain byte count or one with a K, M or G suffix */
+static gboolean
+gst_droid_media_buffer_parse_budget (const gchar * value, gsize * budget)
+{
+  gchar *end = NULL;
+  guint64 bytes;
+  guint shift = 0;
 
-static GstDroidMediaBufferFormatMap
-    gst_droid_media_buffer_formats[GST_DROID_MEDIA_BUFFER_FORMAT_COUNT];
+  if (!g_ascii_isdigit (*value)) {
+    return FALSE;
+  }
 
-static void
-gst_droid_media_buffer_initialize_format_map ()
-{
-  DroidMediaPixelFormatConstants constants;
-  static gboolean initialized = FALSE;
-
-  if (!initialized) {
-    droid_media_pixel_format_constants_init (&constants);
-
-    gst_droid_media_buffer_formats[0].hal_format =
-        constants.HAL_PIXEL_FORMAT_RGBA_8888;
-    gst_droid_media_buffer_formats[0].gst_format = GST_VIDEO_FORMAT_RGBA;
-    gst_droid_media_buffer_formats[0].bytes_per_pixel = 4;
-    gst_droid_media_buffer_formats[0].h_align = 4;
-    gst_droid_media_buffer_formats[0].v_align = 1;
-
-    gst_droid_media_buffer_formats[1].hal_format =
-        constants.HAL_PIXEL_FORMAT_RGBX_8888;
-    gst_droid_media_buffer_formats[1].gst_format = GST_VIDEO_FORMAT_RGBx;
-    gst_droid_media_buffer_formats[1].bytes_per_pixel = 4;
-    gst_droid_media_buffer_formats[1].h_align = 4;
-    gst_droid_media_buffer_formats[1].v_align = 1;
-
-    gst_droid_media_buffer_formats[2].hal_format =
-        constants.HAL_PIXEL_FORMAT_RGB_888;
-    gst_droid_media_buffer_formats[2].gst_format = GST_VIDEO_FORMAT_RGB;
-    gst_droid_media_buffer_formats[2].bytes_per_pixel = 3;
-    gst_droid_media_buffer_formats[2].h_align = 4;
-    gst_droid_media_buffer_formats[2].v_align = 1;
-
-    gst_droid_media_buffer_formats[3].hal_format =
-        constants.HAL_PIXEL_FORMAT_RGB_565;
-    gst_droid_media_buffer_formats[3].gst_format = GST_VIDEO_FORMAT_RGB16;
-    gst_droid_media_buffer_formats[3].bytes_per_pixel = 2;
-    gst_droid_media_buffer_formats[3].h_align = 4;
-    gst_droid_media_buffer_formats[3].v_align = 1;
-
-    gst_droid_media_buffer_formats[4].hal_format =
-        constants.HAL_PIXEL_FORMAT_BGRA_8888;
-    gst_droid_media_buffer_formats[4].gst_format = GST_VIDEO_FORMAT_BGRA;
-    gst_droid_media_buffer_formats[4].bytes_per_pixel = 4;
-    gst_droid_media_buffer_formats[4].h_align = 4;
-    gst_droid_media_buffer_formats[4].v_align = 1;
-
-    gst_droid_media_buffer_formats[5].hal_format =
-        constants.HAL_PIXEL_FORMAT_YV12;
-    gst_droid_media_buffer_formats[5].gst_format = GST_VIDEO_FORMAT_YV12;
-    gst_droid_media_buffer_formats[5].bytes_per_pixel = 1;
-    gst_droid_media_buffer_formats[5].h_align = 16;
-    gst_droid_media_buffer_formats[5].v_align = 1;
-
-    gst_droid_media_buffer_formats[6].hal_format =
-        constants.HAL_PIXEL_FORMAT_YCbCr_422_SP;
-    gst_droid_media_buffer_formats[6].gst_format = GST_VIDEO_FORMAT_NV16;
-    gst_droid_media_buffer_formats[6].bytes_per_pixel = 1;
-    gst_droid_media_buffer_formats[6].h_align = 1;
-    gst_droid_media_buffer_formats[6].v_align = 1;
-
-    gst_droid_media_buffer_formats[7].hal_format =
-        constants.HAL_PIXEL_FORMAT_YCrCb_420_SP;
-    gst_droid_media_buffer_formats[7].gst_format = GST_VIDEO_FORMAT_NV21;
-    gst_droid_media_buffer_formats[7].bytes_per_pixel = 1;
-    gst_droid_media_buffer_formats[7].h_align = 1;
-    gst_droid_media_buffer_formats[7].v_align = 1;
-
-    gst_droid_media_buffer_formats[8].hal_format =
-        constants.HAL_PIXEL_FORMAT_YCbCr_422_I;
-    gst_droid_media_buffer_formats[8].gst_format = GST_VIDEO_FORMAT_YUY2;
-    gst_droid_media_buffer_formats[8].bytes_per_pixel = 1;
-    gst_droid_media_buffer_formats[8].h_align = 1;
-    gst_droid_media_buffer_formats[8].v_align = 1;
-
-    gst_droid_media_buffer_formats[9].hal_format =
-        constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar32m;
-    gst_droid_media_buffer_formats[9].gst_format = GST_VIDEO_FORMAT_YV12;
-    gst_droid_media_buffer_formats[9].bytes_per_pixel = 1;
-    gst_droid_media_buffer_formats[9].h_align = 128;
-    gst_droid_media_buffer_formats[9].v_align = 32;
-
-    gst_droid_media_buffer_formats[10].hal_format =
-        constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka;
-    gst_droid_media_buffer_formats[10].gst_format = GST_VIDEO_FORMAT_NV12_64Z32;
-    gst_droid_media_buffer_formats[10].bytes_per_pixel = 0;
-    gst_droid_media_buffer_formats[10].h_align = 0;
-    gst_droid_media_buffer_formats[10].v_align = 0;
-  }
-}
-
-static int
-gst_droid_media_buffer_index_of_hal_format (int format)
-{
-  int i;
-
-  gst_droid_media_buffer_initialize_format_map ();
-
-  for (i = 0; i < GST_DROID_MEDIA_BUFFER_FORMAT_COUNT; ++i) {
-    if (gst_droid_media_buffer_formats[i].hal_format == format) {
-      return i;
-    }
+  errno = 0;
+  bytes = g_ascii_strtoull (value, &end, 10);
+  if (errno) {
+    return FALSE;
   }
-  return GST_DROID_MEDIA_BUFFER_FORMAT_COUNT;
+
+  switch (g_ascii_toupper (*end)) {
+    case 'G':
+      shift = 30;
+      end++;
+      break;
+    case 'M':
+      shift = 20;
+      end++;
+      break;
+    case 'K':
+      shift = 10;
+      end++;
+      break;
+    default:
+      break;
+  }
+
+  if (*end != '\0' || bytes > (G_MAXSIZE >> shift)) {
+    return FALSE;
+  }
+
+  *budget = (gsize) (bytes << shift);
+
+  return TRUE;
+}
+
+static void
+gst_droid_media_buffer_accounting_add (GstDroidMediaBufferAccounting * acc,
+    gsize bytes)
+{
+  acc->bytes += bytes;
+  acc->buffers++;
+  acc->peak_bytes = MAX (acc->peak_bytes, acc->bytes);
+  acc->peak_buffers = MAX (acc->peak_buffers, acc->buffers);
 }
 
-static int
-gst_droid_media_buffer_index_of_gst_format (GstVideoFormat format)
+static void
+gst_droid_media_buffer_accounting_remove (GstDroidMediaBufferAccounting * acc,
+    gsize bytes)
 {
-  int i;
+  acc->bytes -= bytes;
+  acc->buffers--;
+}
 
-  gst_droid_media_buffer_initialize_format_map ();
+/*
+ * Charges a graphic buffer to its allocator and to the process. Buffers we
+ * allocate ourselves are refused when they do not fit in the budget. Queue
+ * buffers are allocated by the HAL so they are only counted.
+ */
+static gboolean
+gst_droid_media_buffer_charge (GstAllocator * allocator, gsize bytes,
+    gboolean enforce)
+{
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) allocator;
 
-  for (i = 0; i < GST_DROID_MEDIA_BUFFER_FORMAT_COUNT; ++i) {
-    if (gst_droid_media_buffer_formats[i].gst_format == format) {
-      return i;
-    }
+  G_LOCK (accounting_lock);
+
+  if (enforce && graphics_memory_budget != 0
+      && global_accounting.bytes + bytes > graphics_memory_budget) {
+    G_UNLOCK (accounting_lock);
+
+    GST_ERROR_OBJECT (allocator, "allocating %" G_GSIZE_FORMAT
+        " bytes would exceed the graphics memory budget of %" G_GSIZE_FORMAT
+        " bytes (%" G_GSIZE_FORMAT " in use)", bytes, graphics_memory_budget,
+        global_accounting.bytes);
+    return FALSE;
   }
-  return GST_DROID_MEDIA_BUFFER_FORMAT_COUNT;
+
+  gst_droid_media_buffer_accounting_add (&global_accounting, bytes);
+  gst_droid_media_buffer_accounting_add (&alloc->accounting, bytes);
+
+  G_UNLOCK (accounting_lock);
+
+  return TRUE;
+}
+
+static void
+gst_droid_media_buffer_uncharge (GstAllocator * allocator, gsize bytes)
+{
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) allocator;
+
+  G_LOCK (accounting_lock);
+  gst_droid_media_buffer_accounting_remove (&global_accounting, bytes);
+  gst_droid_media_buffer_accounting_remove (&alloc->accounting, bytes);
+  G_UNLOCK (accounting_lock);
+}
+
+static void
+gst_droid_media_buffer_accounting_to_structure (GstDroidMediaBufferAccounting *
+    acc, GstStructure * s)
+{
+  gst_structure_set (s,
+      "bytes", G_TYPE_UINT64, (guint64) acc->bytes,
+      "buffers", G_TYPE_UINT, acc->buffers,
+      "peak-bytes", G_TYPE_UINT64, (guint64) acc->peak_bytes,
+      "peak-buffers", G_TYPE_UINT, acc->peak_buffers, NULL);
 }
 
 GstAllocator *
@@ -234,7 +267,7 @@ droid_media_buffer_allocator_init (GstDroidMediaBufferAllocator * allocator)
   alloc->mem_map = gst_droid_media_buffer_memory_map;
   alloc->mem_unmap = gst_droid_media_buffer_memory_unmap;
   alloc->mem_copy = gst_droid_media_buffer_memory_copy;
-  alloc->mem_share = NULL;
+  alloc->mem_share = gst_droid_media_buffer_memory_share;
   alloc->mem_is_span = NULL;
 
   egl_alloc->create_image = gst_droid_media_buffer_create_image;
@@ -249,18 +282,36 @@ droid_media_buffer_allocator_class_init (GstDroidMediaBufferAllocatorClass *
     klass)
 {
   GstAllocatorClass *allocator_class = (GstAllocatorClass *) klass;
+  const gchar *budget;
 
   klass->egl_create_image_khr =
       (PFNEGLCREATEIMAGEKHRPROC) eglGetProcAddress ("eglCreateImageKHR");
+  klass->egl_destroy_image_khr =
+      (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress ("eglDestroyImageKHR");
+
+  budget = g_getenv ("GST_DROID_GRAPHICS_MEMORY_BUDGET");
+  if (budget && !gst_droid_media_buffer_parse_budget (budget,
+          &graphics_memory_budget)) {
+    g_warning ("ignoring malformed GST_DROID_GRAPHICS_MEMORY_BUDGET \"%s\","
+        " expected a byte count with an optional K, M or G suffix", budget);
+  } else if (budget) {
+    GST_INFO ("graphics memory budget %" G_GSIZE_FORMAT " bytes",
+        graphics_memory_budget);
+  }
 
   allocator_class->alloc = NULL;
   allocator_class->free = gst_droid_media_buffer_allocator_free;
 }
 
+/*
+ * A size of 0 means the size is derived from the buffer layout. Memory
+ * wrapping a queue buffer gets NO_SHARE because the graphic buffer goes
+ * back to the HAL once the GstBuffer is released. Copies of it work.
+ */
 static GstDroidMediaBufferMemory *
 gst_droid_media_buffer_allocator_alloc (GstAllocator * allocator,
-    DroidMediaBuffer * buffer, int format_index, gsize width, gsize height,
-    gsize stride, gsize size)
+    DroidMediaBuffer * buffer, const GstDroidFormat * droid_format,
+    gsize width, gsize height, gsize stride, gsize size, GstMemoryFlags flags)
 {
   GstDroidMediaBufferMemory *mem = g_slice_new0 (GstDroidMediaBufferMemory);
   GstFormat format;
@@ -268,24 +319,23 @@ gst_droid_media_buffer_allocator_alloc (GstAllocator * allocator,
   gsize padded_height = height;
 
   mem->buffer = buffer;
+  g_mutex_init (&mem->map_lock);
   mem->map_data = NULL;
   mem->map_flags = 0;
   mem->map_count = 0;
+  mem->image_display = EGL_NO_DISPLAY;
+  mem->image = EGL_NO_IMAGE_KHR;
 
-  if (format_index == GST_DROID_MEDIA_BUFFER_FORMAT_COUNT) {
+  if (!droid_format) {
     format = GST_VIDEO_FORMAT_ENCODED;
   } else {
-    format = gst_droid_media_buffer_formats[format_index].gst_format;
-    if (gst_droid_media_buffer_formats[format_index].bytes_per_pixel != 0) {
-      stride =
-          stride * gst_droid_media_buffer_formats[format_index].bytes_per_pixel;
+    format = droid_format->gst_format;
+    if (droid_format->bytes_per_pixel != 0) {
+      stride = stride * droid_format->bytes_per_pixel;
       padded_width =
-          ALIGN_SIZE (stride,
-          gst_droid_media_buffer_formats[format_index].h_align) /
-          gst_droid_media_buffer_formats[format_index].bytes_per_pixel;
-      padded_height =
-          ALIGN_SIZE (height,
-          gst_droid_media_buffer_formats[format_index].v_align);
+          ALIGN_SIZE (stride, droid_format->h_align) /
+          droid_format->bytes_per_pixel;
+      padded_height = ALIGN_SIZE (height, droid_format->v_align);
     }
   }
 
@@ -293,35 +343,72 @@ gst_droid_media_buffer_allocator_alloc (GstAllocator * allocator,
       padded_height);
   mem->video_info.width = width;
   mem->video_info.height = height;
-  mem->video_info.size = size;
+  if (size != 0) {
+    mem->video_info.size = size;
+  }
 
   // Android YV12 requires alignment of the UV stride too.
   // So we need to reset the gst UV strides and offsets.
-  if (gst_droid_media_buffer_formats[format_index].gst_format ==
-      GST_VIDEO_FORMAT_YV12) {
-    gsize uvStride = ALIGN_SIZE (stride / 2,
-        gst_droid_media_buffer_formats[format_index].h_align);
+  if (droid_format && droid_format->gst_format == GST_VIDEO_FORMAT_YV12) {
+    gsize uvStride = ALIGN_SIZE (stride / 2, droid_format->h_align);
     mem->video_info.stride[1] = uvStride;
     mem->video_info.stride[2] = uvStride;
     mem->video_info.offset[1] = stride * padded_height *
-        gst_droid_media_buffer_formats[format_index].bytes_per_pixel;
+        droid_format->bytes_per_pixel;
     mem->video_info.offset[2] =
         mem->video_info.offset[1] + uvStride * padded_height / 2;
+
+    if (size == 0) {
+      mem->video_info.size =
+          mem->video_info.offset[2] + uvStride * padded_height / 2;
+    }
+  }
+
+  /* Unknown formats can't be mapped in a meaningful way */
+  if (mem->video_info.size == 0) {
+    mem->video_info.size = 1;
   }
 
   gst_memory_init (GST_MEMORY_CAST (mem),
-      GST_MEMORY_FLAG_NO_SHARE, GST_ALLOCATOR (allocator), NULL,
+      flags, GST_ALLOCATOR (allocator), NULL,
       mem->video_info.size, 0, 0, mem->video_info.size);
   return mem;
 }
 
+/*
+ * Bytes of graphics memory behind a queue buffer of a layout we don't know.
+ * The dma-buf knows its size. Without one it is estimated from the stride,
+ * assuming the 4:2:0 layouts the camera and the decoders use.
+ */
+static gsize
+gst_droid_media_buffer_graphic_size (DroidMediaBuffer * buffer,
+    DroidMediaBufferInfo * info)
+{
+#ifdef HAVE_DROID_MEDIA_BUFFER_GET_FD
+  int fd = droid_media_buffer_get_fd (buffer);
+
+  if (fd >= 0) {
+    off_t pos = lseek (fd, 0, SEEK_CUR);
+    off_t end = lseek (fd, 0, SEEK_END);
+
+    lseek (fd, pos > 0 ? pos : 0, SEEK_SET);
+
+    if (end > 0) {
+      return end;
+    }
+  }
+#endif
+
+  return (gsize) MAX (info->stride, info->width) * info->height * 3 / 2;
+}
+
 GstMemory *
 gst_droid_media_buffer_allocator_alloc_from_buffer (GstAllocator * allocator,
     DroidMediaBuffer * buffer)
 {
   GstDroidMediaBufferMemory *mem;
   DroidMediaBufferInfo info;
-  int format_index;
+  const GstDroidFormat *format;
 
   if (!GST_IS_DROID_MEDIA_BUFFER_ALLOCATOR (allocator)) {
     GST_WARNING_OBJECT (allocator,
@@ -331,10 +418,19 @@ gst_droid_media_buffer_allocator_alloc_from_buffer (GstAllocator * allocator,
 
   droid_media_buffer_get_info (buffer, &info);
 
-  format_index = gst_droid_media_buffer_index_of_hal_format (info.format);
+  format = gst_droid_format_from_hal_format (info.format);
 
   mem = gst_droid_media_buffer_allocator_alloc (allocator, buffer,
-      format_index, info.width, info.height, info.stride, 1);
+      format, info.width, info.height, info.stride, 0,
+      GST_MEMORY_FLAG_NO_SHARE);
+
+  /* the memory size of an unknown layout is a placeholder */
+  if (mem->video_info.size > 1) {
+    mem->accounted = mem->video_info.size;
+  } else {
+    mem->accounted = gst_droid_media_buffer_graphic_size (buffer, &info);
+  }
+  gst_droid_media_buffer_charge (allocator, mem->accounted, FALSE);
 
   GST_DEBUG_OBJECT (allocator, "alloc %p", mem);
 
@@ -348,17 +444,16 @@ gst_droid_media_buffer_allocator_alloc_new (GstAllocator * allocator,
   GstDroidMediaBufferMemory *mem;
   DroidMediaBuffer *dbuf;
   DroidMediaBufferInfo droid_info;
+  const GstDroidFormat *format;
 
-  int format_index;
   if (!GST_IS_DROID_MEDIA_BUFFER_ALLOCATOR (allocator)) {
     GST_WARNING_OBJECT (allocator,
         "allocator is not the correct allocator for droidmediabuffer");
     return NULL;
   }
 
-  format_index =
-      gst_droid_media_buffer_index_of_gst_format (info->finfo->format);
-  if (format_index == GST_DROID_MEDIA_BUFFER_FORMAT_COUNT) {
+  format = gst_droid_format_from_gst_format (info->finfo->format);
+  if (!format) {
     GST_WARNING_OBJECT (allocator,
         "Unknown GStreamer format %s",
         gst_video_format_to_string (info->finfo->format));
@@ -366,18 +461,26 @@ gst_droid_media_buffer_allocator_alloc_new (GstAllocator * allocator,
   }
   GST_WARNING_OBJECT (allocator,
       "GStreamer format %s", gst_video_format_to_string (info->finfo->format));
-  dbuf =
-      droid_media_buffer_create (info->width, info->height,
-      gst_droid_media_buffer_formats[format_index].hal_format);
+
+  if (!gst_droid_media_buffer_charge (allocator, info->size, TRUE)) {
+    return NULL;
+  }
+
+  GST_DROID_HAL_TRACE (allocator, "droid_media_buffer_create",
+      dbuf = droid_media_buffer_create (info->width, info->height,
+          format->hal_format));
   if (!dbuf) {
     GST_ERROR_OBJECT (allocator, "failed to acquire media buffer");
+    gst_droid_media_buffer_uncharge (allocator, info->size);
     return NULL;
   }
 
   droid_media_buffer_get_info (dbuf, &droid_info);
   mem =
       gst_droid_media_buffer_allocator_alloc (allocator, dbuf,
-      format_index, info->width, info->height, droid_info.stride, info->size);
+      format, info->width, info->height, droid_info.stride, info->size,
+      0);
+  mem->accounted = info->size;
   GST_DEBUG_OBJECT (allocator, "alloc %p", mem);
   return GST_MEMORY_CAST (mem);
 }
@@ -395,7 +498,22 @@ gst_droid_media_buffer_allocator_free (GstAllocator * allocator,
   GstDroidMediaBufferMemory *m = (GstDroidMediaBufferMemory *) mem;
   GST_DEBUG_OBJECT (allocator, "free %p", m);
 
-  droid_media_buffer_destroy (m->buffer);
+  if (mem->parent) {
+    /* a share. The parent owns the buffer and the image */
+    g_assert (m->image == EGL_NO_IMAGE_KHR);
+    g_slice_free (GstDroidMediaBufferMemory, m);
+    return;
+  }
+
+  gst_droid_media_buffer_memory_release_lock (mem);
+  g_mutex_clear (&m->map_lock);
+
+  gst_droid_media_buffer_uncharge (allocator, m->accounted);
+
+  gst_droid_media_buffer_memory_destroy_image (m);
+
+  GST_DROID_HAL_TRACE (allocator, "droid_media_buffer_destroy",
+      droid_media_buffer_destroy (m->buffer));
   m->buffer = NULL;
   g_slice_free (GstDroidMediaBufferMemory, m);
 }
@@ -426,13 +544,53 @@ gst_droid_media_buffer_memory_get_buffer_from_gst_buffer (GstBuffer * buffer)
   return NULL;
 }
 
+/* Must be called with the map lock held */
+static gpointer
+gst_droid_media_buffer_memory_lock (GstDroidMediaBufferMemory * m, int f)
+{
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) m->mem.allocator;
+
+  gpointer data;
+
+  g_atomic_int_inc (&alloc->locks);
+
+  GST_DROID_HAL_TRACE (alloc, "droid_media_buffer_lock",
+      data = droid_media_buffer_lock (m->buffer, f));
+
+  return data;
+}
+
+/* Must be called with the map lock held */
+static void
+gst_droid_media_buffer_memory_unlock (GstDroidMediaBufferMemory * m)
+{
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) m->mem.allocator;
+
+  g_atomic_int_inc (&alloc->unlocks);
+
+  GST_DROID_HAL_TRACE (alloc, "droid_media_buffer_unlock",
+      droid_media_buffer_unlock (m->buffer));
+  m->map_data = NULL;
+}
+
 gpointer
 gst_droid_media_buffer_memory_map (GstMemory * mem, gsize maxsize,
     GstMapFlags flags)
 {
   GstDroidMediaBufferMemory *m = (GstDroidMediaBufferMemory *) mem;
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) mem->allocator;
+  gpointer data = NULL;
   int f = 0;
   (void) maxsize;
+
+  if (mem->parent) {
+    /* shares lock the parent. gst_memory_map() adds our offset */
+    return gst_droid_media_buffer_memory_map (mem->parent, maxsize, flags);
+  }
+
   if (flags & GST_MAP_READ) {
     f |= DROID_MEDIA_BUFFER_LOCK_READ;
   }
@@ -440,39 +598,223 @@ gst_droid_media_buffer_memory_map (GstMemory * mem, gsize maxsize,
     f |= DROID_MEDIA_BUFFER_LOCK_WRITE;
   }
 
-  if (m->map_count > 0) {
-    if (m->map_flags != f) {
-      GST_ERROR ("Tried to lock buffer with different flags");
-      return NULL;
+  g_mutex_lock (&m->map_lock);
+
+  if (m->map_data && (m->map_flags & f) == f) {
+    /* already locked with everything we need */
+    if (m->map_count == 0) {
+      g_atomic_int_inc (&alloc->cached_maps);
     }
+    f = m->map_flags;
+  } else if (m->map_data && m->map_count == 0) {
+    /* a lazily kept lock with the wrong flags. Nobody uses it */
+    g_atomic_int_inc (&alloc->upgrades);
+    gst_droid_media_buffer_memory_unlock (m);
+    m->map_data = gst_droid_media_buffer_memory_lock (m, f);
+  } else if (m->map_data) {
+    /*
+     * Relocking with more flags would mean unlocking under the existing
+     * mappings and the HAL is free to hand back another address.
+     */
+    GST_ERROR ("memory %p is mapped with flags 0x%x, can't add 0x%x", mem,
+        m->map_flags, f & ~m->map_flags);
+    goto out;
   } else {
-    m->map_data = droid_media_buffer_lock (m->buffer, f);
-    if (!m->map_data) {
-      GST_ERROR ("Tried to lock buffer with different flags");
-      return NULL;
-    }
+    m->map_data = gst_droid_media_buffer_memory_lock (m, f);
+  }
+
+  if (!m->map_data) {
+    GST_ERROR ("Failed to lock buffer");
+    goto out;
   }
 
   m->map_flags = f;
   m->map_count += 1;
-  return m->map_data;
+  data = m->map_data;
+
+out:
+  g_mutex_unlock (&m->map_lock);
+
+  return data;
 }
 
 void
 gst_droid_media_buffer_memory_unmap (GstMemory * mem)
 {
   GstDroidMediaBufferMemory *m = (GstDroidMediaBufferMemory *) mem;
-  if (m->map_count > 0 && (m->map_count -= 1) == 0) {
-    m->map_data = NULL;
-    droid_media_buffer_unlock (m->buffer);
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) mem->allocator;
+
+  if (mem->parent) {
+    gst_droid_media_buffer_memory_unmap (mem->parent);
+    return;
+  }
+
+  g_mutex_lock (&m->map_lock);
+
+  if (m->map_count > 0 && (m->map_count -= 1) == 0 && !alloc->lazy_unlock) {
+    gst_droid_media_buffer_memory_unlock (m);
   }
+
+  g_mutex_unlock (&m->map_lock);
 }
 
+/*
+ * Drops a lock kept around by the lazy unlock policy. Pools call this when
+ * a buffer comes back so the graphic buffer is never locked while the HAL
+ * owns it.
+ */
+void
+gst_droid_media_buffer_memory_release_lock (GstMemory * mem)
+{
+  GstDroidMediaBufferMemory *m = (GstDroidMediaBufferMemory *) mem;
+
+  if (!gst_is_droid_media_buffer_memory (mem) || mem->parent) {
+    return;
+  }
+
+  g_mutex_lock (&m->map_lock);
+
+  if (m->map_data && m->map_count == 0) {
+    gst_droid_media_buffer_memory_unlock (m);
+  }
+
+  g_mutex_unlock (&m->map_lock);
+}
+
+void
+gst_droid_media_buffer_allocator_set_lazy_unlock (GstAllocator * allocator,
+    gboolean lazy_unlock)
+{
+  g_return_if_fail (GST_IS_DROID_MEDIA_BUFFER_ALLOCATOR (allocator));
+
+  ((GstDroidMediaBufferAllocator *) allocator)->lazy_unlock = lazy_unlock;
+}
+
+GstStructure *
+gst_droid_media_buffer_allocator_get_stats (GstAllocator * allocator)
+{
+  GstDroidMediaBufferAllocator *alloc =
+      (GstDroidMediaBufferAllocator *) allocator;
+  GstStructure *s;
+
+  g_return_val_if_fail (GST_IS_DROID_MEDIA_BUFFER_ALLOCATOR (allocator), NULL);
+
+  s = gst_structure_new ("droidmediabuffer-stats",
+      "locks", G_TYPE_UINT, (guint) g_atomic_int_get (&alloc->locks),
+      "unlocks", G_TYPE_UINT, (guint) g_atomic_int_get (&alloc->unlocks),
+      "upgrades", G_TYPE_UINT, (guint) g_atomic_int_get (&alloc->upgrades),
+      "cached-maps", G_TYPE_UINT,
+      (guint) g_atomic_int_get (&alloc->cached_maps), NULL);
+
+  G_LOCK (accounting_lock);
+  gst_droid_media_buffer_accounting_to_structure (&alloc->accounting, s);
+  G_UNLOCK (accounting_lock);
+
+  return s;
+}
+
+/* Graphics memory held by all droid media buffer memories in the process */
+GstStructure *
+gst_droid_media_buffer_get_global_stats (void)
+{
+  GstStructure *s = gst_structure_new ("droidmediabuffer-global-stats",
+      "budget", G_TYPE_UINT64, (guint64) graphics_memory_budget, NULL);
+
+  G_LOCK (accounting_lock);
+  gst_droid_media_buffer_accounting_to_structure (&global_accounting, s);
+  G_UNLOCK (accounting_lock);
+
+  return s;
+}
+
+/* How much more graphics memory the budget allows. G_MAXSIZE without a budget */
+gsize
+gst_droid_media_buffer_get_budget_available (void)
+{
+  gsize available;
+
+  if (graphics_memory_budget == 0) {
+    return G_MAXSIZE;
+  }
+
+  G_LOCK (accounting_lock);
+  available = graphics_memory_budget > global_accounting.bytes ?
+      graphics_memory_budget - global_accounting.bytes : 0;
+  G_UNLOCK (accounting_lock);
+
+  return available;
+}
+
+/*
+ * Copies into system memory with the same layout so any GstVideoMeta
+ * describing the source stays valid for the copy. The graphic buffer is
+ * locked once for the whole copy.
+ */
 static GstMemory *
 gst_droid_media_buffer_memory_copy (GstMemory * mem, gssize offset, gssize size)
 {
-  GST_ERROR ("Cannot copy droidmediabuffer memory!");
-  return NULL;
+  GstMemory *copy;
+  GstMapInfo src, dst;
+
+  if (size == -1) {
+    size = mem->size > offset ? mem->size - offset : 0;
+  }
+
+  if (!gst_memory_map (mem, &src, GST_MAP_READ)) {
+    GST_ERROR ("failed to lock droidmediabuffer memory %p for copying", mem);
+    return NULL;
+  }
+
+  copy = gst_allocator_alloc (NULL, size, NULL);
+
+  if (!gst_memory_map (copy, &dst, GST_MAP_WRITE)) {
+    GST_ERROR ("failed to map copy of droidmediabuffer memory %p", mem);
+    gst_memory_unmap (mem, &src);
+    gst_memory_unref (copy);
+    return NULL;
+  }
+
+  memcpy (dst.data, src.data + offset, size);
+
+  gst_memory_unmap (copy, &dst);
+  gst_memory_unmap (mem, &src);
+
+  GST_LOG ("copied %" G_GSSIZE_FORMAT " bytes of droidmediabuffer memory %p",
+      size, mem);
+
+  return copy;
+}
+
+/* A view on a range of the same graphic buffer. Mapping it locks the parent */
+static GstMemory *
+gst_droid_media_buffer_memory_share (GstMemory * mem, gssize offset,
+    gssize size)
+{
+  GstDroidMediaBufferMemory *m = (GstDroidMediaBufferMemory *) mem;
+  GstDroidMediaBufferMemory *sub;
+  GstMemory *parent;
+
+  if ((parent = mem->parent) == NULL) {
+    parent = mem;
+  }
+
+  if (size == -1) {
+    size = mem->size - offset;
+  }
+
+  sub = g_slice_new0 (GstDroidMediaBufferMemory);
+  sub->buffer = m->buffer;
+  sub->video_info = m->video_info;
+  sub->image_display = EGL_NO_DISPLAY;
+  sub->image = EGL_NO_IMAGE_KHR;
+
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      mem->allocator, parent, mem->maxsize, mem->align,
+      mem->offset + offset, size);
+
+  return GST_MEMORY_CAST (sub);
 }
 
 EGLImageKHR
@@ -495,6 +837,188 @@ gst_droid_media_buffer_create_image (GstMemory * mem, EGLDisplay dpy,
   }
 }
 
+static void
+gst_droid_media_buffer_memory_destroy_image (GstDroidMediaBufferMemory * m)
+{
+  GstDroidMediaBufferAllocatorClass *aclass;
+
+  if (m->image == EGL_NO_IMAGE_KHR) {
+    return;
+  }
+
+  aclass = GST_DROID_MEDIA_BUFFER_ALLOCATOR_GET_CLASS (m->mem.allocator);
+
+  GST_DEBUG ("destroying cached EGLImageKHR %p of memory %p", m->image, m);
+
+  if (aclass->egl_destroy_image_khr
+      && (*aclass->egl_destroy_image_khr) (m->image_display,
+          m->image) != EGL_TRUE) {
+    GST_WARNING ("failed to destroy EGLImageKHR %p", m->image);
+  }
+
+  m->image = EGL_NO_IMAGE_KHR;
+  m->image_display = EGL_NO_DISPLAY;
+}
+
+/*
+ * Unlike nemo_gst_egl_image_memory_create_image() the image returned here
+ * is owned by the memory. It is created the first time it is asked for and
+ * stays around until the memory is freed, which for queue buffers happens
+ * when the pool unbinds them. Asking with a different display replaces it.
+ */
+gpointer
+gst_droid_media_buffer_memory_get_image (GstMemory * mem, gpointer display)
+{
+  GstDroidMediaBufferMemory *m = (GstDroidMediaBufferMemory *) mem;
+  EGLImageKHR image;
+
+  if (!gst_is_droid_media_buffer_memory (mem)) {
+    return EGL_NO_IMAGE_KHR;
+  }
+
+  if (mem->parent) {
+    /* shares use the image of the parent which outlives them */
+    return gst_droid_media_buffer_memory_get_image (mem->parent, display);
+  }
+
+  G_LOCK (image_lock);
+
+  if (m->image != EGL_NO_IMAGE_KHR && m->image_display != display) {
+    gst_droid_media_buffer_memory_destroy_image (m);
+  }
+
+  if (m->image == EGL_NO_IMAGE_KHR) {
+    m->image = gst_droid_media_buffer_create_image (mem, display,
+        EGL_NO_CONTEXT);
+    if (m->image != EGL_NO_IMAGE_KHR) {
+      m->image_display = display;
+      GST_DEBUG ("created EGLImageKHR %p for memory %p", m->image, m);
+    }
+  }
+
+  image = m->image;
+
+  G_UNLOCK (image_lock);
+
+  return image;
+}
+
+/*
+ * Returns the dma-buf fd backing the graphic buffer or -1 if droidmedia
+ * can't give us one. The fd stays owned by the buffer.
+ */
+gint
+gst_droid_media_buffer_memory_get_fd (GstMemory * mem)
+{
+#ifdef HAVE_DROID_MEDIA_BUFFER_GET_FD
+  DroidMediaBuffer *buffer = gst_droid_media_buffer_memory_get_buffer (mem);
+
+  if (buffer) {
+    return droid_media_buffer_get_fd (buffer);
+  }
+#endif
+
+  return -1;
+}
+
+/*
+ * Bytes of the buffer the video meta describes. Memory wrapping queue
+ * buffers of an unknown format has a placeholder size so it can't be used.
+ */
+static gsize
+gst_droid_media_buffer_meta_size (GstBuffer * buffer)
+{
+  GstVideoMeta *meta = gst_buffer_get_video_meta (buffer);
+  const GstVideoFormatInfo *finfo;
+  gsize size = 0;
+  guint i;
+
+  if (!meta) {
+    return 0;
+  }
+
+  finfo = gst_video_format_get_info (meta->format);
+
+  for (i = 0; i < meta->n_planes; i++) {
+    gint height = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo,
+        GST_VIDEO_FORMAT_INFO_PLANE (finfo, i), meta->height);
+
+    size = MAX (size, meta->offset[i] + (gsize) meta->stride[i] * height);
+  }
+
+  return size;
+}
+
+/*
+ * Wraps the graphic buffer of a droid media buffer in dma-buf memory.
+ * The returned buffer carries the metadata of the original one and keeps
+ * it alive through a GstParentBufferMeta so the graphic buffer does not go
+ * back to its queue while a consumer still holds the fd.
+ */
+GstBuffer *
+gst_droid_media_buffer_export_dmabuf (GstBuffer * buffer,
+    GstAllocator * dmabuf_allocator)
+{
+  GstMemory *mem = NULL;
+  GstBuffer *out;
+  gsize size;
+  off_t end;
+  gint fd;
+  gint i;
+
+  for (i = 0; i < gst_buffer_n_memory (buffer); ++i) {
+    GstMemory *m = gst_buffer_peek_memory (buffer, i);
+    if (gst_is_droid_media_buffer_memory (m)) {
+      mem = m;
+      break;
+    }
+  }
+
+  if (!mem) {
+    GST_WARNING ("buffer %p has no droidmediabuffer memory", buffer);
+    return NULL;
+  }
+
+  fd = gst_droid_media_buffer_memory_get_fd (mem);
+  if (fd < 0) {
+    GST_WARNING ("no dma-buf fd for memory %p", mem);
+    return NULL;
+  }
+
+  fd = dup (fd);
+  if (fd < 0) {
+    GST_WARNING ("failed to duplicate dma-buf fd of memory %p", mem);
+    return NULL;
+  }
+
+  /* A dma-buf knows its own size, the GstMemory size may be a placeholder */
+  end = lseek (fd, 0, SEEK_END);
+  if (end > 0) {
+    size = end;
+    /* the duplicate shares the file offset with the original fd */
+    lseek (fd, 0, SEEK_SET);
+  } else {
+    size = gst_droid_media_buffer_meta_size (buffer);
+  }
+
+  if (size == 0) {
+    GST_WARNING ("unknown size of the dma-buf of memory %p", mem);
+    close (fd);
+    return NULL;
+  }
+
+  out = gst_buffer_new ();
+  gst_buffer_append_memory (out,
+      gst_dmabuf_allocator_alloc (dmabuf_allocator, fd, size));
+
+  /* timestamps, flags and the video and crop metas */
+  gst_buffer_copy_into (out, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+
+  gst_buffer_add_parent_buffer_meta (out, buffer);
+
+  return out;
+}
+
 GstVideoInfo *
 gst_droid_media_buffer_get_video_info (GstMemory * mem)
 {
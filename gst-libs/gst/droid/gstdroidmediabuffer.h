@@ -38,10 +38,20 @@ GstMemory    * gst_droid_media_buffer_allocator_alloc_new (GstAllocator * alloca
                                                            GstVideoInfo * info);
 GstMemory    * gst_droid_media_buffer_allocator_alloc_from_buffer (GstAllocator * allocator,
                                                                    DroidMediaBuffer * buffer);
+void           gst_droid_media_buffer_allocator_set_lazy_unlock (GstAllocator * allocator,
+                                                                 gboolean lazy_unlock);
+GstStructure * gst_droid_media_buffer_allocator_get_stats (GstAllocator * allocator);
+GstStructure * gst_droid_media_buffer_get_global_stats (void);
+gsize          gst_droid_media_buffer_get_budget_available (void);
 
 DroidMediaBuffer * gst_droid_media_buffer_memory_get_buffer (GstMemory * mem);
 DroidMediaBuffer * gst_droid_media_buffer_memory_get_buffer_from_gst_buffer (GstBuffer *buffer);
 gboolean       gst_is_droid_media_buffer_memory (GstMemory * mem);
+gpointer       gst_droid_media_buffer_memory_get_image (GstMemory * mem, gpointer display);
+gint           gst_droid_media_buffer_memory_get_fd (GstMemory * mem);
+void           gst_droid_media_buffer_memory_release_lock (GstMemory * mem);
+GstBuffer    * gst_droid_media_buffer_export_dmabuf (GstBuffer * buffer,
+                                                     GstAllocator * dmabuf_allocator);
 
 GstVideoInfo * gst_droid_media_buffer_get_video_info (GstMemory * mem);
 GstVideoInfo * gst_droid_media_buffer_get_video_info_from_gst_buffer (GstBuffer *buffer);
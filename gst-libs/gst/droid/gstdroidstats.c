@@ -0,0 +1,463 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstdroidstats.h"
+#include "gstdroidmediabuffer.h"
+#include <string.h>             /* memset() */
+
+/*
+ * Counters are updated from the streaming thread and the HAL callback
+ * threads. They are cheap enough that a single lock per element is fine.
+ */
+
+static const gchar *stage_names[GST_DROID_STATS_N_STAGES] = {
+  "queue", "hal", "output"
+};
+
+void
+gst_droid_stats_init (GstDroidStats * stats)
+{
+  g_mutex_init (&stats->lock);
+  stats->interval = 0;
+  stats->allocators = g_ptr_array_new_with_free_func (gst_object_unref);
+  stats->retired = gst_structure_new_empty ("droidmediabuffer-stats");
+  gst_droid_stats_reset (stats);
+}
+
+void
+gst_droid_stats_clear (GstDroidStats * stats)
+{
+  g_ptr_array_free (stats->allocators, TRUE);
+  stats->allocators = NULL;
+  gst_structure_free (stats->retired);
+  stats->retired = NULL;
+  g_mutex_clear (&stats->lock);
+}
+
+/* Adds the unsigned fields of src to the ones of the same name in dest */
+static void
+gst_droid_stats_sum_structure (GstStructure * dest, const GstStructure * src)
+{
+  gint i;
+
+  for (i = 0; i < gst_structure_n_fields (src); i++) {
+    const gchar *name = gst_structure_nth_field_name (src, i);
+    const GValue *value = gst_structure_get_value (src, name);
+    /* peaks of different allocators did not necessarily happen together */
+    gboolean peak = g_str_has_prefix (name, "peak-");
+
+    if (G_VALUE_HOLDS_UINT (value)) {
+      guint sum = 0;
+
+      gst_structure_get_uint (dest, name, &sum);
+      gst_structure_set (dest, name, G_TYPE_UINT,
+          peak ? MAX (sum, g_value_get_uint (value)) :
+          sum + g_value_get_uint (value), NULL);
+    } else if (G_VALUE_HOLDS_UINT64 (value)) {
+      guint64 sum = 0;
+
+      gst_structure_get_uint64 (dest, name, &sum);
+      gst_structure_set (dest, name, G_TYPE_UINT64,
+          peak ? MAX (sum, g_value_get_uint64 (value)) :
+          sum + g_value_get_uint64 (value), NULL);
+    }
+  }
+}
+
+/*
+ * Reports the lock and graphics memory counters of a droid media buffer
+ * allocator with the element stats. Allocators only we still hold on to
+ * have no memory left so their counters are folded into retired.
+ */
+void
+gst_droid_stats_track_allocator (GstDroidStats * stats,
+    GstAllocator * allocator)
+{
+  guint i;
+
+  if (!allocator
+      || g_strcmp0 (allocator->mem_type, GST_ALLOCATOR_DROID_MEDIA_BUFFER)) {
+    return;
+  }
+
+  g_mutex_lock (&stats->lock);
+
+  for (i = 0; i < stats->allocators->len;) {
+    GstAllocator *tracked = g_ptr_array_index (stats->allocators, i);
+
+    if (tracked == allocator) {
+      g_mutex_unlock (&stats->lock);
+      return;
+    }
+
+    if (GST_OBJECT_REFCOUNT_VALUE (tracked) == 1) {
+      GstStructure *s = gst_droid_media_buffer_allocator_get_stats (tracked);
+
+      gst_droid_stats_sum_structure (stats->retired, s);
+      gst_structure_free (s);
+      g_ptr_array_remove_index_fast (stats->allocators, i);
+    } else {
+      i++;
+    }
+  }
+
+  g_ptr_array_add (stats->allocators, gst_object_ref (allocator));
+
+  g_mutex_unlock (&stats->lock);
+}
+
+void
+gst_droid_stats_reset (GstDroidStats * stats)
+{
+  g_mutex_lock (&stats->lock);
+
+  memset (stats->counters, 0x0, sizeof (stats->counters));
+  memset (stats->latency, 0x0, sizeof (stats->latency));
+  stats->hal_calls = 0;
+  stats->hal_time = 0;
+  stats->hal_max = 0;
+  stats->last_post = GST_CLOCK_TIME_NONE;
+
+  g_mutex_unlock (&stats->lock);
+}
+
+void
+gst_droid_stats_add (GstDroidStats * stats, GstDroidStatsCounter counter,
+    guint64 value)
+{
+  g_mutex_lock (&stats->lock);
+  stats->counters[counter] += value;
+  g_mutex_unlock (&stats->lock);
+}
+
+void
+gst_droid_stats_add_latency (GstDroidStats * stats, GstDroidStatsStage stage,
+    GstClockTime latency)
+{
+  guint64 us;
+  guint bucket;
+
+  if (!GST_CLOCK_TIME_IS_VALID (latency)) {
+    return;
+  }
+
+  us = GST_TIME_AS_USECONDS (latency);
+  bucket = us ? g_bit_storage (us) - 1 : 0;
+  bucket = MIN (bucket, GST_DROID_STATS_N_BUCKETS - 1);
+
+  g_mutex_lock (&stats->lock);
+  stats->latency[stage][bucket]++;
+  g_mutex_unlock (&stats->lock);
+}
+
+void
+gst_droid_stats_add_hal_call (GstDroidStats * stats, GstClockTime duration)
+{
+  g_mutex_lock (&stats->lock);
+  stats->hal_calls++;
+  stats->hal_time += duration;
+  stats->hal_max = MAX (stats->hal_max, duration);
+  g_mutex_unlock (&stats->lock);
+}
+
+void
+gst_droid_stats_set_interval (GstDroidStats * stats, guint interval)
+{
+  g_mutex_lock (&stats->lock);
+  stats->interval = interval;
+  g_mutex_unlock (&stats->lock);
+}
+
+guint
+gst_droid_stats_get_interval (GstDroidStats * stats)
+{
+  guint interval;
+
+  g_mutex_lock (&stats->lock);
+  interval = stats->interval;
+  g_mutex_unlock (&stats->lock);
+
+  return interval;
+}
+
+static guint
+gst_droid_stats_field_uint (const GstStructure * s, const gchar * name)
+{
+  guint value = 0;
+
+  gst_structure_get_uint (s, name, &value);
+
+  return value;
+}
+
+static guint64
+gst_droid_stats_field_uint64 (const GstStructure * s, const gchar * name)
+{
+  guint64 value = 0;
+
+  gst_structure_get_uint64 (s, name, &value);
+
+  return value;
+}
+
+/* Upper bound of the bucket holding the given percentile */
+static GstClockTime
+gst_droid_stats_percentile (guint64 * buckets, guint percentile)
+{
+  guint64 total = 0;
+  guint64 target;
+  guint64 seen = 0;
+  guint i;
+
+  for (i = 0; i < GST_DROID_STATS_N_BUCKETS; i++) {
+    total += buckets[i];
+  }
+
+  if (total == 0) {
+    return 0;
+  }
+
+  target = (total * percentile + 99) / 100;
+
+  for (i = 0; i < GST_DROID_STATS_N_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= target) {
+      break;
+    }
+  }
+
+  return (G_GUINT64_CONSTANT (2) << MIN (i, GST_DROID_STATS_N_BUCKETS - 1)) *
+      GST_USECOND;
+}
+
+/* Must be called with the stats lock held */
+static void
+gst_droid_stats_add_memory (GstDroidStats * stats, GstStructure * s)
+{
+  GstStructure *memory = gst_structure_copy (stats->retired);
+  GstStructure *global = gst_droid_media_buffer_get_global_stats ();
+  guint i;
+
+  for (i = 0; i < stats->allocators->len; i++) {
+    GstStructure *as =
+        gst_droid_media_buffer_allocator_get_stats (g_ptr_array_index
+        (stats->allocators, i));
+
+    gst_droid_stats_sum_structure (memory, as);
+    gst_structure_free (as);
+  }
+
+  /* graphics-* is what this element holds, process-graphics-* what all
+   * droid media buffers in the process hold against graphics-budget */
+  gst_structure_set (s,
+      "buffer-locks", G_TYPE_UINT,
+      gst_droid_stats_field_uint (memory, "locks"),
+      "buffer-unlocks", G_TYPE_UINT,
+      gst_droid_stats_field_uint (memory, "unlocks"),
+      "buffer-lock-upgrades", G_TYPE_UINT,
+      gst_droid_stats_field_uint (memory, "upgrades"),
+      "buffer-cached-maps", G_TYPE_UINT,
+      gst_droid_stats_field_uint (memory, "cached-maps"),
+      "graphics-bytes", G_TYPE_UINT64,
+      gst_droid_stats_field_uint64 (memory, "bytes"),
+      "graphics-buffers", G_TYPE_UINT,
+      gst_droid_stats_field_uint (memory, "buffers"),
+      "graphics-peak-bytes", G_TYPE_UINT64,
+      gst_droid_stats_field_uint64 (memory, "peak-bytes"),
+      "graphics-peak-buffers", G_TYPE_UINT,
+      gst_droid_stats_field_uint (memory, "peak-buffers"),
+      "process-graphics-bytes", G_TYPE_UINT64,
+      gst_droid_stats_field_uint64 (global, "bytes"),
+      "process-graphics-buffers", G_TYPE_UINT,
+      gst_droid_stats_field_uint (global, "buffers"),
+      "process-graphics-peak-bytes", G_TYPE_UINT64,
+      gst_droid_stats_field_uint64 (global, "peak-bytes"),
+      "graphics-budget", G_TYPE_UINT64,
+      gst_droid_stats_field_uint64 (global, "budget"), NULL);
+
+  gst_structure_free (global);
+  gst_structure_free (memory);
+}
+
+/* Must be called with the stats lock held */
+static GstStructure *
+gst_droid_stats_build_structure (GstDroidStats * stats)
+{
+  GstStructure *s;
+  guint i;
+
+  s = gst_structure_new ("droid-stats",
+      "frames-in", G_TYPE_UINT64, stats->counters[GST_DROID_STATS_FRAMES_IN],
+      "frames-out", G_TYPE_UINT64, stats->counters[GST_DROID_STATS_FRAMES_OUT],
+      "frames-dropped", G_TYPE_UINT64,
+      stats->counters[GST_DROID_STATS_FRAMES_DROPPED],
+      "pool-starvations", G_TYPE_UINT64,
+      stats->counters[GST_DROID_STATS_POOL_STARVATIONS],
+      "copy-bytes", G_TYPE_UINT64, stats->counters[GST_DROID_STATS_COPY_BYTES],
+      "hal-calls", G_TYPE_UINT64, stats->hal_calls,
+      "hal-time", G_TYPE_UINT64, stats->hal_time,
+      "hal-max", G_TYPE_UINT64, stats->hal_max, NULL);
+
+  gst_droid_stats_add_memory (stats, s);
+
+  for (i = 0; i < GST_DROID_STATS_N_STAGES; i++) {
+    gchar *p50 = g_strdup_printf ("%s-latency-p50", stage_names[i]);
+    gchar *p90 = g_strdup_printf ("%s-latency-p90", stage_names[i]);
+    gchar *p99 = g_strdup_printf ("%s-latency-p99", stage_names[i]);
+
+    gst_structure_set (s,
+        p50, G_TYPE_UINT64,
+        gst_droid_stats_percentile (stats->latency[i], 50),
+        p90, G_TYPE_UINT64,
+        gst_droid_stats_percentile (stats->latency[i], 90),
+        p99, G_TYPE_UINT64,
+        gst_droid_stats_percentile (stats->latency[i], 99), NULL);
+
+    g_free (p50);
+    g_free (p90);
+    g_free (p99);
+  }
+
+  return s;
+}
+
+GstStructure *
+gst_droid_stats_get_structure (GstDroidStats * stats)
+{
+  GstStructure *s;
+
+  g_mutex_lock (&stats->lock);
+  s = gst_droid_stats_build_structure (stats);
+  g_mutex_unlock (&stats->lock);
+
+  return s;
+}
+
+/* Posts the stats as an element message if the interval has passed */
+void
+gst_droid_stats_post (GstDroidStats * stats, GstElement * element)
+{
+  GstStructure *s = NULL;
+  GstClockTime now;
+
+  g_mutex_lock (&stats->lock);
+
+  if (stats->interval == 0) {
+    g_mutex_unlock (&stats->lock);
+    return;
+  }
+
+  now = gst_util_get_timestamp ();
+
+  if (!GST_CLOCK_TIME_IS_VALID (stats->last_post)
+      || now - stats->last_post >= stats->interval * GST_MSECOND) {
+    stats->last_post = now;
+    s = gst_droid_stats_build_structure (stats);
+  }
+
+  g_mutex_unlock (&stats->lock);
+
+  if (s) {
+    gst_element_post_message (element,
+        gst_message_new_element (GST_OBJECT (element), s));
+  }
+}
+
+void
+gst_droid_stats_install_properties (GObjectClass * klass, guint stats_prop,
+    guint interval_prop)
+{
+  g_object_class_install_property (klass, stats_prop,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Frame, latency, HAL and copy statistics", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (klass, interval_prop,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Milliseconds between droid-stats element messages (0 = disabled)",
+          0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+}
+
+/* Remembers when a frame was handed to the HAL */
+void
+gst_droid_stats_mark_frame (GstVideoCodecFrame * frame)
+{
+  GstClockTime *mark = g_new (GstClockTime, 1);
+
+  *mark = gst_util_get_timestamp ();
+
+  gst_video_codec_frame_set_user_data (frame, mark, g_free);
+}
+
+GstClockTime
+gst_droid_stats_get_frame_mark (GstVideoCodecFrame * frame)
+{
+  GstClockTime *mark = gst_video_codec_frame_get_user_data (frame);
+
+  return mark ? *mark : GST_CLOCK_TIME_NONE;
+}
+
+static GQuark
+gst_droid_stats_buffer_mark_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (!quark)) {
+    quark = g_quark_from_static_string ("GstDroidStatsBufferMark");
+  }
+
+  return quark;
+}
+
+/* Remembers when the HAL handed us the data of a buffer */
+void
+gst_droid_stats_mark_buffer (GstBuffer * buffer, GstClockTime received)
+{
+  GstClockTime *mark = g_new (GstClockTime, 1);
+
+  *mark = received;
+
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buffer),
+      gst_droid_stats_buffer_mark_quark (), mark, g_free);
+}
+
+/* Pool buffers come back so the mark is removed once read */
+GstClockTime
+gst_droid_stats_take_buffer_mark (GstBuffer * buffer)
+{
+  GstClockTime *mark, ret;
+
+  mark = gst_mini_object_steal_qdata (GST_MINI_OBJECT_CAST (buffer),
+      gst_droid_stats_buffer_mark_quark ());
+  if (!mark) {
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  ret = *mark;
+  g_free (mark);
+
+  return ret;
+}
@@ -0,0 +1,114 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_DROID_STATS_H__
+#define __GST_DROID_STATS_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstDroidStats GstDroidStats;
+typedef enum _GstDroidStatsCounter GstDroidStatsCounter;
+typedef enum _GstDroidStatsStage GstDroidStatsStage;
+
+enum _GstDroidStatsCounter
+{
+  GST_DROID_STATS_FRAMES_IN,
+  GST_DROID_STATS_FRAMES_OUT,
+  GST_DROID_STATS_FRAMES_DROPPED,
+  GST_DROID_STATS_POOL_STARVATIONS,
+  GST_DROID_STATS_COPY_BYTES,
+  GST_DROID_STATS_N_COUNTERS,
+};
+
+/* A frame goes from the element into the HAL and back out downstream */
+enum _GstDroidStatsStage
+{
+  GST_DROID_STATS_STAGE_QUEUE,
+  GST_DROID_STATS_STAGE_HAL,
+  GST_DROID_STATS_STAGE_OUTPUT,
+  GST_DROID_STATS_N_STAGES,
+};
+
+/* Latencies are kept in power of two microsecond buckets */
+#define GST_DROID_STATS_N_BUCKETS 24
+
+struct _GstDroidStats
+{
+  GMutex lock;
+
+  guint64 counters[GST_DROID_STATS_N_COUNTERS];
+  guint64 hal_calls;
+  GstClockTime hal_time;
+  GstClockTime hal_max;
+  guint64 latency[GST_DROID_STATS_N_STAGES][GST_DROID_STATS_N_BUCKETS];
+
+  /* milliseconds between stats messages. 0 disables them */
+  guint interval;
+  GstClockTime last_post;
+
+  /* droid media buffer allocators used by the element */
+  GPtrArray *allocators;
+  /* what allocators nobody else used anymore had counted */
+  GstStructure *retired;
+};
+
+void gst_droid_stats_init (GstDroidStats * stats);
+void gst_droid_stats_clear (GstDroidStats * stats);
+void gst_droid_stats_reset (GstDroidStats * stats);
+
+void gst_droid_stats_add (GstDroidStats * stats, GstDroidStatsCounter counter,
+    guint64 value);
+void gst_droid_stats_add_latency (GstDroidStats * stats,
+    GstDroidStatsStage stage, GstClockTime latency);
+void gst_droid_stats_add_hal_call (GstDroidStats * stats,
+    GstClockTime duration);
+
+void gst_droid_stats_track_allocator (GstDroidStats * stats,
+    GstAllocator * allocator);
+
+void gst_droid_stats_set_interval (GstDroidStats * stats, guint interval);
+guint gst_droid_stats_get_interval (GstDroidStats * stats);
+
+GstStructure *gst_droid_stats_get_structure (GstDroidStats * stats);
+void gst_droid_stats_post (GstDroidStats * stats, GstElement * element);
+
+void gst_droid_stats_install_properties (GObjectClass * klass,
+    guint stats_prop, guint interval_prop);
+
+void gst_droid_stats_mark_frame (GstVideoCodecFrame * frame);
+GstClockTime gst_droid_stats_get_frame_mark (GstVideoCodecFrame * frame);
+
+void gst_droid_stats_mark_buffer (GstBuffer * buffer, GstClockTime received);
+GstClockTime gst_droid_stats_take_buffer_mark (GstBuffer * buffer);
+
+/* Times a HAL call. The call is always made */
+#define GST_DROID_STATS_HAL_CALL(stats, call) G_STMT_START {     \
+  GstClockTime __droid_stats_start = gst_util_get_timestamp ();  \
+  call;                                                          \
+  gst_droid_stats_add_hal_call ((stats),                         \
+      gst_util_get_timestamp () - __droid_stats_start);          \
+} G_STMT_END
+
+G_END_DECLS
+
+#endif /* __GST_DROID_STATS_H__ */
@@ -126,6 +126,7 @@ static guint droidcamsrc_signals[LAST_SIGNAL];
 #define DEFAULT_JPEG_QUALITY           90
 #define DEFAULT_MIN_JPEG_QUALITY       10
 #define DEFAULT_MAX_JPEG_QUALITY       100
+#define DEFAULT_LAZY_UNLOCK            FALSE
 
 static GstDroidCamSrcPad *
 gst_droidcamsrc_create_pad (GstDroidCamSrc * src,
@@ -196,6 +197,8 @@ gst_droidcamsrc_init (GstDroidCamSrc * src)
   src->fps_d = 1;
   src->target_bitrate = DEFAULT_TARGET_BITRATE;
   src->jpeg_quality = DEFAULT_JPEG_QUALITY;
+  src->lazy_unlock = DEFAULT_LAZY_UNLOCK;
+  gst_droid_stats_init (&src->stats);
 
   gst_droidcamsrc_photography_init (src);
 
@@ -346,6 +349,20 @@ gst_droidcamsrc_get_property (GObject * object, guint prop_id, GValue * value,
       g_value_set_uint (value, src->jpeg_quality);
       break;
 
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_droid_stats_get_structure (&src->stats));
+      break;
+
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_droid_stats_get_interval (&src->stats));
+      break;
+
+    case PROP_LAZY_UNLOCK:
+      GST_OBJECT_LOCK (src);
+      g_value_set_boolean (value, src->lazy_unlock);
+      GST_OBJECT_UNLOCK (src);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -498,6 +515,16 @@ gst_droidcamsrc_set_property (GObject * object, guint prop_id,
       gst_droidcamsrc_apply_mode_settings (src, SET_AND_APPLY);
       break;
 
+    case PROP_STATS_INTERVAL:
+      gst_droid_stats_set_interval (&src->stats, g_value_get_uint (value));
+      break;
+
+    case PROP_LAZY_UNLOCK:
+      GST_OBJECT_LOCK (src);
+      src->lazy_unlock = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -537,6 +564,8 @@ gst_droidcamsrc_finalize (GObject * object)
     gst_caps_replace (&src->preview_caps, NULL);
   }
 
+  gst_droid_stats_clear (&src->stats);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -646,6 +675,8 @@ gst_droidcamsrc_change_state (GstElement * element, GstStateChange transition)
       src->dev =
           gst_droidcamsrc_dev_new (src->vfsrc, src->imgsrc,
           src->vidsrc, &src->dev_lock);
+      gst_droid_stats_track_allocator (&src->stats,
+          src->dev->media_allocator);
 
       /* find the device */
       info = gst_droidcamsrc_find_camera_device (src);
@@ -1238,6 +1269,16 @@ gst_droidcamsrc_class_init (GstDroidCamSrcClass * klass)
           "A custom preview filter to process preview image data",
           GST_TYPE_ELEMENT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  gst_droid_stats_install_properties (gobject_class, PROP_STATS,
+      PROP_STATS_INTERVAL);
+
+  g_object_class_install_property (gobject_class, PROP_LAZY_UNLOCK,
+      g_param_spec_boolean ("lazy-unlock", "Lazy unlock",
+          "Keep viewfinder graphic buffers locked between maps until they "
+          "return to the pool", DEFAULT_LAZY_UNLOCK,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   gst_droidcamsrc_photography_add_overrides (gobject_class);
 
   /* Signals */
@@ -1264,6 +1305,7 @@ gst_droidcamsrc_loop (gpointer user_data)
   GstDroidCamSrc *src = GST_DROIDCAMSRC (GST_PAD_PARENT (data->pad));
   GstBuffer *buffer = NULL;
   GstPad *pad = data->pad;
+  GstClockTime received;
 
   GList *events;
 
@@ -1334,6 +1376,13 @@ exit:
   return;
 
 out:
+  /* time the buffer spent in our queue since the HAL handed it over */
+  received = gst_droid_stats_take_buffer_mark (buffer);
+  if (GST_CLOCK_TIME_IS_VALID (received)) {
+    gst_droid_stats_add_latency (&src->stats, GST_DROID_STATS_STAGE_QUEUE,
+        gst_util_get_timestamp () - received);
+  }
+
   /* segment */
   if (G_UNLIKELY (data->open_segment)) {
     GstEvent *event;
@@ -1376,6 +1425,13 @@ out:
   GST_LOG_OBJECT (pad, "pushing buffer %p", buffer);
   ret = gst_pad_push (data->pad, buffer);
 
+  if (GST_CLOCK_TIME_IS_VALID (received)) {
+    gst_droid_stats_add_latency (&src->stats, GST_DROID_STATS_STAGE_OUTPUT,
+        gst_util_get_timestamp () - received);
+  }
+  gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_OUT, 1);
+  gst_droid_stats_post (&src->stats, GST_ELEMENT (src));
+
   if (G_UNLIKELY (ret != GST_FLOW_OK)) {
     GST_INFO_OBJECT (src, "error %s pushing buffer through pad %s",
         gst_flow_get_name (ret), GST_PAD_NAME (data->pad));
@@ -1826,7 +1882,7 @@ gst_droidcamsrc_vfsrc_negotiate (GstDroidCamSrcPad * data)
       config = gst_buffer_pool_get_config (pool);
       gst_buffer_pool_config_set_params (config, our_caps, size, min, max);
 
-      if (!gst_buffer_pool_set_config (pool, config)) {
+      if (!gst_droid_buffer_pool_apply_config (pool, config)) {
         GST_ERROR_OBJECT (src, "Failed to set buffer pool configuration");
         gst_object_unref (pool);
         pool = NULL;
@@ -1836,6 +1892,28 @@ gst_droidcamsrc_vfsrc_negotiate (GstDroidCamSrcPad * data)
     }
   }
 
+  if (pool && GST_IS_DROID_BUFFER_POOL (pool)) {
+    GstAllocator *allocator = gst_droid_buffer_pool_get_allocator (pool);
+    gboolean lazy_unlock;
+
+    gst_droid_stats_track_allocator (&src->stats, allocator);
+    gst_object_unref (allocator);
+
+    GST_OBJECT_LOCK (src);
+    lazy_unlock = src->lazy_unlock;
+    GST_OBJECT_UNLOCK (src);
+
+    if (lazy_unlock && !gst_buffer_pool_is_active (pool)) {
+      GstStructure *config = gst_buffer_pool_get_config (pool);
+
+      gst_buffer_pool_config_add_option (config,
+          GST_BUFFER_POOL_OPTION_DROID_MEDIA_BUFFER_LAZY_UNLOCK);
+      if (!gst_droid_buffer_pool_apply_config (pool, config)) {
+        GST_WARNING_OBJECT (src, "failed to enable lazy unlock");
+      }
+    }
+  }
+
   g_rec_mutex_lock (&src->dev_lock);
   src->dev->use_raw_data = use_raw_data;
 
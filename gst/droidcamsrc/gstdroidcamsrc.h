@@ -36,6 +36,7 @@
 #include <gst/basecamerabinsrc/gstbasecamerasrc.h>
 #include "droidmediacamera.h"
 #include "gstdroidcamsrcmode.h"
+#include "gst/droid/gstdroidstats.h"
 
 G_BEGIN_DECLS
 
@@ -135,6 +136,9 @@ struct _GstDroidCamSrc
   gint height;
   gint fps_n, fps_d;
   DroidMediaRect crop_rect;
+  gboolean lazy_unlock;
+
+  GstDroidStats stats;
 };
 
 struct _GstDroidCamSrcClass
@@ -31,6 +31,7 @@
 #include "gst/droid/gstdroidmediabuffer.h"
 #include "gst/droid/gstwrappedmemory.h"
 #include "gst/droid/gstdroidbufferpool.h"
+#include "gst/droid/gstdroidhaltrace.h"
 #include <string.h>             /* memcpy() */
 #ifndef GST_USE_UNSTABLE_API
 #define GST_USE_UNSTABLE_API
@@ -194,6 +195,7 @@ gst_droidcamsrc_dev_compressed_image_callback (void *user, DroidMediaData * mem)
   GstTagList *tags;
   GstEvent *event = NULL;
   void *d;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (src, "dev compressed image callback");
 
@@ -205,6 +207,8 @@ gst_droidcamsrc_dev_compressed_image_callback (void *user, DroidMediaData * mem)
   /* TODO: research a way to get rid of the memcpy */
   d = g_malloc (size);
   memcpy (d, data, size);
+  gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_IN, 1);
+  gst_droid_stats_add (&src->stats, GST_DROID_STATS_COPY_BYTES, size);
   buffer = gst_buffer_new_wrapped (d, size);
   if (!dev->img->image_preview_sent) {
     gst_droidcamsrc_post_message (src,
@@ -214,6 +218,7 @@ gst_droidcamsrc_dev_compressed_image_callback (void *user, DroidMediaData * mem)
   }
 
   gst_droidcamsrc_timestamp (src, buffer);
+  gst_droid_stats_mark_buffer (buffer, received);
 
   tags = gst_droidcamsrc_exif_tags_from_jpeg_data (d, size);
   if (tags) {
@@ -284,11 +289,13 @@ gst_droidcamsrc_dev_preview_frame_callback (void *user,
   GstBuffer *buffer;
   gsize width, height;
   DroidMediaRect rect;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (src, "dev preview frame callback");
 
   buffer = gst_buffer_new_allocate (NULL, mem->size, NULL);
   gst_buffer_fill (buffer, 0, mem->data, mem->size);
+  gst_droid_stats_add (&src->stats, GST_DROID_STATS_COPY_BYTES, mem->size);
 
   GST_OBJECT_LOCK (src);
   width = src->width;
@@ -310,6 +317,8 @@ gst_droidcamsrc_dev_preview_frame_callback (void *user,
    * 2) We can get called when we start the preview and we will deadlock because the lock is already held
    */
   if (dev->use_raw_data) {
+    gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_IN, 1);
+    gst_droid_stats_mark_buffer (buffer, received);
     g_mutex_lock (&pad->lock);
     g_queue_push_tail (pad->queue, buffer);
     g_cond_signal (&pad->cond);
@@ -329,9 +338,12 @@ gst_droidcamsrc_dev_video_frame_callback (void *user,
   GstBuffer *buffer;
   GstMemory *mem;
   GstDroidCamSrcDevVideoData *mem_data;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (src, "dev video frame callback");
 
+  gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   g_mutex_lock (&dev->vid->lock);
 
   /* TODO: not sure what to do with timestamp */
@@ -339,7 +351,8 @@ gst_droidcamsrc_dev_video_frame_callback (void *user,
   /* unlikely but just in case */
   if (G_UNLIKELY (!data)) {
     GST_ERROR ("invalid memory from camera HAL");
-    droid_media_camera_release_recording_frame (dev->cam, video_data);
+    GST_DROID_HAL_TRACE (src, "droid_media_camera_release_recording_frame",
+        droid_media_camera_release_recording_frame (dev->cam, video_data));
     goto unlock_and_out;
   }
 
@@ -355,6 +368,7 @@ gst_droidcamsrc_dev_video_frame_callback (void *user,
   gst_buffer_insert_memory (buffer, 0, mem);
 
   gst_droidcamsrc_timestamp (src, buffer);
+  gst_droid_stats_mark_buffer (buffer, received);
 
   gst_droidcamsrc_dev_queue_video_buffer_locked (dev, buffer);
 
@@ -470,9 +484,12 @@ gst_droidcamsrc_dev_frame_available (void *user, DroidMediaBuffer * buffer)
   GstBuffer *buff = NULL;
   GstBufferPool *pool;
   DroidMediaBufferInfo info;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (src, "frame available");
 
+  gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   droid_media_buffer_get_info (buffer, &info);
 
   rect = droid_media_buffer_get_crop_rect (buffer);
@@ -483,6 +500,7 @@ gst_droidcamsrc_dev_frame_available (void *user, DroidMediaBuffer * buffer)
 
   if (!pad->running) {
     GST_DEBUG_OBJECT (src, "vfsrc pad task is not running");
+    gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
 
     return false;
   }
@@ -508,11 +526,14 @@ gst_droidcamsrc_dev_frame_available (void *user, DroidMediaBuffer * buffer)
   if (G_UNLIKELY (!buff)) {
     GST_WARNING_OBJECT (src,
         "unable to acquire a gstreamer buffer for a droid media buffer");
+    gst_droid_stats_add (&src->stats, GST_DROID_STATS_POOL_STARVATIONS, 1);
+    gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
     return false;
   }
 
   gst_droidcamsrc_dev_prepare_buffer (dev, buff, rect,
       gst_droid_media_buffer_get_video_info_from_gst_buffer (buff));
+  gst_droid_stats_mark_buffer (buff, received);
 
   g_mutex_lock (&pad->lock);
   g_queue_push_tail (pad->queue, buff);
@@ -572,6 +593,7 @@ gst_droidcamsrc_dev_open (GstDroidCamSrcDev * dev, GstDroidCamSrcCamInfo * info)
   GstDroidCamSrc *src;
   DroidMediaColourFormatConstants constants;
   int hal_format;
+  bool locked;
 
   droid_media_colour_format_constants_init (&constants);
 
@@ -582,7 +604,8 @@ gst_droidcamsrc_dev_open (GstDroidCamSrcDev * dev, GstDroidCamSrcCamInfo * info)
   GST_DEBUG_OBJECT (src, "dev open");
 
   dev->info = info;
-  dev->cam = droid_media_camera_connect (dev->info->num);
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_connect",
+      dev->cam = droid_media_camera_connect (dev->info->num));
 
   if (!dev->cam) {
     g_rec_mutex_unlock (dev->lock);
@@ -610,8 +633,11 @@ gst_droidcamsrc_dev_open (GstDroidCamSrcDev * dev, GstDroidCamSrcCamInfo * info)
 
   dev->queue = droid_media_camera_get_buffer_queue (dev->cam);
 
-  if (!droid_media_camera_lock (dev->cam)) {
-    droid_media_camera_disconnect (dev->cam);
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_lock",
+      locked = droid_media_camera_lock (dev->cam));
+  if (!locked) {
+    GST_DROID_HAL_TRACE (src, "droid_media_camera_disconnect",
+        droid_media_camera_disconnect (dev->cam));
     dev->cam = NULL;
     dev->queue = NULL;
 
@@ -636,7 +662,8 @@ gst_droidcamsrc_dev_close (GstDroidCamSrcDev * dev)
   g_rec_mutex_lock (dev->lock);
 
   if (dev->cam) {
-    droid_media_camera_disconnect (dev->cam);
+    GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad), "droid_media_camera_disconnect",
+        droid_media_camera_disconnect (dev->cam));
     dev->cam = NULL;
     dev->queue = NULL;
   }
@@ -737,6 +764,7 @@ gst_droidcamsrc_dev_start (GstDroidCamSrcDev * dev, gboolean apply_settings)
 {
   gboolean ret = FALSE;
   GstDroidCamSrc *src = GST_DROIDCAMSRC (GST_PAD_PARENT (dev->imgsrc->pad));
+  bool started;
 
   g_rec_mutex_lock (dev->lock);
 
@@ -770,7 +798,10 @@ gst_droidcamsrc_dev_start (GstDroidCamSrcDev * dev, gboolean apply_settings)
     goto out;
   }
 
-  if (!droid_media_camera_start_preview (dev->cam)) {
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_start_preview",
+      GST_DROID_STATS_HAL_CALL (&src->stats,
+          started = droid_media_camera_start_preview (dev->cam)));
+  if (!started) {
     GST_ERROR_OBJECT (src, "error starting preview");
     goto out;
   }
@@ -803,7 +834,8 @@ gst_droidcamsrc_dev_stop (GstDroidCamSrcDev * dev)
     if (dev->pool) {
       gst_buffer_pool_set_active (dev->pool, FALSE);
     }
-    droid_media_camera_stop_preview (dev->cam);
+    GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad), "droid_media_camera_stop_preview",
+        droid_media_camera_stop_preview (dev->cam));
     dev->running = FALSE;
     GST_DEBUG ("stopped preview");
   }
@@ -820,6 +852,7 @@ gst_droidcamsrc_dev_stop (GstDroidCamSrcDev * dev)
 gboolean
 gst_droidcamsrc_dev_set_params (GstDroidCamSrcDev * dev)
 {
+  GstDroidCamSrc *src = GST_DROIDCAMSRC (GST_PAD_PARENT (dev->imgsrc->pad));
   bool err;
   gboolean ret = FALSE;
   gchar *params;
@@ -843,7 +876,9 @@ gst_droidcamsrc_dev_set_params (GstDroidCamSrcDev * dev)
 
   params = gst_droidcamsrc_params_to_string (dev->params);
   GST_LOG ("setting parameters %s", params);
-  err = droid_media_camera_set_parameters (dev->cam, params);
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_set_parameters",
+      GST_DROID_STATS_HAL_CALL (&src->stats,
+          err = droid_media_camera_set_parameters (dev->cam, params)));
   g_free (params);
 
   if (!err) {
@@ -865,6 +900,7 @@ gst_droidcamsrc_dev_capture_image (GstDroidCamSrcDev * dev)
   GstDroidCamSrc *src = GST_DROIDCAMSRC (GST_PAD_PARENT (dev->imgsrc->pad));
 
   gboolean ret = FALSE;
+  bool taken;
   int msg_type = dev->c.CAMERA_MSG_SHUTTER | dev->c.CAMERA_MSG_RAW_IMAGE
       | dev->c.CAMERA_MSG_POSTVIEW_FRAME | dev->c.CAMERA_MSG_COMPRESSED_IMAGE;
 
@@ -899,7 +935,10 @@ gst_droidcamsrc_dev_capture_image (GstDroidCamSrcDev * dev)
 
   dev->img->preview_image_requested = src->post_preview;
 
-  if (!droid_media_camera_take_picture (dev->cam, msg_type)) {
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_take_picture",
+      GST_DROID_STATS_HAL_CALL (&src->stats,
+          taken = droid_media_camera_take_picture (dev->cam, msg_type)));
+  if (!taken) {
     GST_ERROR ("error capturing image");
     goto out;
   }
@@ -1037,7 +1076,8 @@ gst_droidcamsrc_dev_stop_video_recording (GstDroidCamSrcDev * dev)
   if (dev->use_recorder) {
     gst_droidcamsrc_recorder_stop (dev->recorder);
   } else {
-    droid_media_camera_stop_recording (dev->cam);
+    GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad), "droid_media_camera_stop_recording",
+        droid_media_camera_stop_recording (dev->cam));
   }
 
   /* Update the preview callback flag again; seems to be overwritten. */
@@ -1061,7 +1101,10 @@ gst_droidcamsrc_dev_release_recording_frame (void *data,
   g_rec_mutex_lock (dev->lock);
   --dev->vid->queued_frames;
 
-  droid_media_camera_release_recording_frame (dev->cam, video_data->data);
+  GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad),
+      "droid_media_camera_release_recording_frame",
+      droid_media_camera_release_recording_frame (dev->cam,
+          video_data->data));
 
   g_slice_free (GstDroidCamSrcDevVideoData, video_data);
   g_rec_mutex_unlock (dev->lock);
@@ -1073,7 +1116,8 @@ gst_droidcamsrc_dev_update_params_locked (GstDroidCamSrcDev * dev)
   GstDroidCamSrc *src = GST_DROIDCAMSRC (GST_PAD_PARENT (dev->imgsrc->pad));
   gchar *params;
 
-  params = droid_media_camera_get_parameters (dev->cam);
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_get_parameters",
+      params = droid_media_camera_get_parameters (dev->cam));
 
   if (!params) {
     GST_ELEMENT_ERROR (src, LIBRARY, INIT, (NULL),
@@ -1103,6 +1147,7 @@ gboolean
 gst_droidcamsrc_dev_start_autofocus (GstDroidCamSrcDev * dev)
 {
   gboolean ret = FALSE;
+  bool started;
 
   g_rec_mutex_lock (dev->lock);
 
@@ -1111,7 +1156,9 @@ gst_droidcamsrc_dev_start_autofocus (GstDroidCamSrcDev * dev)
     goto out;
   }
 
-  if (!droid_media_camera_start_auto_focus (dev->cam)) {
+  GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad), "droid_media_camera_start_auto_focus",
+      started = droid_media_camera_start_auto_focus (dev->cam));
+  if (!started) {
     GST_WARNING ("error starting autofocus");
     goto out;
   }
@@ -1130,7 +1177,11 @@ gst_droidcamsrc_dev_stop_autofocus (GstDroidCamSrcDev * dev)
   g_rec_mutex_lock (dev->lock);
 
   if (dev->cam) {
-    if (!droid_media_camera_cancel_auto_focus (dev->cam))
+    bool cancelled;
+
+    GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad), "droid_media_camera_cancel_auto_focus",
+        cancelled = droid_media_camera_cancel_auto_focus (dev->cam));
+    if (!cancelled)
       GST_WARNING ("error stopping autofocus");
   }
 
@@ -1143,6 +1194,7 @@ gst_droidcamsrc_dev_enable_face_detection (GstDroidCamSrcDev * dev,
     gboolean enable)
 {
   gboolean res = FALSE;
+  bool enabled;
 
   GST_LOG ("enable face detection %d", enable);
 
@@ -1152,8 +1204,11 @@ gst_droidcamsrc_dev_enable_face_detection (GstDroidCamSrcDev * dev,
     goto out;
   }
 
-  if (!droid_media_camera_enable_face_detection (dev->cam,
-          DROID_MEDIA_CAMERA_FACE_DETECTION_HW, enable ? true : false)) {
+  GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad),
+      "droid_media_camera_enable_face_detection",
+      enabled = droid_media_camera_enable_face_detection (dev->cam,
+          DROID_MEDIA_CAMERA_FACE_DETECTION_HW, enable ? true : false));
+  if (!enabled) {
     GST_ERROR ("error %s face detection", enable ? "enabling" : "disabling");
     goto out;
   }
@@ -1192,7 +1247,8 @@ gst_droidcamsrc_dev_send_command (GstDroidCamSrcDev * dev, gint cmd, gint arg1,
     gint arg2)
 {
   g_rec_mutex_lock (dev->lock);
-  droid_media_camera_send_command (dev->cam, cmd, arg1, arg2);
+  GST_DROID_HAL_TRACE (GST_PAD_PARENT (dev->imgsrc->pad), "droid_media_camera_send_command",
+      droid_media_camera_send_command (dev->cam, cmd, arg1, arg2));
   g_rec_mutex_unlock (dev->lock);
 }
 
@@ -1263,15 +1319,20 @@ static gboolean
 gst_droidcamsrc_dev_start_video_recording_raw_locked (GstDroidCamSrcDev * dev)
 {
   GstDroidCamSrc *src = GST_DROIDCAMSRC (GST_PAD_PARENT (dev->imgsrc->pad));
+  bool started, stored;
 
   /* TODO: get that from caps */
-  if (!droid_media_camera_store_meta_data_in_buffers (dev->cam, true)) {
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_store_meta_data_in_buffers",
+      stored = droid_media_camera_store_meta_data_in_buffers (dev->cam, true));
+  if (!stored) {
     GST_ELEMENT_ERROR (src, LIBRARY, SETTINGS,
         ("error storing meta data in buffers for video recording"), (NULL));
     return FALSE;
   }
 
-  if (!droid_media_camera_start_recording (dev->cam)) {
+  GST_DROID_HAL_TRACE (src, "droid_media_camera_start_recording",
+      started = droid_media_camera_start_recording (dev->cam));
+  if (!started) {
     GST_ELEMENT_ERROR (src, LIBRARY, FAILED, ("error starting video recording"),
         (NULL));
     return FALSE;
@@ -1308,6 +1369,7 @@ gst_droidcamsrc_dev_queue_video_buffer_locked (GstDroidCamSrcDev * dev,
   if (drop_buffer) {
     GST_INFO_OBJECT (src,
         "dropping buffer because video recording is not running");
+    gst_droid_stats_add (&src->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
     gst_buffer_unref (buffer);
   } else {
     g_mutex_lock (&dev->vidsrc->lock);
@@ -84,7 +84,13 @@ typedef enum
   /* camerabin interface */
   PROP_POST_PREVIEW,
   PROP_PREVIEW_CAPS,
-  PROP_PREVIEW_FILTER
+  PROP_PREVIEW_FILTER,
+
+  /* statistics */
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+
+  PROP_LAZY_UNLOCK
 } GstDroidCamSrcProperties;
 
 void gst_droidcamsrc_photography_register (gpointer g_iface,  gpointer iface_data);
@@ -73,6 +73,9 @@ gst_droidcamsrc_recorder_init (GstDroidCamSrcRecorder * recorder,
 
   recorder->recorder = droid_media_recorder_create (cam, &recorder->md);
 
+  gst_droid_codec_configure_encoded_pool (recorder->codec,
+      recorder->md.bitrate, recorder->md.parent.fps, 1);
+
   if (!recorder->recorder) {
     return FALSE;
   }
@@ -126,6 +129,7 @@ gst_droidcamsrc_recorder_data_available (void *data,
   GstDroidCamSrc *src =
       GST_DROIDCAMSRC (GST_PAD_PARENT (recorder->vidsrc->pad));
   GstBuffer *buffer = NULL;
+  GstClockTime received = gst_util_get_timestamp ();
 
   if (encoded->codec_config) {
     GstBuffer *codec_data = NULL;
@@ -137,6 +141,11 @@ gst_droidcamsrc_recorder_data_available (void *data,
         gst_droid_codec_create_encoder_codec_data (recorder->codec,
         &encoded->data);
 
+    if (!codec_data && gst_droid_codec_uses_in_band_headers (recorder->codec)) {
+      /* headers will be sent in band with the key frames */
+      return;
+    }
+
     if (!codec_data) {
       GST_ELEMENT_ERROR (src, STREAM, FORMAT, (NULL),
           ("Failed to construct codec_data. Expect corrupted stream"));
@@ -161,7 +170,7 @@ gst_droidcamsrc_recorder_data_available (void *data,
   }
 
   buffer =
-      gst_droid_codec_prepare_encoded_data (recorder->codec, &encoded->data);
+      gst_droid_codec_prepare_encoded_data (recorder->codec, encoded);
   if (!buffer) {
     GST_ELEMENT_ERROR (src, LIBRARY, ENCODE, (NULL),
         ("failed to process encoded data"));
@@ -177,5 +186,6 @@ gst_droidcamsrc_recorder_data_available (void *data,
     GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
   }
 
+  gst_droid_stats_mark_buffer (buffer, received);
   gst_droidcamsrc_dev_queue_video_buffer (src->dev, buffer);
 }
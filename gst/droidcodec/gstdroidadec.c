@@ -38,6 +38,15 @@ G_DEFINE_TYPE (GstDroidADec, gst_droidadec, GST_TYPE_AUDIO_DECODER);
 GST_DEBUG_CATEGORY_EXTERN (gst_droid_adec_debug);
 #define GST_CAT_DEFAULT gst_droid_adec_debug
 
+#define GST_DROIDADEC_NUM_OUTPUT_BUFFERS 4
+
+enum
+{
+  PROP_0,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+};
+
 static GstStaticPadTemplate gst_droidadec_src_template_factory =
 GST_STATIC_PAD_TEMPLATE (GST_AUDIO_DECODER_SRC_NAME,
     GST_PAD_SRC,
@@ -49,6 +58,223 @@ static void gst_droidadec_signal_eos (void *data);
 static void gst_droidadec_data_available (void *data,
     DroidMediaCodecData * encoded);
 static GstFlowReturn gst_droidadec_finish (GstAudioDecoder * decoder);
+static GstFlowReturn gst_droidadec_drain (GstDroidADec * dec,
+    gboolean destroy);
+
+/* Encoder delay and padding of one input frame, in samples */
+typedef struct
+{
+  guint64 frame;
+  guint64 start;
+  guint64 end;
+} GstDroidADecClip;
+
+static void
+gst_droidadec_reset_clips (GstDroidADec * dec)
+{
+  GstDroidADecClip *clip;
+
+  while ((clip = g_queue_pop_head (&dec->clips))) {
+    g_slice_free (GstDroidADecClip, clip);
+  }
+
+  dec->frames_in = 0;
+  dec->frames_out = 0;
+}
+
+/*
+ * Input frames map 1:1 to output frames once they are aligned to spf
+ * so we can trim the output using the clipping meta of the matching input frame.
+ * Returns NULL if nothing is left.
+ */
+static GstBuffer *
+gst_droidadec_clip (GstDroidADec * dec, GstBuffer * out, gint nframes)
+{
+  guint64 start = 0, end = 0;
+  gsize size = gst_buffer_get_size (out);
+  GstDroidADecClip *clip;
+
+  while ((clip = g_queue_peek_head (&dec->clips))
+      && clip->frame < dec->frames_out + nframes) {
+    g_queue_pop_head (&dec->clips);
+
+    if (clip->frame >= dec->frames_out) {
+      if (clip->frame == dec->frames_out) {
+        start = clip->start;
+      }
+
+      if (clip->frame == dec->frames_out + nframes - 1) {
+        end = clip->end;
+      }
+    }
+
+    g_slice_free (GstDroidADecClip, clip);
+  }
+
+  dec->frames_out += nframes;
+
+  if (start == 0 && end == 0) {
+    return out;
+  }
+
+  start *= dec->info->bpf;
+  end *= dec->info->bpf;
+
+  GST_DEBUG_OBJECT (dec, "clipping %" G_GUINT64_FORMAT " bytes at start and %"
+      G_GUINT64_FORMAT " bytes at end", start, end);
+
+  if (start + end >= size) {
+    gst_buffer_unref (out);
+    return NULL;
+  }
+
+  out = gst_buffer_make_writable (out);
+  gst_buffer_resize (out, start, size - start - end);
+
+  return out;
+}
+
+/* Output buffers holding exactly one frame come from here */
+static void
+gst_droidadec_configure_pool (GstDroidADec * dec)
+{
+  GstStructure *config;
+  gsize size;
+
+  gst_buffer_replace (&dec->partial, NULL);
+  dec->partial_size = 0;
+
+  if (dec->pool) {
+    gst_buffer_pool_set_active (dec->pool, FALSE);
+    gst_object_unref (dec->pool);
+    dec->pool = NULL;
+  }
+
+  if (dec->spf == -1) {
+    return;
+  }
+
+  size = dec->spf * dec->info->bpf;
+
+  dec->pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (dec->pool);
+  gst_buffer_pool_config_set_params (config, NULL, size,
+      GST_DROIDADEC_NUM_OUTPUT_BUFFERS, 0);
+
+  if (!gst_buffer_pool_set_config (dec->pool, config)
+      || !gst_buffer_pool_set_active (dec->pool, TRUE)) {
+    GST_WARNING_OBJECT (dec, "failed to set up output pool");
+    gst_object_unref (dec->pool);
+    dec->pool = NULL;
+    return;
+  }
+
+  GST_DEBUG_OBJECT (dec, "output pool of %" G_GSIZE_FORMAT " byte buffers",
+      size);
+}
+
+static GstBuffer *
+gst_droidadec_acquire_output (GstDroidADec * dec, GstBufferPool * pool,
+    gsize size)
+{
+  GstBuffer *out = NULL;
+
+  if (pool && gst_buffer_pool_acquire_buffer (pool, &out, NULL) != GST_FLOW_OK) {
+    gst_droid_stats_add (&dec->stats, GST_DROID_STATS_POOL_STARVATIONS, 1);
+  }
+
+  if (!out) {
+    out = gst_audio_decoder_allocate_output_buffer (GST_AUDIO_DECODER (dec),
+        size);
+  }
+
+  return out;
+}
+
+/* The decoded data only lives during the callback so this is the one copy we make */
+static void
+gst_droidadec_write_output (GstDroidADec * dec, GstBuffer * out, gsize offset,
+    const guint8 * data, gsize size)
+{
+  GstMapInfo info;
+
+  gst_buffer_map (out, &info, GST_MAP_WRITE);
+  orc_memcpy (info.data + offset, data, size);
+  gst_buffer_unmap (out, &info);
+
+  gst_droid_stats_add (&dec->stats, GST_DROID_STATS_COPY_BYTES, size);
+}
+
+static GstFlowReturn
+gst_droidadec_push_output (GstDroidADec * dec, GstBuffer * out,
+    GstClockTime received)
+{
+  GstFlowReturn ret;
+
+  if (dec->spf != -1) {
+    out = gst_droidadec_clip (dec, out, 1);
+  }
+
+  GST_DEBUG_OBJECT (dec, "pushing %" G_GSIZE_FORMAT " bytes out",
+      out ? gst_buffer_get_size (out) : 0);
+
+  ret = gst_audio_decoder_finish_frame (GST_AUDIO_DECODER (dec), out, 1);
+
+  gst_droid_stats_add_latency (&dec->stats, GST_DROID_STATS_STAGE_OUTPUT,
+      gst_util_get_timestamp () - received);
+  gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_OUT, 1);
+
+  return ret;
+}
+
+/*
+ * The codec can be kept across a caps change as long as nothing it was
+ * configured from differs
+ */
+static gboolean
+gst_droidadec_caps_compatible (GstDroidADec * dec, GstCaps * caps)
+{
+  const gchar *fields[] =
+      { "rate", "channels", "codec_data", "mpegversion", "mpegaudioversion",
+    "layer", "stream-format"
+  };
+  GstCaps *current =
+      gst_pad_get_current_caps (GST_AUDIO_DECODER_SINK_PAD (dec));
+  GstStructure *s, *c;
+  gboolean ret = FALSE;
+  guint i;
+
+  if (!current) {
+    return FALSE;
+  }
+
+  s = gst_caps_get_structure (caps, 0);
+  c = gst_caps_get_structure (current, 0);
+
+  if (!gst_structure_has_name (s, gst_structure_get_name (c))) {
+    goto out;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (fields); i++) {
+    const GValue *v1 = gst_structure_get_value (s, fields[i]);
+    const GValue *v2 = gst_structure_get_value (c, fields[i]);
+
+    if (!v1 && !v2) {
+      continue;
+    }
+
+    if (!v1 || !v2 || gst_value_compare (v1, v2) != GST_VALUE_EQUAL) {
+      GST_DEBUG_OBJECT (dec, "%s differs", fields[i]);
+      goto out;
+    }
+  }
+
+  ret = TRUE;
+
+out:
+  gst_caps_unref (current);
+  return ret;
+}
 
 static gboolean
 gst_droidadec_create_codec (GstDroidADec * dec, GstBuffer * input)
@@ -83,6 +309,11 @@ gst_droidadec_create_codec (GstDroidADec * dec, GstBuffer * input)
   }
 
   dec->codec = droid_media_codec_create_decoder (&md);
+  dec->info = NULL;
+
+  /* The old codec has been drained so its frame size is not needed anymore */
+  dec->spf = dec->pending_spf;
+  GST_INFO_OBJECT (dec, "samples per frame: %d", dec->spf);
 
   if (md.codec_data.size > 0) {
     g_free (md.codec_data.data);
@@ -131,7 +362,9 @@ gst_droidadec_data_available (void *data, DroidMediaCodecData * encoded)
   GstDroidADec *dec = (GstDroidADec *) data;
   GstAudioDecoder *decoder = GST_AUDIO_DECODER (dec);
   GstBuffer *out;
-  GstMapInfo info;
+  const guint8 *src;
+  gsize frame_size, size;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (dec, "data available of size %"G_GSSIZE_FORMAT, encoded->data.size);
 
@@ -145,7 +378,8 @@ gst_droidadec_data_available (void *data, DroidMediaCodecData * encoded)
     goto out;
   }
 
-  if (G_UNLIKELY (gst_audio_decoder_get_audio_info (GST_AUDIO_DECODER
+  if (G_UNLIKELY (!dec->info
+          || gst_audio_decoder_get_audio_info (GST_AUDIO_DECODER
               (dec))->finfo->format == GST_AUDIO_FORMAT_UNKNOWN)) {
     DroidMediaCodecMetaData md;
     DroidMediaRect crop;        /* TODO: get rid of that */
@@ -165,35 +399,66 @@ gst_droidadec_data_available (void *data, DroidMediaCodecData * encoded)
       goto out;
     }
 
-    dec->info = gst_audio_decoder_get_audio_info (GST_AUDIO_DECODER (dec));
-  }
+    /*
+     * HE-AAC doubles the output rate and with it the samples of each frame.
+     * Only once per codec, dec->info is reset when the codec is created.
+     */
+    if (!dec->info && dec->spf != -1 && dec->rate > 0
+        && md.sample_rate > dec->rate) {
+      dec->spf = dec->spf * md.sample_rate / dec->rate;
+      GST_INFO_OBJECT (dec, "samples per output frame: %d", dec->spf);
+    }
 
-  out = gst_audio_decoder_allocate_output_buffer (decoder, encoded->data.size);
+    dec->info = gst_audio_decoder_get_audio_info (GST_AUDIO_DECODER (dec));
 
-  gst_buffer_map (out, &info, GST_MAP_READWRITE);
-  orc_memcpy (info.data, encoded->data.data, encoded->data.size);
-  gst_buffer_unmap (out, &info);
+    gst_droidadec_configure_pool (dec);
+  }
 
-  //  GST_WARNING_OBJECT (dec, "bpf %d, bps %d", dec->info->bpf, GST_AUDIO_INFO_BPS(dec->info));
-  if (dec->spf == -1 || (encoded->data.size == dec->spf * dec->info->bpf
-          && gst_adapter_available (dec->adapter) == 0)) {
+  if (dec->spf == -1) {
     /* fast path. no need for anything */
-    goto push;
+    out = gst_droidadec_acquire_output (dec, NULL, encoded->data.size);
+    gst_droidadec_write_output (dec, out, 0, encoded->data.data,
+        encoded->data.size);
+    flow_ret = gst_droidadec_push_output (dec, out, received);
+    goto pushed;
   }
 
-  gst_adapter_push (dec->adapter, out);
+  frame_size = dec->spf * dec->info->bpf;
+  src = encoded->data.data;
+  size = encoded->data.size;
+  flow_ret = GST_FLOW_OK;
 
-  if (gst_adapter_available (dec->adapter) >= dec->spf * dec->info->bpf) {
-    out = gst_adapter_take_buffer (dec->adapter, dec->spf * dec->info->bpf);
-  } else {
-    flow_ret = GST_FLOW_OK;
-    goto out;
-  }
+  /*
+   * Each frame is copied straight into the pool buffer we push. A frame split
+   * across callbacks waits in dec->partial for the rest of its samples.
+   */
+  while (size > 0 && flow_ret == GST_FLOW_OK) {
+    gsize len;
+
+    if (!dec->partial) {
+      dec->partial = gst_droidadec_acquire_output (dec, dec->pool, frame_size);
+      dec->partial_size = 0;
+    }
+
+    len = MIN (size, frame_size - dec->partial_size);
+    gst_droidadec_write_output (dec, dec->partial, dec->partial_size, src, len);
+    dec->partial_size += len;
+    src += len;
+    size -= len;
+
+    if (dec->partial_size < frame_size) {
+      break;
+    }
+
+    out = dec->partial;
+    dec->partial = NULL;
+    dec->partial_size = 0;
 
-push:
-  GST_DEBUG_OBJECT (dec, "pushing %"G_GSIZE_FORMAT" bytes out", gst_buffer_get_size (out));
+    flow_ret = gst_droidadec_push_output (dec, out, received);
+  }
 
-  flow_ret = gst_audio_decoder_finish_frame (decoder, out, 1);
+pushed:
+  gst_droid_stats_post (&dec->stats, GST_ELEMENT (dec));
 
   if (flow_ret == GST_FLOW_OK || flow_ret == GST_FLOW_FLUSHING) {
     goto out;
@@ -270,7 +535,15 @@ gst_droidadec_stop (GstAudioDecoder * decoder)
     dec->codec = NULL;
   }
 
-  gst_adapter_flush (dec->adapter, gst_adapter_available (dec->adapter));
+  gst_buffer_replace (&dec->partial, NULL);
+  dec->partial_size = 0;
+  gst_droidadec_reset_clips (dec);
+
+  if (dec->pool) {
+    gst_buffer_pool_set_active (dec->pool, FALSE);
+    gst_object_unref (dec->pool);
+    dec->pool = NULL;
+  }
 
   g_mutex_lock (&dec->eos_lock);
   dec->eos = FALSE;
@@ -298,12 +571,46 @@ gst_droidadec_finalize (GObject * object)
   g_mutex_clear (&dec->eos_lock);
   g_cond_clear (&dec->eos_cond);
 
-  gst_object_unref (dec->adapter);
-  dec->adapter = NULL;
+  gst_droid_stats_clear (&dec->stats);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_droidadec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstDroidADec *dec = GST_DROIDADEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS_INTERVAL:
+      gst_droid_stats_set_interval (&dec->stats, g_value_get_uint (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_droidadec_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstDroidADec *dec = GST_DROIDADEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_droid_stats_get_structure (&dec->stats));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_droid_stats_get_interval (&dec->stats));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static gboolean
 gst_droidadec_open (GstAudioDecoder * decoder)
 {
@@ -340,8 +647,11 @@ gst_droidadec_start (GstAudioDecoder * decoder)
   dec->codec_type = NULL;
   dec->dirty = TRUE;
   dec->spf = -1;
+  dec->pending_spf = -1;
   dec->running = TRUE;
 
+  gst_droid_stats_reset (&dec->stats);
+
   return TRUE;
 }
 
@@ -360,21 +670,14 @@ gst_droidadec_set_format (GstAudioDecoder * decoder, GstCaps * caps)
 
   GST_DEBUG_OBJECT (dec, "set format %" GST_PTR_FORMAT, caps);
 
-  if (dec->codec) {
-    /* If we get a format change then we stop */
-    GstCaps *current =
-        gst_pad_get_current_caps (GST_AUDIO_DECODER_SINK_PAD (decoder));
-    gboolean equal = gst_caps_is_equal_fixed (caps, current);
-    gst_caps_unref (current);
-
-    GST_DEBUG_OBJECT (dec, "new format is similar to old format? %d", equal);
-
-    if (!equal) {
-      GST_ELEMENT_ERROR (dec, LIBRARY, SETTINGS, (NULL),
-          ("codec already configured"));
-    }
+  if (dec->codec && gst_droidadec_caps_compatible (dec, caps)) {
+    /* Same format (e.g. the next track). Keep decoding with the running codec */
+    GST_DEBUG_OBJECT (dec, "keeping codec for compatible format");
+    return TRUE;
+  }
 
-    return equal;
+  if (dec->codec_type) {
+    gst_droid_codec_unref (dec->codec_type);
   }
 
   dec->codec_type =
@@ -397,12 +700,14 @@ gst_droidadec_set_format (GstAudioDecoder * decoder, GstCaps * caps)
 
   gst_buffer_replace (&dec->codec_data, codec_data);
 
-  /* handle_frame will create the codec */
+  /* handle_frame will drain the old codec if any and create a new one */
   dec->dirty = TRUE;
 
-  dec->spf = gst_droid_codec_get_samples_per_frane (caps);
-
-  GST_INFO_OBJECT (dec, "samples per frame: %d", dec->spf);
+  /*
+   * The old codec can still deliver data sized for the old format so the
+   * new frame size is only used once the new codec is created
+   */
+  dec->pending_spf = gst_droid_codec_get_samples_per_frane (caps);
 
   return TRUE;
 }
@@ -411,12 +716,26 @@ gst_droidadec_set_format (GstAudioDecoder * decoder, GstCaps * caps)
 static GstFlowReturn
 gst_droidadec_finish (GstAudioDecoder * decoder)
 {
-  gboolean locked = FALSE;      /* TODO: This is a hack */
   GstDroidADec *dec = GST_DROIDADEC (decoder);
-  gint available;
 
   GST_DEBUG_OBJECT (dec, "finish");
 
+  return gst_droidadec_drain (dec, FALSE);
+}
+
+/*
+ * always call with stream lock.
+ * Drains the codec and pushes out everything it had. If the codec can be reset
+ * in place it is kept for the next stream unless destroy is set.
+ */
+static GstFlowReturn
+gst_droidadec_drain (GstDroidADec * dec, gboolean destroy)
+{
+  gboolean locked = FALSE;      /* TODO: This is a hack */
+  GstAudioDecoder *decoder = GST_AUDIO_DECODER (dec);
+
+  GST_DEBUG_OBJECT (dec, "drain. destroy codec: %d", destroy);
+
   if (!dec->running) {
     GST_DEBUG_OBJECT (dec, "decoder is not running");
     goto finish;
@@ -439,44 +758,44 @@ gst_droidadec_finish (GstAudioDecoder * decoder)
   GST_AUDIO_DECODER_STREAM_LOCK (decoder);
 
 finish:
-  /* We drained the codec. Better to recreate it. */
+#ifdef HAVE_DROID_MEDIA_CODEC_FLUSH
+  if (dec->codec && dec->running && !destroy) {
+    /* A flushed codec accepts input again. This avoids a gap between tracks */
+    GST_AUDIO_DECODER_STREAM_UNLOCK (decoder);
+    droid_media_codec_flush (dec->codec);
+    GST_AUDIO_DECODER_STREAM_LOCK (decoder);
+  } else
+#endif
   if (dec->codec) {
+    /* We drained the codec. Better to recreate it. */
     droid_media_codec_stop (dec->codec);
     droid_media_codec_destroy (dec->codec);
     dec->codec = NULL;
   }
 
-  if (dec->spf != -1) {
-    available = gst_adapter_available (dec->adapter);
-    if (available > 0) {
-      gint size = dec->spf * dec->info->bpf;
-      gint nframes = available / size;
-      GstBuffer *out;
-      GstFlowReturn ret G_GNUC_UNUSED;
-
-      GST_INFO_OBJECT (dec, "pushing remaining %d bytes", available);
-      if (nframes > 0) {
-        out = gst_adapter_take_buffer (dec->adapter, nframes * size);
-        available -= (nframes * size);
-      } else {
-        out = gst_adapter_take_buffer (dec->adapter, available);
-        nframes = 1;
-        available = 0;
-      }
+  if (dec->partial) {
+    GstBuffer *out = dec->partial;
+    GstFlowReturn ret G_GNUC_UNUSED;
 
-      ret = gst_audio_decoder_finish_frame (decoder, out, nframes);
+    GST_INFO_OBJECT (dec, "pushing remaining %" G_GSIZE_FORMAT " bytes",
+        dec->partial_size);
 
+    dec->partial = NULL;
+    gst_buffer_resize (out, 0, dec->partial_size);
+    dec->partial_size = 0;
 
-      GST_INFO_OBJECT (dec, "pushed %d frames. flow return: %s", nframes,
-          gst_flow_get_name (ret));
+    out = gst_droidadec_clip (dec, out, 1);
+    ret = gst_audio_decoder_finish_frame (decoder, out, 1);
 
-      if (available > 0) {
-        GST_ERROR_OBJECT (dec, "%d bytes remaining", available);
-      }
-    }
+    GST_INFO_OBJECT (dec, "pushed remaining frame. flow return: %s",
+        gst_flow_get_name (ret));
   }
 
-  dec->dirty = TRUE;
+  gst_droidadec_reset_clips (dec);
+
+  if (!dec->codec) {
+    dec->dirty = TRUE;
+  }
 
 out:
   dec->eos = FALSE;
@@ -495,6 +814,7 @@ gst_droidadec_handle_frame (GstAudioDecoder * decoder, GstBuffer * buffer)
   GstFlowReturn ret;
   DroidMediaCodecData data;
   DroidMediaBufferCallbacks cb;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (dec, "handle frame");
 
@@ -502,6 +822,8 @@ gst_droidadec_handle_frame (GstAudioDecoder * decoder, GstBuffer * buffer)
     return gst_droidadec_finish (decoder);
   }
 
+  gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   if (dec->downstream_flow_ret != GST_FLOW_OK) {
     GST_DEBUG_OBJECT (dec, "not handling frame in error state: %s",
         gst_flow_get_name (dec->downstream_flow_ret));
@@ -524,7 +846,7 @@ gst_droidadec_handle_frame (GstAudioDecoder * decoder, GstBuffer * buffer)
    */
   if (G_UNLIKELY (dec->dirty)) {
     if (dec->codec) {
-      gst_droidadec_finish (decoder);
+      gst_droidadec_drain (dec, TRUE);
     }
 
     if (!gst_droidadec_create_codec (dec, buffer)) {
@@ -562,8 +884,27 @@ gst_droidadec_handle_frame (GstAudioDecoder * decoder, GstBuffer * buffer)
    * to call get_oldest_frame() which acquires the stream lock the base class
    * is holding before calling us
    */
+  if (dec->spf != -1) {
+    GstAudioClippingMeta *meta = gst_buffer_get_audio_clipping_meta (buffer);
+
+    if (meta && meta->format == GST_FORMAT_DEFAULT
+        && (meta->start > 0 || meta->end > 0)) {
+      GstDroidADecClip *clip = g_slice_new (GstDroidADecClip);
+      clip->frame = dec->frames_in;
+      clip->start = meta->start;
+      clip->end = meta->end;
+      g_queue_push_tail (&dec->clips, clip);
+    }
+
+    dec->frames_in++;
+  }
+
+  gst_droid_stats_add_latency (&dec->stats, GST_DROID_STATS_STAGE_QUEUE,
+      gst_util_get_timestamp () - received);
+
   GST_AUDIO_DECODER_STREAM_UNLOCK (decoder);
-  droid_media_codec_queue (dec->codec, &data, &cb);
+  GST_DROID_STATS_HAL_CALL (&dec->stats,
+      droid_media_codec_queue (dec->codec, &data, &cb));
   GST_AUDIO_DECODER_STREAM_LOCK (decoder);
 
   /* from now on decoder owns a frame reference so we cannot use the out label otherwise
@@ -606,7 +947,19 @@ gst_droidadec_flush (GstAudioDecoder * decoder, gboolean hard)
   GST_DEBUG_OBJECT (dec, "flush %d", hard);
 
   if (hard) {
-    gst_droidadec_finish (decoder);
+#ifdef HAVE_DROID_MEDIA_CODEC_FLUSH
+    if (dec->codec && dec->running) {
+      /* Throw away whatever the codec has and keep it running */
+      GST_AUDIO_DECODER_STREAM_UNLOCK (decoder);
+      droid_media_codec_flush (dec->codec);
+      GST_AUDIO_DECODER_STREAM_LOCK (decoder);
+
+      gst_buffer_replace (&dec->partial, NULL);
+      dec->partial_size = 0;
+      gst_droidadec_reset_clips (dec);
+    } else
+#endif
+      gst_droidadec_drain (dec, TRUE);
   }
 
   dec->downstream_flow_ret = GST_FLOW_OK;
@@ -628,10 +981,17 @@ gst_droidadec_init (GstDroidADec * dec)
   dec->codec_data = NULL;
   dec->channels = 0;
   dec->rate = 0;
+  dec->info = NULL;
+  dec->pool = NULL;
+  dec->partial = NULL;
+  dec->partial_size = 0;
+  g_queue_init (&dec->clips);
+  dec->frames_in = 0;
+  dec->frames_out = 0;
 
   g_mutex_init (&dec->eos_lock);
   g_cond_init (&dec->eos_cond);
-  dec->adapter = gst_adapter_new ();
+  gst_droid_stats_init (&dec->stats);
 }
 
 static void
@@ -660,6 +1020,8 @@ gst_droidadec_class_init (GstDroidADecClass * klass)
       gst_static_pad_template_get (&gst_droidadec_src_template_factory));
 
   gobject_class->finalize = gst_droidadec_finalize;
+  gobject_class->set_property = gst_droidadec_set_property;
+  gobject_class->get_property = gst_droidadec_get_property;
 
   gstaudiodecoder_class->open = GST_DEBUG_FUNCPTR (gst_droidadec_open);
   gstaudiodecoder_class->close = GST_DEBUG_FUNCPTR (gst_droidadec_close);
@@ -670,4 +1032,7 @@ gst_droidadec_class_init (GstDroidADecClass * klass)
   gstaudiodecoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_droidadec_handle_frame);
   gstaudiodecoder_class->flush = GST_DEBUG_FUNCPTR (gst_droidadec_flush);
+
+  gst_droid_stats_install_properties (gobject_class, PROP_STATS,
+      PROP_STATS_INTERVAL);
 }
@@ -24,8 +24,8 @@
 
 #include <gst/gst.h>
 #include <gst/audio/gstaudiodecoder.h>
-#include <gst/base/gstadapter.h>
 #include "gst/droid/gstdroidcodec.h"
+#include "gst/droid/gstdroidstats.h"
 
 G_BEGIN_DECLS
 
@@ -62,9 +62,21 @@ struct _GstDroidADec
   GstBuffer *codec_data;
   gboolean dirty;
   gint spf;
+  /* spf of the current caps, used once the codec is recreated */
+  gint pending_spf;
   GstAudioInfo *info;
-  GstAdapter *adapter;
+  /* pool buffer of the frame being filled */
+  GstBuffer *partial;
+  gsize partial_size;
+  GstBufferPool *pool;
   gboolean running;
+
+  /* samples to trim from the decoded frames. protected by decoder stream lock */
+  GQueue clips;
+  guint64 frames_in;
+  guint64 frames_out;
+
+  GstDroidStats stats;
 };
 
 struct _GstDroidADecClass
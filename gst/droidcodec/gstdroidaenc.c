@@ -43,15 +43,43 @@ enum
 {
   PROP_0,
   PROP_TARGET_BITRATE,
+  PROP_FRAMES_PER_BUFFER,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
 };
 
 #define GST_DROID_A_ENC_TARGET_BITRATE_DEFAULT 128000
+#define GST_DROID_A_ENC_FRAMES_PER_BUFFER_DEFAULT 1
+
+/* Android encodes 1024 samples per frame. See _data_available () */
+#define GST_DROID_A_ENC_SAMPLES_PER_FRAME 1024
+
+/* Input timestamps further than this from our own count are taken as a discontinuity */
+#define GST_DROID_A_ENC_TIMESTAMP_TOLERANCE (40 * GST_MSECOND)
+
+typedef struct
+{
+  GstMapInfo info;
+  GstBuffer *buffer;
+} GstDroidAEncFrameReleaseData;
 
 static void gst_droidaenc_signal_eos (void *data);
 static void gst_droidaenc_error (void *data, int err);
 static void gst_droidaenc_data_available (void *data,
     DroidMediaCodecData * encoded);
 
+static void
+gst_droidaenc_release_input_frame (void *data)
+{
+  GstDroidAEncFrameReleaseData *release_data =
+      (GstDroidAEncFrameReleaseData *) data;
+
+  gst_buffer_unmap (release_data->buffer, &release_data->info);
+  gst_buffer_unref (release_data->buffer);
+
+  g_slice_free (GstDroidAEncFrameReleaseData, release_data);
+}
+
 static gboolean
 gst_droidaenc_negotiate_src_caps (GstDroidAEnc * enc, GstAudioInfo * info)
 {
@@ -112,9 +140,13 @@ gst_droidaenc_create_codec (GstDroidAEnc * enc)
   md.parent.flags = DROID_MEDIA_CODEC_SW_ONLY;
   md.meta_data = false;
   md.bitrate = enc->target_bitrate;
-  md.max_input_size = info.bpf * enc->rate;
+  md.max_input_size = info.bpf * MAX (enc->rate,
+      GST_DROID_A_ENC_SAMPLES_PER_FRAME * enc->frames_per_buffer);
   enc->codec = droid_media_codec_create_encoder (&md);
 
+  gst_droid_codec_configure_encoded_pool (enc->codec_type, md.bitrate,
+      enc->rate, GST_DROID_A_ENC_SAMPLES_PER_FRAME);
+
   // Reset timestamp clock
   GstClock *clock = GST_ELEMENT_CLOCK (enc);
   if (clock) {
@@ -204,6 +236,7 @@ gst_droidaenc_data_available (void *data, DroidMediaCodecData * encoded)
   GstDroidAEnc *enc = (GstDroidAEnc *) data;
   GstAudioEncoder *encoder = GST_AUDIO_ENCODER (enc);
   GstBuffer *buffer;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (enc, "data available");
 
@@ -263,9 +296,16 @@ gst_droidaenc_data_available (void *data, DroidMediaCodecData * encoded)
   }
 
   buffer =
-      gst_audio_encoder_allocate_output_buffer (GST_AUDIO_ENCODER (enc),
-      encoded->data.size);
-  gst_buffer_fill (buffer, 0, encoded->data.data, encoded->data.size);
+      gst_droid_codec_prepare_encoded_data (enc->codec_type, encoded);
+  if (!buffer) {
+    enc->downstream_flow_ret = GST_FLOW_ERROR;
+
+    GST_AUDIO_ENCODER_STREAM_UNLOCK (encoder);
+
+    GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
+        ("failed to process encoded data"));
+    return;
+  }
 
   GST_BUFFER_PTS (buffer) = encoded->ts;
   GST_BUFFER_DTS (buffer) = encoded->decoding_ts;
@@ -276,7 +316,13 @@ gst_droidaenc_data_available (void *data, DroidMediaCodecData * encoded)
    * be revisited if we ever use another audio encoding format
    */
   flow_ret =
-      gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (enc), buffer, 1024);
+      gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (enc), buffer,
+      GST_DROID_A_ENC_SAMPLES_PER_FRAME);
+
+  gst_droid_stats_add_latency (&enc->stats, GST_DROID_STATS_STAGE_OUTPUT,
+      gst_util_get_timestamp () - received);
+  gst_droid_stats_add (&enc->stats, GST_DROID_STATS_FRAMES_OUT, 1);
+  gst_droid_stats_post (&enc->stats, GST_ELEMENT (enc));
 
   if (flow_ret == GST_FLOW_OK || flow_ret == GST_FLOW_FLUSHING) {
     goto out;
@@ -303,6 +349,12 @@ gst_droidaenc_set_property (GObject * object, guint prop_id,
     case PROP_TARGET_BITRATE:
       enc->target_bitrate = g_value_get_int (value);
       break;
+    case PROP_FRAMES_PER_BUFFER:
+      enc->frames_per_buffer = g_value_get_uint (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      gst_droid_stats_set_interval (&enc->stats, g_value_get_uint (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -319,6 +371,15 @@ gst_droidaenc_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_TARGET_BITRATE:
       g_value_set_int (value, enc->target_bitrate);
       break;
+    case PROP_FRAMES_PER_BUFFER:
+      g_value_set_uint (value, enc->frames_per_buffer);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_droid_stats_get_structure (&enc->stats));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_droid_stats_get_interval (&enc->stats));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -337,6 +398,8 @@ gst_droidaenc_finalize (GObject * object)
   g_mutex_clear (&enc->eos_lock);
   g_cond_clear (&enc->eos_cond);
 
+  gst_droid_stats_clear (&enc->stats);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -376,6 +439,8 @@ gst_droidaenc_start (GstAudioEncoder * encoder)
   enc->dirty = TRUE;
   enc->finished = FALSE;
 
+  gst_droid_stats_reset (&enc->stats);
+
   return TRUE;
 }
 
@@ -420,11 +485,24 @@ gst_droidaenc_set_format (GstAudioEncoder * encoder, GstAudioInfo * info)
 
   enc->channels = info->channels;
   enc->rate = info->rate;
+  enc->bpf = GST_AUDIO_INFO_BPF (info);
+  enc->base_ts = GST_CLOCK_TIME_NONE;
+  enc->samples = 0;
 
   if (!gst_droidaenc_negotiate_src_caps (enc, info)) {
     return FALSE;
   }
 
+  /* Let the base class collect whole codec frames so each queue () call
+   * carries up to frames_per_buffer of them. frame_samples is per codec
+   * frame and frame_max is the number of codec frames per call so a call
+   * never exceeds the max_input_size given to the codec. */
+  gst_audio_encoder_set_frame_samples_min (encoder,
+      GST_DROID_A_ENC_SAMPLES_PER_FRAME);
+  gst_audio_encoder_set_frame_samples_max (encoder,
+      GST_DROID_A_ENC_SAMPLES_PER_FRAME);
+  gst_audio_encoder_set_frame_max (encoder, enc->frames_per_buffer);
+
   /* handle_frame will create the codec */
   enc->dirty = TRUE;
 
@@ -463,14 +541,64 @@ out:
   return GST_FLOW_OK;
 }
 
+/*
+ * The base class hands us whole codec frames which rarely start at an upstream
+ * buffer boundary so we count samples ourselves and only follow upstream
+ * timestamps when they drift away from that.
+ */
+static GstClockTime
+gst_droidaenc_get_timestamp (GstDroidAEnc * enc, GstBuffer * buffer)
+{
+  GstClockTime ts = GST_BUFFER_PTS (buffer);
+  GstClockTime expected = GST_CLOCK_TIME_NONE;
+
+  if (GST_CLOCK_TIME_IS_VALID (enc->base_ts)) {
+    expected = enc->base_ts + gst_util_uint64_scale_int (enc->samples,
+        GST_SECOND, enc->rate);
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (ts)) {
+    if (!GST_CLOCK_TIME_IS_VALID (expected)
+        || ABS (GST_CLOCK_DIFF (expected, ts)) >
+        GST_DROID_A_ENC_TIMESTAMP_TOLERANCE) {
+      GST_DEBUG_OBJECT (enc, "resyncing to %" GST_TIME_FORMAT " (expected %"
+          GST_TIME_FORMAT ")", GST_TIME_ARGS (ts), GST_TIME_ARGS (expected));
+      enc->base_ts = ts;
+      enc->samples = 0;
+      expected = ts;
+    }
+  } else if (!GST_CLOCK_TIME_IS_VALID (expected)) {
+    /* Set it from the encoder's clock, as some versions of libstagefright
+     * throw away frames if it doesn't increase */
+    GstClock *clock = gst_element_get_clock (GST_ELEMENT (enc));
+    if (clock) {
+      expected = gst_clock_get_time (clock) - GST_ELEMENT_CAST (enc)->base_time;
+      gst_object_unref (clock);
+    } else {
+      expected = 0;
+    }
+
+    GST_DEBUG_OBJECT (enc, "No timestamp. Starting at %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (expected));
+    enc->base_ts = expected;
+    enc->samples = 0;
+  }
+
+  enc->samples += gst_buffer_get_size (buffer) / enc->bpf;
+
+  return expected;
+}
+
 static GstFlowReturn
 gst_droidaenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
 {
   GstDroidAEnc *enc = GST_DROIDAENC (encoder);
   GstFlowReturn ret = GST_FLOW_ERROR;
   DroidMediaCodecData data;
-  GstMapInfo info;
   DroidMediaBufferCallbacks cb;
+  GstDroidAEncFrameReleaseData *release_data;
+  GstClockTime ts;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (enc, "handle frame");
 
@@ -482,6 +610,8 @@ gst_droidaenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
     return gst_droidaenc_finish (encoder);
   }
 
+  gst_droid_stats_add (&enc->stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   if (enc->downstream_flow_ret != GST_FLOW_OK) {
     GST_DEBUG_OBJECT (enc, "not handling frame in error state: %s",
         gst_flow_get_name (enc->downstream_flow_ret));
@@ -511,33 +641,27 @@ gst_droidaenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
 
   enc->finished = FALSE;
 
-  gst_buffer_map (buffer, &info, GST_MAP_READ);
-  data.data.size = info.size;
-  data.data.data = g_malloc (info.size);
+  /* The codec reads the PCM data directly. We keep the buffer mapped until it is done with it */
+  release_data = g_slice_new0 (GstDroidAEncFrameReleaseData);
+  release_data->buffer = gst_buffer_ref (buffer);
+  if (!gst_buffer_map (release_data->buffer, &release_data->info,
+          GST_MAP_READ)) {
+    gst_buffer_unref (release_data->buffer);
+    g_slice_free (GstDroidAEncFrameReleaseData, release_data);
+    GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
+        ("failed to map input buffer"));
+    goto error;
+  }
+
+  data.data.size = release_data->info.size;
+  data.data.data = release_data->info.data;
   data.sync = false;
 
-/* Check if the buffer has a valid timestamp, and if not then set it from the
- * encoder's clock, as some versions of libstagefright throw away frames if
- * it doesn't increase
- */
-  GstClockTime ts = GST_BUFFER_PTS (buffer);
-  if (!GST_CLOCK_TIME_IS_VALID (ts)) {
-    GST_DEBUG_OBJECT (enc, "Replacing invalid timestamp: %" GST_TIME_FORMAT,
-        GST_TIME_ARGS (ts));
-    GstClock *clock = gst_element_get_clock (GST_ELEMENT (enc));
-    if (clock) {
-      ts = gst_clock_get_time (clock) - GST_ELEMENT_CAST (enc)->base_time;
-      GST_DEBUG_OBJECT (enc, "New timestamp: %" GST_TIME_FORMAT,
-          GST_TIME_ARGS (ts));
-    }
-  }
+  ts = gst_droidaenc_get_timestamp (enc, buffer);
   data.ts = GST_TIME_AS_USECONDS (ts);
-  memcpy (data.data.data, info.data, info.size);
-
-  gst_buffer_unmap (buffer, &info);
 
-  cb.unref = g_free;
-  cb.data = data.data.data;
+  cb.unref = gst_droidaenc_release_input_frame;
+  cb.data = release_data;
 
   /* This can deadlock if droidmedia/stagefright input buffer queue is full thus we
    * cannot write the input buffer. We end up waiting for the write operation
@@ -546,8 +670,12 @@ gst_droidaenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
    * to call get_oldest_frame() which acquires the stream lock the base class
    * is holding before calling us
    */
+  gst_droid_stats_add_latency (&enc->stats, GST_DROID_STATS_STAGE_QUEUE,
+      gst_util_get_timestamp () - received);
+
   GST_AUDIO_ENCODER_STREAM_UNLOCK (encoder);
-  droid_media_codec_queue (enc->codec, &data, &cb);
+  GST_DROID_STATS_HAL_CALL (&enc->stats,
+      droid_media_codec_queue (enc->codec, &data, &cb));
   GST_AUDIO_ENCODER_STREAM_LOCK (encoder);
 
   if (enc->downstream_flow_ret != GST_FLOW_OK) {
@@ -586,6 +714,8 @@ gst_droidaenc_flush (GstAudioEncoder * encoder)
   GST_DEBUG_OBJECT (enc, "flush");
 
   enc->downstream_flow_ret = GST_FLOW_OK;
+  enc->base_ts = GST_CLOCK_TIME_NONE;
+  enc->samples = 0;
   g_mutex_lock (&enc->eos_lock);
   enc->eos = FALSE;
   g_mutex_unlock (&enc->eos_lock);
@@ -604,11 +734,16 @@ gst_droidaenc_init (GstDroidAEnc * enc)
   enc->downstream_flow_ret = GST_FLOW_OK;
   enc->channels = 0;
   enc->rate = 0;
+  enc->bpf = 0;
+  enc->frames_per_buffer = GST_DROID_A_ENC_FRAMES_PER_BUFFER_DEFAULT;
+  enc->base_ts = GST_CLOCK_TIME_NONE;
+  enc->samples = 0;
   enc->caps = NULL;
   enc->finished = FALSE;
 
   g_mutex_init (&enc->eos_lock);
   g_cond_init (&enc->eos_cond);
+  gst_droid_stats_init (&enc->stats);
 }
 
 static void
@@ -656,4 +791,14 @@ gst_droidaenc_class_init (GstDroidAEncClass * klass)
           "Target bitrate", 0, G_MAXINT,
           GST_DROID_A_ENC_TARGET_BITRATE_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAMES_PER_BUFFER,
+      g_param_spec_uint ("frames-per-buffer", "Frames Per Buffer",
+          "Number of codec frames handed to the encoder at once", 1, 32,
+          GST_DROID_A_ENC_FRAMES_PER_BUFFER_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  gst_droid_stats_install_properties (gobject_class, PROP_STATS,
+      PROP_STATS_INTERVAL);
 }
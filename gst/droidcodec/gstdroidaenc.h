@@ -25,6 +25,7 @@
 #include <gst/gst.h>
 #include <gst/audio/gstaudioencoder.h>
 #include "gst/droid/gstdroidcodec.h"
+#include "gst/droid/gstdroidstats.h"
 
 G_BEGIN_DECLS
 
@@ -52,18 +53,26 @@ struct _GstDroidAEnc
   GstCaps *caps;
   gint channels;
   gint rate;
+  gint bpf;
 
   gint32 target_bitrate;
+  guint frames_per_buffer;
+
+  /* input timestamp interpolation. protected by encoder stream lock */
+  GstClockTime base_ts;
+  guint64 samples;
 
   /* eos handling */
   gboolean eos;
   GMutex eos_lock;
   GCond eos_cond;
 
-  /* protected by decoder stream lock */
+  /* protected by encoder stream lock */
   GstFlowReturn downstream_flow_ret;
   gboolean dirty;
   gboolean finished;
+
+  GstDroidStats stats;
 };
 
 struct _GstDroidAEncClass
@@ -26,8 +26,10 @@
 #include "gstdroidvdec.h"
 #include "gst/droid/gstdroidmediabuffer.h"
 #include "gst/droid/gstdroidbufferpool.h"
+#include "gst/droid/gstdroidformat.h"
+#include "gst/droid/gstdroidhaltrace.h"
 #include "plugin.h"
-#include "droidmediaconstants.h"
+#include <gst/allocators/allocators.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <string.h>             /* memset() */
@@ -38,6 +40,7 @@
 #endif
 
 #define GST_DROID_DEC_NUM_BUFFERS         2
+#define GST_DROID_DEC_LAZY_UNLOCK_DEFAULT FALSE
 
 #define gst_droidvdec_parent_class parent_class
 G_DEFINE_TYPE (GstDroidVDec, gst_droidvdec, GST_TYPE_VIDEO_DECODER);
@@ -51,16 +54,24 @@ GST_DEBUG_CATEGORY_EXTERN (gst_droid_vdec_debug);
 #define GST_DROIDVDEC_STATE_UNLOCK(decoder) \
     g_mutex_unlock (&(decoder)->state_lock)
 
-typedef struct
+enum
 {
-  int *hal_format;
-  GstVideoFormat gst_format;
-  GstDroidVideoConvertToI420 convert_to_i420;
-  gsize bytes_per_pixel;
-  gsize h_align;
-  gsize v_align;
-
-} GstDroidVideoFormatMap;
+  PROP_0,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_LAZY_UNLOCK,
+};
+
+#ifdef HAVE_DROID_MEDIA_BUFFER_GET_FD
+/* Linear codec formats. Anything else is decoded to I420 instead */
+#define GST_DROIDVDEC_DMABUF_FORMATS "{ NV12, I420, NV16, YUY2, YVYU, " \
+    "UYVY, GRAY8, ABGR, ARGB, RGB16, BGR16 }"
+#define GST_DROIDVDEC_DMABUF_CAPS \
+  GST_VIDEO_CAPS_MAKE_WITH_FEATURES (GST_CAPS_FEATURE_MEMORY_DMABUF, \
+      GST_DROIDVDEC_DMABUF_FORMATS) ";"
+#else
+#define GST_DROIDVDEC_DMABUF_CAPS
+#endif
 
 static GstStaticPadTemplate gst_droidvdec_src_template_factory =
     GST_STATIC_PAD_TEMPLATE (GST_VIDEO_DECODER_SRC_NAME,
@@ -69,7 +80,7 @@ static GstStaticPadTemplate gst_droidvdec_src_template_factory =
     GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE_WITH_FEATURES
         (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER,
             GST_DROID_MEDIA_BUFFER_MEMORY_VIDEO_FORMATS) ";"
-        GST_VIDEO_CAPS_MAKE ("I420")));
+        GST_DROIDVDEC_DMABUF_CAPS GST_VIDEO_CAPS_MAKE ("I420")));
 
 static gboolean gst_droidvdec_configure_state (GstVideoDecoder * decoder,
     guint width, guint height);
@@ -87,8 +98,9 @@ static void gst_droidvdec_data_available (void *data,
 static gboolean gst_droidvdec_convert_buffer (GstDroidVDec * dec,
     GstBuffer * out, DroidMediaData * in, GstVideoInfo * info);
 static void gst_droidvdec_loop (GstDroidVDec * dec);
+static void gst_droidvdec_drop_pending_frames (GstDroidVDec * dec);
 static GstFlowReturn gst_droidvdec_finish_frame (GstVideoDecoder * decoder,
-    GstVideoCodecFrame * frame);
+    GstVideoCodecFrame * frame, GstClockTime received);
 
 static void
 gst_droidvdec_loop (GstDroidVDec * dec)
@@ -103,37 +115,6 @@ gst_droidvdec_loop (GstDroidVDec * dec)
   }
 }
 
-static void
-gst_droidvec_copy_plane (guint8 * out, gint stride_out, guint8 * in,
-    gint stride_in, gint width, gint height)
-{
-  int i;
-  for (i = 0; i < height; i++) {
-    orc_memcpy (out, in, width);
-    out += stride_out;
-    in += stride_in;
-  }
-}
-
-static void
-gst_droidvec_copy_packed_planes (guint8 * out0, guint8 * out1, gint stride_out,
-    guint8 * in, gint stride_in, gint width, gint height)
-{
-  int x, y;
-  for (y = 0; y < height; y++) {
-    guint8 *row = in;
-    for (x = 0; x < width; x++) {
-      out0[x] = row[0];
-      out1[x] = row[1];
-      row += 2;
-    }
-
-    out0 += stride_out;
-    out1 += stride_out;
-    in += stride_in;
-  }
-}
-
 #define ALIGN_SIZE(size, to) (((size) + to  - 1) & ~(to - 1))
 
 static gboolean
@@ -144,6 +125,7 @@ gst_droidvdec_convert_native_to_i420 (GstDroidVDec * dec, GstMapInfo * out,
   gboolean use_external_buffer = out->size != size;
   guint8 *data = NULL;
   gboolean ret = TRUE;
+  bool converted;
 
   if (use_external_buffer) {
     GST_DEBUG_OBJECT (dec, "using an external buffer for I420 conversion.");
@@ -152,7 +134,9 @@ gst_droidvdec_convert_native_to_i420 (GstDroidVDec * dec, GstMapInfo * out,
     data = out->data;
   }
 
-  if (droid_media_convert_to_i420 (dec->convert, in, data) != true) {
+  GST_DROID_HAL_TRACE (dec, "droid_media_convert_to_i420",
+      converted = droid_media_convert_to_i420 (dec->convert, in, data));
+  if (!converted) {
     GST_ELEMENT_ERROR (dec, LIBRARY, FAILED, (NULL),
         ("failed to convert frame"));
 
@@ -198,81 +182,11 @@ gst_droidvdec_convert_native_to_i420 (GstDroidVDec * dec, GstMapInfo * out,
 }
 
 static gboolean
-gst_droidvdec_convert_yuv420_planar_to_i420 (GstDroidVDec * dec,
-    GstMapInfo * out, DroidMediaData * in, GstVideoInfo * info, gsize width,
-    gsize height)
-{
-  /* Buffer is already I420, so we can copy it straight over */
-  /* though we need to handle the cropping */
-
-  GST_DEBUG_OBJECT (dec, "Copying I420 buffer");
-  gint top = dec->crop_rect.top;
-  gint left = dec->crop_rect.left;
-  gint crop_width = dec->crop_rect.right - left;
-  gint crop_height = dec->crop_rect.bottom - top;
-
-  guint8 *y = in->data + (top * width) + left;
-  guint8 *u = in->data + (width * height) + (top * width / 2) + (left / 2);
-  guint8 *v =
-      in->data + (width * height) + (width * height / 4) +
-      (top * width / 2) + (left / 2);
-
-  gst_droidvec_copy_plane (out->data + info->offset[0],
-      info->stride[0], y, width, crop_width, crop_height);
-  gst_droidvec_copy_plane (out->data + info->offset[1],
-      info->stride[1], u, width / 2, crop_width / 2, crop_height / 2);
-  gst_droidvec_copy_plane (out->data + info->offset[2],
-      info->stride[2], v, width / 2, crop_width / 2, crop_height / 2);
-
-  return TRUE;
-}
-
-static gboolean
-gst_droidvdec_convert_yuv420_semi_planar_to_i420 (GstDroidVDec * dec,
-    GstMapInfo * out, DroidMediaData * in, GstVideoInfo * info, gsize width,
-    gsize height)
-{
-  GST_DEBUG_OBJECT (dec, "Converting from OMX_COLOR_FormatYUV420SemiPlanar");
-  gint stride = width;
-  gint slice_height = ALIGN_SIZE (height, 16);
-  gint top = dec->crop_rect.top;
-  gint left = dec->crop_rect.left;
-
-  guint8 *y = in->data + (top * stride) + left;
-  guint8 *uv = in->data + (stride * slice_height) + (top * stride / 2) + left;
-
-  gst_droidvec_copy_plane (out->data + info->offset[0],
-      info->stride[0], y, stride, info->width, info->height);
-  gst_droidvec_copy_packed_planes (out->data + info->offset[1],
-      out->data + info->offset[2], info->stride[1], uv, stride,
-      info->width / 2, info->height / 2);
-
-  return TRUE;
-}
-
-static gboolean
-gst_droidvdec_convert_yuv420_packed_semi_planar_to_i420 (GstDroidVDec * dec,
-    GstMapInfo * out, DroidMediaData * in, GstVideoInfo * info, gsize width,
-    gsize height)
+gst_droidvdec_convert_software_to_i420 (GstDroidVDec * dec, GstMapInfo * out,
+    DroidMediaData * in, GstVideoInfo * info, gsize width, gsize height)
 {
-  /* copy to the output buffer swapping the u and v planes and cropping if necessary */
-  /* NV12 format with 128 byte alignment */
-  GST_DEBUG_OBJECT (dec, "Converting from qcom NV12 semi planar");
-  gint stride = ALIGN_SIZE (width, 128);
-  gint slice_height = ALIGN_SIZE (height, 32);
-  gint top = ALIGN_SIZE (dec->crop_rect.top, 2);
-  gint left = ALIGN_SIZE (dec->crop_rect.left, 2);
-
-  guint8 *y = in->data + (top * stride) + left;
-  guint8 *uv = in->data + (stride * slice_height) + (top * stride / 2) + left;
-
-  gst_droidvec_copy_plane (out->data + info->offset[0],
-      info->stride[0], y, stride, info->width, info->height);
-  gst_droidvec_copy_packed_planes (out->data + info->offset[1],
-      out->data + info->offset[2], info->stride[1], uv, stride,
-      info->width / 2, info->height / 2);
-
-  return TRUE;
+  return dec->convert_func (out->data, info, in->data, width, height,
+      &dec->crop_rect);
 }
 
 static gboolean
@@ -280,6 +194,7 @@ gst_droidvdec_create_codec (GstDroidVDec * dec, GstBuffer * input)
 {
   DroidMediaCodecDecoderMetaData md;
   DroidMediaBufferQueue *queue;
+  bool started;
   const gchar *droid = gst_droid_codec_get_droid_type (dec->codec_type);
 
   GST_INFO_OBJECT (dec, "create codec of type %s: %dx%d",
@@ -314,7 +229,8 @@ gst_droidvdec_create_codec (GstDroidVDec * dec, GstBuffer * input)
       goto error;
   }
 
-  dec->codec = droid_media_codec_create_decoder (&md);
+  GST_DROID_HAL_TRACE (dec, "droid_media_codec_create_decoder",
+      dec->codec = droid_media_codec_create_decoder (&md));
 
   if (md.codec_data.size > 0) {
     g_free (md.codec_data.data);
@@ -349,11 +265,14 @@ gst_droidvdec_create_codec (GstDroidVDec * dec, GstBuffer * input)
     droid_media_codec_set_data_callbacks (dec->codec, &cb, dec);
   }
 
-  if (!droid_media_codec_start (dec->codec)) {
+  GST_DROID_HAL_TRACE (dec, "droid_media_codec_start",
+      started = droid_media_codec_start (dec->codec));
+  if (!started) {
     GST_ELEMENT_ERROR (dec, LIBRARY, INIT, (NULL),
         ("Failed to start the decoder"));
 
-    droid_media_codec_destroy (dec->codec);
+    GST_DROID_HAL_TRACE (dec, "droid_media_codec_destroy",
+        droid_media_codec_destroy (dec->codec));
     dec->codec = NULL;
 
     goto error;
@@ -411,6 +330,12 @@ gst_droidvdec_buffer_created (void *user, DroidMediaBuffer * buffer)
       GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
       return false;
     }
+
+    /* falling back from dma-buf, the codec gets recreated */
+    if (dec->dirty) {
+      GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
+      return false;
+    }
   }
 
   pool = gst_video_decoder_get_buffer_pool (decoder);
@@ -474,6 +399,7 @@ gst_droidvdec_frame_available (void *user, DroidMediaBuffer * buffer)
   GstVideoCropMeta *crop_meta;
   DroidMediaBufferInfo droid_info;
   GstVideoInfo video_info;
+  GstClockTime received = gst_util_get_timestamp ();
   bool ret = true;
 
   GST_DEBUG_OBJECT (dec, "frame available");
@@ -503,6 +429,7 @@ gst_droidvdec_frame_available (void *user, DroidMediaBuffer * buffer)
   if (G_UNLIKELY (!buff)) {
     GST_DEBUG_OBJECT (dec,
         "unable to acquire a gstreamer buffer for a droid media buffer");
+    gst_droid_stats_add (&dec->stats, GST_DROID_STATS_POOL_STARVATIONS, 1);
     goto error;
   }
 
@@ -531,6 +458,22 @@ gst_droidvdec_frame_available (void *user, DroidMediaBuffer * buffer)
       droid_info.width, droid_info.height, video_info.finfo->n_planes,
       video_info.offset, video_info.stride);
 
+  if (dec->use_dmabuf) {
+    /* The exported buffer holds on to the queue buffer until it is released */
+    GstBuffer *dmabuf =
+        gst_droid_media_buffer_export_dmabuf (buff, dec->dmabuf_allocator);
+
+    gst_buffer_unref (buff);
+
+    if (G_UNLIKELY (!dmabuf)) {
+      GST_ELEMENT_ERROR (dec, LIBRARY, FAILED, (NULL),
+          ("failed to export droid media buffer as dma-buf"));
+      goto error;
+    }
+
+    buff = dmabuf;
+  }
+
   frame = gst_video_decoder_get_oldest_frame (decoder);
 
   if (G_UNLIKELY (!frame)) {
@@ -553,7 +496,8 @@ gst_droidvdec_frame_available (void *user, DroidMediaBuffer * buffer)
      * so we need to compensate it and the 2nd ref which is already owned by
      * the base class GstVideoDecoder
      */
-    dec->downstream_flow_ret = gst_droidvdec_finish_frame (decoder, frame);
+    dec->downstream_flow_ret =
+        gst_droidvdec_finish_frame (decoder, frame, received);
   }
 
 out:
@@ -574,6 +518,7 @@ gst_droidvdec_data_available (void *data, DroidMediaCodecData * encoded)
   GstBuffer *buff;
   GstFlowReturn flow_ret;
   GstVideoCodecFrame *frame;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (dec, "data available");
 
@@ -612,6 +557,9 @@ gst_droidvdec_data_available (void *data, DroidMediaCodecData * encoded)
     goto out;
   }
 
+  gst_droid_stats_add (&dec->stats, GST_DROID_STATS_COPY_BYTES,
+      dec->out_state->info.size);
+
   frame = gst_video_decoder_get_oldest_frame (decoder);
 
   if (G_UNLIKELY (!frame)) {
@@ -632,7 +580,7 @@ gst_droidvdec_data_available (void *data, DroidMediaCodecData * encoded)
    * so we need to compensate it and the 2nd ref which is already owned by
    * the base class GstVideoDecoder
    */
-  flow_ret = gst_droidvdec_finish_frame (decoder, frame);
+  flow_ret = gst_droidvdec_finish_frame (decoder, frame, received);
 
 out:
   dec->downstream_flow_ret = flow_ret;
@@ -642,14 +590,26 @@ out:
 
 static GstFlowReturn
 gst_droidvdec_finish_frame (GstVideoDecoder * decoder,
-    GstVideoCodecFrame * frame)
+    GstVideoCodecFrame * frame, GstClockTime received)
 {
+  GstDroidVDec *dec = GST_DROIDVDEC (decoder);
+  GstClockTime queued = gst_droid_stats_get_frame_mark (frame);
   GstFlowReturn flow_ret;
 
   GST_DEBUG_OBJECT (decoder, "finish frame");
 
+  if (GST_CLOCK_TIME_IS_VALID (queued)) {
+    gst_droid_stats_add_latency (&dec->stats, GST_DROID_STATS_STAGE_HAL,
+        received - queued);
+  }
+
   flow_ret = gst_video_decoder_finish_frame (decoder, frame);
 
+  gst_droid_stats_add_latency (&dec->stats, GST_DROID_STATS_STAGE_OUTPUT,
+      gst_util_get_timestamp () - received);
+  gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_OUT, 1);
+  gst_droid_stats_post (&dec->stats, GST_ELEMENT (dec));
+
   if (flow_ret == GST_FLOW_OK || flow_ret == GST_FLOW_FLUSHING) {
     goto out;
   } else if (flow_ret == GST_FLOW_EOS) {
@@ -733,6 +693,31 @@ gst_droidvdec_size_changed (void *data, int32_t width, int32_t height)
   return err;
 }
 
+/*
+ * dma-buf consumers only get the caps and the video meta so the layout has
+ * to be fully described by them. That rules out formats we don't know,
+ * tiled ones and ones the graphic buffer itself describes differently,
+ * like QOMX 32m which is NV12 for the codec but YV12 for the gralloc.
+ */
+static gboolean
+gst_droidvdec_can_export_dmabuf (int hal_format, const GstDroidFormat * format)
+{
+  const GstDroidFormat *layout;
+
+  if (!format || format->bytes_per_pixel == 0) {
+    return FALSE;
+  }
+
+  if (GST_VIDEO_FORMAT_INFO_IS_TILED (gst_video_format_get_info
+          (format->gst_format))) {
+    return FALSE;
+  }
+
+  layout = gst_droid_format_from_hal_format (hal_format);
+
+  return !layout || layout->gst_format == format->gst_format;
+}
+
 static gboolean
 gst_droidvdec_configure_state (GstVideoDecoder * decoder, guint width,
     guint height)
@@ -740,58 +725,11 @@ gst_droidvdec_configure_state (GstVideoDecoder * decoder, guint width,
   GstDroidVDec *dec = GST_DROIDVDEC (decoder);
   DroidMediaCodecMetaData md;
   DroidMediaRect rect;
-  DroidMediaColourFormatConstants constants;
-  int format_index, format_count;
-
-  const GstDroidVideoFormatMap formats[] = {
-    {&constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar32m,
-          GST_VIDEO_FORMAT_NV12,
-        gst_droidvdec_convert_yuv420_packed_semi_planar_to_i420, 1, 128, 32},
-    {&constants.QOMX_COLOR_FormatYUV420PackedSemiPlanar64x32Tile2m8ka,
-        GST_VIDEO_FORMAT_NV12_64Z32, NULL, 0, 0, 0},
-    {&constants.OMX_COLOR_FormatYUV420Planar,
-          GST_VIDEO_FORMAT_I420,
-        gst_droidvdec_convert_yuv420_planar_to_i420, 1, 4, 1},
-    {&constants.OMX_COLOR_FormatYUV420PackedPlanar,
-          GST_VIDEO_FORMAT_I420, NULL,
-        1, 1, 1},
-    {&constants.OMX_COLOR_FormatYUV420SemiPlanar, GST_VIDEO_FORMAT_NV12,
-        gst_droidvdec_convert_yuv420_semi_planar_to_i420, 1, 1, 1},
-    {&constants.OMX_COLOR_FormatL8, GST_VIDEO_FORMAT_GRAY8, NULL, 1, 1,
-        1},
-    {&constants.OMX_COLOR_FormatYUV422SemiPlanar, GST_VIDEO_FORMAT_NV16,
-          NULL,
-        1, 1, 1},
-    {&constants.OMX_COLOR_FormatYCbYCr, GST_VIDEO_FORMAT_YUY2, NULL, 1,
-        1, 1},
-    {&constants.OMX_COLOR_FormatYCrYCb, GST_VIDEO_FORMAT_YVYU, NULL, 1,
-        1, 1},
-    {&constants.OMX_COLOR_FormatCbYCrY, GST_VIDEO_FORMAT_UYVY, NULL, 1,
-        1, 1},
-    {&constants.OMX_COLOR_Format32bitARGB8888,
-          /* There is a mismatch in omxil specification 4.2.1 between
-           * OMX_COLOR_Format32bitARGB8888 and its description
-           * Follow the description */
-          GST_VIDEO_FORMAT_ABGR,
-          NULL,
-        4, 4, 1},
-    {&constants.OMX_COLOR_Format32bitBGRA8888,
-          /* Same issue as OMX_COLOR_Format32bitARGB8888 */
-          GST_VIDEO_FORMAT_ARGB,
-          NULL,
-        4, 4, 1},
-    {&constants.OMX_COLOR_Format16bitRGB565, GST_VIDEO_FORMAT_RGB16,
-          NULL, 2, 4,
-        1},
-    {&constants.OMX_COLOR_Format16bitBGR565, GST_VIDEO_FORMAT_BGR16,
-          NULL, 2, 4,
-        1}
-  };
+  const GstDroidFormat *format;
 
   memset (&md, 0x0, sizeof (md));
   memset (&rect, 0x0, sizeof (rect));
 
-  droid_media_colour_format_constants_init (&constants);
   droid_media_codec_get_output_info (dec->codec, &md, &rect);
 
   GST_INFO_OBJECT (dec,
@@ -807,23 +745,32 @@ gst_droidvdec_configure_state (GstVideoDecoder * decoder, guint width,
     if (dec->codec_type->quirks & DONT_USE_DROID_CONVERT_VALUE) {
       GST_INFO_OBJECT (dec, "not using droid convert binary");
     } else {
-      dec->convert = droid_media_convert_create ();
+      GST_DROID_HAL_TRACE (dec, "droid_media_convert_create",
+          dec->convert = droid_media_convert_create ());
     }
   }
 
-  format_count = sizeof (formats) / sizeof (formats[0]);
-  for (format_index = 0; format_index < format_count; ++format_index) {
-    if (*formats[format_index].hal_format == md.hal_format) {
-      break;
-    }
+  format = gst_droid_format_from_colour_format (md.hal_format);
+
+  if (dec->use_dmabuf && !gst_droidvdec_can_export_dmabuf (md.hal_format,
+          format)) {
+    /* The codec already writes to a buffer queue. The next handle_frame
+     * recreates it without one */
+    GST_WARNING_OBJECT (dec, "HAL codec format 0x%x can't be exported as "
+        "dma-buf, falling back to I420", md.hal_format);
+    dec->use_dmabuf = FALSE;
+    dec->use_hardware_buffers = FALSE;
+    dec->dirty = TRUE;
+    dec->recreate = TRUE;
+    return TRUE;
   }
 
   if (dec->use_hardware_buffers) {
-    if (format_index < format_count) {
-      dec->format = formats[format_index].gst_format;
-      dec->bytes_per_pixel = formats[format_index].bytes_per_pixel;
-      dec->h_align = formats[format_index].h_align;
-      dec->v_align = formats[format_index].v_align;
+    if (format) {
+      dec->format = format->gst_format;
+      dec->bytes_per_pixel = format->bytes_per_pixel;
+      dec->h_align = format->h_align;
+      dec->v_align = format->v_align;
     } else {
       GST_INFO_OBJECT (dec, "The HAL codec format 0x%x is unrecognized",
           md.hal_format);
@@ -840,8 +787,13 @@ gst_droidvdec_configure_state (GstVideoDecoder * decoder, guint width,
   } else {
     if (dec->convert) {
       dec->convert_to_i420 = gst_droidvdec_convert_native_to_i420;
-    } else if (format_index < format_count) {
-      dec->convert_to_i420 = formats[format_index].convert_to_i420;
+    } else if (format) {
+      dec->convert_func =
+          gst_droid_convert_get_to_i420_func (format->converter);
+      dec->convert_to_i420 =
+          dec->convert_func ? gst_droidvdec_convert_software_to_i420 : NULL;
+      GST_DEBUG_OBJECT (dec, "software conversion from 0x%x: %d",
+          md.hal_format, format->converter);
     } else {
       dec->convert_to_i420 = NULL;
     }
@@ -869,9 +821,9 @@ gst_droidvdec_configure_state (GstVideoDecoder * decoder, guint width,
   dec->out_state->caps = gst_video_info_to_caps (&dec->out_state->info);
 
   if (dec->use_hardware_buffers) {
-    GstCapsFeatures *feature =
-        gst_caps_features_new (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER,
-        NULL);
+    GstCapsFeatures *feature = gst_caps_features_new (dec->use_dmabuf ?
+        GST_CAPS_FEATURE_MEMORY_DMABUF :
+        GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER, NULL);
     gst_caps_set_features (dec->out_state->caps, 0, feature);
   } else {
     memcpy (&dec->crop_rect, &rect, sizeof (rect));
@@ -900,7 +852,8 @@ error:
   }
 
   if (dec->convert) {
-    droid_media_convert_destroy (dec->convert);
+    GST_DROID_HAL_TRACE (dec, "droid_media_convert_destroy",
+        droid_media_convert_destroy (dec->convert));
     dec->convert = NULL;
   }
 
@@ -910,17 +863,21 @@ error:
 static gboolean
 gst_droidvdec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
 {
+  GstDroidVDec *dec = GST_DROIDVDEC (decoder);
   GstCaps *caps;
   GstCapsFeatures *features;
+  gboolean lazy_unlock;
+  gboolean ret;
 
   gst_query_parse_allocation (query, &caps, NULL);
 
   features = gst_caps_get_features (caps, 0);
 
   /* If we've negotiated caps with the droid memory queue buffers feature then ensure we use
-   * a buffer pool that supports that. Otherwise let the default implementation decide. */
+   * a buffer pool that supports that. Otherwise let the default implementation decide.
+   * dma-buf output is exported from queue buffers so it needs the same pool. */
   if (gst_caps_features_contains (features,
-          GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER)) {
+          GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER) || dec->use_dmabuf) {
     GstBufferPool *pool = NULL;
     gint i;
     guint min, max;
@@ -955,16 +912,22 @@ gst_droidvdec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
        * but for completeness add this a fallback. */
       GstStructure *config;
       GstVideoInfo video_info;
+      GstCaps *pool_caps = gst_caps_copy (caps);
       gst_video_info_from_caps (&video_info, caps);
 
+      gst_caps_set_features (pool_caps, 0,
+          gst_caps_features_new
+          (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER, NULL));
+
       pool = gst_droid_buffer_pool_new ();
       size = video_info.finfo->format == GST_VIDEO_FORMAT_ENCODED
           ? 1 : video_info.size;
 
       config = gst_buffer_pool_get_config (pool);
-      gst_buffer_pool_config_set_params (config, caps, size, min, max);
+      gst_buffer_pool_config_set_params (config, pool_caps, size, min, max);
+      gst_caps_unref (pool_caps);
 
-      if (!gst_buffer_pool_set_config (pool, config)) {
+      if (!gst_droid_buffer_pool_apply_config (pool, config)) {
         GST_ERROR_OBJECT (decoder, "Failed to set buffer pool configuration");
       }
 
@@ -982,8 +945,55 @@ gst_droidvdec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
     pool = NULL;
   }
 
-  return GST_VIDEO_DECODER_CLASS (parent_class)->decide_allocation (decoder,
+  ret = GST_VIDEO_DECODER_CLASS (parent_class)->decide_allocation (decoder,
       query);
+
+  GST_OBJECT_LOCK (dec);
+  lazy_unlock = dec->lazy_unlock;
+  GST_OBJECT_UNLOCK (dec);
+
+  if (ret && dec->use_hardware_buffers) {
+    GstBufferPool *pool = NULL;
+    GstStructure *config;
+    guint size, min, max;
+
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+
+    if (GST_IS_DROID_BUFFER_POOL (pool)) {
+      GstAllocator *allocator = gst_droid_buffer_pool_get_allocator (pool);
+      gst_droid_stats_track_allocator (&dec->stats, allocator);
+      gst_object_unref (allocator);
+    }
+
+    if (dec->use_dmabuf || lazy_unlock) {
+      config = gst_buffer_pool_get_config (pool);
+
+      if (dec->use_dmabuf) {
+        /* The base class configured the pool with the dma-buf caps but the
+         * pool itself has to keep handing out queue buffers */
+        GstCaps *pool_caps = gst_caps_copy (caps);
+        gst_caps_set_features (pool_caps, 0,
+            gst_caps_features_new
+            (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER, NULL));
+        gst_buffer_pool_config_set_params (config, pool_caps, size, min, max);
+        gst_caps_unref (pool_caps);
+      }
+
+      if (lazy_unlock) {
+        gst_buffer_pool_config_add_option (config,
+            GST_BUFFER_POOL_OPTION_DROID_MEDIA_BUFFER_LAZY_UNLOCK);
+      }
+
+      if (!gst_droid_buffer_pool_apply_config (pool, config)) {
+        GST_ERROR_OBJECT (dec, "Failed to set buffer pool configuration");
+        ret = FALSE;
+      }
+    }
+
+    gst_object_unref (pool);
+  }
+
+  return ret;
 }
 
 static gboolean
@@ -994,8 +1004,10 @@ gst_droidvdec_stop (GstVideoDecoder * decoder)
   GST_DEBUG_OBJECT (dec, "stop");
 
   if (dec->codec) {
-    droid_media_codec_stop (dec->codec);
-    droid_media_codec_destroy (dec->codec);
+    GST_DROID_HAL_TRACE (dec, "droid_media_codec_stop",
+        droid_media_codec_stop (dec->codec));
+    GST_DROID_HAL_TRACE (dec, "droid_media_codec_destroy",
+        droid_media_codec_destroy (dec->codec));
     dec->codec = NULL;
   }
 
@@ -1017,7 +1029,8 @@ gst_droidvdec_stop (GstVideoDecoder * decoder)
   }
 
   if (dec->convert) {
-    droid_media_convert_destroy (dec->convert);
+    GST_DROID_HAL_TRACE (dec, "droid_media_convert_destroy",
+        droid_media_convert_destroy (dec->convert));
     dec->convert = NULL;
   }
 
@@ -1051,12 +1064,62 @@ gst_droidvdec_finalize (GObject * object)
   gst_object_unref (dec->allocator);
   dec->allocator = NULL;
 
+  gst_object_unref (dec->dmabuf_allocator);
+  dec->dmabuf_allocator = NULL;
+
   g_mutex_clear (&dec->state_lock);
   g_cond_clear (&dec->state_cond);
 
+  gst_droid_stats_clear (&dec->stats);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_droidvdec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstDroidVDec *dec = GST_DROIDVDEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS_INTERVAL:
+      gst_droid_stats_set_interval (&dec->stats, g_value_get_uint (value));
+      break;
+    case PROP_LAZY_UNLOCK:
+      GST_OBJECT_LOCK (dec);
+      dec->lazy_unlock = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (dec);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_droidvdec_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstDroidVDec *dec = GST_DROIDVDEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_droid_stats_get_structure (&dec->stats));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_droid_stats_get_interval (&dec->stats));
+      break;
+    case PROP_LAZY_UNLOCK:
+      GST_OBJECT_LOCK (dec);
+      g_value_set_boolean (value, dec->lazy_unlock);
+      GST_OBJECT_UNLOCK (dec);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static gboolean
 gst_droidvdec_open (GstVideoDecoder * decoder)
 {
@@ -1092,11 +1155,14 @@ gst_droidvdec_start (GstVideoDecoder * decoder)
   dec->downstream_flow_ret = GST_FLOW_OK;
   dec->codec_type = NULL;
   dec->dirty = TRUE;
+  dec->recreate = FALSE;
   dec->running = TRUE;
   dec->format = GST_VIDEO_FORMAT_UNKNOWN;
   dec->codec_reported_height = -1;
   dec->codec_reported_width = -1;
 
+  gst_droid_stats_reset (&dec->stats);
+
   return TRUE;
 }
 
@@ -1141,6 +1207,7 @@ gst_droidvdec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
   GST_DEBUG_OBJECT (dec, "peer caps %" GST_PTR_FORMAT, caps);
 
   dec->use_hardware_buffers = FALSE;
+  dec->use_dmabuf = FALSE;
 
   count = gst_caps_get_size (caps);
   for (i = 0; i < count; ++i) {
@@ -1148,9 +1215,20 @@ gst_droidvdec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
     if (gst_caps_features_contains
         (features, GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER)) {
       dec->use_hardware_buffers = TRUE;
+    } else if (gst_caps_features_contains (features,
+            GST_CAPS_FEATURE_MEMORY_DMABUF)) {
+      dec->use_dmabuf = TRUE;
     }
   }
 
+  /* Queue buffers are preferred. dma-buf is only offered when droidmedia can export it */
+  if (dec->use_hardware_buffers) {
+    dec->use_dmabuf = FALSE;
+  } else if (dec->use_dmabuf) {
+    GST_INFO_OBJECT (dec, "exporting decoded frames as dma-buf");
+    dec->use_hardware_buffers = TRUE;
+  }
+
   gst_caps_unref (caps);
 
   if (G_UNLIKELY (count == 0)) {
@@ -1167,6 +1245,11 @@ gst_droidvdec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
 
   gst_buffer_replace (&dec->codec_data, state->codec_data);
 
+  /* The pending frames can't be decoded by a codec for the new format */
+  if (dec->recreate) {
+    gst_droidvdec_drop_pending_frames (dec);
+  }
+
   /* handle_frame will create the codec */
   dec->dirty = TRUE;
 
@@ -1194,7 +1277,8 @@ gst_droidvdec_finish (GstVideoDecoder * decoder)
 
     GST_INFO_OBJECT (dec, "draining");
     dec->state = GST_DROID_VDEC_STATE_WAITING_FOR_EOS;
-    droid_media_codec_drain (dec->codec);
+    GST_DROID_HAL_TRACE (dec, "droid_media_codec_drain",
+        droid_media_codec_drain (dec->codec));
 
     /* release the lock to allow _frame_available () to do its job */
     GST_LOG_OBJECT (dec, "releasing stream lock");
@@ -1217,8 +1301,10 @@ gst_droidvdec_finish (GstVideoDecoder * decoder)
     GST_LOG_OBJECT (dec, "acquired stream lock");
 
     if (dec->codec) {
-      droid_media_codec_stop (dec->codec);
-      droid_media_codec_destroy (dec->codec);
+      GST_DROID_HAL_TRACE (dec, "droid_media_codec_stop",
+          droid_media_codec_stop (dec->codec));
+      GST_DROID_HAL_TRACE (dec, "droid_media_codec_destroy",
+          droid_media_codec_destroy (dec->codec));
       dec->codec = NULL;
     }
 
@@ -1234,17 +1320,182 @@ gst_droidvdec_finish (GstVideoDecoder * decoder)
   return GST_FLOW_OK;
 }
 
+/*
+ * Tears down a codec that never produced output. Draining it would wait
+ * for an EOS it cannot deliver. Called with the stream lock.
+ */
+static void
+gst_droidvdec_destroy_codec (GstDroidVDec * dec)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (dec);
+  GstBufferPool *pool;
+
+  droid_media_buffer_queue_set_callbacks (droid_media_codec_get_buffer_queue
+      (dec->codec), NULL, NULL);
+
+  /* the loop can be waiting for the stream lock */
+  GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
+  GST_DROID_HAL_TRACE (dec, "droid_media_codec_stop",
+      droid_media_codec_stop (dec->codec));
+  gst_pad_pause_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
+  GST_VIDEO_DECODER_STREAM_LOCK (decoder);
+
+  pool = gst_video_decoder_get_buffer_pool (decoder);
+  if (pool) {
+    gst_droid_buffer_pool_media_buffers_invalidated (pool);
+    gst_object_unref (pool);
+  }
+
+  GST_DROID_HAL_TRACE (dec, "droid_media_codec_destroy",
+      droid_media_codec_destroy (dec->codec));
+  dec->codec = NULL;
+}
+
+static gboolean
+gst_droidvdec_queue_frame (GstDroidVDec * dec, GstVideoCodecFrame * frame,
+    GstClockTime received)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (dec);
+  DroidMediaCodecData data;
+  DroidMediaBufferCallbacks cb;
+
+  if (!gst_droid_codec_prepare_decoder_frame (dec->codec_type, frame,
+          &data.data, &cb)) {
+    GST_ELEMENT_ERROR (dec, STREAM, FORMAT, (NULL),
+        ("Failed to prepare data for decoding"));
+    return FALSE;
+  }
+
+  /*
+   * try to use dts if pts is not valid.
+   * on one of the test streams we get the first PTS set to GST_CLOCK_TIME_NONE
+   * which breaks timestamping.
+   */
+  data.ts =
+      GST_CLOCK_TIME_IS_VALID (frame->
+      pts) ? GST_TIME_AS_USECONDS (frame->pts) : GST_TIME_AS_USECONDS (frame->
+      dts);
+  data.sync = GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame) ? true : false;
+
+  /* This can deadlock if droidmedia/stagefright input buffer queue is full thus we
+   * cannot write the input buffer. We end up waiting for the write operation
+   * which does not happen because stagefright needs us to provide
+   * output buffers to be filled (which can not happen because _loop() tries
+   * to call get_oldest_frame() which acquires the stream lock the base class
+   * is holding before calling us
+   */
+  gst_droid_stats_add_latency (&dec->stats, GST_DROID_STATS_STAGE_QUEUE,
+      gst_util_get_timestamp () - received);
+  gst_droid_stats_mark_frame (frame);
+
+  GST_LOG_OBJECT (dec, "releasing stream lock");
+  GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
+  GST_DROID_HAL_TRACE (dec, "droid_media_codec_queue",
+      GST_DROID_STATS_HAL_CALL (&dec->stats,
+          droid_media_codec_queue (dec->codec, &data, &cb)));
+  GST_VIDEO_DECODER_STREAM_LOCK (decoder);
+
+  GST_LOG_OBJECT (dec, "acquired stream lock");
+
+  return TRUE;
+}
+
+/*
+ * The dma-buf fallback replaced a codec that refused its output buffers.
+ * Everything it was given is still pending so a new codec decodes it again,
+ * from the oldest pending sync frame up to the current frame.
+ */
+static gboolean
+gst_droidvdec_recreate_codec (GstDroidVDec * dec, GstVideoCodecFrame * current)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (dec);
+  GList *frames, *l;
+  gboolean created = FALSE;
+  gboolean ret = TRUE;
+
+  dec->recreate = FALSE;
+
+  if (dec->codec) {
+    gst_droidvdec_destroy_codec (dec);
+  }
+
+  frames = gst_video_decoder_get_frames (decoder);
+
+  for (l = frames; l && ret; l = l->next) {
+    GstVideoCodecFrame *frame = l->data;
+
+    if (frame == current) {
+      break;
+    }
+
+    if (!created) {
+      if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+        /* nothing to decode it from */
+        gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
+        gst_video_decoder_drop_frame (decoder, frame);
+        l->data = NULL;
+        continue;
+      }
+
+      if (!gst_droidvdec_create_codec (dec, frame->input_buffer)) {
+        ret = FALSE;
+        break;
+      }
+
+      created = TRUE;
+      dec->dirty = FALSE;
+    }
+
+    GST_DEBUG_OBJECT (dec, "queueing pending frame %u again",
+        frame->system_frame_number);
+    ret = gst_droidvdec_queue_frame (dec, frame, gst_util_get_timestamp ());
+  }
+
+  for (l = frames; l; l = l->next) {
+    if (l->data) {
+      gst_video_codec_frame_unref (l->data);
+    }
+  }
+
+  g_list_free (frames);
+
+  return ret;
+}
+
+/* Throws away the codec the dma-buf fallback replaces with all it was given */
+static void
+gst_droidvdec_drop_pending_frames (GstDroidVDec * dec)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (dec);
+  GList *frames, *l;
+
+  dec->recreate = FALSE;
+
+  if (dec->codec) {
+    gst_droidvdec_destroy_codec (dec);
+  }
+
+  frames = gst_video_decoder_get_frames (decoder);
+  for (l = frames; l; l = l->next) {
+    gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
+    gst_video_decoder_release_frame (decoder, l->data);
+  }
+
+  g_list_free (frames);
+}
+
 static GstFlowReturn
 gst_droidvdec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame)
 {
   GstDroidVDec *dec = GST_DROIDVDEC (decoder);
   GstFlowReturn ret;
-  DroidMediaCodecData data;
-  DroidMediaBufferCallbacks cb;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (dec, "handle frame");
 
+  gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   if (G_UNLIKELY (!dec->running)) {
     GST_DEBUG_OBJECT (dec, "codec is not running");
     ret = GST_FLOW_FLUSHING;
@@ -1255,6 +1506,7 @@ gst_droidvdec_handle_frame (GstVideoDecoder * decoder,
       && !GST_CLOCK_TIME_IS_VALID (frame->pts)) {
     GST_WARNING_OBJECT (dec,
         "dropping received frame with invalid timestamps.");
+    gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
     ret = GST_FLOW_OK;
     goto error;
   }
@@ -1283,9 +1535,17 @@ gst_droidvdec_handle_frame (GstVideoDecoder * decoder,
    * construct_decoder_codec_data which will store the nal prefix length for H264.
    * This is a bad situation. TODO: fix it
    */
+  if (G_UNLIKELY (dec->recreate)) {
+    if (!gst_droidvdec_recreate_codec (dec, frame)) {
+      ret = GST_FLOW_ERROR;
+      goto error;
+    }
+  }
+
   if (G_UNLIKELY (dec->dirty)) {
     if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
       ret = GST_FLOW_OK;
+      gst_droid_stats_add (&dec->stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
       gst_video_decoder_drop_frame (decoder, frame);
       goto out;
     }
@@ -1302,39 +1562,11 @@ gst_droidvdec_handle_frame (GstVideoDecoder * decoder,
     dec->dirty = FALSE;
   }
 
-  if (!gst_droid_codec_prepare_decoder_frame (dec->codec_type, frame,
-          &data.data, &cb)) {
+  if (!gst_droidvdec_queue_frame (dec, frame, received)) {
     ret = GST_FLOW_ERROR;
-    GST_ELEMENT_ERROR (dec, STREAM, FORMAT, (NULL),
-        ("Failed to prepare data for decoding"));
     goto error;
   }
 
-  /*
-   * try to use dts if pts is not valid.
-   * on one of the test streams we get the first PTS set to GST_CLOCK_TIME_NONE
-   * which breaks timestamping.
-   */
-  data.ts =
-      GST_CLOCK_TIME_IS_VALID (frame->
-      pts) ? GST_TIME_AS_USECONDS (frame->pts) : GST_TIME_AS_USECONDS (frame->
-      dts);
-  data.sync = GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame) ? true : false;
-
-  /* This can deadlock if droidmedia/stagefright input buffer queue is full thus we
-   * cannot write the input buffer. We end up waiting for the write operation
-   * which does not happen because stagefright needs us to provide
-   * output buffers to be filled (which can not happen because _loop() tries
-   * to call get_oldest_frame() which acquires the stream lock the base class
-   * is holding before calling us
-   */
-  GST_LOG_OBJECT (dec, "releasing stream lock");
-  GST_VIDEO_DECODER_STREAM_UNLOCK (decoder);
-  droid_media_codec_queue (dec->codec, &data, &cb);
-  GST_VIDEO_DECODER_STREAM_LOCK (decoder);
-
-  GST_LOG_OBJECT (dec, "acquired stream lock");
-
   /* from now on decoder owns a frame reference */
 
   if (dec->downstream_flow_ret != GST_FLOW_OK) {
@@ -1455,7 +1687,14 @@ gst_droidvdec_init (GstDroidVDec * dec)
   g_mutex_init (&dec->state_lock);
   g_cond_init (&dec->state_cond);
 
+  gst_droid_stats_init (&dec->stats);
+
   dec->allocator = gst_droid_media_buffer_allocator_new ();
+  gst_droid_stats_track_allocator (&dec->stats, dec->allocator);
+  dec->lazy_unlock = GST_DROID_DEC_LAZY_UNLOCK_DEFAULT;
+  dec->dmabuf_allocator = gst_dmabuf_allocator_new ();
+  dec->use_dmabuf = FALSE;
+  dec->recreate = FALSE;
   dec->in_state = NULL;
   dec->out_state = NULL;
   dec->convert = NULL;
@@ -1487,6 +1726,8 @@ gst_droidvdec_class_init (GstDroidVDecClass * klass)
       gst_static_pad_template_get (&gst_droidvdec_src_template_factory));
 
   gobject_class->finalize = gst_droidvdec_finalize;
+  gobject_class->set_property = gst_droidvdec_set_property;
+  gobject_class->get_property = gst_droidvdec_get_property;
 
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR (gst_droidvdec_change_state);
@@ -1502,4 +1743,14 @@ gst_droidvdec_class_init (GstDroidVDecClass * klass)
   gstvideodecoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_droidvdec_handle_frame);
   gstvideodecoder_class->flush = GST_DEBUG_FUNCPTR (gst_droidvdec_flush);
+
+  gst_droid_stats_install_properties (gobject_class, PROP_STATS,
+      PROP_STATS_INTERVAL);
+
+  g_object_class_install_property (gobject_class, PROP_LAZY_UNLOCK,
+      g_param_spec_boolean ("lazy-unlock", "Lazy unlock",
+          "Keep output graphic buffers locked between maps until they "
+          "return to the pool", GST_DROID_DEC_LAZY_UNLOCK_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
 }
@@ -25,6 +25,8 @@
 #include <gst/gst.h>
 #include <gst/video/gstvideodecoder.h>
 #include "gst/droid/gstdroidcodec.h"
+#include "gst/droid/gstdroidconvert.h"
+#include "gst/droid/gstdroidstats.h"
 #include "droidmediaconvert.h"
 
 G_BEGIN_DECLS
@@ -61,6 +63,7 @@ struct _GstDroidVDec
   GstVideoDecoder parent;
   DroidMediaCodec *codec;
   GstAllocator *allocator;
+  GstAllocator *dmabuf_allocator;
   GstDroidCodec *codec_type;
 
   /* eos handling */
@@ -75,6 +78,9 @@ struct _GstDroidVDec
   DroidMediaRect crop_rect;
   gboolean running;
   gboolean use_hardware_buffers;
+  gboolean use_dmabuf;
+  /* the codec produced nothing and is replaced for the pending frames */
+  gboolean recreate;
   GstVideoFormat format;
 
   gsize codec_reported_height;
@@ -87,7 +93,13 @@ struct _GstDroidVDec
   GstVideoCodecState *out_state;
   DroidMediaConvert *convert;
   GstDroidVideoConvertToI420 convert_to_i420;
+  GstDroidConvertToI420Func convert_func;
   gint32 hal_format;
+
+  /* protected by object lock */
+  gboolean lazy_unlock;
+
+  GstDroidStats stats;
 };
 
 struct _GstDroidVDecClass
@@ -26,6 +26,8 @@
 #include "gstdroidvenc.h"
 #include "gst/droid/gstwrappedmemory.h"
 #include "gst/droid/gstdroidquery.h"
+#include "gst/droid/gstdroidmediabuffer.h"
+#include "gst/droid/gstdroidhaltrace.h"
 #include "plugin.h"
 #include <string.h>
 
@@ -36,27 +38,42 @@ GST_DEBUG_CATEGORY_EXTERN (gst_droid_venc_debug);
 #define GST_CAT_DEFAULT gst_droid_venc_debug
 
 #define GST_DROIDVENC_EOS_TIMEOUT_SEC          2
+#define GST_DROIDVENC_NUM_STAGING_BUFFERS      2
 
 static GstStaticPadTemplate gst_droidvenc_sink_template_factory =
 GST_STATIC_PAD_TEMPLATE (GST_VIDEO_ENCODER_SINK_NAME,
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE_WITH_FEATURES
-        (GST_CAPS_FEATURE_MEMORY_DROID_VIDEO_META_DATA, "{YV12}")));
+        (GST_CAPS_FEATURE_MEMORY_DROID_VIDEO_META_DATA, "{YV12}") "; "
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER,
+            GST_DROID_MEDIA_BUFFER_MEMORY_VIDEO_FORMATS) "; "
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_BUFFER,
+            GST_DROID_MEDIA_BUFFER_MEMORY_VIDEO_FORMATS) "; "
+        GST_VIDEO_CAPS_MAKE ("{I420, YV12, NV12, NV21}")));
 
 enum
 {
   PROP_0,
   PROP_TARGET_BITRATE,
+  PROP_KEY_INT_MAX,
+  PROP_CONTROL_RATE,
+  PROP_INTRA_REFRESH_PERIOD,
+  PROP_REPEAT_HEADERS,
+  PROP_PREWARM,
+  PROP_FIRST_FRAME_LATENCY,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
 };
 
 #define GST_DROID_ENC_TARGET_BITRATE_DEFAULT 192000
-
-typedef struct
-{
-  GstMapInfo info;
-  GstVideoCodecFrame *frame;
-} GstDroidVEncFrameReleaseData;
+#define GST_DROID_ENC_KEY_INT_MAX_DEFAULT 0
+#define GST_DROID_ENC_CONTROL_RATE_DEFAULT GST_DROIDVENC_CONTROL_RATE_DEFAULT
+#define GST_DROID_ENC_INTRA_REFRESH_PERIOD_DEFAULT 0
+#define GST_DROID_ENC_REPEAT_HEADERS_DEFAULT FALSE
+#define GST_DROID_ENC_PREWARM_DEFAULT FALSE
 
 static GstVideoCodecState *gst_droidvenc_configure_state (GstDroidVEnc * enc,
     GstCaps * caps);
@@ -64,23 +81,26 @@ static void gst_droidvenc_signal_eos (void *data);
 static void gst_droidvenc_error (void *data, int err);
 static void
 gst_droidvenc_data_available (void *data, DroidMediaCodecData * encoded);
-static void gst_droidvenc_release_input_frame (void *data);
+static void gst_droidvenc_report_first_frame (GstDroidVEnc * enc);
 
-static void
-gst_droidvenc_release_input_frame (void *data)
+GType
+gst_droidvenc_control_rate_get_type (void)
 {
-  GstDroidVEncFrameReleaseData *release_data =
-      (GstDroidVEncFrameReleaseData *) data;
-
-  gst_buffer_unmap (release_data->frame->input_buffer, &release_data->info);
-
-  /* We need to release the input buffer */
-  gst_buffer_unref (release_data->frame->input_buffer);
-  release_data->frame->input_buffer = NULL;
-
-  gst_video_codec_frame_unref (release_data->frame);
-
-  g_slice_free (GstDroidVEncFrameReleaseData, release_data);
+  static GType gst_droidvenc_control_rate_type = 0;
+  static GEnumValue gst_droidvenc_control_rates[] = {
+    {GST_DROIDVENC_CONTROL_RATE_DEFAULT, "Encoder default", "default"},
+    {GST_DROIDVENC_CONTROL_RATE_CQ, "Constant quality", "cq"},
+    {GST_DROIDVENC_CONTROL_RATE_VBR, "Variable bitrate", "vbr"},
+    {GST_DROIDVENC_CONTROL_RATE_CBR, "Constant bitrate", "cbr"},
+    {0, NULL, NULL},
+  };
+
+  if (G_UNLIKELY (!gst_droidvenc_control_rate_type)) {
+    gst_droidvenc_control_rate_type =
+        g_enum_register_static ("GstDroidVEncControlRate",
+        gst_droidvenc_control_rates);
+  }
+  return gst_droidvenc_control_rate_type;
 }
 
 static gboolean
@@ -117,11 +137,223 @@ error:
   return FALSE;
 }
 
+/*
+ * NV12 input which is already laid out the way the encoder expects
+ * (same strides and plane offsets as the staging buffers) can be handed over as is.
+ */
+static gboolean
+gst_droidvenc_can_wrap_frame (GstDroidVEnc * enc, GstVideoFrame * frame)
+{
+  GstVideoInfo *info = &enc->staging.info;
+
+  return GST_VIDEO_FRAME_FORMAT (frame) == GST_VIDEO_FORMAT_NV12
+      && gst_buffer_n_memory (frame->buffer) == 1
+      && GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0) ==
+      GST_VIDEO_INFO_PLANE_STRIDE (info, 0)
+      && GST_VIDEO_FRAME_PLANE_STRIDE (frame, 1) ==
+      GST_VIDEO_INFO_PLANE_STRIDE (info, 1)
+      && GST_VIDEO_FRAME_PLANE_OFFSET (frame, 0) == 0
+      && GST_VIDEO_FRAME_PLANE_OFFSET (frame, 1) ==
+      GST_VIDEO_INFO_PLANE_OFFSET (info, 1);
+}
+
+static GstBuffer *
+gst_droidvenc_stage_frame (GstDroidVEnc * enc, GstVideoFrame * in)
+{
+  GstBuffer *buffer = gst_droid_codec_staging_convert (&enc->staging, in);
+
+  if (buffer) {
+    gst_droid_stats_add (&enc->stats, GST_DROID_STATS_COPY_BYTES,
+        GST_VIDEO_INFO_SIZE (&enc->staging.info));
+  }
+
+  return buffer;
+}
+
+static GstBuffer *
+gst_droidvenc_stage_media_buffer (GstDroidVEnc * enc, GstBuffer * input)
+{
+  GstBuffer *buffer =
+      gst_droid_codec_staging_convert_media_buffer (&enc->staging, input);
+
+  if (buffer) {
+    gst_droid_stats_add (&enc->stats, GST_DROID_STATS_COPY_BYTES,
+        GST_VIDEO_INFO_SIZE (&enc->staging.info));
+  }
+
+  return buffer;
+}
+
+/*
+ * Returns the buffer to be handed to the encoder: either a reference to the
+ * input buffer or a staging buffer holding an NV12 copy of it
+ */
+static GstBuffer *
+gst_droidvenc_prepare_input_buffer (GstDroidVEnc * enc,
+    GstVideoCodecFrame * frame)
+{
+  GstVideoFrame vframe;
+  GstVideoInfo *info = &enc->in_state->info;
+  GstBuffer *buffer;
+
+  if (enc->input_mode == GST_DROIDVENC_INPUT_META_DATA
+      || (enc->input_mode == GST_DROIDVENC_INPUT_MEDIA_BUFFER
+          && !enc->stage_media_buffers)) {
+    return gst_buffer_ref (frame->input_buffer);
+  }
+
+  if (enc->input_mode == GST_DROIDVENC_INPUT_MEDIA_BUFFER) {
+    return gst_droidvenc_stage_media_buffer (enc, frame->input_buffer);
+  }
+
+  if (!gst_video_frame_map (&vframe, info, frame->input_buffer, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (enc, "failed to map input frame");
+    return NULL;
+  }
+
+  if (enc->input_mode == GST_DROIDVENC_INPUT_RAW
+      && gst_droidvenc_can_wrap_frame (enc, &vframe)) {
+    GST_LOG_OBJECT (enc, "wrapping input frame");
+    buffer = gst_buffer_ref (frame->input_buffer);
+  } else {
+    buffer = gst_droidvenc_stage_frame (enc, &vframe);
+  }
+
+  gst_video_frame_unmap (&vframe);
+
+  return buffer;
+}
+
+/*
+ * Rejects settings the droidmedia headers we were built against have no field for
+ * so that they fail negotiation instead of being silently ignored. This is decided
+ * at build time. A codec which does not support a setting it is given may still
+ * ignore it, droidmedia has no way to ask.
+ */
+static gboolean
+gst_droidvenc_check_settings (GstDroidVEnc * enc)
+{
+  GstDroidVEncControlRate control_rate G_GNUC_UNUSED;
+  guint intra_refresh_period G_GNUC_UNUSED;
+  gint profile G_GNUC_UNUSED, level G_GNUC_UNUSED;
+
+  GST_OBJECT_LOCK (enc);
+  control_rate = enc->control_rate;
+  intra_refresh_period = enc->intra_refresh_period;
+  GST_OBJECT_UNLOCK (enc);
+
+  gst_droid_codec_get_profile_level (enc->codec_type, &profile, &level);
+
+#ifndef HAVE_DROID_MEDIA_CODEC_BITRATE_MODE
+  if (control_rate != GST_DROIDVENC_CONTROL_RATE_DEFAULT) {
+    GST_ELEMENT_ERROR (enc, CORE, NEGOTIATION, (NULL),
+        ("Rate control mode cannot be selected with this droidmedia"));
+    return FALSE;
+  }
+#endif
+
+#ifndef HAVE_DROID_MEDIA_CODEC_INTRA_REFRESH
+  if (intra_refresh_period > 0) {
+    GST_ELEMENT_ERROR (enc, CORE, NEGOTIATION, (NULL),
+        ("Intra refresh is not supported with this droidmedia"));
+    return FALSE;
+  }
+#endif
+
+#ifndef HAVE_DROID_MEDIA_CODEC_PROFILE
+  if (profile != 0) {
+    GST_ELEMENT_ERROR (enc, CORE, NEGOTIATION, (NULL),
+        ("Profile cannot be selected with this droidmedia"));
+    return FALSE;
+  }
+#endif
+
+#ifndef HAVE_DROID_MEDIA_CODEC_LEVEL
+  if (level != 0) {
+    GST_ELEMENT_ERROR (enc, CORE, NEGOTIATION, (NULL),
+        ("Level cannot be selected with this droidmedia"));
+    return FALSE;
+  }
+#endif
+
+  return TRUE;
+}
+
+static void
+gst_droidvenc_fill_settings (GstDroidVEnc * enc,
+    DroidMediaCodecEncoderMetaData * md)
+{
+  GstDroidVEncControlRate control_rate;
+  guint intra_refresh_period;
+  gint profile, level;
+
+  GST_OBJECT_LOCK (enc);
+  control_rate = enc->control_rate;
+  intra_refresh_period = enc->intra_refresh_period;
+  GST_OBJECT_UNLOCK (enc);
+
+  gst_droid_codec_get_profile_level (enc->codec_type, &profile, &level);
+
+  GST_INFO_OBJECT (enc,
+      "rate control %d, intra refresh period %u, profile 0x%x, level 0x%x",
+      control_rate, intra_refresh_period, profile, level);
+
+#ifdef HAVE_DROID_MEDIA_CODEC_BITRATE_MODE
+  switch (control_rate) {
+    case GST_DROIDVENC_CONTROL_RATE_CQ:
+      md->bitrate_mode = DROID_MEDIA_CODEC_BITRATE_CONTROL_CQ;
+      break;
+    case GST_DROIDVENC_CONTROL_RATE_VBR:
+      md->bitrate_mode = DROID_MEDIA_CODEC_BITRATE_CONTROL_VBR;
+      break;
+    case GST_DROIDVENC_CONTROL_RATE_CBR:
+      md->bitrate_mode = DROID_MEDIA_CODEC_BITRATE_CONTROL_CBR;
+      break;
+    case GST_DROIDVENC_CONTROL_RATE_DEFAULT:
+      break;
+  }
+#endif
+
+#ifdef HAVE_DROID_MEDIA_CODEC_INTRA_REFRESH
+  md->intra_refresh_period = intra_refresh_period;
+#endif
+
+#ifdef HAVE_DROID_MEDIA_CODEC_PROFILE
+  md->profile = profile;
+#endif
+
+#ifdef HAVE_DROID_MEDIA_CODEC_LEVEL
+  md->level = level;
+#endif
+}
+
+/* Returns TRUE if the frame should be encoded as a sync frame */
+static gboolean
+gst_droidvenc_check_sync_frame (GstDroidVEnc * enc, GstVideoCodecFrame * frame)
+{
+  guint key_int_max;
+
+  GST_OBJECT_LOCK (enc);
+  key_int_max = enc->key_int_max;
+  GST_OBJECT_UNLOCK (enc);
+
+  if (!gst_droid_codec_check_sync_frame (GST_OBJECT (enc),
+          GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame), key_int_max,
+          &enc->frames_since_sync)) {
+    return FALSE;
+  }
+
+  gst_droid_codec_request_sync_frame (GST_OBJECT (enc), enc->codec);
+
+  return TRUE;
+}
+
 static gboolean
 gst_droidvenc_create_codec (GstDroidVEnc * enc)
 {
   DroidMediaCodecEncoderMetaData md;
   GstQuery *query;
+  bool started;
 
   const gchar *droid = gst_droid_codec_get_droid_type (enc->codec_type);
 
@@ -137,32 +369,86 @@ gst_droidvenc_create_codec (GstDroidVEnc * enc)
   md.parent.height = enc->in_state->info.height;
   md.parent.fps = enc->in_state->info.fps_n / enc->in_state->info.fps_d;        // TODO: bad
   md.parent.flags = DROID_MEDIA_CODEC_HW_ONLY;
+  GST_OBJECT_LOCK (enc);
   md.bitrate = enc->target_bitrate;
+  enc->bitrate_changed = FALSE;
+  GST_OBJECT_UNLOCK (enc);
   md.stride = enc->in_state->info.width;
   md.slice_height = enc->in_state->info.height;
 
-  /* TODO: get this from caps */
-  md.meta_data = true;
+  gst_droidvenc_fill_settings (enc, &md);
+
+  switch (enc->input_mode) {
+    case GST_DROIDVENC_INPUT_META_DATA:
+      md.meta_data = true;
+
+      /* The color format does not change for the negotiated caps so we only ask once */
+      if (enc->color_format == -1) {
+        query = gst_droid_query_new_video_color_format ();
+        if (!gst_pad_peer_query (GST_VIDEO_ENCODER_SINK_PAD (GST_VIDEO_ENCODER
+                    (enc)), query)) {
+          gst_query_unref (query);
+          GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
+              ("Failed to query video color format"));
+          return FALSE;
+        }
+
+        if (!gst_droid_query_parse_video_color_format (query,
+                &enc->color_format)) {
+          gst_query_unref (query);
+          enc->color_format = -1;
+          GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
+              ("Failed to get video color format"));
+          return FALSE;
+        }
+
+        gst_query_unref (query);
+      }
+
+      md.color_format = enc->color_format;
+      break;
 
-  query = gst_droid_query_new_video_color_format ();
-  if (!gst_pad_peer_query (GST_VIDEO_ENCODER_SINK_PAD (GST_VIDEO_ENCODER (enc)),
-          query)) {
-    gst_query_unref (query);
-    GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
-        ("Failed to query video color format"));
-    return FALSE;
+    case GST_DROIDVENC_INPUT_MEDIA_BUFFER:
+      if (!enc->stage_media_buffers) {
+        /* Graphic buffers are passed in meta data mode */
+        md.meta_data = true;
+        md.color_format = GST_DROID_CODEC_COLOR_FORMAT_ANDROID_OPAQUE;
+        break;
+      }
+
+      /* fall through */
+    case GST_DROIDVENC_INPUT_RAW:
+      /* Raw input is always staged */
+      if (!gst_droid_codec_staging_start (&enc->staging,
+              GST_VIDEO_INFO_WIDTH (&enc->in_state->info),
+              GST_VIDEO_INFO_HEIGHT (&enc->in_state->info),
+              GST_DROIDVENC_NUM_STAGING_BUFFERS)) {
+        GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
+            ("Failed to create staging buffer pool"));
+        return FALSE;
+      }
+
+      gst_droid_codec_staging_fill_settings (&enc->staging, &md);
+      break;
   }
 
-  if (!gst_droid_query_parse_video_color_format (query, &md.color_format)) {
-    gst_query_unref (query);
-    GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
-        ("Failed to get video color format"));
-    return FALSE;
-  }
+  GST_DROID_HAL_TRACE (enc, "droid_media_codec_create_encoder",
+      enc->codec = droid_media_codec_create_encoder (&md));
 
-  gst_query_unref (query);
+  gst_droid_codec_configure_encoded_pool (enc->codec_type, md.bitrate,
+      enc->in_state->info.fps_n, enc->in_state->info.fps_d);
 
-  enc->codec = droid_media_codec_create_encoder (&md);
+  GST_OBJECT_LOCK (enc);
+  gst_droid_codec_set_repeat_headers (enc->codec_type, enc->repeat_headers);
+  GST_OBJECT_UNLOCK (enc);
+
+  if (!enc->codec && enc->input_mode == GST_DROIDVENC_INPUT_MEDIA_BUFFER
+      && !enc->stage_media_buffers) {
+    GST_WARNING_OBJECT (enc,
+        "encoder does not accept graphic buffers. Falling back to copying");
+    enc->stage_media_buffers = TRUE;
+    return gst_droidvenc_create_codec (enc);
+  }
 
   if (!enc->codec) {
     GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
@@ -183,11 +469,14 @@ gst_droidvenc_create_codec (GstDroidVEnc * enc)
     droid_media_codec_set_data_callbacks (enc->codec, &cb, enc);
   }
 
-  if (!droid_media_codec_start (enc->codec)) {
+  GST_DROID_HAL_TRACE (enc, "droid_media_codec_start",
+      started = droid_media_codec_start (enc->codec));
+  if (!started) {
     GST_ELEMENT_ERROR (enc, LIBRARY, INIT, (NULL),
         ("Failed to start the encoder"));
 
-    droid_media_codec_destroy (enc->codec);
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_destroy",
+        droid_media_codec_destroy (enc->codec));
     enc->codec = NULL;
     return FALSE;
   }
@@ -245,6 +534,8 @@ gst_droidvenc_data_available (void *data, DroidMediaCodecData * encoded)
   GstFlowReturn flow_ret;
   GstDroidVEnc *enc = (GstDroidVEnc *) data;
   GstVideoEncoder *encoder = GST_VIDEO_ENCODER (enc);
+  GstClockTime received = gst_util_get_timestamp ();
+  GstClockTime queued;
 
   GST_DEBUG_OBJECT (enc, "data available");
 
@@ -259,6 +550,12 @@ gst_droidvenc_data_available (void *data, DroidMediaCodecData * encoded)
         gst_droid_codec_create_encoder_codec_data (enc->codec_type,
         &encoded->data);
 
+    if (!codec_data && gst_droid_codec_uses_in_band_headers (enc->codec_type)) {
+      /* headers will be sent in band with the key frames */
+      GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+      return;
+    }
+
     if (!codec_data) {
       enc->downstream_flow_ret = GST_FLOW_ERROR;
 
@@ -286,7 +583,7 @@ gst_droidvenc_data_available (void *data, DroidMediaCodecData * encoded)
   }
 
   frame->output_buffer =
-      gst_droid_codec_prepare_encoded_data (enc->codec_type, &encoded->data);
+      gst_droid_codec_prepare_encoded_data (enc->codec_type, encoded);
   if (!frame->output_buffer) {
     GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
         ("failed to process encoded data"));
@@ -300,14 +597,31 @@ gst_droidvenc_data_available (void *data, DroidMediaCodecData * encoded)
   GST_BUFFER_PTS (frame->output_buffer) = encoded->ts;
   GST_BUFFER_DTS (frame->output_buffer) = encoded->decoding_ts;
 
+  if (G_UNLIKELY (!enc->first_frame_sent)) {
+    gst_droidvenc_report_first_frame (enc);
+  }
+
+  /* frames_since_sync is only counted on the input side, frames queued
+   * behind this one have already been counted there */
   if (encoded->sync) {
     GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
   }
 
+  queued = gst_droid_stats_get_frame_mark (frame);
+  if (GST_CLOCK_TIME_IS_VALID (queued)) {
+    gst_droid_stats_add_latency (&enc->stats, GST_DROID_STATS_STAGE_HAL,
+        received - queued);
+  }
+
   flow_ret = gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (enc), frame);
   /* release our ref */
   gst_video_codec_frame_unref (frame);
 
+  gst_droid_stats_add_latency (&enc->stats, GST_DROID_STATS_STAGE_OUTPUT,
+      gst_util_get_timestamp () - received);
+  gst_droid_stats_add (&enc->stats, GST_DROID_STATS_FRAMES_OUT, 1);
+  gst_droid_stats_post (&enc->stats, GST_ELEMENT (enc));
+
   if (flow_ret == GST_FLOW_OK || flow_ret == GST_FLOW_FLUSHING) {
     goto out;
   } else if (flow_ret == GST_FLOW_EOS) {
@@ -323,6 +637,33 @@ out:
   GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
 }
 
+static void
+gst_droidvenc_report_first_frame (GstDroidVEnc * enc)
+{
+  GstClockTime latency;
+  GstStructure *s;
+
+  enc->first_frame_sent = TRUE;
+
+  if (!GST_CLOCK_TIME_IS_VALID (enc->first_frame_time)) {
+    return;
+  }
+
+  latency = gst_util_get_timestamp () - enc->first_frame_time;
+
+  GST_INFO_OBJECT (enc, "first encoded frame after %" GST_TIME_FORMAT
+      " (prewarmed: %d)", GST_TIME_ARGS (latency), enc->prewarmed);
+
+  GST_OBJECT_LOCK (enc);
+  enc->first_frame_latency = latency;
+  GST_OBJECT_UNLOCK (enc);
+
+  s = gst_structure_new ("droidvenc-first-frame", "latency", GST_TYPE_CLOCK_TIME,
+      latency, "prewarmed", G_TYPE_BOOLEAN, enc->prewarmed, NULL);
+  gst_element_post_message (GST_ELEMENT (enc),
+      gst_message_new_element (GST_OBJECT (enc), s));
+}
+
 static GstVideoCodecState *
 gst_droidvenc_configure_state (GstDroidVEnc * enc, GstCaps * caps)
 {
@@ -351,7 +692,40 @@ gst_droidvenc_set_property (GObject * object, guint prop_id,
 
   switch (prop_id) {
     case PROP_TARGET_BITRATE:
-      enc->target_bitrate = g_value_get_int (value);
+      GST_OBJECT_LOCK (enc);
+      if (enc->target_bitrate != g_value_get_int (value)) {
+        enc->target_bitrate = g_value_get_int (value);
+        enc->bitrate_changed = TRUE;
+      }
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_KEY_INT_MAX:
+      GST_OBJECT_LOCK (enc);
+      enc->key_int_max = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_CONTROL_RATE:
+      GST_OBJECT_LOCK (enc);
+      enc->control_rate = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_INTRA_REFRESH_PERIOD:
+      GST_OBJECT_LOCK (enc);
+      enc->intra_refresh_period = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_REPEAT_HEADERS:
+      GST_OBJECT_LOCK (enc);
+      enc->repeat_headers = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_PREWARM:
+      GST_OBJECT_LOCK (enc);
+      enc->prewarm = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_STATS_INTERVAL:
+      gst_droid_stats_set_interval (&enc->stats, g_value_get_uint (value));
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -367,7 +741,45 @@ gst_droidvenc_get_property (GObject * object, guint prop_id, GValue * value,
 
   switch (prop_id) {
     case PROP_TARGET_BITRATE:
+      GST_OBJECT_LOCK (enc);
       g_value_set_int (value, enc->target_bitrate);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_KEY_INT_MAX:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_uint (value, enc->key_int_max);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_CONTROL_RATE:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_enum (value, enc->control_rate);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_INTRA_REFRESH_PERIOD:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_uint (value, enc->intra_refresh_period);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_REPEAT_HEADERS:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_boolean (value, enc->repeat_headers);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_PREWARM:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_boolean (value, enc->prewarm);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_FIRST_FRAME_LATENCY:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_uint64 (value, enc->first_frame_latency);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_droid_stats_get_structure (&enc->stats));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_droid_stats_get_interval (&enc->stats));
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -387,6 +799,8 @@ gst_droidvenc_finalize (GObject * object)
   g_mutex_clear (&enc->eos_lock);
   g_cond_clear (&enc->eos_cond);
 
+  gst_droid_stats_clear (&enc->stats);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -425,6 +839,12 @@ gst_droidvenc_start (GstVideoEncoder * encoder)
   enc->downstream_flow_ret = GST_FLOW_OK;
   enc->dirty = TRUE;
 
+  GST_OBJECT_LOCK (enc);
+  enc->first_frame_latency = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (enc);
+
+  gst_droid_stats_reset (&enc->stats);
+
   return TRUE;
 }
 
@@ -436,12 +856,16 @@ gst_droidvenc_stop (GstVideoEncoder * encoder)
   GST_DEBUG_OBJECT (enc, "stop");
 
   if (enc->codec) {
-    droid_media_codec_stop (enc->codec);
-    droid_media_codec_destroy (enc->codec);
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_stop",
+        droid_media_codec_stop (enc->codec));
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_destroy",
+        droid_media_codec_destroy (enc->codec));
     enc->codec = NULL;
     enc->dirty = TRUE;
   }
 
+  gst_droid_codec_staging_stop (&enc->staging);
+
   if (enc->in_state) {
     gst_video_codec_state_unref (enc->in_state);
     enc->in_state = NULL;
@@ -465,9 +889,28 @@ gst_droidvenc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
 {
   GstDroidVEnc *enc = GST_DROIDVENC (encoder);
   gboolean ret = FALSE;
+  GstCapsFeatures *features;
+  gboolean prewarm;
 
   GST_DEBUG_OBJECT (enc, "set format %" GST_PTR_FORMAT, state->caps);
 
+  if (enc->codec && enc->prewarmed
+      && !GST_CLOCK_TIME_IS_VALID (enc->first_frame_time)) {
+    /* A prewarmed codec which has not seen any data yet can simply be replaced */
+    GST_INFO_OBJECT (enc, "dropping prewarmed codec");
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_stop",
+        droid_media_codec_stop (enc->codec));
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_destroy",
+        droid_media_codec_destroy (enc->codec));
+    enc->codec = NULL;
+    gst_video_codec_state_unref (enc->in_state);
+    enc->in_state = NULL;
+    gst_video_codec_state_unref (enc->out_state);
+    enc->out_state = NULL;
+    gst_droid_codec_unref (enc->codec_type);
+    enc->codec_type = NULL;
+  }
+
   if (enc->codec) {
     GST_FIXME_OBJECT (enc, "What to do here?");
     GST_ERROR_OBJECT (enc, "codec already renegotiate");
@@ -475,15 +918,60 @@ gst_droidvenc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
   }
 
   enc->first_frame_sent = FALSE;
+  enc->first_frame_time = GST_CLOCK_TIME_NONE;
+  enc->prewarmed = FALSE;
+  enc->color_format = -1;
 
   enc->in_state = gst_video_codec_state_ref (state);
 
+  features = gst_caps_get_features (state->caps, 0);
+  if (gst_caps_features_contains (features,
+          GST_CAPS_FEATURE_MEMORY_DROID_VIDEO_META_DATA)) {
+    GST_INFO_OBJECT (enc, "input is video meta data");
+    enc->input_mode = GST_DROIDVENC_INPUT_META_DATA;
+  } else if (gst_caps_features_contains (features,
+          GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_BUFFER)
+      || gst_caps_features_contains (features,
+          GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER)) {
+    GST_INFO_OBJECT (enc, "input is droid media buffers");
+    enc->input_mode = GST_DROIDVENC_INPUT_MEDIA_BUFFER;
+  } else {
+    GST_INFO_OBJECT (enc, "input is raw video");
+    enc->input_mode = GST_DROIDVENC_INPUT_RAW;
+  }
+
+  enc->stage_media_buffers = FALSE;
+
   if (!gst_droidvenc_negotiate_src_caps (enc)) {
     goto error;
   }
 
-  /* handle_frame will create the codec */
-  enc->dirty = TRUE;
+  if (!gst_droidvenc_check_settings (enc)) {
+    goto error;
+  }
+
+  GST_OBJECT_LOCK (enc);
+  prewarm = enc->prewarm;
+  GST_OBJECT_UNLOCK (enc);
+
+  if (prewarm) {
+    /* Create and start the codec now so the first frame does not have to wait for it */
+    GstClockTime start = gst_util_get_timestamp ();
+
+    if (!gst_droidvenc_create_codec (enc)) {
+      goto error;
+    }
+
+    GST_INFO_OBJECT (enc, "codec prewarmed in %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (gst_util_get_timestamp () - start));
+
+    enc->prewarmed = TRUE;
+    enc->dirty = FALSE;
+    enc->frames_since_sync = 0;
+  } else {
+    /* handle_frame will create the codec */
+    enc->dirty = TRUE;
+  }
 
   return TRUE;
 
@@ -513,7 +1001,8 @@ gst_droidvenc_finish (GstVideoEncoder * encoder)
   enc->eos = TRUE;
 
   if (enc->codec) {
-    droid_media_codec_drain (enc->codec);
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_drain",
+        droid_media_codec_drain (enc->codec));
   } else {
     goto out;
   }
@@ -535,8 +1024,10 @@ out:
   enc->eos = FALSE;
 
   if (enc->codec) {
-    droid_media_codec_stop (enc->codec);
-    droid_media_codec_destroy (enc->codec);
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_stop",
+        droid_media_codec_stop (enc->codec));
+    GST_DROID_HAL_TRACE (enc, "droid_media_codec_destroy",
+        droid_media_codec_destroy (enc->codec));
     enc->codec = NULL;
     enc->dirty = TRUE;
   }
@@ -553,12 +1044,15 @@ gst_droidvenc_handle_frame (GstVideoEncoder * encoder,
   GstDroidVEnc *enc = GST_DROIDVENC (encoder);
   GstFlowReturn ret = GST_FLOW_ERROR;
   DroidMediaCodecData data;
-  GstMapInfo info;
   DroidMediaBufferCallbacks cb;
-  GstDroidVEncFrameReleaseData *release_data;
+  GstBuffer *buffer;
+  DroidMediaBuffer *media_buffer = NULL;
+  GstClockTime received = gst_util_get_timestamp ();
 
   GST_DEBUG_OBJECT (enc, "handle frame");
 
+  gst_droid_stats_add (&enc->stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   if (enc->downstream_flow_ret != GST_FLOW_OK) {
     GST_DEBUG_OBJECT (enc, "not handling frame in error state: %s",
         gst_flow_get_name (enc->downstream_flow_ret));
@@ -575,6 +1069,10 @@ gst_droidvenc_handle_frame (GstVideoEncoder * encoder,
   }
   g_mutex_unlock (&enc->eos_lock);
 
+  if (G_UNLIKELY (!GST_CLOCK_TIME_IS_VALID (enc->first_frame_time))) {
+    enc->first_frame_time = gst_util_get_timestamp ();
+  }
+
   /* Now we create the actual codec */
   if (G_UNLIKELY (enc->dirty)) {
     g_assert (enc->codec == NULL);
@@ -584,20 +1082,46 @@ gst_droidvenc_handle_frame (GstVideoEncoder * encoder,
     }
 
     enc->dirty = FALSE;
+    enc->frames_since_sync = 0;
+  } else {
+    gst_droid_codec_update_encoder_bitrate (GST_OBJECT (enc), enc->codec,
+        &enc->target_bitrate, &enc->bitrate_changed);
   }
 
-  gst_buffer_map (frame->input_buffer, &info, GST_MAP_READ);
-  data.data.size = info.size;
-  data.data.data = info.data;
-  data.sync = false;
-  data.ts = GST_TIME_AS_USECONDS (frame->pts);
+  if (enc->input_mode == GST_DROIDVENC_INPUT_MEDIA_BUFFER
+      && !enc->stage_media_buffers) {
+    media_buffer =
+        gst_droid_media_buffer_memory_get_buffer_from_gst_buffer
+        (frame->input_buffer);
+    if (!media_buffer) {
+      GST_ELEMENT_ERROR (enc, STREAM, FORMAT, (NULL),
+          ("input buffer does not carry a droid media buffer"));
+      goto error;
+    }
+  }
 
-  release_data = g_slice_new (GstDroidVEncFrameReleaseData);
-  release_data->info = info;
-  release_data->frame = gst_video_codec_frame_ref (frame);
+  buffer = gst_droidvenc_prepare_input_buffer (enc, frame);
+  if (!buffer) {
+    GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
+        ("failed to prepare input frame"));
+    goto error;
+  }
 
-  cb.unref = gst_droidvenc_release_input_frame;
-  cb.data = release_data;
+  /* We do not need the input buffer anymore. Either we hold a reference or we copied it */
+  gst_buffer_unref (frame->input_buffer);
+  frame->input_buffer = NULL;
+
+  /* With a media buffer the encoder reads the graphic buffer directly. We keep
+   * the GstBuffer (and thus the upstream pool buffer) alive until it is done with it */
+  if (!gst_droid_codec_prepare_encoder_frame (buffer, media_buffer, frame,
+          &data, &cb)) {
+    GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
+        ("failed to map input frame"));
+    goto error;
+  }
+
+  data.sync = gst_droidvenc_check_sync_frame (enc, frame);
+  data.ts = GST_TIME_AS_USECONDS (frame->pts);
 
   /* This can deadlock if droidmedia/stagefright input buffer queue is full thus we
    * cannot write the input buffer. We end up waiting for the write operation
@@ -606,8 +1130,14 @@ gst_droidvenc_handle_frame (GstVideoEncoder * encoder,
    * to call get_oldest_frame() which acquires the stream lock the base class
    * is holding before calling us
    */
+  gst_droid_stats_add_latency (&enc->stats, GST_DROID_STATS_STAGE_QUEUE,
+      gst_util_get_timestamp () - received);
+  gst_droid_stats_mark_frame (frame);
+
   GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
-  droid_media_codec_queue (enc->codec, &data, &cb);
+  GST_DROID_HAL_TRACE (enc, "droid_media_codec_queue",
+      GST_DROID_STATS_HAL_CALL (&enc->stats,
+          droid_media_codec_queue (enc->codec, &data, &cb)));
   GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
 
   if (enc->downstream_flow_ret != GST_FLOW_OK) {
@@ -657,6 +1187,16 @@ gst_droidvenc_flush (GstVideoEncoder * encoder)
   return TRUE;
 }
 
+static gboolean
+gst_droidvenc_propose_allocation (GstVideoEncoder * encoder, GstQuery * query)
+{
+  /* We can handle padded raw frames */
+  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+
+  return GST_VIDEO_ENCODER_CLASS (parent_class)->propose_allocation (encoder,
+      query);
+}
+
 static void
 gst_droidvenc_init (GstDroidVEnc * enc)
 {
@@ -664,10 +1204,25 @@ gst_droidvenc_init (GstDroidVEnc * enc)
   enc->codec_type = NULL;
   enc->in_state = NULL;
   enc->out_state = NULL;
+  enc->input_mode = GST_DROIDVENC_INPUT_META_DATA;
+  enc->stage_media_buffers = FALSE;
+  gst_droid_codec_staging_init (&enc->staging);
   enc->target_bitrate = GST_DROID_ENC_TARGET_BITRATE_DEFAULT;
+  enc->bitrate_changed = FALSE;
+  enc->key_int_max = GST_DROID_ENC_KEY_INT_MAX_DEFAULT;
+  enc->control_rate = GST_DROID_ENC_CONTROL_RATE_DEFAULT;
+  enc->intra_refresh_period = GST_DROID_ENC_INTRA_REFRESH_PERIOD_DEFAULT;
+  enc->repeat_headers = GST_DROID_ENC_REPEAT_HEADERS_DEFAULT;
+  enc->prewarm = GST_DROID_ENC_PREWARM_DEFAULT;
+  enc->prewarmed = FALSE;
+  enc->color_format = -1;
+  enc->first_frame_time = GST_CLOCK_TIME_NONE;
+  enc->first_frame_latency = GST_CLOCK_TIME_NONE;
+  enc->frames_since_sync = 0;
   enc->downstream_flow_ret = GST_FLOW_OK;
   g_mutex_init (&enc->eos_lock);
   g_cond_init (&enc->eos_cond);
+  gst_droid_stats_init (&enc->stats);
 }
 
 static GstCaps *
@@ -767,10 +1322,57 @@ gst_droidvenc_class_init (GstDroidVEncClass * klass)
   gstvideoencoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_droidvenc_handle_frame);
   gstvideoencoder_class->flush = GST_DEBUG_FUNCPTR (gst_droidvenc_flush);
+  gstvideoencoder_class->propose_allocation =
+      GST_DEBUG_FUNCPTR (gst_droidvenc_propose_allocation);
 
   g_object_class_install_property (gobject_class, PROP_TARGET_BITRATE,
       g_param_spec_int ("target-bitrate", "Target Bitrate",
           "Target bitrate", 0, G_MAXINT,
           GST_DROID_ENC_TARGET_BITRATE_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_KEY_INT_MAX,
+      g_param_spec_uint ("key-int-max", "Key Int Max",
+          "Maximum number of frames between key frames (0 = encoder default)",
+          0, G_MAXINT, GST_DROID_ENC_KEY_INT_MAX_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_CONTROL_RATE,
+      g_param_spec_enum ("control-rate", "Control Rate",
+          "Bitrate control mode", GST_TYPE_DROIDVENC_CONTROL_RATE,
+          GST_DROID_ENC_CONTROL_RATE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_INTRA_REFRESH_PERIOD,
+      g_param_spec_uint ("intra-refresh-period", "Intra Refresh Period",
+          "Number of frames over which a cyclic intra refresh covers the picture (0 = disabled)",
+          0, G_MAXINT, GST_DROID_ENC_INTRA_REFRESH_PERIOD_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_REPEAT_HEADERS,
+      g_param_spec_boolean ("repeat-headers", "Repeat Headers",
+          "Insert SPS and PPS before every key frame in byte-stream mode",
+          GST_DROID_ENC_REPEAT_HEADERS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_PREWARM,
+      g_param_spec_boolean ("prewarm", "Prewarm",
+          "Create and start the encoder as soon as the input caps are known",
+          GST_DROID_ENC_PREWARM_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_FIRST_FRAME_LATENCY,
+      g_param_spec_uint64 ("first-frame-latency", "First Frame Latency",
+          "Time from the first input frame to the first encoded frame in ns",
+          0, G_MAXUINT64, GST_CLOCK_TIME_NONE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  gst_droid_stats_install_properties (gobject_class, PROP_STATS,
+      PROP_STATS_INTERVAL);
 }
@@ -25,6 +25,7 @@
 #include <gst/gst.h>
 #include <gst/video/gstvideoencoder.h>
 #include "gst/droid/gstdroidcodec.h"
+#include "gst/droid/gstdroidstats.h"
 
 G_BEGIN_DECLS
 
@@ -42,6 +43,23 @@ G_BEGIN_DECLS
 typedef struct _GstDroidVEnc GstDroidVEnc;
 typedef struct _GstDroidVEncClass GstDroidVEncClass;
 
+#define GST_TYPE_DROIDVENC_CONTROL_RATE (gst_droidvenc_control_rate_get_type())
+
+typedef enum
+{
+  GST_DROIDVENC_CONTROL_RATE_DEFAULT,
+  GST_DROIDVENC_CONTROL_RATE_CQ,
+  GST_DROIDVENC_CONTROL_RATE_VBR,
+  GST_DROIDVENC_CONTROL_RATE_CBR,
+} GstDroidVEncControlRate;
+
+typedef enum
+{
+  GST_DROIDVENC_INPUT_META_DATA,
+  GST_DROIDVENC_INPUT_RAW,
+  GST_DROIDVENC_INPUT_MEDIA_BUFFER,
+} GstDroidVEncInputMode;
+
 struct _GstDroidVEnc
 {
   GstVideoEncoder parent;
@@ -50,7 +68,28 @@ struct _GstDroidVEnc
   GstVideoCodecState *in_state;
   GstVideoCodecState *out_state;
   gboolean first_frame_sent;
+  GstClockTime first_frame_time;
+  gboolean prewarmed;
+  gint color_format;
+
+  /* protected by object lock */
   gint32 target_bitrate;
+  gboolean bitrate_changed;
+  guint key_int_max;
+  GstDroidVEncControlRate control_rate;
+  guint intra_refresh_period;
+  gboolean repeat_headers;
+  gboolean prewarm;
+  GstClockTime first_frame_latency;
+
+  /* protected by encoder stream lock */
+  guint frames_since_sync;
+
+  /* raw input is converted into semi planar buffers from this pool.
+   * media buffers are staged too if the codec refuses them */
+  GstDroidVEncInputMode input_mode;
+  gboolean stage_media_buffers;
+  GstDroidCodecStaging staging;
 
   /* eos handling */
   gboolean eos;
@@ -60,6 +99,8 @@ struct _GstDroidVEnc
   /* protected by decoder stream lock */
   GstFlowReturn downstream_flow_ret;
   gboolean dirty;
+
+  GstDroidStats stats;
 };
 
 struct _GstDroidVEncClass
@@ -68,6 +109,7 @@ struct _GstDroidVEncClass
 };
 
 GType gst_droidvenc_get_type (void);
+GType gst_droidvenc_control_rate_get_type (void);
 
 G_END_DECLS
 
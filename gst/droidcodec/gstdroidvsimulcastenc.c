@@ -0,0 +1,1180 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstdroidvsimulcastenc.h"
+#include "gst/droid/gstdroidmediabuffer.h"
+#include "gst/droid/gstdroidhaltrace.h"
+#include "plugin.h"
+#include <string.h>
+
+#define gst_droidvsimulcastenc_parent_class parent_class
+G_DEFINE_TYPE (GstDroidVSimulcastEnc, gst_droidvsimulcastenc,
+    GST_TYPE_ELEMENT);
+G_DEFINE_TYPE (GstDroidVSimulcastEncPad, gst_droidvsimulcastenc_pad,
+    GST_TYPE_PAD);
+
+GST_DEBUG_CATEGORY_EXTERN (gst_droid_vsimulcastenc_debug);
+#define GST_CAT_DEFAULT gst_droid_vsimulcastenc_debug
+
+#define GST_DROIDVSIMULCASTENC_EOS_TIMEOUT_SEC          2
+#define GST_DROIDVSIMULCASTENC_NUM_STAGING_BUFFERS      2
+
+static GstStaticPadTemplate gst_droidvsimulcastenc_sink_template_factory =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_QUEUE_BUFFER,
+            GST_DROID_MEDIA_BUFFER_MEMORY_VIDEO_FORMATS) "; "
+        GST_VIDEO_CAPS_MAKE_WITH_FEATURES
+        (GST_CAPS_FEATURE_MEMORY_DROID_MEDIA_BUFFER,
+            GST_DROID_MEDIA_BUFFER_MEMORY_VIDEO_FORMATS)));
+
+enum
+{
+  PROP_0,
+  PROP_KEY_INT_MAX,
+};
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_TARGET_BITRATE,
+  PROP_PAD_WIDTH,
+  PROP_PAD_HEIGHT,
+};
+
+#define GST_DROID_SIMULCAST_ENC_KEY_INT_MAX_DEFAULT 0
+#define GST_DROID_SIMULCAST_ENC_PAD_TARGET_BITRATE_DEFAULT 192000
+#define GST_DROID_SIMULCAST_ENC_PAD_WIDTH_DEFAULT 0
+#define GST_DROID_SIMULCAST_ENC_PAD_HEIGHT_DEFAULT 0
+
+static void gst_droidvsimulcastenc_signal_eos (void *data);
+static void gst_droidvsimulcastenc_error (void *data, int err);
+static void
+gst_droidvsimulcastenc_data_available (void *data,
+    DroidMediaCodecData * encoded);
+
+static void
+gst_droidvsimulcastenc_layer_stop (GstDroidVSimulcastEncPad * pad)
+{
+  if (pad->codec) {
+    GST_DROID_HAL_TRACE (pad, "droid_media_codec_stop",
+        droid_media_codec_stop (pad->codec));
+    GST_DROID_HAL_TRACE (pad, "droid_media_codec_destroy",
+        droid_media_codec_destroy (pad->codec));
+    pad->codec = NULL;
+  }
+
+  gst_droid_codec_staging_stop (&pad->staging);
+
+  if (pad->codec_type) {
+    gst_droid_codec_unref (pad->codec_type);
+    pad->codec_type = NULL;
+  }
+
+  pad->staged = FALSE;
+
+  GST_OBJECT_LOCK (pad);
+  gst_event_replace (&pad->key_unit_event, NULL);
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_droidvsimulcastenc_stop_layers (GstDroidVSimulcastEnc * enc)
+{
+  GList *l;
+
+  for (l = enc->layers; l; l = l->next) {
+    GstDroidVSimulcastEncPad *pad = l->data;
+
+    gst_droidvsimulcastenc_layer_stop (pad);
+    g_atomic_int_set (&pad->flow_ret, GST_FLOW_OK);
+  }
+
+  gst_flow_combiner_reset (enc->combiner);
+  enc->frames_since_sync = 0;
+}
+
+/* Each layer is a stream of its own */
+static void
+gst_droidvsimulcastenc_layer_push_stream_start (GstDroidVSimulcastEnc * enc,
+    GstDroidVSimulcastEncPad * pad)
+{
+  GstEvent *event;
+  gchar *stream_id;
+
+  stream_id =
+      gst_pad_create_stream_id (GST_PAD (pad), GST_ELEMENT (enc),
+      GST_OBJECT_NAME (pad));
+  event = gst_event_new_stream_start (stream_id);
+  if (enc->have_group_id) {
+    gst_event_set_group_id (event, enc->group_id);
+  }
+  g_free (stream_id);
+
+  gst_pad_push_event (GST_PAD (pad), event);
+  pad->stream_started = TRUE;
+}
+
+static gboolean
+gst_droidvsimulcastenc_layer_negotiate (GstDroidVSimulcastEnc * enc,
+    GstDroidVSimulcastEncPad * pad)
+{
+  GstPad *srcpad = GST_PAD (pad);
+  GstCaps *caps;
+
+  caps = gst_pad_peer_query_caps (srcpad, NULL);
+
+  GST_LOG_OBJECT (pad, "peer caps %" GST_PTR_FORMAT, caps);
+
+  caps = gst_caps_truncate (caps);
+
+  pad->codec_type =
+      gst_droid_codec_new_from_caps (caps, GST_DROID_CODEC_ENCODER_VIDEO);
+  if (!pad->codec_type) {
+    GST_ELEMENT_ERROR (enc, LIBRARY, FAILED, (NULL),
+        ("Unknown codec type for caps %" GST_PTR_FORMAT, caps));
+
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  caps = gst_caps_make_writable (caps);
+  gst_caps_set_simple (caps, "width", G_TYPE_INT,
+      GST_VIDEO_INFO_WIDTH (&pad->info), "height", G_TYPE_INT,
+      GST_VIDEO_INFO_HEIGHT (&pad->info), "framerate", GST_TYPE_FRACTION,
+      GST_VIDEO_INFO_FPS_N (&enc->in_info), GST_VIDEO_INFO_FPS_D (&enc->in_info),
+      NULL);
+  caps = gst_caps_fixate (caps);
+  gst_droid_codec_complement_caps (pad->codec_type, caps);
+
+  GST_INFO_OBJECT (pad, "caps %" GST_PTR_FORMAT, caps);
+
+  /* Restarts after a flush or a caps change continue the stream */
+  if (!pad->stream_started) {
+    gst_droidvsimulcastenc_layer_push_stream_start (enc, pad);
+  }
+
+  if (!gst_pad_push_event (srcpad, gst_event_new_caps (caps))) {
+    GST_ELEMENT_ERROR (enc, CORE, NEGOTIATION, (NULL),
+        ("Failed to set caps on %s", GST_OBJECT_NAME (pad)));
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  gst_caps_unref (caps);
+
+  if (enc->have_segment) {
+    gst_pad_push_event (srcpad, gst_event_new_segment (&enc->segment));
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_droidvsimulcastenc_layer_create_codec (GstDroidVSimulcastEnc * enc,
+    GstDroidVSimulcastEncPad * pad)
+{
+  DroidMediaCodecEncoderMetaData md;
+  gint width = GST_VIDEO_INFO_WIDTH (&pad->info);
+  gint height = GST_VIDEO_INFO_HEIGHT (&pad->info);
+  gint profile G_GNUC_UNUSED, level G_GNUC_UNUSED;
+  bool started;
+
+  memset (&md, 0x0, sizeof (md));
+
+  md.parent.type = gst_droid_codec_get_droid_type (pad->codec_type);
+  md.parent.width = width;
+  md.parent.height = height;
+  md.parent.fps =
+      GST_VIDEO_INFO_FPS_N (&enc->in_info) /
+      GST_VIDEO_INFO_FPS_D (&enc->in_info);
+  md.parent.flags = DROID_MEDIA_CODEC_HW_ONLY;
+  GST_OBJECT_LOCK (pad);
+  md.bitrate = pad->target_bitrate;
+  pad->bitrate_changed = FALSE;
+  GST_OBJECT_UNLOCK (pad);
+  md.stride = width;
+  md.slice_height = height;
+
+  gst_droid_codec_get_profile_level (pad->codec_type, &profile, &level);
+
+#ifdef HAVE_DROID_MEDIA_CODEC_PROFILE
+  md.profile = profile;
+#endif
+
+#ifdef HAVE_DROID_MEDIA_CODEC_LEVEL
+  md.level = level;
+#endif
+
+  if (!pad->staged) {
+    /* Same resolution as the input. The encoder reads the graphic buffer directly */
+    md.meta_data = true;
+    md.color_format = GST_DROID_CODEC_COLOR_FORMAT_ANDROID_OPAQUE;
+  } else {
+    if (!gst_droid_codec_staging_start (&pad->staging, width, height,
+            GST_DROIDVSIMULCASTENC_NUM_STAGING_BUFFERS)) {
+      GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
+          ("Failed to create staging buffer pool"));
+      return FALSE;
+    }
+
+    gst_droid_codec_staging_fill_settings (&pad->staging, &md);
+  }
+
+  GST_INFO_OBJECT (pad,
+      "create codec of type: %s resolution: %dx%d bitrate: %d staged: %d",
+      md.parent.type, width, height, md.bitrate, pad->staged);
+
+  GST_DROID_HAL_TRACE (pad, "droid_media_codec_create_encoder",
+      pad->codec = droid_media_codec_create_encoder (&md));
+
+  if (!pad->codec && !pad->staged) {
+    GST_WARNING_OBJECT (pad,
+        "encoder does not accept graphic buffers. Falling back to copying");
+    pad->staged = TRUE;
+    return gst_droidvsimulcastenc_layer_create_codec (enc, pad);
+  }
+
+  if (!pad->codec) {
+    GST_ELEMENT_ERROR (enc, LIBRARY, SETTINGS, NULL,
+        ("Failed to create encoder for %s", GST_OBJECT_NAME (pad)));
+    return FALSE;
+  }
+
+  gst_droid_codec_configure_encoded_pool (pad->codec_type, md.bitrate,
+      GST_VIDEO_INFO_FPS_N (&enc->in_info),
+      GST_VIDEO_INFO_FPS_D (&enc->in_info));
+
+  {
+    DroidMediaCodecCallbacks cb;
+    cb.signal_eos = gst_droidvsimulcastenc_signal_eos;
+    cb.error = gst_droidvsimulcastenc_error;
+    droid_media_codec_set_callbacks (pad->codec, &cb, pad);
+  }
+
+  {
+    DroidMediaCodecDataCallbacks cb;
+    cb.data_available = gst_droidvsimulcastenc_data_available;
+    droid_media_codec_set_data_callbacks (pad->codec, &cb, pad);
+  }
+
+  GST_DROID_HAL_TRACE (pad, "droid_media_codec_start",
+      started = droid_media_codec_start (pad->codec));
+  if (!started) {
+    GST_ELEMENT_ERROR (enc, LIBRARY, INIT, (NULL),
+        ("Failed to start the encoder for %s", GST_OBJECT_NAME (pad)));
+
+    GST_DROID_HAL_TRACE (pad, "droid_media_codec_destroy",
+        droid_media_codec_destroy (pad->codec));
+    pad->codec = NULL;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_droidvsimulcastenc_layer_start (GstDroidVSimulcastEnc * enc,
+    GstDroidVSimulcastEncPad * pad)
+{
+  guint width, height;
+
+  GST_OBJECT_LOCK (pad);
+  width = pad->width;
+  height = pad->height;
+  GST_OBJECT_UNLOCK (pad);
+
+  if (width == 0) {
+    width = GST_VIDEO_INFO_WIDTH (&enc->in_info);
+  }
+
+  if (height == 0) {
+    height = GST_VIDEO_INFO_HEIGHT (&enc->in_info);
+  }
+
+  /* Only layers with the input resolution can share the graphic buffer.
+   * The rest get an NV12 copy scaled down to their size */
+  pad->staged = width != GST_VIDEO_INFO_WIDTH (&enc->in_info)
+      || height != GST_VIDEO_INFO_HEIGHT (&enc->in_info);
+
+  gst_video_info_set_format (&pad->info, GST_VIDEO_FORMAT_NV12, width, height);
+
+  if (!gst_droidvsimulcastenc_layer_negotiate (enc, pad)) {
+    goto error;
+  }
+
+  if (!gst_droidvsimulcastenc_layer_create_codec (enc, pad)) {
+    goto error;
+  }
+
+  g_atomic_int_set (&pad->flow_ret, GST_FLOW_OK);
+
+  return TRUE;
+
+error:
+  gst_droidvsimulcastenc_layer_stop (pad);
+  return FALSE;
+}
+
+static gboolean
+gst_droidvsimulcastenc_layer_queue (GstDroidVSimulcastEnc * enc,
+    GstDroidVSimulcastEncPad * pad, GstBuffer * buffer,
+    DroidMediaBuffer * media_buffer, gboolean sync)
+{
+  DroidMediaCodecData data;
+  DroidMediaBufferCallbacks cb;
+  GstBuffer *input;
+
+  /* Every layer holds its own reference to the input buffer so the
+   * producer only gets it back once all encoders are done with it */
+  if (!pad->staged) {
+    input = gst_buffer_ref (buffer);
+  } else {
+    input =
+        gst_droid_codec_staging_convert_media_buffer (&pad->staging, buffer);
+    if (!input) {
+      GST_ERROR_OBJECT (pad, "failed to stage input frame");
+      return FALSE;
+    }
+
+    media_buffer = NULL;
+  }
+
+  if (!gst_droid_codec_prepare_encoder_frame (input, media_buffer, NULL, &data,
+          &cb)) {
+    return FALSE;
+  }
+
+  data.sync = sync;
+  data.ts = GST_TIME_AS_USECONDS (GST_BUFFER_PTS (buffer));
+
+  GST_DROID_HAL_TRACE (pad, "droid_media_codec_queue",
+      droid_media_codec_queue (pad->codec, &data, &cb));
+
+  return TRUE;
+}
+
+/*
+ * Returns TRUE if the frame should be a sync frame. The decision is taken
+ * once per input frame and applied to all layers so they switch together.
+ * A requested key unit is announced downstream on every layer.
+ */
+static gboolean
+gst_droidvsimulcastenc_check_sync_frame (GstDroidVSimulcastEnc * enc,
+    GstBuffer * buffer, gboolean layer_started)
+{
+  guint key_int_max;
+  gboolean force_key_unit, all_headers;
+  guint count;
+  GList *l;
+
+  GST_OBJECT_LOCK (enc);
+  key_int_max = enc->key_int_max;
+  force_key_unit = enc->force_key_unit;
+  all_headers = enc->key_unit_all_headers;
+  count = enc->key_unit_count;
+  enc->force_key_unit = FALSE;
+  enc->key_unit_all_headers = FALSE;
+  GST_OBJECT_UNLOCK (enc);
+
+  if (layer_started) {
+    GST_DEBUG_OBJECT (enc, "layer started. Aligning key frames");
+  }
+
+  if (!gst_droid_codec_check_sync_frame (GST_OBJECT (enc),
+          force_key_unit || layer_started, key_int_max,
+          &enc->frames_since_sync)) {
+    return FALSE;
+  }
+
+  if (!force_key_unit) {
+    return TRUE;
+  }
+
+  for (l = enc->layers; l; l = l->next) {
+    GstDroidVSimulcastEncPad *pad = l->data;
+    GstClockTime pts = GST_BUFFER_PTS (buffer);
+    GstClockTime stream_time = GST_CLOCK_TIME_NONE;
+    GstClockTime running_time = GST_CLOCK_TIME_NONE;
+    GstEvent *event;
+
+    if (!pad->codec) {
+      continue;
+    }
+
+    if (enc->have_segment) {
+      stream_time =
+          gst_segment_to_stream_time (&enc->segment, GST_FORMAT_TIME, pts);
+      running_time =
+          gst_segment_to_running_time (&enc->segment, GST_FORMAT_TIME, pts);
+    }
+
+    event = gst_video_event_new_downstream_force_key_unit (pts, stream_time,
+        running_time, all_headers, count);
+
+    GST_OBJECT_LOCK (pad);
+    gst_event_replace (&pad->key_unit_event, NULL);
+    pad->key_unit_event = event;
+    GST_OBJECT_UNLOCK (pad);
+  }
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_droidvsimulcastenc_chain (GstPad * sinkpad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (parent);
+  GstFlowReturn ret = GST_FLOW_NOT_LINKED;
+  DroidMediaBuffer *media_buffer;
+  gboolean layer_started = FALSE;
+  gboolean sync;
+  GList *l;
+
+  media_buffer =
+      gst_droid_media_buffer_memory_get_buffer_from_gst_buffer (buffer);
+  if (!media_buffer) {
+    GST_ELEMENT_ERROR (enc, STREAM, FORMAT, (NULL),
+        ("input buffer does not carry a droid media buffer"));
+    gst_buffer_unref (buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  g_mutex_lock (&enc->lock);
+
+  if (!enc->have_info) {
+    GST_ELEMENT_ERROR (enc, CORE, NEGOTIATION, (NULL),
+        ("received buffer before caps"));
+    ret = GST_FLOW_NOT_NEGOTIATED;
+    goto out;
+  }
+
+  /* Layers are started on the first buffer after they got linked */
+  for (l = enc->layers; l; l = l->next) {
+    GstDroidVSimulcastEncPad *pad = l->data;
+
+    if (pad->codec) {
+      continue;
+    }
+
+    if (!gst_pad_is_linked (GST_PAD (pad))) {
+      g_atomic_int_set (&pad->flow_ret, GST_FLOW_NOT_LINKED);
+      continue;
+    }
+
+    if (!gst_droidvsimulcastenc_layer_start (enc, pad)) {
+      ret = GST_FLOW_NOT_NEGOTIATED;
+      goto out;
+    }
+
+    layer_started = TRUE;
+  }
+
+  sync = gst_droidvsimulcastenc_check_sync_frame (enc, buffer, layer_started);
+
+  for (l = enc->layers; l; l = l->next) {
+    GstDroidVSimulcastEncPad *pad = l->data;
+
+    if (!pad->codec || g_atomic_int_get (&pad->flow_ret) < GST_FLOW_EOS) {
+      continue;
+    }
+
+    gst_droid_codec_update_encoder_bitrate (GST_OBJECT (pad), pad->codec,
+        &pad->target_bitrate, &pad->bitrate_changed);
+
+    if (sync) {
+      gst_droid_codec_request_sync_frame (GST_OBJECT (pad), pad->codec);
+    }
+
+    if (!gst_droidvsimulcastenc_layer_queue (enc, pad, buffer, media_buffer,
+            sync)) {
+      GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
+          ("failed to prepare input frame for %s", GST_OBJECT_NAME (pad)));
+      ret = GST_FLOW_ERROR;
+      goto out;
+    }
+  }
+
+  for (l = enc->layers; l; l = l->next) {
+    GstDroidVSimulcastEncPad *pad = l->data;
+
+    ret = gst_flow_combiner_update_pad_flow (enc->combiner, GST_PAD (pad),
+        g_atomic_int_get (&pad->flow_ret));
+  }
+
+out:
+  g_mutex_unlock (&enc->lock);
+  gst_buffer_unref (buffer);
+
+  return ret;
+}
+
+static void
+gst_droidvsimulcastenc_drain (GstDroidVSimulcastEnc * enc)
+{
+  gboolean pending = FALSE;
+  gint64 end_time;
+  GList *l;
+
+  GST_DEBUG_OBJECT (enc, "drain");
+
+  g_mutex_lock (&enc->lock);
+  g_mutex_lock (&enc->eos_lock);
+
+  for (l = enc->layers; l; l = l->next) {
+    GstDroidVSimulcastEncPad *pad = l->data;
+
+    if (pad->codec) {
+      pad->draining = TRUE;
+      GST_DROID_HAL_TRACE (pad, "droid_media_codec_drain",
+          droid_media_codec_drain (pad->codec));
+    }
+  }
+
+  end_time = g_get_monotonic_time () +
+      G_USEC_PER_SEC * GST_DROIDVSIMULCASTENC_EOS_TIMEOUT_SEC;
+
+  /* We cannot wait forever because sometimes we never hear anything from the video encoders */
+  do {
+    pending = FALSE;
+
+    for (l = enc->layers; l; l = l->next) {
+      pending |= ((GstDroidVSimulcastEncPad *) l->data)->draining;
+    }
+  } while (pending
+      && g_cond_wait_until (&enc->eos_cond, &enc->eos_lock, end_time));
+
+  if (pending) {
+    GST_WARNING_OBJECT (enc, "timeout waiting for eos");
+  }
+
+  for (l = enc->layers; l; l = l->next) {
+    ((GstDroidVSimulcastEncPad *) l->data)->draining = FALSE;
+  }
+
+  g_mutex_unlock (&enc->eos_lock);
+
+  gst_droidvsimulcastenc_stop_layers (enc);
+
+  g_mutex_unlock (&enc->lock);
+}
+
+static void
+gst_droidvsimulcastenc_signal_eos (void *data)
+{
+  GstDroidVSimulcastEncPad *pad = (GstDroidVSimulcastEncPad *) data;
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (GST_PAD_PARENT (pad));
+
+  GST_DEBUG_OBJECT (pad, "codec signaled EOS");
+
+  g_mutex_lock (&enc->eos_lock);
+
+  if (!pad->draining) {
+    GST_WARNING_OBJECT (pad, "codec signaled EOS but we are not expecting it");
+  }
+
+  pad->draining = FALSE;
+  g_cond_broadcast (&enc->eos_cond);
+  g_mutex_unlock (&enc->eos_lock);
+}
+
+static void
+gst_droidvsimulcastenc_error (void *data, int err)
+{
+  GstDroidVSimulcastEncPad *pad = (GstDroidVSimulcastEncPad *) data;
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (GST_PAD_PARENT (pad));
+
+  GST_DEBUG_OBJECT (pad, "codec error");
+
+  g_mutex_lock (&enc->eos_lock);
+
+  if (pad->draining) {
+    /* Gotta love Android. We will ignore errors if we are expecting EOS */
+    pad->draining = FALSE;
+    g_cond_broadcast (&enc->eos_cond);
+    g_mutex_unlock (&enc->eos_lock);
+    return;
+  }
+
+  g_mutex_unlock (&enc->eos_lock);
+
+  g_atomic_int_set (&pad->flow_ret, GST_FLOW_ERROR);
+
+  GST_ELEMENT_ERROR (enc, LIBRARY, FAILED, NULL,
+      ("error 0x%x from android codec for %s", -err, GST_OBJECT_NAME (pad)));
+}
+
+static void
+gst_droidvsimulcastenc_data_available (void *data,
+    DroidMediaCodecData * encoded)
+{
+  GstDroidVSimulcastEncPad *pad = (GstDroidVSimulcastEncPad *) data;
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (GST_PAD_PARENT (pad));
+  GstBuffer *buffer;
+  GstFlowReturn flow_ret;
+
+  GST_LOG_OBJECT (pad, "data available");
+
+  if (encoded->codec_config) {
+    GstBuffer *codec_data;
+    GstCaps *caps;
+
+    GST_INFO_OBJECT (pad, "received codec_data");
+
+    codec_data =
+        gst_droid_codec_create_encoder_codec_data (pad->codec_type,
+        &encoded->data);
+
+    if (!codec_data && gst_droid_codec_uses_in_band_headers (pad->codec_type)) {
+      /* headers will be sent in band with the key frames */
+      return;
+    }
+
+    if (!codec_data) {
+      g_atomic_int_set (&pad->flow_ret, GST_FLOW_ERROR);
+      GST_ELEMENT_ERROR (enc, STREAM, FORMAT, (NULL),
+          ("Failed to construct codec_data. Expect corrupted stream"));
+      return;
+    }
+
+    caps = gst_pad_get_current_caps (GST_PAD (pad));
+    caps = gst_caps_make_writable (caps);
+    gst_caps_set_simple (caps, "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
+    gst_buffer_unref (codec_data);
+
+    if (!gst_pad_push_event (GST_PAD (pad), gst_event_new_caps (caps))) {
+      g_atomic_int_set (&pad->flow_ret, GST_FLOW_NOT_NEGOTIATED);
+      GST_ELEMENT_ERROR (enc, STREAM, FORMAT, (NULL),
+          ("Failed to set video caps"));
+    }
+
+    gst_caps_unref (caps);
+    return;
+  }
+
+  buffer = gst_droid_codec_prepare_encoded_data (pad->codec_type, encoded);
+  if (!buffer) {
+    g_atomic_int_set (&pad->flow_ret, GST_FLOW_ERROR);
+    GST_ELEMENT_ERROR (enc, LIBRARY, ENCODE, (NULL),
+        ("failed to process encoded data"));
+    return;
+  }
+
+  GST_BUFFER_PTS (buffer) = encoded->ts;
+  GST_BUFFER_DTS (buffer) = encoded->decoding_ts;
+
+  if (encoded->sync) {
+    GstEvent *event;
+
+    GST_BUFFER_FLAG_UNSET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    GST_OBJECT_LOCK (pad);
+    event = pad->key_unit_event;
+    pad->key_unit_event = NULL;
+    GST_OBJECT_UNLOCK (pad);
+
+    if (event) {
+      GST_INFO_OBJECT (pad, "sending key unit event");
+      gst_pad_push_event (GST_PAD (pad), event);
+    }
+  } else {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  flow_ret = gst_pad_push (GST_PAD (pad), buffer);
+  g_atomic_int_set (&pad->flow_ret, flow_ret);
+
+  if (flow_ret < GST_FLOW_EOS) {
+    GST_ELEMENT_ERROR (enc, STREAM, FAILED,
+        ("Internal data stream error."), ("stream stopped, reason %s",
+            gst_flow_get_name (flow_ret)));
+  }
+}
+
+static void
+gst_droidvsimulcastenc_request_key_unit (GstDroidVSimulcastEnc * enc,
+    gboolean all_headers, guint count)
+{
+  GST_OBJECT_LOCK (enc);
+  enc->force_key_unit = TRUE;
+  enc->key_unit_all_headers |= all_headers;
+  enc->key_unit_count = count;
+  GST_OBJECT_UNLOCK (enc);
+}
+
+static gboolean
+gst_droidvsimulcastenc_sink_event (GstPad * sinkpad, GstObject * parent,
+    GstEvent * event)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (parent);
+  GList *l;
+
+  GST_LOG_OBJECT (enc, "event %" GST_PTR_FORMAT, event);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_STREAM_START:
+      /* every layer sends its own stream-start. Running layers announce
+       * the new stream right away, the rest once they start */
+      g_mutex_lock (&enc->lock);
+      enc->have_group_id = gst_event_parse_group_id (event, &enc->group_id);
+
+      for (l = enc->layers; l; l = l->next) {
+        GstDroidVSimulcastEncPad *pad = l->data;
+
+        if (pad->codec) {
+          gst_droidvsimulcastenc_layer_push_stream_start (enc, pad);
+        } else {
+          pad->stream_started = FALSE;
+        }
+      }
+      g_mutex_unlock (&enc->lock);
+      gst_event_unref (event);
+      return TRUE;
+
+    case GST_EVENT_CAPS:
+    {
+      GstCaps *caps;
+      GstVideoInfo info;
+
+      gst_event_parse_caps (event, &caps);
+
+      if (!gst_video_info_from_caps (&info, caps)) {
+        GST_ERROR_OBJECT (enc, "failed to parse caps %" GST_PTR_FORMAT, caps);
+        gst_event_unref (event);
+        return FALSE;
+      }
+
+      gst_event_unref (event);
+
+      if (enc->have_info && gst_video_info_is_equal (&info, &enc->in_info)) {
+        return TRUE;
+      }
+
+      /* Layers will be restarted with the new input on the next buffer */
+      gst_droidvsimulcastenc_drain (enc);
+
+      g_mutex_lock (&enc->lock);
+      enc->in_info = info;
+      enc->have_info = TRUE;
+      g_mutex_unlock (&enc->lock);
+      return TRUE;
+    }
+
+    case GST_EVENT_SEGMENT:
+      g_mutex_lock (&enc->lock);
+      gst_event_copy_segment (event, &enc->segment);
+      enc->have_segment = TRUE;
+
+      for (l = enc->layers; l; l = l->next) {
+        GstDroidVSimulcastEncPad *pad = l->data;
+
+        if (pad->codec) {
+          gst_pad_push_event (GST_PAD (pad), gst_event_ref (event));
+        }
+      }
+      g_mutex_unlock (&enc->lock);
+
+      gst_event_unref (event);
+      return TRUE;
+
+    case GST_EVENT_EOS:
+      gst_droidvsimulcastenc_drain (enc);
+      break;
+
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&enc->lock);
+      gst_droidvsimulcastenc_stop_layers (enc);
+      g_mutex_unlock (&enc->lock);
+      break;
+
+    default:
+      if (gst_video_event_is_force_key_unit (event)) {
+        gboolean all_headers;
+        guint count;
+
+        /* Sent on to every layer ahead of its key frame */
+        gst_video_event_parse_downstream_force_key_unit (event, NULL, NULL,
+            NULL, &all_headers, &count);
+        gst_droidvsimulcastenc_request_key_unit (enc, all_headers, count);
+        gst_event_unref (event);
+        return TRUE;
+      }
+      break;
+  }
+
+  return gst_pad_event_default (sinkpad, parent, event);
+}
+
+static gboolean
+gst_droidvsimulcastenc_src_event (GstPad * srcpad, GstObject * parent,
+    GstEvent * event)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (parent);
+
+  if (gst_video_event_is_force_key_unit (event)) {
+    gboolean all_headers;
+    guint count;
+
+    /* A key frame requested by any layer is produced by all of them */
+    GST_INFO_OBJECT (srcpad, "key unit requested");
+    gst_video_event_parse_upstream_force_key_unit (event, NULL, &all_headers,
+        &count);
+    gst_droidvsimulcastenc_request_key_unit (enc, all_headers, count);
+    gst_event_unref (event);
+    return TRUE;
+  }
+
+  return gst_pad_event_default (srcpad, parent, event);
+}
+
+static GstPad *
+gst_droidvsimulcastenc_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name,
+    const GstCaps * caps G_GNUC_UNUSED)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (element);
+  GstPad *pad;
+  gchar *pad_name = NULL;
+
+  g_mutex_lock (&enc->lock);
+
+  if (!name) {
+    pad_name = g_strdup_printf ("src_%u", enc->next_pad_id++);
+    name = pad_name;
+  }
+
+  pad = g_object_new (GST_TYPE_DROIDVSIMULCASTENC_PAD, "name", name,
+      "direction", GST_PAD_SRC, "template", templ, NULL);
+  g_free (pad_name);
+
+  gst_pad_set_event_function (pad,
+      GST_DEBUG_FUNCPTR (gst_droidvsimulcastenc_src_event));
+  gst_pad_use_fixed_caps (pad);
+
+  enc->layers = g_list_append (enc->layers, pad);
+  gst_flow_combiner_add_pad (enc->combiner, pad);
+
+  g_mutex_unlock (&enc->lock);
+
+  GST_DEBUG_OBJECT (enc, "new layer %s", GST_OBJECT_NAME (pad));
+
+  gst_element_add_pad (element, pad);
+
+  return pad;
+}
+
+static void
+gst_droidvsimulcastenc_release_pad (GstElement * element, GstPad * pad)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (element);
+
+  GST_DEBUG_OBJECT (enc, "release layer %s", GST_OBJECT_NAME (pad));
+
+  g_mutex_lock (&enc->lock);
+  enc->layers = g_list_remove (enc->layers, pad);
+  gst_flow_combiner_remove_pad (enc->combiner, pad);
+  gst_droidvsimulcastenc_layer_stop (GST_DROIDVSIMULCASTENC_PAD (pad));
+  g_mutex_unlock (&enc->lock);
+
+  gst_element_remove_pad (element, pad);
+}
+
+static GstStateChangeReturn
+gst_droidvsimulcastenc_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (element);
+  GstStateChangeReturn ret;
+  GList *l;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      GST_OBJECT_LOCK (enc);
+      enc->force_key_unit = FALSE;
+      enc->key_unit_all_headers = FALSE;
+      enc->key_unit_count = 0;
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      g_mutex_lock (&enc->lock);
+      gst_droidvsimulcastenc_stop_layers (enc);
+      for (l = enc->layers; l; l = l->next) {
+        ((GstDroidVSimulcastEncPad *) l->data)->stream_started = FALSE;
+      }
+      enc->have_info = FALSE;
+      enc->have_segment = FALSE;
+      enc->have_group_id = FALSE;
+      g_mutex_unlock (&enc->lock);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static void
+gst_droidvsimulcastenc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (object);
+
+  switch (prop_id) {
+    case PROP_KEY_INT_MAX:
+      GST_OBJECT_LOCK (enc);
+      enc->key_int_max = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_droidvsimulcastenc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (object);
+
+  switch (prop_id) {
+    case PROP_KEY_INT_MAX:
+      GST_OBJECT_LOCK (enc);
+      g_value_set_uint (value, enc->key_int_max);
+      GST_OBJECT_UNLOCK (enc);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_droidvsimulcastenc_finalize (GObject * object)
+{
+  GstDroidVSimulcastEnc *enc = GST_DROIDVSIMULCASTENC (object);
+
+  GST_DEBUG_OBJECT (enc, "finalize");
+
+  g_list_free (enc->layers);
+  enc->layers = NULL;
+  gst_flow_combiner_free (enc->combiner);
+
+  g_mutex_clear (&enc->lock);
+  g_mutex_clear (&enc->eos_lock);
+  g_cond_clear (&enc->eos_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_droidvsimulcastenc_init (GstDroidVSimulcastEnc * enc)
+{
+  enc->sinkpad =
+      gst_pad_new_from_static_template
+      (&gst_droidvsimulcastenc_sink_template_factory, "sink");
+  gst_pad_set_chain_function (enc->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_droidvsimulcastenc_chain));
+  gst_pad_set_event_function (enc->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_droidvsimulcastenc_sink_event));
+  gst_element_add_pad (GST_ELEMENT (enc), enc->sinkpad);
+
+  enc->layers = NULL;
+  enc->next_pad_id = 0;
+  enc->combiner = gst_flow_combiner_new ();
+  enc->have_info = FALSE;
+  enc->have_segment = FALSE;
+  enc->have_group_id = FALSE;
+  enc->frames_since_sync = 0;
+  enc->key_int_max = GST_DROID_SIMULCAST_ENC_KEY_INT_MAX_DEFAULT;
+  enc->force_key_unit = FALSE;
+  enc->key_unit_all_headers = FALSE;
+  enc->key_unit_count = 0;
+
+  g_mutex_init (&enc->lock);
+  g_mutex_init (&enc->eos_lock);
+  g_cond_init (&enc->eos_cond);
+}
+
+static void
+gst_droidvsimulcastenc_class_init (GstDroidVSimulcastEncClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstCaps *caps;
+  GstPadTemplate *tpl;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "Simulcast video encoder", "Encoder/Video/Device",
+      "Android HAL encoder producing one stream per requested layer",
+      "Jolla Ltd.");
+
+  caps = gst_droid_codec_get_all_caps (GST_DROID_CODEC_ENCODER_VIDEO);
+
+  tpl = gst_pad_template_new_with_gtype ("src_%u", GST_PAD_SRC,
+      GST_PAD_REQUEST, caps, GST_TYPE_DROIDVSIMULCASTENC_PAD);
+  gst_element_class_add_pad_template (gstelement_class, tpl);
+  gst_caps_unref (caps);
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get
+      (&gst_droidvsimulcastenc_sink_template_factory));
+
+  gobject_class->finalize = gst_droidvsimulcastenc_finalize;
+  gobject_class->set_property = gst_droidvsimulcastenc_set_property;
+  gobject_class->get_property = gst_droidvsimulcastenc_get_property;
+
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_droidvsimulcastenc_change_state);
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_droidvsimulcastenc_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_droidvsimulcastenc_release_pad);
+
+  g_object_class_install_property (gobject_class, PROP_KEY_INT_MAX,
+      g_param_spec_uint ("key-int-max", "Key Int Max",
+          "Maximum number of frames between key frames in all layers (0 = encoder default)",
+          0, G_MAXINT, GST_DROID_SIMULCAST_ENC_KEY_INT_MAX_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+}
+
+static void
+gst_droidvsimulcastenc_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstDroidVSimulcastEncPad *pad = GST_DROIDVSIMULCASTENC_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_TARGET_BITRATE:
+      GST_OBJECT_LOCK (pad);
+      if (pad->target_bitrate != g_value_get_int (value)) {
+        pad->target_bitrate = g_value_get_int (value);
+        pad->bitrate_changed = TRUE;
+      }
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_WIDTH:
+      GST_OBJECT_LOCK (pad);
+      pad->width = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_HEIGHT:
+      GST_OBJECT_LOCK (pad);
+      pad->height = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_droidvsimulcastenc_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstDroidVSimulcastEncPad *pad = GST_DROIDVSIMULCASTENC_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_TARGET_BITRATE:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_int (value, pad->target_bitrate);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_WIDTH:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_uint (value, pad->width);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_HEIGHT:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_uint (value, pad->height);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_droidvsimulcastenc_pad_init (GstDroidVSimulcastEncPad * pad)
+{
+  pad->target_bitrate = GST_DROID_SIMULCAST_ENC_PAD_TARGET_BITRATE_DEFAULT;
+  pad->bitrate_changed = FALSE;
+  pad->width = GST_DROID_SIMULCAST_ENC_PAD_WIDTH_DEFAULT;
+  pad->height = GST_DROID_SIMULCAST_ENC_PAD_HEIGHT_DEFAULT;
+  pad->codec = NULL;
+  pad->codec_type = NULL;
+  pad->staged = FALSE;
+  gst_droid_codec_staging_init (&pad->staging);
+  pad->stream_started = FALSE;
+  pad->key_unit_event = NULL;
+  pad->draining = FALSE;
+  pad->flow_ret = GST_FLOW_OK;
+}
+
+static void
+gst_droidvsimulcastenc_pad_class_init (GstDroidVSimulcastEncPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_droidvsimulcastenc_pad_set_property;
+  gobject_class->get_property = gst_droidvsimulcastenc_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PAD_TARGET_BITRATE,
+      g_param_spec_int ("target-bitrate", "Target Bitrate",
+          "Target bitrate of this layer", 0, G_MAXINT,
+          GST_DROID_SIMULCAST_ENC_PAD_TARGET_BITRATE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_WIDTH,
+      g_param_spec_uint ("width", "Width",
+          "Width of this layer (0 = input width)", 0, G_MAXINT,
+          GST_DROID_SIMULCAST_ENC_PAD_WIDTH_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_HEIGHT,
+      g_param_spec_uint ("height", "Height",
+          "Height of this layer (0 = input height)", 0, G_MAXINT,
+          GST_DROID_SIMULCAST_ENC_PAD_HEIGHT_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+}
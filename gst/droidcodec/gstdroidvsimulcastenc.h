@@ -0,0 +1,129 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_DROID_V_SIMULCAST_ENC_H__
+#define __GST_DROID_V_SIMULCAST_ENC_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/base/gstflowcombiner.h>
+#include "gst/droid/gstdroidcodec.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DROIDVSIMULCASTENC \
+  (gst_droidvsimulcastenc_get_type())
+#define GST_DROIDVSIMULCASTENC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_DROIDVSIMULCASTENC, GstDroidVSimulcastEnc))
+#define GST_DROIDVSIMULCASTENC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_DROIDVSIMULCASTENC, GstDroidVSimulcastEncClass))
+#define GST_IS_DROIDVSIMULCASTENC(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_DROIDVSIMULCASTENC))
+#define GST_IS_DROIDVSIMULCASTENC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_DROIDVSIMULCASTENC))
+
+#define GST_TYPE_DROIDVSIMULCASTENC_PAD \
+  (gst_droidvsimulcastenc_pad_get_type())
+#define GST_DROIDVSIMULCASTENC_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_DROIDVSIMULCASTENC_PAD, GstDroidVSimulcastEncPad))
+#define GST_IS_DROIDVSIMULCASTENC_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_DROIDVSIMULCASTENC_PAD))
+
+typedef struct _GstDroidVSimulcastEnc GstDroidVSimulcastEnc;
+typedef struct _GstDroidVSimulcastEncClass GstDroidVSimulcastEncClass;
+typedef struct _GstDroidVSimulcastEncPad GstDroidVSimulcastEncPad;
+typedef struct _GstDroidVSimulcastEncPadClass GstDroidVSimulcastEncPadClass;
+
+/* One encoded layer. Each layer owns a HAL encoder and a src pad */
+struct _GstDroidVSimulcastEncPad
+{
+  GstPad parent;
+
+  /* protected by object lock */
+  gint32 target_bitrate;
+  gboolean bitrate_changed;
+  guint width;
+  guint height;
+  /* downstream force-key-unit to send before the next key frame */
+  GstEvent *key_unit_event;
+
+  /* protected by the element lock */
+  DroidMediaCodec *codec;
+  GstDroidCodec *codec_type;
+  GstVideoInfo info;
+  gboolean staged;
+  GstDroidCodecStaging staging;
+  gboolean stream_started;
+
+  /* protected by the element eos lock */
+  gboolean draining;
+
+  /* written from the codec threads */
+  GstFlowReturn flow_ret;
+};
+
+struct _GstDroidVSimulcastEncPadClass
+{
+  GstPadClass parent_class;
+};
+
+struct _GstDroidVSimulcastEnc
+{
+  GstElement parent;
+
+  GstPad *sinkpad;
+
+  /* protects the layers and their codecs */
+  GMutex lock;
+  GList *layers;
+  guint next_pad_id;
+  GstFlowCombiner *combiner;
+
+  /* protected by the element lock */
+  GstVideoInfo in_info;
+  gboolean have_info;
+  GstSegment segment;
+  gboolean have_segment;
+  guint group_id;
+  gboolean have_group_id;
+  guint frames_since_sync;
+
+  /* protected by object lock */
+  guint key_int_max;
+  gboolean force_key_unit;
+  gboolean key_unit_all_headers;
+  guint key_unit_count;
+
+  /* eos handling */
+  GMutex eos_lock;
+  GCond eos_cond;
+};
+
+struct _GstDroidVSimulcastEncClass
+{
+  GstElementClass parent_class;
+};
+
+GType gst_droidvsimulcastenc_get_type (void);
+GType gst_droidvsimulcastenc_pad_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_DROID_V_SIMULCAST_ENC_H__ */
@@ -41,7 +41,9 @@ enum
 enum
 {
   PROP_0,
-  PROP_EGL_DISPLAY
+  PROP_EGL_DISPLAY,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
 };
 
 GST_DEBUG_CATEGORY_EXTERN (gst_droid_eglsink_debug);
@@ -176,7 +178,7 @@ gst_droideglsink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
               NULL) && gst_caps_is_equal (caps, pool_caps)) {
         gst_buffer_pool_config_set_params (config, caps, size, min, max);
 
-        if (gst_buffer_pool_set_config (previous_pool, config)) {
+        if (gst_droid_buffer_pool_apply_config (previous_pool, config)) {
           pool = previous_pool;
           sink->invalidated_signal_id = previous_pool_signal_id;
 
@@ -186,13 +188,19 @@ gst_droideglsink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
     }
 
     if (!pool) {
+      GstAllocator *allocator;
+
       pool = gst_droid_buffer_pool_new ();
 
       gst_droid_buffer_pool_set_egl_display (pool, sink->dpy);
 
+      allocator = gst_droid_buffer_pool_get_allocator (pool);
+      gst_droid_stats_track_allocator (&sink->stats, allocator);
+      gst_object_unref (allocator);
+
       config = gst_buffer_pool_get_config (pool);
       gst_buffer_pool_config_set_params (config, caps, size, min, max);
-      if (!gst_buffer_pool_set_config (pool, config)) {
+      if (!gst_droid_buffer_pool_apply_config (pool, config)) {
         GST_ERROR_OBJECT (sink, "Failed to set buffer pool configuration");
         gst_object_unref (pool);
         goto out;
@@ -205,6 +213,11 @@ gst_droideglsink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
       }
     }
 
+    /* the pool may have cut max down to the graphics memory budget */
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_get_params (config, NULL, NULL, NULL, &max);
+    gst_structure_free (config);
+
     gst_query_add_allocation_pool (query, pool, size, min,
         min > max ? min : max);
 
@@ -237,11 +250,42 @@ out:
 static GstFlowReturn
 gst_droideglsink_show_frame (GstVideoSink * vsink, GstBuffer * buf)
 {
+  GstDroidEglSink *sink = GST_DROIDEGLSINK (vsink);
+  GstClockTime start = gst_util_get_timestamp ();
+
   g_signal_emit (vsink, gst_droideglsink_signals[SHOW_FRAME], 0, buf);
 
+  if (buf) {
+    gst_droid_stats_add (&sink->stats, GST_DROID_STATS_FRAMES_IN, 1);
+    gst_droid_stats_add_latency (&sink->stats, GST_DROID_STATS_STAGE_OUTPUT,
+        gst_util_get_timestamp () - start);
+    gst_droid_stats_add (&sink->stats, GST_DROID_STATS_FRAMES_OUT, 1);
+    gst_droid_stats_post (&sink->stats, GST_ELEMENT (sink));
+  }
+
   return GST_FLOW_OK;
 }
 
+/* Late frames are dropped by the base class before they get to us */
+static GstStructure *
+gst_droideglsink_get_stats (GstDroidEglSink * sink)
+{
+  GstStructure *stats = gst_droid_stats_get_structure (&sink->stats);
+  GstStructure *base = gst_base_sink_get_stats (GST_BASE_SINK (sink));
+  guint64 late = 0;
+  guint64 dropped = 0;
+
+  if (gst_structure_get_uint64 (base, "dropped", &late)
+      && gst_structure_get_uint64 (stats, "frames-dropped", &dropped)) {
+    gst_structure_set (stats, "frames-dropped", G_TYPE_UINT64,
+        dropped + late, NULL);
+  }
+
+  gst_structure_free (base);
+
+  return stats;
+}
+
 static void
 gst_droideglsink_buffers_invalidated (GstDroidEglSink * sink)
 {
@@ -316,6 +360,9 @@ gst_droideglsink_set_property (GObject * object, guint prop_id,
       GST_DROIDEGLSINK (sink)->dpy = sink->dpy;
       g_mutex_unlock (&sink->lock);
       break;
+    case PROP_STATS_INTERVAL:
+      gst_droid_stats_set_interval (&sink->stats, g_value_get_uint (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -339,6 +386,14 @@ gst_droideglsink_get_property (GObject * object, guint prop_id,
       g_mutex_unlock (&sink->lock);
       break;
 
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_droideglsink_get_stats (sink));
+      break;
+
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_droid_stats_get_interval (&sink->stats));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -354,6 +409,8 @@ gst_droideglsink_finalize (GObject * object)
 
   g_mutex_clear (&sink->lock);
 
+  gst_droid_stats_clear (&sink->stats);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -363,6 +420,7 @@ gst_droideglsink_init (GstDroidEglSink * sink)
   sink->pool = NULL;
   sink->dpy = EGL_NO_DISPLAY;
   g_mutex_init (&sink->lock);
+  gst_droid_stats_init (&sink->stats);
 }
 
 static void
@@ -416,4 +474,7 @@ gst_droideglsink_class_init (GstDroidEglSinkClass * klass)
           "EGL display ",
           "The application provided EGL display to be used for creating EGLImageKHR objects.",
           G_PARAM_READWRITE));
+
+  gst_droid_stats_install_properties (gobject_class, PROP_STATS,
+      PROP_STATS_INTERVAL);
 }
@@ -26,6 +26,7 @@
 #include <gst/video/gstvideosink.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include "gst/droid/gstdroidstats.h"
 
 G_BEGIN_DECLS
 
@@ -53,6 +54,8 @@ struct _GstDroidEglSink
   gulong invalidated_signal_id;
   EGLDisplay dpy;
   GMutex lock;
+
+  GstDroidStats stats;
 };
 
 struct _GstDroidEglSinkClass
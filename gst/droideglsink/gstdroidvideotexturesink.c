@@ -139,7 +139,6 @@ gst_droidvideotexturesink_start (GstBaseSink * bsink)
 
   sink->image = EGL_NO_IMAGE_KHR;
   sink->sync = NULL;
-  sink->eglDestroyImageKHR = NULL;
   sink->eglClientWaitSyncKHR = NULL;
   sink->eglDestroySyncKHR = NULL;
 
@@ -161,11 +160,7 @@ gst_droidvideotexturesink_stop (GstBaseSink * bsink)
 
   g_mutex_lock (&sink->lock);
 
-  if (sink->image) {
-    GST_WARNING_OBJECT (sink, "destroying leftover EGLImageKHR");
-    sink->eglDestroyImageKHR (sink->dpy, sink->image);
-    sink->image = EGL_NO_IMAGE_KHR;
-  }
+  sink->image = EGL_NO_IMAGE_KHR;
 
   if (sink->acquired_buffer) {
     GST_WARNING_OBJECT (sink, "freeing leftover acquired buffer");
@@ -188,12 +183,15 @@ static GstFlowReturn
 gst_droidvideotexturesink_show_frame (GstVideoSink * vsink, GstBuffer * buf)
 {
   GstDroidVideoTextureSink *sink;
+  GstDroidStats *stats = &GST_DROIDEGLSINK (vsink)->stats;
   gint n_memory;
 
   sink = GST_DROIDVIDEOTEXTURESINK (vsink);
 
   GST_DEBUG_OBJECT (sink, "show frame");
 
+  gst_droid_stats_add (stats, GST_DROID_STATS_FRAMES_IN, 1);
+
   n_memory = gst_buffer_n_memory (buf);
 
   if (G_UNLIKELY (n_memory == 0)) {
@@ -207,6 +205,7 @@ gst_droidvideotexturesink_show_frame (GstVideoSink * vsink, GstBuffer * buf)
     GST_INFO_OBJECT (sink,
         "acquired buffer exists. Not replacing current buffer");
     g_mutex_unlock (&sink->lock);
+    gst_droid_stats_add (stats, GST_DROID_STATS_FRAMES_DROPPED, 1);
     return GST_FLOW_OK;
   }
 
@@ -219,6 +218,9 @@ gst_droidvideotexturesink_show_frame (GstVideoSink * vsink, GstBuffer * buf)
 
   nemo_gst_video_texture_frame_ready (NEMO_GST_VIDEO_TEXTURE (sink), 0);
 
+  gst_droid_stats_add (stats, GST_DROID_STATS_FRAMES_OUT, 1);
+  gst_droid_stats_post (stats, GST_ELEMENT (sink));
+
   return GST_FLOW_OK;
 }
 
@@ -322,7 +324,6 @@ gst_droidvideotexturesink_init (GstDroidVideoTextureSink * sink)
   sink->image = EGL_NO_IMAGE_KHR;
   sink->sync = NULL;
   g_mutex_init (&sink->lock);
-  sink->eglDestroyImageKHR = NULL;
   sink->eglClientWaitSyncKHR = NULL;
   sink->eglDestroySyncKHR = NULL;
 }
@@ -391,15 +392,6 @@ gst_droidvideotexturesink_populate_egl_proc (GstDroidVideoTextureSink * sink)
 {
   GST_DEBUG_OBJECT (sink, "populate egl proc");
 
-  if (G_UNLIKELY (!sink->eglDestroyImageKHR)) {
-    sink->eglDestroyImageKHR =
-        (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress ("eglDestroyImageKHR");
-  }
-
-  if (G_UNLIKELY (!sink->eglDestroyImageKHR)) {
-    return FALSE;
-  }
-
   if (G_UNLIKELY (!sink->eglClientWaitSyncKHR)) {
     sink->eglClientWaitSyncKHR = (PFNEGLCLIENTWAITSYNCKHRPROC)
         eglGetProcAddress ("eglClientWaitSyncKHR");
@@ -510,8 +502,8 @@ gst_droidvideotexturesink_bind_frame (NemoGstVideoTexture * iface,
       sink->acquired_buffer);
   g_assert (mem);
 
-  sink->image =
-      nemo_gst_egl_image_memory_create_image (mem, sink->dpy, EGL_NO_CONTEXT);
+  /* The image is cached by the memory and lives as long as the buffer stays bound */
+  sink->image = gst_droid_media_buffer_memory_get_image (mem, sink->dpy);
 
   /* Buffer will not go anywhere so we should be safe to unlock. */
   g_mutex_unlock (&sink->lock);
@@ -544,10 +536,7 @@ gst_droidvideotexturesink_unbind_frame (NemoGstVideoTexture * iface)
     goto out;
   }
 
-  if (sink->eglDestroyImageKHR (sink->dpy, sink->image) != EGL_TRUE) {
-    GST_WARNING_OBJECT (sink, "failed to destroy EGLImageKHR %p", sink->image);
-  }
-
+  /* The memory owns the image so there is nothing to destroy */
   sink->image = EGL_NO_IMAGE_KHR;
 
 out:
@@ -54,7 +54,6 @@ struct _GstDroidVideoTextureSink
   EGLSyncKHR sync;
   GMutex lock;
 
-  PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
   PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
   PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
 };
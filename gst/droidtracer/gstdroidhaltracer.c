@@ -0,0 +1,198 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The droidhal tracer records every droidmedia call made by the droid
+ * elements and allocators and streams them out as Chrome trace JSON which
+ * can be opened in chrome://tracing or Perfetto. The file uses the array
+ * format so a trace cut short by a crash still loads.
+ *
+ *   GST_TRACERS="droidhal(file=/tmp/droidhal.json)" gst-launch-1.0 ...
+ *
+ * Without a file the trace goes to droidhal-<pid>.json in the temp dir.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstdroidhaltracer.h"
+#include "gst/droid/gstdroidhaltrace.h"
+#include <unistd.h>
+#include <errno.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_droid_hal_tracer_debug);
+#define GST_CAT_DEFAULT gst_droid_hal_tracer_debug
+
+#define _do_init \
+    GST_DEBUG_CATEGORY_INIT (gst_droid_hal_tracer_debug, "droidhaltracer", \
+        0, "droidmedia HAL call tracer");
+#define gst_droid_hal_tracer_parent_class parent_class
+/* Bounds what a crash can lose without flushing on every call */
+#define GST_DROID_HAL_TRACER_FLUSH_EVENTS      256
+
+G_DEFINE_TYPE_WITH_CODE (GstDroidHalTracer, gst_droid_hal_tracer,
+    GST_TYPE_TRACER, _do_init);
+
+static void
+gst_droid_hal_tracer_record (GstObject * object, const gchar * call,
+    guint64 thread_id, GstClockTime start, GstClockTime end,
+    gpointer user_data)
+{
+  GstDroidHalTracer *tracer = GST_DROID_HAL_TRACER (user_data);
+  gchar *name = NULL;
+  gchar *escaped;
+
+  if (object) {
+    name = gst_object_get_name (object);
+  }
+
+  escaped = g_strescape (name ? name : "", NULL);
+
+  g_mutex_lock (&tracer->lock);
+
+  if (tracer->out) {
+    fprintf (tracer->out,
+        "%s\n{\"name\":\"%s\",\"cat\":\"droidhal\",\"ph\":\"X\","
+        "\"ts\":%" G_GUINT64_FORMAT ".%03u,\"dur\":%" G_GUINT64_FORMAT ".%03u,"
+        "\"pid\":%d,\"tid\":%" G_GUINT64_FORMAT ",\"args\":{\"object\":\"%s\"}}",
+        tracer->n_events ? "," : "", call,
+        start / 1000, (guint) (start % 1000),
+        (end - start) / 1000, (guint) ((end - start) % 1000),
+        (gint) getpid (), thread_id, escaped);
+    tracer->n_events++;
+
+    if (tracer->n_events % GST_DROID_HAL_TRACER_FLUSH_EVENTS == 0) {
+      fflush (tracer->out);
+    }
+  }
+
+  g_mutex_unlock (&tracer->lock);
+
+  g_free (escaped);
+  g_free (name);
+}
+
+static void
+gst_droid_hal_tracer_open (GstDroidHalTracer * tracer)
+{
+  tracer->out = fopen (tracer->file, "w");
+  if (!tracer->out) {
+    GST_ERROR_OBJECT (tracer, "failed to open %s: %s", tracer->file,
+        g_strerror (errno));
+    return;
+  }
+
+  fputs ("[", tracer->out);
+}
+
+static void
+gst_droid_hal_tracer_close (GstDroidHalTracer * tracer)
+{
+  g_mutex_lock (&tracer->lock);
+
+  if (tracer->out) {
+    fputs ("\n]\n", tracer->out);
+
+    if (fclose (tracer->out) != 0) {
+      GST_ERROR_OBJECT (tracer, "failed to write %s: %s", tracer->file,
+          g_strerror (errno));
+    } else {
+      GST_INFO_OBJECT (tracer, "wrote %u HAL calls to %s", tracer->n_events,
+          tracer->file);
+    }
+
+    tracer->out = NULL;
+  }
+
+  g_mutex_unlock (&tracer->lock);
+}
+
+static void
+gst_droid_hal_tracer_constructed (GObject * object)
+{
+  GstDroidHalTracer *tracer = GST_DROID_HAL_TRACER (object);
+  gchar *params = NULL;
+  GstStructure *s = NULL;
+
+  G_OBJECT_CLASS (parent_class)->constructed (object);
+
+  g_object_get (tracer, "params", &params, NULL);
+
+  if (params) {
+    gchar *str = g_strdup_printf ("droidhal,%s", params);
+    s = gst_structure_from_string (str, NULL);
+    g_free (str);
+
+    if (!s) {
+      GST_WARNING_OBJECT (tracer, "invalid params: %s", params);
+    }
+  }
+
+  if (s) {
+    tracer->file = g_strdup (gst_structure_get_string (s, "file"));
+    gst_structure_free (s);
+  }
+
+  if (!tracer->file) {
+    gchar *name = g_strdup_printf ("droidhal-%d.json", (gint) getpid ());
+    tracer->file = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+  }
+
+  g_free (params);
+
+  gst_droid_hal_tracer_open (tracer);
+
+  gst_droid_hal_trace_set_func (gst_droid_hal_tracer_record, tracer);
+}
+
+static void
+gst_droid_hal_tracer_finalize (GObject * object)
+{
+  GstDroidHalTracer *tracer = GST_DROID_HAL_TRACER (object);
+
+  gst_droid_hal_trace_set_func (NULL, NULL);
+
+  gst_droid_hal_tracer_close (tracer);
+
+  g_mutex_clear (&tracer->lock);
+  g_free (tracer->file);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_droid_hal_tracer_init (GstDroidHalTracer * tracer)
+{
+  g_mutex_init (&tracer->lock);
+  tracer->out = NULL;
+  tracer->n_events = 0;
+  tracer->file = NULL;
+}
+
+static void
+gst_droid_hal_tracer_class_init (GstDroidHalTracerClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->constructed = gst_droid_hal_tracer_constructed;
+  gobject_class->finalize = gst_droid_hal_tracer_finalize;
+}
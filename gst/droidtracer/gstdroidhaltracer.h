@@ -0,0 +1,65 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_DROID_HAL_TRACER_H__
+#define __GST_DROID_HAL_TRACER_H__
+
+#include <gst/gst.h>
+#include <gst/gsttracer.h>
+#include <stdio.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DROID_HAL_TRACER \
+  (gst_droid_hal_tracer_get_type())
+#define GST_DROID_HAL_TRACER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_DROID_HAL_TRACER,GstDroidHalTracer))
+#define GST_DROID_HAL_TRACER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_DROID_HAL_TRACER,GstDroidHalTracerClass))
+#define GST_IS_DROID_HAL_TRACER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_DROID_HAL_TRACER))
+#define GST_IS_DROID_HAL_TRACER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_DROID_HAL_TRACER))
+
+typedef struct _GstDroidHalTracer GstDroidHalTracer;
+typedef struct _GstDroidHalTracerClass GstDroidHalTracerClass;
+
+struct _GstDroidHalTracer
+{
+  GstTracer parent;
+
+  gchar *file;
+
+  /* trace events are streamed to out. protected by lock */
+  GMutex lock;
+  FILE *out;
+  guint n_events;
+};
+
+struct _GstDroidHalTracerClass
+{
+  GstTracerClass parent_class;
+};
+
+GType gst_droid_hal_tracer_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_DROID_HAL_TRACER_H__ */
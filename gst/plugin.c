@@ -30,8 +30,10 @@
 #include "gstdroidvideotexturesink.h"
 #include "gstdroidvdec.h"
 #include "gstdroidvenc.h"
+#include "gstdroidvsimulcastenc.h"
 #include "gstdroidadec.h"
 #include "gstdroidaenc.h"
+#include "gstdroidhaltracer.h"
 #include "droidmedia.h"
 
 GST_DEBUG_CATEGORY (gst_droid_camsrc_debug);
@@ -39,6 +41,7 @@ GST_DEBUG_CATEGORY (gst_droid_adec_debug);
 GST_DEBUG_CATEGORY (gst_droid_aenc_debug);
 GST_DEBUG_CATEGORY (gst_droid_vdec_debug);
 GST_DEBUG_CATEGORY (gst_droid_venc_debug);
+GST_DEBUG_CATEGORY (gst_droid_vsimulcastenc_debug);
 GST_DEBUG_CATEGORY (gst_droid_codec_debug);
 GST_DEBUG_CATEGORY (gst_droid_eglsink_debug);
 GST_DEBUG_CATEGORY (gst_droid_videotexturesink_debug);
@@ -69,6 +72,9 @@ plugin_init (GstPlugin * plugin)
   GST_DEBUG_CATEGORY_INIT (gst_droid_venc_debug, "droidvenc",
       0, "Android HAL video encoder");
 
+  GST_DEBUG_CATEGORY_INIT (gst_droid_vsimulcastenc_debug, "droidvsimulcastenc",
+      0, "Android HAL simulcast video encoder");
+
   GST_DEBUG_CATEGORY_INIT (gst_droid_codec_debug, "droidcodec",
       0, "Android HAL codec");
 
@@ -83,11 +89,15 @@ plugin_init (GstPlugin * plugin)
       GST_TYPE_DROIDVDEC);
   ok &= gst_element_register (plugin, "droidvenc", GST_RANK_PRIMARY + 1,
       GST_TYPE_DROIDVENC);
+  ok &= gst_element_register (plugin, "droidvsimulcastenc", GST_RANK_NONE,
+      GST_TYPE_DROIDVSIMULCASTENC);
   ok &= gst_element_register (plugin, "droidadec", GST_RANK_PRIMARY + 1,
       GST_TYPE_DROIDADEC);
   ok &= gst_element_register (plugin, "droidaenc", GST_RANK_PRIMARY + 1,
       GST_TYPE_DROIDAENC);
 
+  ok &= gst_tracer_register (plugin, "droidhal", GST_TYPE_DROID_HAL_TRACER);
+
   if (ok)
     ok = droid_media_init ();
 
@@ -0,0 +1,131 @@
+/*
+ * gst-droid
+ *
+ * Copyright (C) 2015-2021 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/allocators/allocators.h>
+#include <string.h>
+#include <unistd.h>
+#include "fakedroidmedia.h"
+#include "gst/droid/gstdroidmediabuffer.h"
+
+#ifdef HAVE_DROID_MEDIA_BUFFER_GET_FD
+
+/* Wraps a memfd backed fake graphic buffer like droidvdec does */
+static GstBuffer *
+wrap_fake_buffer (GstAllocator * allocator, guint width, guint height,
+    guint32 format, DroidMediaBuffer ** fake)
+{
+  GstBuffer *buffer;
+  GstMemory *mem;
+
+  *fake = fake_droid_media_buffer_new (width, height, format);
+  fail_unless (*fake != NULL);
+  fake_droid_media_frame_fill ((*fake)->data, format, width, height,
+      (*fake)->stride, 3);
+
+  mem = gst_droid_media_buffer_allocator_alloc_from_buffer (allocator, *fake);
+  fail_unless (mem != NULL);
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, mem);
+
+  return buffer;
+}
+
+static void
+check_export (guint width, guint height, guint32 format)
+{
+  GstAllocator *allocator = gst_droid_media_buffer_allocator_new ();
+  GstAllocator *dmabuf_allocator = gst_dmabuf_allocator_new ();
+  DroidMediaBuffer *fake;
+  GstBuffer *buffer, *exported;
+  GstMemory *mem;
+  GstMapInfo info;
+
+  buffer = wrap_fake_buffer (allocator, width, height, format, &fake);
+  GST_BUFFER_PTS (buffer) = 42 * GST_MSECOND;
+
+  exported = gst_droid_media_buffer_export_dmabuf (buffer, dmabuf_allocator);
+  fail_unless (exported != NULL);
+  fail_unless_equals_int (gst_buffer_n_memory (exported), 1);
+  fail_unless_equals_uint64 (GST_BUFFER_PTS (exported), 42 * GST_MSECOND);
+
+  mem = gst_buffer_peek_memory (exported, 0);
+  fail_unless (gst_is_dmabuf_memory (mem));
+  fail_if (gst_dmabuf_memory_get_fd (mem) == fake->fd);
+
+  /* the whole graphic buffer, not the size of the wrapping memory */
+  fail_unless_equals_uint64 (gst_memory_get_sizes (mem, NULL, NULL),
+      fake->size);
+
+  fail_unless (gst_memory_map (mem, &info, GST_MAP_READ));
+  fail_unless (memcmp (info.data, fake->data, fake->size) == 0);
+  gst_memory_unmap (mem, &info);
+
+  /* the exported buffer keeps the graphic buffer alive */
+  gst_buffer_unref (buffer);
+  fail_unless (gst_memory_map (mem, &info, GST_MAP_READ));
+  fail_unless (memcmp (info.data, fake->data, fake->size) == 0);
+  gst_memory_unmap (mem, &info);
+
+  gst_buffer_unref (exported);
+  gst_object_unref (dmabuf_allocator);
+  gst_object_unref (allocator);
+}
+
+GST_START_TEST (test_export_dmabuf_known_format)
+{
+  check_export (320, 240, FAKE_HAL_PIXEL_FORMAT_YV12);
+  check_export (177, 145, FAKE_HAL_PIXEL_FORMAT_YCrCb_420_SP);
+}
+
+GST_END_TEST;
+
+/* Memory of formats we can't lay out has a placeholder size of 1 */
+GST_START_TEST (test_export_dmabuf_unknown_format)
+{
+  check_export (64, 64, 0x1234);
+  check_export (320, 240, FAKE_QOMX_COLOR_FormatYUV420PackedSemiPlanar32m);
+}
+
+GST_END_TEST;
+
+#endif /* HAVE_DROID_MEDIA_BUFFER_GET_FD */
+
+static Suite *
+droidmediabuffer_suite (void)
+{
+  Suite *s = suite_create ("droidmediabuffer");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+#ifdef HAVE_DROID_MEDIA_BUFFER_GET_FD
+  tcase_add_test (tc_chain, test_export_dmabuf_known_format);
+  tcase_add_test (tc_chain, test_export_dmabuf_unknown_format);
+#endif
+
+  return s;
+}
+
+GST_CHECK_MAIN (droidmediabuffer);